@@ -0,0 +1,162 @@
+// Compares how fast the PNGs of a directory are read and decoded with a file
+// based loop and with DS_IO_Reader followed by decoding from memory. The file
+// loop runs twice: with libpng alone as the baseline, and with the fast
+// decoder for small grey PNGs that the reader runs also decode with. Before
+// every run the files are evicted from the page cache, so the numbers are for
+// a cold cache (as far as the file system honours the eviction hint). Finally
+// the per-image overhead of decoding into network inputs is compared with the
+// bare decode on a warm cache.
+//
+// Usage: ./build/bin/bench_io DIR [THREADS]
+
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include <fcntl.h>
+#include <time.h>
+
+#define CHUNK_FILES 4096
+
+static double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void evict_from_page_cache(const DS_FILE_FileList *const file_list) {
+  for (size_t i = 0; i < file_list->count; ++i) {
+    const int fd = open(file_list->paths[i], O_RDONLY);
+    if (fd < 0)
+      continue;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+static void report(const char *const name, const size_t count,
+                   const double seconds) {
+  DS_PRINTF("%-24s %8.3fs %12.0f files/s\n", name, seconds,
+            (double)count / seconds);
+}
+
+static void bench_file_loop(const DS_FILE_FileList *const file_list,
+                            uint8_t *const pixels, const size_t length,
+                            const bool fast) {
+  char message[PNG_ERROR_MESSAGE_LENGTH];
+  evict_from_page_cache(file_list);
+  const double start = now_seconds();
+  for (size_t i = 0; i < file_list->count; ++i)
+    DS_ASSERT(fast ? decode_grey_pixels(file_list->paths[i], pixels, length,
+                                        message)
+                   : decode_grey_pixels_libpng(file_list->paths[i], pixels,
+                                               length, message),
+              "Could not load \"%s\": %s", file_list->paths[i], message);
+  report(fast ? "fast file loop" : "libpng file loop", file_list->count,
+         now_seconds() - start);
+}
+
+static void bench_reader(const DS_FILE_FileList *const file_list,
+                         DS_THREAD_Pool *const pool, const bool use_io_uring,
+                         uint8_t *const pixels, const size_t length) {
+  DS_IO_Reader *reader = DS_IO_reader_create(pool, use_io_uring);
+  if (use_io_uring && !DS_IO_reader_uses_io_uring(reader)) {
+    DS_PRINTF("io_uring is not available.\n");
+    DS_IO_reader_free(reader);
+    return;
+  }
+  DS_IO_File *files = DS_MALLOC(CHUNK_FILES * sizeof(files[0]));
+  DS_ASSERT(files, "Out of memory.");
+
+  evict_from_page_cache(file_list);
+  const double start = now_seconds();
+  double read_seconds = 0;
+  for (size_t first = 0; first < file_list->count; first += CHUNK_FILES) {
+    const size_t count = DS_MIN(CHUNK_FILES, file_list->count - first);
+    const double read_start = now_seconds();
+    DS_ASSERT(
+        DS_IO_read_files(reader, &file_list->paths[first], count, files),
+        "Could not read files.");
+    read_seconds += now_seconds() - read_start;
+    for (size_t i = 0; i < count; ++i)
+      DS_ASSERT(DS_PNG_decode_grey_pixels_from_memory(
+                    NULL, files[i].data, files[i].size, pixels, length),
+                "Could not decode \"%s\".", file_list->paths[first + i]);
+  }
+  const double seconds = now_seconds() - start;
+
+  report(use_io_uring ? "io_uring read" : "pread pool read", file_list->count,
+         read_seconds);
+  report(use_io_uring ? "io_uring read + decode" : "pread pool read + decode",
+         file_list->count, seconds);
+  DS_FREE(files);
+  DS_IO_reader_free(reader);
+}
+
+static void bench_decode_inputs(const DS_FILE_FileList *const file_list,
+                                uint8_t *const pixels, const size_t length) {
+  double start = now_seconds();
+  for (size_t i = 0; i < file_list->count; ++i)
+    DS_ASSERT(
+        DS_PNG_decode_grey_pixels(NULL, file_list->paths[i], pixels, length),
+        "Could not load \"%s\".", file_list->paths[i]);
+  report("decode to bytes (warm)", file_list->count, now_seconds() - start);
+
+  DS_PNG_Decoder *decoder = DS_PNG_decoder_create();
+  start = now_seconds();
+  for (size_t i = 0; i < file_list->count; ++i) {
+    DS_PNG_Input *png_input =
+        DS_PNG_input_load_grey(decoder, file_list->paths[i]);
+    DS_ASSERT(png_input, "Could not load \"%s\".", file_list->paths[i]);
+    DS_PNG_input_free(png_input);
+  }
+  report("DS_PNG_Input per image", file_list->count, now_seconds() - start);
+
+  DS_FLOAT *inputs = DS_MALLOC(length * sizeof(inputs[0]));
+  DS_ASSERT(inputs, "Out of memory.");
+  start = now_seconds();
+  for (size_t i = 0; i < file_list->count; ++i)
+    DS_ASSERT(DS_PNG_decode_grey_inputs(decoder, file_list->paths[i], inputs,
+                                        length),
+              "Could not load \"%s\".", file_list->paths[i]);
+  report("decoder into inputs", file_list->count, now_seconds() - start);
+  DS_PNG_decoder_free(decoder);
+  DS_FREE(inputs);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    DS_PRINTF("Usage: %s DIR [THREADS]\n", argv[0]);
+    return 1;
+  }
+  DS_THREAD_Pool *pool =
+      DS_THREAD_pool_create(argc > 2 ? strtoul(argv[2], NULL, 10) : 0);
+  DS_FILE_FileList *file_list = DS_FILE_get_files(argv[1], pool);
+  DS_ASSERT(file_list->count > 0, "No files found.");
+  DS_PNG_Input *first = DS_PNG_input_load_grey(NULL, file_list->paths[0]);
+  DS_ASSERT(first, "Could not load \"%s\".", file_list->paths[0]);
+  const size_t length = first->width * first->height;
+  DS_PNG_input_free(first);
+  uint8_t *pixels = DS_MALLOC(length);
+  DS_ASSERT(pixels, "Out of memory.");
+
+  DS_PRINTF("%lu files, %lu pread threads\n", file_list->count,
+            DS_THREAD_pool_size(pool));
+  bench_file_loop(file_list, pixels, length, false);
+  bench_file_loop(file_list, pixels, length, true);
+  bench_reader(file_list, pool, false, pixels, length);
+  bench_reader(file_list, pool, true, pixels, length);
+  bench_decode_inputs(file_list, pixels, length);
+
+  DS_THREAD_pool_free(pool);
+  DS_FREE(pixels);
+  DS_FILE_file_list_free(file_list);
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Compares the fast path for small 8-bit grey PNGs with libpng's simplified
+// API on one core. All files of a directory are read into memory first, then
+// every file is checked to decode bit-exactly the same with both decoders and
+// both are timed over several rounds of decoding all files.
+//
+// Usage: ./build/bin/bench_png DIR [ROUNDS]
+
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include <time.h>
+
+static double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static bool decode_libpng(const DS_IO_File *const file, uint8_t *const pixels,
+                          const size_t length) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&image, file->data, file->size))
+    return false;
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  return finish_grey_pixels(&image, pixels, length, message);
+}
+
+static bool decode_fast(const DS_IO_File *const file, uint8_t *const pixels,
+                        const size_t length) {
+  return decode_grey8_fast(file->data, file->size, pixels, length, 0);
+}
+
+static void bench(const char *const name, const DS_IO_File *const files,
+                  const size_t count, const size_t rounds,
+                  bool (*decode)(const DS_IO_File *const, uint8_t *const,
+                                 const size_t),
+                  uint8_t *const pixels, const size_t length) {
+  const double start = now_seconds();
+  for (size_t r = 0; r < rounds; ++r)
+    for (size_t i = 0; i < count; ++i)
+      DS_ASSERT(decode(&files[i], pixels, length), "Could not decode.");
+  const double seconds = now_seconds() - start;
+  DS_PRINTF("%-10s %8.3fs %12.0f images/s/core\n", name, seconds,
+            (double)(count * rounds) / seconds);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    DS_PRINTF("Usage: %s DIR [ROUNDS]\n", argv[0]);
+    return 1;
+  }
+  const size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 10;
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(0);
+  DS_FILE_FileList *file_list = DS_FILE_get_files(argv[1], pool);
+  DS_ASSERT(file_list->count > 0, "No files found.");
+  DS_IO_Reader *reader = DS_IO_reader_create(pool, false);
+  DS_IO_File *files = DS_MALLOC(file_list->count * sizeof(files[0]));
+  DS_ASSERT(files, "Out of memory.");
+  DS_ASSERT(DS_IO_read_files(reader, file_list->paths, file_list->count, files),
+            "Could not read files.");
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  DS_ASSERT(png_image_begin_read_from_memory(&image, files[0].data,
+                                             files[0].size),
+            "Could not read \"%s\".", file_list->paths[0]);
+  image.format = PNG_FORMAT_GRAY;
+  const size_t length = PNG_IMAGE_SIZE(image);
+  png_image_free(&image);
+  uint8_t *fast = DS_MALLOC(length);
+  uint8_t *reference = DS_MALLOC(length);
+  DS_ASSERT(fast && reference, "Out of memory.");
+
+  size_t in_profile = 0;
+  for (size_t i = 0; i < file_list->count; ++i) {
+    DS_ASSERT(decode_libpng(&files[i], reference, length),
+              "libpng could not decode \"%s\".", file_list->paths[i]);
+    if (!decode_fast(&files[i], fast, length))
+      continue;
+    ++in_profile;
+    DS_ASSERT(memcmp(fast, reference, length) == 0,
+              "Fast path differs from libpng for \"%s\".",
+              file_list->paths[i]);
+  }
+  DS_PRINTF("%lu files, %lu in the fast profile, all bit-exact with "
+            "libpng\n",
+            file_list->count, in_profile);
+  DS_ASSERT(in_profile == file_list->count,
+            "Timing needs all files in the fast profile.");
+
+  bench("libpng", files, file_list->count, rounds, &decode_libpng, reference,
+        length);
+  bench("fast path", files, file_list->count, rounds, &decode_fast, fast,
+        length);
+
+  DS_FREE(reference);
+  DS_FREE(fast);
+  DS_FREE(files);
+  DS_IO_reader_free(reader);
+  DS_FILE_file_list_free(file_list);
+  DS_THREAD_pool_free(pool);
+  return 0;
+}
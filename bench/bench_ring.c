@@ -0,0 +1,184 @@
+// Compares the round trip of a frame through the shared memory ring with a
+// tensor request over the Unix socket of the prediction server. A child
+// process hosts both, with a random network of the MNIST size, and the
+// parent sends one frame at a time and reports the latency percentiles.
+// Finally the ring is filled with windows of frames before their results
+// are taken, which is how a capture loop that does not wait for every frame
+// uses it.
+//
+// Usage: ./build/bin/bench_ring [FRAMES]
+
+#include "deepsea.c"
+#include "deepsea_batcher.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_model.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_ring.c"
+#include "deepsea_serve.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include <sys/wait.h>
+#include <time.h>
+
+#define INPUT_LENGTH 784
+#define NUM_OUTPUTS 10
+#define DEFAULT_FRAMES 20000
+#define NUM_FRAME_PATTERNS 64
+#define SOCKET_PATH "/tmp/bench_ring.sock"
+#define RING_NAME "/bench_ring"
+#define SEED 1234
+
+static double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/// Hosts both transports until the parent closes the stop pipe.
+static void run_servers(const int ready_fd, const int stop_fd) {
+  size_t sizes[3] = {INPUT_LENGTH, 30, NUM_OUTPUTS};
+  DS_MODEL_Model *model =
+      DS_MODEL_create(DS_network_create_random(sizes, 3, NULL));
+  DS_SERVE_Server *socket_server =
+      DS_SERVE_server_create(SOCKET_PATH, model, 1, NULL, NULL);
+  DS_RING_Server *ring_server =
+      DS_RING_server_create(RING_NAME, model, DS_RING_DEFAULT_NUM_SLOTS);
+  DS_ASSERT(socket_server && ring_server, "Could not start servers.");
+  const char ready = 1;
+  DS_ASSERT(write(ready_fd, &ready, 1) == 1, "Could not report readiness.");
+  char stop = 0;
+  while (read(stop_fd, &stop, 1) > 0)
+    ;
+  DS_RING_server_free(ring_server);
+  DS_SERVE_server_free(socket_server);
+  DS_MODEL_free(model);
+}
+
+static void report(const char *const name, double *const seconds,
+                   const size_t count, const double total) {
+  DS_PRINTF("%-22s p50 %7.1f us  p99 %7.1f us  %9.0f frames/s\n", name,
+            DS_SERVE_percentile(seconds, count, 0.5) * 1e6,
+            DS_SERVE_percentile(seconds, count, 0.99) * 1e6,
+            (double)count / total);
+}
+
+static void bench_socket(uint8_t frames[][INPUT_LENGTH],
+                         double *const seconds, const size_t count) {
+  DS_SERVE_Client *client = DS_SERVE_client_connect(SOCKET_PATH);
+  DS_ASSERT(client, "Could not connect to \"%s\".", SOCKET_PATH);
+  float values[INPUT_LENGTH];
+  const double start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    const double sent = now_seconds();
+    const uint8_t *const frame = frames[i % NUM_FRAME_PATTERNS];
+    for (size_t j = 0; j < INPUT_LENGTH; ++j)
+      values[j] = frame[j] / 255.f;
+    DS_SERVE_Response response;
+    DS_ASSERT(DS_SERVE_client_predict_tensor(client, values, INPUT_LENGTH,
+                                             &response) &&
+                  response.status == DS_SERVE_OK,
+              "Socket request failed.");
+    seconds[i] = now_seconds() - sent;
+  }
+  report("socket, tensor", seconds, count, now_seconds() - start);
+  DS_SERVE_client_free(client);
+}
+
+static void bench_ring(DS_RING_Client *const client,
+                       uint8_t frames[][INPUT_LENGTH], double *const seconds,
+                       const size_t count) {
+  const double start = now_seconds();
+  for (size_t i = 0; i < count; ++i) {
+    const double sent = now_seconds();
+    uint8_t *const slot = DS_RING_client_slot(client);
+    DS_ASSERT(slot, "Ring stopped.");
+    memcpy(slot, frames[i % NUM_FRAME_PATTERNS], INPUT_LENGTH);
+    const uint32_t ticket = DS_RING_client_submit(client);
+    DS_RING_Result result;
+    DS_ASSERT(DS_RING_client_result(client, ticket, &result),
+              "Ring stopped.");
+    seconds[i] = now_seconds() - sent;
+  }
+  report("ring, one frame", seconds, count, now_seconds() - start);
+}
+
+/// Submits windows of `window` frames and then takes their results. The
+/// latency of a frame is counted from its submission to its result.
+static void bench_ring_windows(DS_RING_Client *const client,
+                               uint8_t frames[][INPUT_LENGTH],
+                               double *const seconds, const size_t count,
+                               const size_t window) {
+  uint32_t tickets[DS_RING_DEFAULT_NUM_SLOTS];
+  double sent[DS_RING_DEFAULT_NUM_SLOTS];
+  const double start = now_seconds();
+  for (size_t first = 0; first < count; first += window) {
+    const size_t frames_in_window = DS_MIN(window, count - first);
+    for (size_t f = 0; f < frames_in_window; ++f) {
+      uint8_t *const slot = DS_RING_client_slot(client);
+      DS_ASSERT(slot, "Ring stopped.");
+      memcpy(slot, frames[(first + f) % NUM_FRAME_PATTERNS], INPUT_LENGTH);
+      sent[f] = now_seconds();
+      tickets[f] = DS_RING_client_submit(client);
+    }
+    for (size_t f = 0; f < frames_in_window; ++f) {
+      DS_RING_Result result;
+      DS_ASSERT(DS_RING_client_result(client, tickets[f], &result),
+                "Ring stopped.");
+      seconds[first + f] = now_seconds() - sent[f];
+    }
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "ring, windows of %lu", window);
+  report(name, seconds, count, now_seconds() - start);
+}
+
+int main(int argc, char **argv) {
+  const size_t count =
+      argc > 1 ? strtoul(argv[1], NULL, 10) : (size_t)DEFAULT_FRAMES;
+  DS_ASSERT(count > 0, "Need at least one frame.");
+
+  int ready[2];
+  int stop[2];
+  DS_ASSERT(pipe(ready) == 0 && pipe(stop) == 0, "Could not create pipes.");
+  const pid_t child = fork();
+  DS_ASSERT(child >= 0, "Could not fork.");
+  if (child == 0) {
+    close(ready[0]);
+    close(stop[1]);
+    run_servers(ready[1], stop[0]);
+    return 0;
+  }
+  close(ready[1]);
+  close(stop[0]);
+  char byte = 0;
+  DS_ASSERT(read(ready[0], &byte, 1) == 1, "Servers did not start.");
+
+  srand(SEED);
+  static uint8_t frames[NUM_FRAME_PATTERNS][INPUT_LENGTH];
+  for (size_t f = 0; f < NUM_FRAME_PATTERNS; ++f)
+    for (size_t j = 0; j < INPUT_LENGTH; ++j)
+      frames[f][j] = (uint8_t)(rand() & 0xff);
+  double *seconds = DS_MALLOC(count * sizeof(seconds[0]));
+  DS_ASSERT(seconds, "Out of memory.");
+
+  DS_PRINTF("%lu frames of %d grey values, server in process %d\n", count,
+            INPUT_LENGTH, (int)child);
+  bench_socket(frames, seconds, count);
+  DS_RING_Client *client = DS_RING_client_open(RING_NAME);
+  DS_ASSERT(client, "Could not open ring \"%s\".", RING_NAME);
+  bench_ring(client, frames, seconds, count);
+  bench_ring_windows(client, frames, seconds, count, 8);
+  bench_ring_windows(client, frames, seconds, count,
+                     DS_RING_DEFAULT_NUM_SLOTS);
+  DS_RING_client_free(client);
+
+  DS_FREE(seconds);
+  close(stop[1]);
+  waitpid(child, NULL, 0);
+  return 0;
+}
@@ -0,0 +1,39 @@
+// Measures how fast DS_FILE_get_files walks a directory tree, serially and
+// with a thread pool.
+//
+// Usage: ./build/bin/bench_scan DIR [THREADS]
+
+#include "deepsea.c"
+#include "deepsea_file.c"
+#include "deepsea_thread.c"
+
+#include <time.h>
+
+static double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void bench_scan(const char *const dir_path, DS_THREAD_Pool *const pool) {
+  const double start = now_seconds();
+  DS_FILE_FileList *file_list = DS_FILE_get_files(dir_path, pool);
+  const double seconds = now_seconds() - start;
+  DS_PRINTF("%3lu threads: %8lu files in %8.3fs %12.0f files/s\n",
+            DS_THREAD_pool_size(pool), file_list->count, seconds,
+            (double)file_list->count / seconds);
+  DS_FILE_file_list_free(file_list);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    DS_PRINTF("Usage: %s DIR [THREADS]\n", argv[0]);
+    return 1;
+  }
+  DS_THREAD_Pool *pool =
+      DS_THREAD_pool_create(argc > 2 ? strtoul(argv[2], NULL, 10) : 0);
+  bench_scan(argv[1], NULL);
+  bench_scan(argv[1], pool);
+  DS_THREAD_pool_free(pool);
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Compares full shuffling with block shuffling of an in-memory data set.
+// First the gather throughput of one epoch over a data set larger than the
+// caches, then the convergence of a small network on a data set that is
+// sorted by label, which is the worst case for block shuffling.
+//
+// Usage: ./build/bin/bench_shuffle [SAMPLES]
+
+#include "deepsea.c"
+#include "deepsea_alloc.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_pipeline.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include <time.h>
+
+#define INPUT_LENGTH 784
+#define BATCH_SIZE 10
+#define SEED 1234
+
+#define CONVERGENCE_SAMPLES 4000
+#define CONVERGENCE_INPUTS 16
+#define CONVERGENCE_OUTPUTS 4 // One per label 0..3
+#define CONVERGENCE_EPOCHS 10
+#define LEARNING_RATE 0.5f
+
+typedef struct {
+  const char *name;
+  size_t block_size;
+  size_t window;
+} Mode;
+
+static const Mode modes[] = {
+    {"full shuffle", 0, 1},
+    {"blocks of 16, window 16", 16, 16},
+    {"blocks of 64, window 16", 64, 16},
+    {"blocks of 256, window 8", 256, 8},
+    {"blocks of 1024, window 4", 1024, 4},
+};
+#define NUM_MODES (sizeof(modes) / sizeof(modes[0]))
+
+static double now_seconds(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+static void bench_gather(const DS_DATA_Set *const data_set, const Mode mode) {
+  DS_BatchIterator *iterator =
+      DS_batch_iterator_create(data_set->count, BATCH_SIZE, SEED);
+  DS_batch_iterator_set_block_shuffle(iterator, mode.block_size, mode.window);
+  DS_FLOAT *inputs = DS_MALLOC(BATCH_SIZE * INPUT_LENGTH * sizeof(DS_FLOAT));
+  DS_ASSERT(inputs, "Out of memory.");
+
+  DS_batch_iterator_start_epoch(iterator);
+  const double start = now_seconds();
+  DS_FLOAT checksum = 0;
+  const size_t *indexes = NULL;
+  size_t count = 0;
+  while ((count = DS_batch_iterator_next(iterator, &indexes)) > 0) {
+    for (size_t i = 0; i < count; ++i)
+      DS_DATA_load_input(data_set, indexes[i], &inputs[i * INPUT_LENGTH]);
+    checksum += inputs[0];
+  }
+  const double seconds = now_seconds() - start;
+  DS_PRINTF("%-26s %8.3fs %12.0f samples/s %8.0f MiB/s (%.0f)\n", mode.name,
+            seconds, (double)data_set->count / seconds,
+            (double)(data_set->count * INPUT_LENGTH) / seconds /
+                (1024. * 1024.),
+            checksum);
+  DS_FREE(inputs);
+  DS_batch_iterator_free(iterator);
+}
+
+/// Four classes around different prototypes, stored sorted by label.
+static DS_DATA_Set *create_sorted_data_set(void) {
+  DS_DATA_Set *data_set =
+      DS_DATA_set_create(CONVERGENCE_SAMPLES, CONVERGENCE_INPUTS, NULL);
+  uint64_t state = SEED;
+  for (size_t i = 0; i < CONVERGENCE_SAMPLES; ++i) {
+    const uint16_t label = (uint16_t)(i * 4 / CONVERGENCE_SAMPLES);
+    data_set->labels[i] = label;
+    for (size_t j = 0; j < CONVERGENCE_INPUTS; ++j) {
+      const uint8_t center = (j % 4 == label) ? 200 : 40;
+      data_set->pixels[i * CONVERGENCE_INPUTS + j] =
+          (uint8_t)(center + splitmix64(&state) % 48);
+    }
+  }
+  return data_set;
+}
+
+static void bench_convergence(const DS_DATA_Set *const data_set,
+                              const DS_LabelledView *const all,
+                              const Mode mode) {
+  const size_t sizes[] = {CONVERGENCE_INPUTS, 8, CONVERGENCE_OUTPUTS};
+  char *labels[CONVERGENCE_OUTPUTS] = {"0", "1", "2", "3"};
+  srand(SEED); // Same initial weights for every mode
+  DS_Backprop *backprop =
+      DS_backprop_create(sizes, 3, labels, DS_CROSS_ENTROPY, 0);
+  DS_PIPELINE_Pipeline *pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH_SIZE, 4, 1);
+  DS_PIPELINE_set_block_shuffle(pipeline, mode.block_size, mode.window);
+
+  DS_PRINTF("%-26s", mode.name);
+  for (size_t epoch = 0; epoch < CONVERGENCE_EPOCHS; ++epoch) {
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *batch = NULL;
+    while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      DS_backprop_learn_once_view(backprop, batch, LEARNING_RATE,
+                                  data_set->count);
+      DS_PIPELINE_release_batch(pipeline, batch);
+    }
+    DS_PRINTF(" %6.3f", DS_backprop_network_cost_view(backprop, all));
+  }
+  DS_PRINTF("\n");
+  DS_PIPELINE_free(pipeline);
+  DS_backprop_free(backprop);
+}
+
+int main(int argc, char *argv[]) {
+  const size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 500000;
+  DS_init_rand(SEED);
+
+  DS_DATA_Set *data_set = DS_DATA_set_create(count, INPUT_LENGTH, NULL);
+  memset(data_set->pixels, 0x55, count * INPUT_LENGTH);
+  memset(data_set->labels, 0, count * sizeof(data_set->labels[0]));
+  DS_DATA_set_print_memory(data_set);
+  DS_PRINTF("Gathering one epoch in minibatches of %d:\n", BATCH_SIZE);
+  for (size_t m = 0; m < NUM_MODES; ++m)
+    bench_gather(data_set, modes[m]);
+  DS_DATA_set_free(data_set);
+
+  DS_DATA_Set *sorted = create_sorted_data_set();
+  const DS_LabelledView all = DS_DATA_set_view(sorted, 0, sorted->count);
+
+  DS_PRINTF("\nCost on a data set sorted by label after each of %d epochs:\n",
+            CONVERGENCE_EPOCHS);
+  for (size_t m = 0; m < NUM_MODES; ++m)
+    bench_convergence(sorted, &all, modes[m]);
+
+  DS_DATA_set_free(sorted);
+  return 0;
+}
@@ -6,6 +6,38 @@
 #include <string.h>
 #include <time.h>
 
+#ifdef DS_COUNT_ALLOCATIONS
+#include <stdatomic.h>
+#ifndef DS_COUNTING_MALLOC
+#define DS_COUNTING_MALLOC malloc
+#endif
+#ifndef DS_COUNTING_CALLOC
+#define DS_COUNTING_CALLOC calloc
+#endif
+#ifndef DS_COUNTING_REALLOC
+#define DS_COUNTING_REALLOC realloc
+#endif
+
+static atomic_size_t allocation_count = 0;
+
+void *DS_counting_malloc(size_t size) {
+  atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+  return DS_COUNTING_MALLOC(size);
+}
+
+void *DS_counting_calloc(size_t num, size_t size) {
+  atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+  return DS_COUNTING_CALLOC(num, size);
+}
+
+void *DS_counting_realloc(void *ptr, size_t size) {
+  atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+  return DS_COUNTING_REALLOC(ptr, size);
+}
+
+size_t DS_allocation_count(void) { return atomic_load(&allocation_count); }
+#endif
+
 void DS_init_rand(long seed) {
   static bool random_init = false;
 
@@ -17,6 +49,7 @@ void DS_init_rand(long seed) {
 }
 
 #define IDX(i, j, m) ((i) * (m) + (j))
+#define MAX_GREY_VALUE 255.
 
 typedef struct {
   DS_FLOAT **activations;
@@ -149,6 +182,12 @@ DS_Network *DS_network_load(const char *const file_path) {
         DS_ERROR("Could not parse line %lu: %s", current_line, strerror(errno));
         goto load_error;
       }
+      if (num_layers < 2) {
+        DS_ERROR("Could not parse line %lu. At least 2 layers are needed, got "
+                 "%lu.",
+                 current_line, num_layers);
+        goto load_error;
+      }
       parsing_state = PS_LAYER_SIZES;
       relative_line_index = 0;
       continue;
@@ -290,6 +329,14 @@ DS_Network *DS_network_load(const char *const file_path) {
     }
     ++relative_line_index;
   }
+  // NOTE: A file cut short, e.g. one still being written, ends before the
+  // weights of the last layer
+  if (parsing_state != PS_OUTPUT_LABELS &&
+      parsing_state != PS_PARSING_ERROR) {
+    DS_ERROR("Could not load network \"%s\". File ends after line %lu.",
+             file_path, current_line - 1);
+    goto load_error;
+  }
 
   DS_Network *network = DS_network_create_owned(weights, biases, sizes,
                                                 num_layers, output_labels);
@@ -303,8 +350,19 @@ DS_Network *DS_network_load(const char *const file_path) {
   return network;
 
 load_error:
+  fclose(f);
   if (line)
     DS_FREE(line);
+  if (output_labels) {
+    const size_t L =
+        sizes[num_layers -
+              1]; // sizes and num_layers must exist if output_labels exist
+    for (size_t l = 0; l < L; ++l) {
+      if (output_labels[l])
+        DS_FREE(output_labels[l]);
+    }
+    DS_FREE(output_labels);
+  }
   if (sizes)
     DS_FREE(sizes);
   if (biases) {
@@ -312,21 +370,14 @@ load_error:
       if (biases[l])
         DS_FREE(biases[l]);
     }
+    DS_FREE(biases);
   }
   if (weights) {
     for (size_t l = 0; l < num_layers - 1; ++l) {
       if (weights[l])
         DS_FREE(weights[l]);
     }
-  }
-  if (output_labels) {
-    const size_t L =
-        sizes[num_layers -
-              1]; // sizes and num_layers must exist if output_labels exist
-    for (size_t l = 0; l < L; ++l) {
-      if (output_labels[l])
-        DS_FREE(output_labels[l]);
-    }
+    DS_FREE(weights);
   }
   return NULL;
 }
@@ -595,6 +646,27 @@ static DS_FLOAT cross_entropy_cost(const DS_FLOAT *const a,
   return -out;
 }
 
+static DS_FLOAT quadratic_cost_class(const DS_FLOAT *const a,
+                                     const size_t label, const size_t n) {
+  DS_FLOAT cost = 0;
+  for (size_t i = 0; i < n; ++i) {
+    DS_FLOAT diff = (a[i] - (i == label));
+    cost += diff * diff;
+  }
+  return 0.5f * cost;
+}
+
+static DS_FLOAT cross_entropy_cost_class(const DS_FLOAT *const a,
+                                         const size_t label, const size_t n) {
+  DS_FLOAT out = 0;
+  for (size_t i = 0; i < n; ++i) {
+    DS_FLOAT tmp = i == label ? logf(a[i]) : logf(1 - a[i]);
+    if (!isnanf(tmp))
+      out += tmp;
+  }
+  return -out;
+}
+
 static DS_FLOAT l2_regularization_cost(const DS_FLOAT *const W, const size_t n,
                                        const size_t m) {
   DS_FLOAT cost = 0;
@@ -619,50 +691,165 @@ static inline void dot_add(const DS_FLOAT *const W, const DS_FLOAT *const x,
   }
 }
 
-static const DS_FLOAT *
-network_get_output_activations(const DS_Network *const network) {
+/// Like dot_add for grey values, which are converted and scaled to \[0, 1\]
+/// inside the loop instead of being expanded into a DS_FLOAT row first.
+static inline void dot_add_grey(const DS_FLOAT *const W,
+                                const uint8_t *const x,
+                                const DS_FLOAT *const b, DS_FLOAT *const out,
+                                const size_t n, const size_t m) {
+  const DS_FLOAT scale = 1. / MAX_GREY_VALUE;
+  for (size_t i = 0; i < n; ++i) {
+    DS_FLOAT tmp = 0;
+    for (size_t j = 0; j < m; ++j) {
+      tmp += W[IDX(i, j, m)] * (DS_FLOAT)x[j];
+    }
+    out[i] = tmp * scale + b[i];
+  }
+}
 
-  return network->result->activations[network->num_layers - 1];
+/// dot_add for `count` rows of inputs, `stride` bytes apart, into `count`
+/// rows of `n` outputs. Every row of W is loaded once for all of them rather
+/// than once per row. The sum of every output is taken in the same order as
+/// by dot_add, so batching does not change any result.
+static inline void dot_add_rows(const DS_FLOAT *const W,
+                                const uint8_t *const x, const size_t stride,
+                                const DS_FLOAT *const b, DS_FLOAT *const out,
+                                const size_t n, const size_t m,
+                                const size_t count) {
+  for (size_t i = 0; i < n; ++i) {
+    const DS_FLOAT *const W_i = &W[IDX(i, 0, m)];
+    for (size_t r = 0; r < count; ++r) {
+      const DS_FLOAT *const x_r = (const DS_FLOAT *)(x + r * stride);
+      DS_FLOAT tmp = 0;
+      for (size_t j = 0; j < m; ++j) {
+        tmp += W_i[j] * x_r[j];
+      }
+      out[r * n + i] = tmp + b[i];
+    }
+  }
 }
 
-void DS_network_feedforward(DS_Network *const network,
-                            const DS_FLOAT *const input) {
-  DS_ASSERT(memcpy(network->result->inputs[0], input,
-                   network->layer_sizes[0] * sizeof(input[0])),
-            "Could not copy inputs.");
+/// dot_add_grey for `count` rows, like dot_add_rows.
+static inline void dot_add_grey_rows(const DS_FLOAT *const W,
+                                     const uint8_t *const x,
+                                     const size_t stride,
+                                     const DS_FLOAT *const b,
+                                     DS_FLOAT *const out, const size_t n,
+                                     const size_t m, const size_t count) {
+  const DS_FLOAT scale = 1. / MAX_GREY_VALUE;
+  for (size_t i = 0; i < n; ++i) {
+    const DS_FLOAT *const W_i = &W[IDX(i, 0, m)];
+    for (size_t r = 0; r < count; ++r) {
+      const uint8_t *const x_r = x + r * stride;
+      DS_FLOAT tmp = 0;
+      for (size_t j = 0; j < m; ++j) {
+        tmp += W_i[j] * (DS_FLOAT)x_r[j];
+      }
+      out[r * n + i] = tmp * scale + b[i];
+    }
+  }
+}
 
-  DS_ASSERT(memcpy(network->result->activations[0], input,
-                   network->layer_sizes[0] * sizeof(input[0])),
-            "Could not copy activations.");
-  for (size_t l = 0; l < network->num_layers - 1; ++l) {
+/// Applies the activation function to layer l, whose weighted inputs have
+/// been written to its activations. The weighted inputs are kept for
+/// backpropagation if the result has room for them.
+static void activate_layer(const DS_Network *const network,
+                           DS_NetworkResult *const result, const size_t l) {
+  if (result->inputs)
+    DS_ASSERT(memcpy(result->inputs[l], result->activations[l],
+                     network->layer_sizes[l] * sizeof(result->inputs[l][0])),
+              "Could not copy inputs.");
+  sigmoid(result->activations[l], result->activations[l],
+          network->layer_sizes[l]); // Inplace
+}
+
+/// Feeds the activations of layer `first` forward through the remaining
+/// layers.
+static void feedforward_layers(const DS_Network *const network,
+                               DS_NetworkResult *const result,
+                               const size_t first) {
+  for (size_t l = first; l < network->num_layers - 1; ++l) {
     const size_t n = network->layer_sizes[l + 1];
     const size_t m = network->layer_sizes[l];
     const DS_FLOAT *const W = network->weights[l];
     const DS_FLOAT *const b = network->biases[l];
-    dot_add(W, network->result->activations[l], b,
-            network->result->activations[l + 1], n, m);
-    DS_ASSERT(memcpy(network->result->inputs[l + 1],
-                     network->result->activations[l + 1],
-                     network->layer_sizes[l + 1] *
-                         sizeof(network->result->inputs[l + 1][0])),
+    dot_add(W, result->activations[l], b, result->activations[l + 1], n, m);
+    activate_layer(network, result, l + 1);
+  }
+}
+
+static void feedforward_input(const DS_Network *const network,
+                              DS_NetworkResult *const result,
+                              const DS_FLOAT *const input) {
+  if (result->inputs)
+    DS_ASSERT(memcpy(result->inputs[0], input,
+                     network->layer_sizes[0] * sizeof(input[0])),
               "Could not copy inputs.");
-    sigmoid(network->result->activations[l + 1],
-            network->result->activations[l + 1], n); // Inplace
+
+  DS_ASSERT(memcpy(result->activations[0], input,
+                   network->layer_sizes[0] * sizeof(input[0])),
+            "Could not copy activations.");
+  feedforward_layers(network, result, 0);
+}
+
+void DS_network_feedforward(DS_Network *const network,
+                            const DS_FLOAT *const input) {
+  feedforward_input(network, network->result, input);
+}
+
+/// Feeds row `index` of a view forward into `result`. Grey rows are read by
+/// the first layer directly and never stored in the first layer of the
+/// result, they are returned instead. Returns NULL for DS_FLOAT rows.
+static const uint8_t *feedforward_view_row(const DS_Network *const network,
+                                           DS_NetworkResult *const result,
+                                           const DS_LabelledView *const view,
+                                           const size_t index) {
+  DS_ASSERT(view->input_length == network->layer_sizes[0],
+            "View input length does not fit network input size, must be %lu "
+            "but got %lu",
+            network->layer_sizes[0], view->input_length);
+  const uint8_t *const row =
+      (const uint8_t *)view->inputs + index * view->input_stride;
+  switch (view->input_type) {
+  case DS_DTYPE_FLOAT: {
+    feedforward_input(network, result, (const DS_FLOAT *)row);
+    return NULL;
   }
+  case DS_DTYPE_U8: {
+    dot_add_grey(network->weights[0], row, network->biases[0],
+                 result->activations[1], network->layer_sizes[1],
+                 network->layer_sizes[0]);
+    activate_layer(network, result, 1);
+    feedforward_layers(network, result, 1);
+    return row;
+  }
+  default:
+    DS_ASSERT(false, "Unreachable");
+  }
+  return NULL;
 }
 
-DS_FLOAT DS_network_predict(DS_Network *const network,
-                            const DS_FLOAT *const input,
-                            char prediction[MAX_OUTPUT_LABEL_STRLEN + 1]) {
+void DS_grey_to_inputs(const uint8_t *restrict const grey,
+                       DS_FLOAT *restrict const inputs, const size_t length) {
+  const DS_FLOAT scale = 1. / MAX_GREY_VALUE;
+  for (size_t i = 0; i < length; ++i)
+    inputs[i] = (DS_FLOAT)grey[i] * scale;
+}
 
-  DS_network_feedforward(network, input);
+void DS_label_to_outputs(const size_t label, DS_FLOAT *const outputs,
+                         const size_t num_outputs) {
+  for (size_t i = 0; i < num_outputs; i++)
+    outputs[i] = (DS_FLOAT)(i == label);
+}
+
+/// Index of the most active of `L` output activations and its share of all
+/// of them.
+static DS_FLOAT most_active(const DS_FLOAT *const output_activations,
+                            const size_t L, size_t *const index) {
   size_t prediction_index = 0;
   DS_FLOAT max_activation = 0.;
   DS_FLOAT sum_activation = 0.;
 
-  const size_t L = DS_network_output_layer_size(network);
-  const DS_FLOAT *output_activations = network_get_output_activations(network);
-
   for (size_t i = 0; i < L; ++i) {
     sum_activation += output_activations[i];
     if (output_activations[i] > max_activation) {
@@ -670,13 +857,54 @@ DS_FLOAT DS_network_predict(DS_Network *const network,
       prediction_index = i;
     }
   }
+  *index = prediction_index;
+  return max_activation / sum_activation;
+}
+
+/// Index of the most active output of the last feedforward into `result`
+/// and its share of all output activations.
+static DS_FLOAT most_active_output(const DS_Network *const network,
+                                   const DS_NetworkResult *const result,
+                                   size_t *const index) {
+  return most_active(result->activations[network->num_layers - 1],
+                     DS_network_output_layer_size(network), index);
+}
+
+DS_FLOAT DS_network_predict(DS_Network *const network,
+                            const DS_FLOAT *const input,
+                            char prediction[MAX_OUTPUT_LABEL_STRLEN + 1]) {
+
+  DS_network_feedforward(network, input);
+  size_t prediction_index = 0;
+  const DS_FLOAT probability =
+      most_active_output(network, network->result, &prediction_index);
 
   if (network->output_labels)
     strcpy(prediction, network->output_labels[prediction_index]);
   else
     snprintf(prediction, MAX_OUTPUT_LABEL_STRLEN, "%lu", prediction_index);
 
-  return max_activation / sum_activation;
+  return probability;
+}
+
+void DS_network_predict_view(DS_Network *const network,
+                             const DS_LabelledView *const view,
+                             size_t *const predictions,
+                             DS_FLOAT *const probabilities) {
+  for (size_t i = 0; i < view->count; ++i) {
+    feedforward_view_row(network, network->result, view, i);
+    const DS_FLOAT probability =
+        most_active_output(network, network->result, &predictions[i]);
+    if (probabilities)
+      probabilities[i] = probability;
+  }
+}
+
+const char *DS_network_output_label(const DS_Network *const network,
+                                    const size_t index) {
+  DS_ASSERT(index < DS_network_output_layer_size(network),
+            "Output %lu does not exist.", index);
+  return network->output_labels ? network->output_labels[index] : NULL;
 }
 
 void DS_network_print_prediction(DS_Network *const network,
@@ -705,6 +933,47 @@ size_t DS_network_output_layer_size(const DS_Network *const network) {
   return network->layer_sizes[network->num_layers - 1];
 }
 
+size_t DS_network_num_layers(const DS_Network *const network) {
+  return network->num_layers;
+}
+
+size_t DS_network_layer_size(const DS_Network *const network,
+                             const size_t layer) {
+  DS_ASSERT(layer < network->num_layers, "Layer %lu does not exist.", layer);
+  return network->layer_sizes[layer];
+}
+
+bool DS_network_same_layers(const DS_Network *const a,
+                            const DS_Network *const b) {
+  if (a->num_layers != b->num_layers)
+    return false;
+  for (size_t l = 0; l < a->num_layers; ++l)
+    if (a->layer_sizes[l] != b->layer_sizes[l])
+      return false;
+  return true;
+}
+
+size_t DS_network_num_parameters(const DS_Network *const network) {
+  size_t count = 0;
+  for (size_t l = 0; l < network->num_layers - 1; ++l)
+    count += network->layer_sizes[l + 1] * (network->layer_sizes[l] + 1);
+  return count;
+}
+
+void DS_network_copy_parameters(const DS_Network *const network,
+                                DS_FLOAT *const parameters) {
+  size_t position = 0;
+  for (size_t l = 0; l < network->num_layers - 1; ++l) {
+    const size_t n = network->layer_sizes[l + 1];
+    const size_t m = network->layer_sizes[l];
+    memcpy(&parameters[position], network->biases[l], n * sizeof(DS_FLOAT));
+    position += n;
+    memcpy(&parameters[position], network->weights[l],
+           n * m * sizeof(DS_FLOAT));
+    position += n * m;
+  }
+}
+
 struct DS_Backprop {
   DS_FLOAT **errors;
   DS_FLOAT **weight_error_sums;
@@ -713,6 +982,9 @@ struct DS_Backprop {
   // normalized by the number of inputs yet)
   DS_FLOAT (*cost_function)(const DS_FLOAT *const a, const DS_FLOAT *const y,
                             const size_t n);
+  // NOTE: Same cost, but for the one-hot encoding of a class label
+  DS_FLOAT (*class_cost_function)(const DS_FLOAT *const a, const size_t label,
+                                  const size_t n);
   DS_FLOAT (*last_output_error)(const DS_FLOAT a, const DS_FLOAT z,
                                 const DS_FLOAT y);
   DS_FLOAT regularization_param;
@@ -783,11 +1055,13 @@ DS_backprop_create_from_network(DS_Network *const network,
   switch (cost_function_type) {
   case DS_QUADRATIC: {
     backprop->cost_function = &quadratic_cost;
+    backprop->class_cost_function = &quadratic_cost_class;
     backprop->last_output_error = &last_output_error_quadratic;
   } break;
 
   case DS_CROSS_ENTROPY: {
     backprop->cost_function = &cross_entropy_cost;
+    backprop->class_cost_function = &cross_entropy_cost_class;
     backprop->last_output_error = &last_output_error_cross_entropy;
   } break;
   default: {
@@ -825,41 +1099,84 @@ void DS_backprop_free(DS_Backprop *const backprop) {
   DS_FREE(backprop);
 }
 
+/// Cost of the output of the last feedforward, not normalized. The expected
+/// outputs are y or, if y is NULL, the one-hot encoding of class label.
+static DS_FLOAT output_cost(const DS_Backprop *const backprop,
+                            const DS_FLOAT *const y, const size_t label) {
+  const size_t L = backprop->network->num_layers - 1;
+  const DS_FLOAT *const a = backprop->network->result->activations[L];
+  const size_t n = backprop->network->layer_sizes[L];
+  return y ? backprop->cost_function(a, y, n)
+           : backprop->class_cost_function(a, label, n);
+}
+
+DS_FLOAT DS_network_regularization_cost(const DS_Network *const network) {
+  DS_FLOAT regularization_cost = 0;
+  for (size_t l = 0; l < network->num_layers - 1; ++l) {
+    const size_t n = network->layer_sizes[l + 1];
+    const size_t m = network->layer_sizes[l];
+    const DS_FLOAT *const W = network->weights[l];
+    regularization_cost +=
+        l2_regularization_cost(W, n, m); // TODO: Let user choose type
+  }
+  return regularization_cost;
+}
+
+static DS_FLOAT normalized_cost(const DS_Backprop *const backprop,
+                                const DS_FLOAT cost, const size_t count) {
+  return 1.f / (DS_FLOAT)count *
+         (cost + backprop->regularization_param *
+                     DS_network_regularization_cost(backprop->network));
+}
+
+/// Class label of row `index` of a view, checked against the network.
+static size_t view_label(const DS_Backprop *const backprop,
+                         const DS_LabelledView *const view,
+                         const size_t index) {
+  const size_t num_outputs =
+      backprop->network->layer_sizes[backprop->network->num_layers - 1];
+  DS_ASSERT(view->labels[index] < num_outputs,
+            "Label %u of row %lu has no output, network has %lu outputs.",
+            view->labels[index], index, num_outputs);
+  return view->labels[index];
+}
+
 DS_FLOAT
 DS_backprop_network_cost(DS_Backprop *const backprop,
                          const DS_Labelled_Inputs *const labelled_input) {
   DS_FLOAT cost = 0;
-  size_t len_output =
-      backprop->network->layer_sizes[backprop->network->num_layers - 1];
   for (size_t p = 0; p < labelled_input->count; ++p) {
-    const DS_FLOAT *x = labelled_input->inputs[p];
-    const DS_FLOAT *y = labelled_input->labels[p];
-    DS_network_feedforward(backprop->network, x);
-    cost += backprop->cost_function(
-        backprop->network->result
-            ->activations[backprop->network->num_layers - 1],
-        y, len_output);
+    DS_network_feedforward(backprop->network, labelled_input->inputs[p]);
+    cost += output_cost(backprop, labelled_input->labels[p], 0);
   }
-  DS_FLOAT regularization_cost = 0;
-  for (size_t l = 0; l < backprop->network->num_layers - 1; ++l) {
-    const size_t n = backprop->network->layer_sizes[l + 1];
-    const size_t m = backprop->network->layer_sizes[l];
-    const DS_FLOAT *const W = backprop->network->weights[l];
-    regularization_cost +=
-        l2_regularization_cost(W, n, m); // TODO: Let user choose type
+  return normalized_cost(backprop, cost, labelled_input->count);
+}
+
+DS_FLOAT DS_backprop_network_cost_view(DS_Backprop *const backprop,
+                                       const DS_LabelledView *const view) {
+  DS_ASSERT(view->labels, "Cannot compute the cost without labels.");
+  DS_FLOAT cost = 0;
+  for (size_t p = 0; p < view->count; ++p) {
+    feedforward_view_row(backprop->network, backprop->network->result, view,
+                         p);
+    cost += output_cost(backprop, NULL, view_label(backprop, view, p));
   }
-  return 1.f / (DS_FLOAT)labelled_input->count *
-         (cost + backprop->regularization_param * regularization_cost);
+  return normalized_cost(backprop, cost, view->count);
 }
 
+/// Errors of all layers for the last feedforward. The expected outputs are y
+/// or, if y is NULL, the one-hot encoding of class label, which is generated
+/// on the fly.
 static void calculate_output_error(DS_Backprop *const backprop,
-                                   const DS_FLOAT *const y) {
+                                   const DS_FLOAT *const y,
+                                   const size_t label) {
   const size_t L = backprop->network->num_layers - 1;
   size_t n = backprop->network->layer_sizes[L];
   for (size_t i = 0; i < n; ++i) {
+    const DS_FLOAT expected = y ? y[i] : (DS_FLOAT)(i == label);
     backprop->errors[L][i] = backprop->last_output_error(
         backprop->network->result->activations[L][i],
-        backprop->network->result->inputs[L][i], y[i]);
+        backprop->network->result->inputs[L][i], expected);
   }
 
   for (long long l = L - 1; l >= 0; --l) {
@@ -879,10 +1196,7 @@ static void calculate_output_error(DS_Backprop *const backprop,
   }
 }
 
-static void
-calculate_error_sums(DS_Backprop *const backprop,
-                     const DS_Labelled_Inputs *const labelled_input) {
-
+static void reset_error_sums(DS_Backprop *const backprop) {
   for (size_t l = 0; l < backprop->network->num_layers - 1; ++l) {
     const size_t n = backprop->network->layer_sizes[l + 1];
     const size_t m = backprop->network->layer_sizes[l];
@@ -891,29 +1205,51 @@ calculate_error_sums(DS_Backprop *const backprop,
     memset(backprop->weight_error_sums[l], 0,
            m * n * sizeof(backprop->weight_error_sums[l][0]));
   }
+}
 
-  for (size_t d = 0; d < labelled_input->count; ++d) {
-    const DS_FLOAT *const x = labelled_input->inputs[d];
-    const DS_FLOAT *const y = labelled_input->labels[d];
-    DS_network_feedforward(backprop->network, x);
-    calculate_output_error(backprop, y);
-    for (size_t l = 0; l < backprop->network->num_layers - 1; ++l) {
-      const size_t n = backprop->network->layer_sizes[l + 1];
-      const size_t m = backprop->network->layer_sizes[l];
-      const DS_FLOAT *const a = backprop->network->result->activations[l];
-      for (size_t i = 0; i < n; ++i) {
-        backprop->bias_error_sums[l][i] += backprop->errors[l + 1][i];
-      }
+/// Adds the errors of the last feedforward, see calculate_output_error. If
+/// grey_input is not NULL, it is the input of the first layer instead of the
+/// activations stored in the result, see feedforward_view_row.
+static void add_error_sums(DS_Backprop *const backprop,
+                           const DS_FLOAT *const y, const size_t label,
+                           const uint8_t *const grey_input) {
+  calculate_output_error(backprop, y, label);
+  for (size_t l = 0; l < backprop->network->num_layers - 1; ++l) {
+    const size_t n = backprop->network->layer_sizes[l + 1];
+    const size_t m = backprop->network->layer_sizes[l];
+    const DS_FLOAT *const a = backprop->network->result->activations[l];
+    for (size_t i = 0; i < n; ++i) {
+      backprop->bias_error_sums[l][i] += backprop->errors[l + 1][i];
+    }
+    if (l == 0 && grey_input) {
       for (size_t i = 0; i < n; ++i) {
+        const DS_FLOAT error = backprop->errors[l + 1][i] / MAX_GREY_VALUE;
         for (size_t j = 0; j < m; ++j) {
           backprop->weight_error_sums[l][IDX(i, j, m)] +=
-              a[j] * backprop->errors[l + 1][i];
+              (DS_FLOAT)grey_input[j] * error;
         }
       }
+      continue;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < m; ++j) {
+        backprop->weight_error_sums[l][IDX(i, j, m)] +=
+            a[j] * backprop->errors[l + 1][i];
+      }
     }
   }
 }
 
+static void
+calculate_error_sums(DS_Backprop *const backprop,
+                     const DS_Labelled_Inputs *const labelled_input) {
+  reset_error_sums(backprop);
+  for (size_t d = 0; d < labelled_input->count; ++d) {
+    DS_network_feedforward(backprop->network, labelled_input->inputs[d]);
+    add_error_sums(backprop, labelled_input->labels[d], 0, NULL);
+  }
+}
+
 static void update_weights_and_biases(DS_Backprop *const backprop,
                                       const DS_FLOAT learning_rate,
                                       const size_t batch_size,
@@ -950,10 +1286,209 @@ void DS_backprop_learn_once(DS_Backprop *const backprop,
                             total_training_set_size);
 }
 
+void DS_backprop_learn_once_view(DS_Backprop *const backprop,
+                                 const DS_LabelledView *const view,
+                                 const DS_FLOAT learning_rate,
+                                 const size_t total_training_set_size) {
+  DS_ASSERT(view->labels, "Cannot learn without labels.");
+  reset_error_sums(backprop);
+  for (size_t d = 0; d < view->count; ++d) {
+    const uint8_t *const grey_input =
+        feedforward_view_row(backprop->network, backprop->network->result,
+                             view, d);
+    add_error_sums(backprop, NULL, view_label(backprop, view, d), grey_input);
+  }
+
+  update_weights_and_biases(backprop, learning_rate, view->count,
+                            total_training_set_size);
+}
+
 DS_Network const *DS_backprop_network(const DS_Backprop *const backprop) {
   return backprop->network;
 }
 
+void DS_backprop_set_parameters(DS_Backprop *const backprop,
+                                const DS_FLOAT *const parameters) {
+  DS_Network *const network = backprop->network;
+  size_t position = 0;
+  for (size_t l = 0; l < network->num_layers - 1; ++l) {
+    const size_t n = network->layer_sizes[l + 1];
+    const size_t m = network->layer_sizes[l];
+    memcpy(network->biases[l], &parameters[position], n * sizeof(DS_FLOAT));
+    position += n;
+    memcpy(network->weights[l], &parameters[position],
+           n * m * sizeof(DS_FLOAT));
+    position += n * m;
+  }
+}
+
+struct DS_Inference {
+  const DS_Network *network;
+  // NOTE: Copied, the network may be freed before the inference if it was
+  // switched to another one
+  size_t num_layers;
+  size_t *layer_sizes;
+  size_t batch_size; // Rows fed forward at once
+  // NOTE: Activations of batch_size rows per layer, one row after the other,
+  // except for the first layer which is read from the view directly
+  DS_FLOAT **activations;
+  DS_FLOAT (*class_cost_function)(const DS_FLOAT *const a, const size_t label,
+                                  const size_t n);
+};
+
+DS_Inference *
+DS_inference_create(const DS_Network *const network,
+                    const DS_CostFunctionType cost_function_type,
+                    const size_t batch_size) {
+  DS_ASSERT(batch_size > 0, "Inference must feed at least one row forward.");
+  DS_Inference *inference = DS_MALLOC(sizeof(*inference));
+  DS_ASSERT(inference, "Could not create inference. Out of memory.");
+  inference->network = network;
+  inference->num_layers = network->num_layers;
+  inference->layer_sizes =
+      DS_MALLOC(network->num_layers * sizeof(inference->layer_sizes[0]));
+  DS_ASSERT(inference->layer_sizes,
+            "Could not create inference. Out of memory.");
+  memcpy(inference->layer_sizes, network->layer_sizes,
+         network->num_layers * sizeof(inference->layer_sizes[0]));
+  inference->batch_size = batch_size;
+  inference->activations =
+      DS_CALLOC(network->num_layers, sizeof(inference->activations[0]));
+  DS_ASSERT(inference->activations,
+            "Could not create inference. Out of memory.");
+  for (size_t l = 1; l < network->num_layers; ++l) {
+    inference->activations[l] =
+        DS_CALLOC(batch_size * network->layer_sizes[l],
+                  sizeof(inference->activations[l][0]));
+    DS_ASSERT(inference->activations[l],
+              "Could not create inference. Out of memory.");
+  }
+  switch (cost_function_type) {
+  case DS_QUADRATIC: {
+    inference->class_cost_function = &quadratic_cost_class;
+  } break;
+  case DS_CROSS_ENTROPY: {
+    inference->class_cost_function = &cross_entropy_cost_class;
+  } break;
+  default: {
+    DS_ASSERT(false, "Unreachable");
+  } break;
+  }
+  return inference;
+}
+
+void DS_inference_free(DS_Inference *const inference) {
+  for (size_t l = 0; l < inference->num_layers; ++l)
+    DS_FREE(inference->activations[l]);
+  DS_FREE(inference->activations);
+  DS_FREE(inference->layer_sizes);
+  DS_FREE(inference);
+}
+
+size_t DS_inference_batch_size(const DS_Inference *const inference) {
+  return inference->batch_size;
+}
+
+void DS_inference_set_network(DS_Inference *const inference,
+                              const DS_Network *const network) {
+  bool same_layers = network->num_layers == inference->num_layers;
+  for (size_t l = 0; same_layers && l < network->num_layers; ++l)
+    same_layers = network->layer_sizes[l] == inference->layer_sizes[l];
+  DS_ASSERT(same_layers,
+            "Inference cannot switch to a network with other layers.");
+  inference->network = network;
+}
+
+/// Feeds `count` rows of a view, starting at row `first`, forward at once.
+/// The output activations of row r are at r times the output layer size.
+static const DS_FLOAT *
+inference_feedforward_rows(DS_Inference *const inference,
+                           const DS_LabelledView *const view,
+                           const size_t first, const size_t count) {
+  const DS_Network *const network = inference->network;
+  DS_ASSERT(view->input_length == network->layer_sizes[0],
+            "View input length does not fit network input size, must be %lu "
+            "but got %lu",
+            network->layer_sizes[0], view->input_length);
+  DS_ASSERT(count <= inference->batch_size,
+            "Cannot feed %lu rows forward at once, inference has room for "
+            "%lu.",
+            count, inference->batch_size);
+  DS_FLOAT **const a = inference->activations;
+  const uint8_t *const rows =
+      (const uint8_t *)view->inputs + first * view->input_stride;
+  const size_t num_hidden = network->layer_sizes[1];
+  const size_t num_inputs = network->layer_sizes[0];
+  switch (view->input_type) {
+  case DS_DTYPE_FLOAT: {
+    dot_add_rows(network->weights[0], rows, view->input_stride,
+                 network->biases[0], a[1], num_hidden, num_inputs, count);
+  } break;
+  case DS_DTYPE_U8: {
+    dot_add_grey_rows(network->weights[0], rows, view->input_stride,
+                      network->biases[0], a[1], num_hidden, num_inputs,
+                      count);
+  } break;
+  default: {
+    DS_ASSERT(false, "Unreachable");
+  } break;
+  }
+  sigmoid(a[1], a[1], count * num_hidden); // Inplace
+  for (size_t l = 1; l < network->num_layers - 1; ++l) {
+    const size_t n = network->layer_sizes[l + 1];
+    const size_t m = network->layer_sizes[l];
+    dot_add_rows(network->weights[l], (const uint8_t *)a[l],
+                 m * sizeof(a[l][0]), network->biases[l], a[l + 1], n, m,
+                 count);
+    sigmoid(a[l + 1], a[l + 1], count * n); // Inplace
+  }
+  return a[network->num_layers - 1];
+}
+
+void DS_inference_predict_view(DS_Inference *const inference,
+                               const DS_LabelledView *const view,
+                               size_t *const predictions,
+                               DS_FLOAT *const probabilities) {
+  const size_t num_outputs = DS_network_output_layer_size(inference->network);
+  for (size_t first = 0; first < view->count;
+       first += inference->batch_size) {
+    const size_t count = DS_MIN(inference->batch_size, view->count - first);
+    const DS_FLOAT *const a =
+        inference_feedforward_rows(inference, view, first, count);
+    for (size_t r = 0; r < count; ++r) {
+      const DS_FLOAT probability = most_active(
+          &a[r * num_outputs], num_outputs, &predictions[first + r]);
+      if (probabilities)
+        probabilities[first + r] = probability;
+    }
+  }
+}
+
+DS_FLOAT DS_inference_score_view(DS_Inference *const inference,
+                                 const DS_LabelledView *const view,
+                                 size_t *const predictions) {
+  DS_ASSERT(view->labels, "Cannot compute the cost without labels.");
+  const size_t num_outputs = DS_network_output_layer_size(inference->network);
+  for (size_t p = 0; p < view->count; ++p)
+    DS_ASSERT(view->labels[p] < num_outputs,
+              "Label %u of row %lu has no output, network has %lu outputs.",
+              view->labels[p], p, num_outputs);
+  DS_FLOAT cost = 0;
+  for (size_t first = 0; first < view->count;
+       first += inference->batch_size) {
+    const size_t count = DS_MIN(inference->batch_size, view->count - first);
+    const DS_FLOAT *const a =
+        inference_feedforward_rows(inference, view, first, count);
+    for (size_t r = 0; r < count; ++r) {
+      const DS_FLOAT *const a_r = &a[r * num_outputs];
+      most_active(a_r, num_outputs, &predictions[first + r]);
+      cost += inference->class_cost_function(a_r, view->labels[first + r],
+                                             num_outputs);
+    }
+  }
+  return cost;
+}
+
 void DS_print_pixels_bw(const DS_PixelsBW *const pixels) {
 
   DS_PRINTF("╷");
@@ -2,11 +2,26 @@
 #define DEEPSEE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifndef DS_FLOAT
 #define DS_FLOAT double
 #endif
+#ifdef DS_COUNT_ALLOCATIONS
+// NOTE: Counting allocator mode, every allocation is counted and forwarded to
+// DS_COUNTING_MALLOC, DS_COUNTING_CALLOC and DS_COUNTING_REALLOC (the C
+// library by default). Used to check that the training loop does not
+// allocate once it is warmed up.
+void *DS_counting_malloc(size_t size);
+void *DS_counting_calloc(size_t num, size_t size);
+void *DS_counting_realloc(void *ptr, size_t size);
+/// Number of allocations made so far.
+size_t DS_allocation_count(void);
+#define DS_MALLOC DS_counting_malloc
+#define DS_CALLOC DS_counting_calloc
+#define DS_REALLOC DS_counting_realloc
+#endif
 #ifndef DS_MALLOC
 #define DS_MALLOC malloc
 #endif
@@ -48,6 +63,34 @@ typedef struct {
 
 void DS_labelled_inputs_free(DS_Labelled_Inputs *inputs);
 
+typedef enum { DS_DTYPE_FLOAT, DS_DTYPE_U8 } DS_DType;
+
+/// Labelled samples whose inputs are rows of equal length at a fixed
+/// distance from each other, e.g. a contiguous batch buffer, an in-memory data
+/// set or an mmap'd IDX file. A view never owns the memory it points to.
+/// DS_DTYPE_U8 inputs are grey values, which are scaled to \[0, 1\] when
+/// they are fed into a network.
+typedef struct {
+  const void *inputs;  // First row
+  size_t input_stride; // Bytes from the start of one row to the next
+  size_t input_length; // Values per row
+  DS_DType input_type;
+  const uint16_t *labels; // Class of every row, NULL if unlabelled
+  size_t count;
+} DS_LabelledView;
+
+/// Scales grey values (0-255) to network inputs in \[0, 1\]. Written as a
+/// multiply by the reciprocal over non-aliasing rows, such that the compiler
+/// vectorizes it.
+void DS_grey_to_inputs(const uint8_t *restrict const grey,
+                       DS_FLOAT *restrict const inputs, const size_t length);
+
+/// One-hot encodes a class label as the expected output activations of a
+/// network, output `label` is 1, all others are 0. A label without an output
+/// encodes to all zeros.
+void DS_label_to_outputs(const size_t label, DS_FLOAT *const outputs,
+                         const size_t num_outputs);
+
 /// Initialize the random number generator with a seed.
 /// If a negative seed is given, the current time is used as the seed.
 void DS_init_rand(long seed);
@@ -111,12 +154,81 @@ DS_FLOAT DS_network_predict(DS_Network *const network,
 void DS_network_print_prediction(DS_Network *const network,
                                  const DS_FLOAT *const input);
 
+/// Predicts every row of a view. For row i the index of the most active
+/// output is written to predictions\[i\] and, if probabilities is not NULL,
+/// its share of all output activations to probabilities\[i\].
+void DS_network_predict_view(DS_Network *const network,
+                             const DS_LabelledView *const view,
+                             size_t *const predictions,
+                             DS_FLOAT *const probabilities);
+
+/// Name of output `index`, NULL if the network has no output labels.
+const char *DS_network_output_label(const DS_Network *const network,
+                                    const size_t index);
+
 size_t DS_network_input_layer_size(const DS_Network *const network);
 
 size_t DS_network_output_layer_size(const DS_Network *const network);
 
+size_t DS_network_num_layers(const DS_Network *const network);
+
+size_t DS_network_layer_size(const DS_Network *const network,
+                             const size_t layer);
+
+/// Whether both networks have as many layers of the same sizes, so one can
+/// take the place of the other.
+bool DS_network_same_layers(const DS_Network *const a,
+                            const DS_Network *const b);
+
+/// Number of biases and weights of the network.
+size_t DS_network_num_parameters(const DS_Network *const network);
+
+/// Copies the biases and then the weights of every layer, from the first
+/// layer to the last, into `parameters`, which must hold
+/// DS_network_num_parameters values.
+void DS_network_copy_parameters(const DS_Network *const network,
+                                DS_FLOAT *const parameters);
+
+/// Sum of the squared weights of the network, which L2 regularization adds
+/// to the cost.
+DS_FLOAT DS_network_regularization_cost(const DS_Network *const network);
+
 typedef enum { DS_QUADRATIC, DS_CROSS_ENTROPY } DS_CostFunctionType;
 
+/// Activations of one feedforward through a network that is only evaluated,
+/// without the buffers backpropagation needs. The network is never changed,
+/// so threads with one inference each can share it. Up to batch_size rows
+/// are fed forward at once, which loads every weight once per batch instead
+/// of once per row and predicts the same as one row at a time.
+typedef struct DS_Inference DS_Inference;
+
+DS_Inference *
+DS_inference_create(const DS_Network *const network,
+                    const DS_CostFunctionType cost_function_type,
+                    const size_t batch_size);
+
+void DS_inference_free(DS_Inference *const inference);
+
+size_t DS_inference_batch_size(const DS_Inference *const inference);
+
+/// Predicts with `network` from now on, which must have the same layers as
+/// the network of the inference, so the activations fit it.
+void DS_inference_set_network(DS_Inference *const inference,
+                              const DS_Network *const network);
+
+/// DS_network_predict_view on the activations of the inference.
+void DS_inference_predict_view(DS_Inference *const inference,
+                               const DS_LabelledView *const view,
+                               size_t *const predictions,
+                               DS_FLOAT *const probabilities);
+
+/// Predicts every row of a labelled view like DS_network_predict_view and
+/// returns the sum of the costs of the rows, which is not normalized and
+/// does not include regularization, see DS_backprop_network_cost_view.
+DS_FLOAT DS_inference_score_view(DS_Inference *const inference,
+                                 const DS_LabelledView *const view,
+                                 size_t *const predictions);
+
 DS_Backprop *DS_backprop_create(const size_t *const sizes,
                                 const size_t num_layers,
                                 char *const *const output_labels,
@@ -135,8 +247,23 @@ void DS_backprop_learn_once(DS_Backprop *const backprop,
                             const DS_FLOAT learing_rate,
                             const size_t total_training_set_size);
 
+/// Like DS_backprop_learn_once and DS_backprop_network_cost, but reads the
+/// samples straight from a view. The view must have labels.
+void DS_backprop_learn_once_view(DS_Backprop *const backprop,
+                                 const DS_LabelledView *const view,
+                                 const DS_FLOAT learning_rate,
+                                 const size_t total_training_set_size);
+
+DS_FLOAT DS_backprop_network_cost_view(DS_Backprop *const backprop,
+                                       const DS_LabelledView *const view);
+
 DS_Network const *DS_backprop_network(const DS_Backprop *const backprop);
 
+/// Overwrites the biases and weights of the trained network with parameters
+/// in the order of DS_network_copy_parameters.
+void DS_backprop_set_parameters(DS_Backprop *const backprop,
+                                const DS_FLOAT *const parameters);
+
 DS_FLOAT
 DS_backprop_network_cost(DS_Backprop *const backprop,
                          const DS_Labelled_Inputs *const labelled_input);
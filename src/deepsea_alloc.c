@@ -0,0 +1,38 @@
+#include "deepsea_alloc.h"
+
+size_t DS_ALLOC_arena_size(const size_t size) {
+  return (size + DS_ALLOC_ALIGNMENT - 1) / DS_ALLOC_ALIGNMENT *
+         DS_ALLOC_ALIGNMENT;
+}
+
+DS_ALLOC_Arena *DS_ALLOC_arena_create(const size_t capacity) {
+  DS_ALLOC_Arena *arena = DS_MALLOC(sizeof(*arena));
+  DS_ASSERT(arena, "Could not create arena. Out of memory.");
+  // NOTE: Over-allocate to align the start, DS_MALLOC may be any allocator
+  arena->_block = DS_MALLOC(capacity + DS_ALLOC_ALIGNMENT);
+  DS_ASSERT(arena->_block, "Could not create arena. Out of memory.");
+  arena->data = (uint8_t *)DS_ALLOC_arena_size((uintptr_t)arena->_block);
+  arena->capacity = capacity;
+  arena->used = 0;
+  return arena;
+}
+
+void DS_ALLOC_arena_free(DS_ALLOC_Arena *const arena) {
+  if (!arena)
+    return;
+  DS_FREE(arena->_block);
+  DS_FREE(arena);
+}
+
+void *DS_ALLOC_arena_alloc(DS_ALLOC_Arena *const arena, const size_t size) {
+  const size_t reserved = DS_ALLOC_arena_size(size);
+  if (reserved > arena->capacity - arena->used)
+    return NULL;
+  void *const memory = &arena->data[arena->used];
+  arena->used += reserved;
+  return memory;
+}
+
+void DS_ALLOC_arena_reset(DS_ALLOC_Arena *const arena) {
+  arena->used = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef DEEPSEA_ALLOC_H
+#define DEEPSEA_ALLOC_H
+
+#include "deepsea.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// Every arena allocation starts on its own cache line.
+#define DS_ALLOC_ALIGNMENT 64
+
+/// Bump allocator over one block of memory that is allocated up front with
+/// DS_MALLOC. Allocations are never freed one by one, the whole arena is
+/// reset or freed at once. Buffers that live as long as their owner are
+/// carved out of an arena, so a hot loop which reuses them never touches the
+/// heap.
+typedef struct {
+  uint8_t *data; // DS_ALLOC_ALIGNMENT aligned
+  size_t capacity;
+  size_t used;
+
+  // NOTE: Private, the block allocated with DS_MALLOC
+  void *_block;
+} DS_ALLOC_Arena;
+
+/// Bytes an allocation of `size` bytes takes up in an arena. Sum this over
+/// all allocations to get the capacity an arena needs.
+size_t DS_ALLOC_arena_size(const size_t size);
+
+DS_ALLOC_Arena *DS_ALLOC_arena_create(const size_t capacity);
+
+void DS_ALLOC_arena_free(DS_ALLOC_Arena *const arena);
+
+/// Returns DS_ALLOC_ALIGNMENT aligned memory, or NULL if the arena is full.
+void *DS_ALLOC_arena_alloc(DS_ALLOC_Arena *const arena, const size_t size);
+
+/// Forgets all allocations, the memory is handed out again.
+void DS_ALLOC_arena_reset(DS_ALLOC_Arena *const arena);
+
+#endif // DEEPSEA_ALLOC_H
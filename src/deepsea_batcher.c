@@ -0,0 +1,302 @@
+#include "deepsea_batcher.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/// Row waiting to be predicted, on the stack of the thread predicting it.
+typedef struct Pending {
+  const DS_LabelledView *row;
+  unsigned long long submitted_ns;
+  size_t prediction;
+  DS_FLOAT probability;
+  bool done;
+  struct Pending *next;
+} Pending;
+
+struct DS_BATCHER_Batcher {
+  DS_MODEL_Reader *reader; // NOTE: Of the thread of the batcher
+  size_t input_length;
+  size_t max_batch_size;
+  unsigned long long deadline_ns;
+  pthread_t thread;
+
+  // NOTE: Only used by the thread of the batcher
+  DS_Inference *inference;
+  Pending **batch;   // Taken from the queue
+  Pending **members; // Rows of the batch of one input type
+  uint8_t *grey;     // Grey rows of the batch, one after the other
+  DS_FLOAT *values;  // DS_FLOAT rows of the batch
+  size_t *predictions;
+  DS_FLOAT *probabilities;
+
+  pthread_mutex_t mutex;    // Guards everything below
+  pthread_cond_t submitted; // A row was queued or the batcher stops
+  pthread_cond_t done;      // A batch was predicted
+  Pending *head;
+  Pending *tail;
+  size_t queued;
+  size_t producers;
+  bool stop;
+  unsigned long long created_ns;
+  size_t requests;
+  size_t batches;
+  size_t batch_sizes[DS_BATCHER_HISTOGRAM_BUCKETS];
+  unsigned long long queue_ns; // Sum over all predicted rows
+  unsigned long long max_queue_ns;
+};
+
+static unsigned long long batcher_now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (unsigned long long)time.tv_sec * 1000000000ull +
+         (unsigned long long)time.tv_nsec;
+}
+
+/// Waits for `submitted` until the monotonic time `deadline_ns`.
+static void wait_until(DS_BATCHER_Batcher *const batcher,
+                       const unsigned long long deadline_ns) {
+  const struct timespec deadline = {
+      .tv_sec = (time_t)(deadline_ns / 1000000000ull),
+      .tv_nsec = (long)(deadline_ns % 1000000000ull),
+  };
+  pthread_cond_timedwait(&batcher->submitted, &batcher->mutex, &deadline);
+}
+
+static size_t histogram_bucket(size_t batch_size) {
+  size_t bucket = 0;
+  while (batch_size > 1 && bucket < DS_BATCHER_HISTOGRAM_BUCKETS - 1) {
+    batch_size >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+/// Feeds the rows of the batch of one input type forward together. They
+/// are copied next to each other, since the rows of different threads lie
+/// anywhere in memory.
+static void predict_rows(DS_BATCHER_Batcher *const batcher,
+                         const size_t count, const DS_DType type) {
+  const size_t length = batcher->input_length;
+  size_t rows = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const DS_LabelledView *const row = batcher->batch[i]->row;
+    if (row->input_type != type)
+      continue;
+    if (type == DS_DTYPE_U8)
+      memcpy(&batcher->grey[rows * length], row->inputs, length);
+    else
+      memcpy(&batcher->values[rows * length], row->inputs,
+             length * sizeof(batcher->values[0]));
+    batcher->members[rows++] = batcher->batch[i];
+  }
+  if (rows == 0)
+    return;
+
+  DS_LabelledView view = {.input_length = length,
+                          .input_type = type,
+                          .count = rows};
+  if (type == DS_DTYPE_U8) {
+    view.inputs = batcher->grey;
+    view.input_stride = length;
+  } else {
+    view.inputs = batcher->values;
+    view.input_stride = length * sizeof(batcher->values[0]);
+  }
+  DS_inference_predict_view(batcher->inference, &view, batcher->predictions,
+                            batcher->probabilities);
+  for (size_t r = 0; r < rows; ++r) {
+    batcher->members[r]->prediction = batcher->predictions[r];
+    batcher->members[r]->probability = batcher->probabilities[r];
+  }
+}
+
+/// Whether the batch at the head of the queue is dispatched. Called with
+/// the lock held.
+static bool batch_ready(const DS_BATCHER_Batcher *const batcher,
+                        const unsigned long long now_ns) {
+  return batcher->stop || batcher->queued >= batcher->max_batch_size ||
+         (batcher->producers > 0 && batcher->queued >= batcher->producers) ||
+         now_ns >= batcher->head->submitted_ns + batcher->deadline_ns;
+}
+
+static void *batcher_main(void *const arg) {
+  DS_BATCHER_Batcher *const batcher = arg;
+  pthread_mutex_lock(&batcher->mutex);
+  while (true) {
+    while (!batcher->head && !batcher->stop)
+      pthread_cond_wait(&batcher->submitted, &batcher->mutex);
+    if (!batcher->head)
+      break; // NOTE: Stopped and every row was predicted
+    unsigned long long now_ns = batcher_now_ns();
+    while (!batch_ready(batcher, now_ns)) {
+      wait_until(batcher, batcher->head->submitted_ns + batcher->deadline_ns);
+      now_ns = batcher_now_ns();
+    }
+
+    const size_t count = DS_MIN(batcher->queued, batcher->max_batch_size);
+    unsigned long long queue_ns = 0;
+    unsigned long long max_queue_ns = 0;
+    for (size_t i = 0; i < count; ++i) {
+      Pending *const pending = batcher->head;
+      batcher->head = pending->next;
+      batcher->batch[i] = pending;
+      const unsigned long long waited_ns = now_ns - pending->submitted_ns;
+      queue_ns += waited_ns;
+      max_queue_ns = DS_MAX(max_queue_ns, waited_ns);
+    }
+    if (!batcher->head)
+      batcher->tail = NULL;
+    batcher->queued -= count;
+    pthread_mutex_unlock(&batcher->mutex);
+
+    DS_inference_set_network(batcher->inference,
+                             DS_MODEL_enter(batcher->reader));
+    predict_rows(batcher, count, DS_DTYPE_U8);
+    predict_rows(batcher, count, DS_DTYPE_FLOAT);
+    DS_MODEL_leave(batcher->reader);
+
+    pthread_mutex_lock(&batcher->mutex);
+    for (size_t i = 0; i < count; ++i)
+      batcher->batch[i]->done = true;
+    batcher->requests += count;
+    ++batcher->batches;
+    batcher->queue_ns += queue_ns;
+    batcher->max_queue_ns = DS_MAX(batcher->max_queue_ns, max_queue_ns);
+    ++batcher->batch_sizes[histogram_bucket(count)];
+    pthread_cond_broadcast(&batcher->done);
+  }
+  pthread_mutex_unlock(&batcher->mutex);
+  return NULL;
+}
+
+static void batcher_free_memory(DS_BATCHER_Batcher *const batcher) {
+  DS_inference_free(batcher->inference);
+  DS_MODEL_reader_unregister(batcher->reader);
+  DS_FREE(batcher->batch);
+  DS_FREE(batcher->members);
+  DS_FREE(batcher->grey);
+  DS_FREE(batcher->values);
+  DS_FREE(batcher->predictions);
+  DS_FREE(batcher->probabilities);
+  pthread_cond_destroy(&batcher->submitted);
+  pthread_cond_destroy(&batcher->done);
+  pthread_mutex_destroy(&batcher->mutex);
+  DS_FREE(batcher);
+}
+
+DS_BATCHER_Batcher *
+DS_BATCHER_create(DS_MODEL_Model *const model,
+                  const DS_BATCHER_Options *const options) {
+  DS_ASSERT(options->max_batch_size > 0,
+            "Batches must have room for at least one row.");
+  DS_BATCHER_Batcher *batcher = DS_CALLOC(1, sizeof(*batcher));
+  DS_ASSERT(batcher, "Could not create batcher. Out of memory.");
+  const size_t max = options->max_batch_size;
+  batcher->reader = DS_MODEL_reader_register(model);
+  const DS_Network *const network = DS_MODEL_enter(batcher->reader);
+  const size_t length = DS_network_input_layer_size(network);
+  batcher->input_length = length;
+  batcher->max_batch_size = max;
+  batcher->deadline_ns =
+      (unsigned long long)(DS_MAX(options->deadline_seconds, 0.) * 1e9);
+  // NOTE: Only predicts, the cost function is never used
+  batcher->inference = DS_inference_create(network, DS_QUADRATIC, max);
+  DS_MODEL_leave(batcher->reader);
+  batcher->batch = DS_MALLOC(max * sizeof(batcher->batch[0]));
+  batcher->members = DS_MALLOC(max * sizeof(batcher->members[0]));
+  batcher->grey = DS_MALLOC(max * length);
+  batcher->values = DS_MALLOC(max * length * sizeof(batcher->values[0]));
+  batcher->predictions = DS_MALLOC(max * sizeof(batcher->predictions[0]));
+  batcher->probabilities =
+      DS_MALLOC(max * sizeof(batcher->probabilities[0]));
+  DS_ASSERT(batcher->batch && batcher->members && batcher->grey &&
+                batcher->values && batcher->predictions &&
+                batcher->probabilities,
+            "Could not create batcher. Out of memory.");
+  pthread_mutex_init(&batcher->mutex, NULL);
+  // NOTE: Deadlines are taken on the monotonic clock
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&batcher->submitted, &attributes);
+  pthread_condattr_destroy(&attributes);
+  pthread_cond_init(&batcher->done, NULL);
+  batcher->created_ns = batcher_now_ns();
+
+  const int error =
+      pthread_create(&batcher->thread, NULL, &batcher_main, batcher);
+  if (error != 0) {
+    DS_ERROR("Could not start batcher: %s", strerror(error));
+    batcher_free_memory(batcher);
+    return NULL;
+  }
+  return batcher;
+}
+
+void DS_BATCHER_free(DS_BATCHER_Batcher *const batcher) {
+  pthread_mutex_lock(&batcher->mutex);
+  batcher->stop = true;
+  pthread_cond_signal(&batcher->submitted);
+  pthread_mutex_unlock(&batcher->mutex);
+  pthread_join(batcher->thread, NULL);
+  batcher_free_memory(batcher);
+}
+
+void DS_BATCHER_attach(DS_BATCHER_Batcher *const batcher) {
+  pthread_mutex_lock(&batcher->mutex);
+  ++batcher->producers;
+  pthread_mutex_unlock(&batcher->mutex);
+}
+
+void DS_BATCHER_detach(DS_BATCHER_Batcher *const batcher) {
+  pthread_mutex_lock(&batcher->mutex);
+  DS_ASSERT(batcher->producers > 0, "Detached a producer never attached.");
+  --batcher->producers;
+  // NOTE: The rows waiting may be all that remain now
+  pthread_cond_signal(&batcher->submitted);
+  pthread_mutex_unlock(&batcher->mutex);
+}
+
+DS_FLOAT DS_BATCHER_predict(DS_BATCHER_Batcher *const batcher,
+                            const DS_LabelledView *const row,
+                            size_t *const prediction) {
+  DS_ASSERT(row->count == 1, "Batcher predicts single rows, not %lu.",
+            row->count);
+  DS_ASSERT(row->input_length == batcher->input_length,
+            "Row length does not fit network input size, must be %lu but "
+            "got %lu",
+            batcher->input_length, row->input_length);
+  Pending pending = {.row = row, .submitted_ns = batcher_now_ns()};
+  pthread_mutex_lock(&batcher->mutex);
+  if (batcher->tail)
+    batcher->tail->next = &pending;
+  else
+    batcher->head = &pending;
+  batcher->tail = &pending;
+  ++batcher->queued;
+  pthread_cond_signal(&batcher->submitted);
+  while (!pending.done)
+    pthread_cond_wait(&batcher->done, &batcher->mutex);
+  pthread_mutex_unlock(&batcher->mutex);
+  *prediction = pending.prediction;
+  return pending.probability;
+}
+
+DS_BATCHER_Stats DS_BATCHER_stats(DS_BATCHER_Batcher *const batcher) {
+  DS_BATCHER_Stats stats = {0};
+  pthread_mutex_lock(&batcher->mutex);
+  stats.requests = batcher->requests;
+  stats.batches = batcher->batches;
+  memcpy(stats.batch_sizes, batcher->batch_sizes, sizeof(stats.batch_sizes));
+  const double seconds =
+      (double)(batcher_now_ns() - batcher->created_ns) * 1e-9;
+  if (seconds > 0)
+    stats.requests_per_second = (double)batcher->requests / seconds;
+  if (batcher->requests > 0)
+    stats.mean_queue_seconds =
+        (double)batcher->queue_ns * 1e-9 / (double)batcher->requests;
+  stats.max_queue_seconds = (double)batcher->max_queue_ns * 1e-9;
+  pthread_mutex_unlock(&batcher->mutex);
+  return stats;
+}
@@ -0,0 +1,66 @@
+#ifndef DEEPSEA_BATCHER_H
+#define DEEPSEA_BATCHER_H
+
+#include "deepsea.h"
+#include "deepsea_model.h"
+#include <stddef.h>
+
+/// Scheduler that coalesces single rows, predicted concurrently by many
+/// threads, into micro-batches which one thread feeds forward at once. A
+/// batch is dispatched as soon as it is full, as soon as every attached
+/// producer waits in it, since no further row can arrive then, or once its
+/// oldest row waited for the deadline. Under low load rows are thus
+/// predicted right away, under high load the weights are loaded once per
+/// batch instead of once per row.
+typedef struct DS_BATCHER_Batcher DS_BATCHER_Batcher;
+
+#define DS_BATCHER_DEFAULT_MAX_BATCH_SIZE 32
+#define DS_BATCHER_DEFAULT_DEADLINE_SECONDS 500e-6
+/// Bucket b of the batch size histogram counts the batches of 2^b up to
+/// 2^(b+1) - 1 rows, the last one all larger batches too.
+#define DS_BATCHER_HISTOGRAM_BUCKETS 10
+
+typedef struct {
+  size_t max_batch_size;   // Rows fed forward at once
+  double deadline_seconds; // Longest a row waits for others to join it
+} DS_BATCHER_Options;
+
+typedef struct {
+  size_t requests; // Rows predicted
+  size_t batches;
+  size_t batch_sizes[DS_BATCHER_HISTOGRAM_BUCKETS];
+  double requests_per_second; // Since the batcher was created
+  double mean_queue_seconds;  // Time from submission to dispatch
+  double max_queue_seconds;
+} DS_BATCHER_Stats;
+
+/// Starts the thread that feeds the batches forward, each with the network
+/// the model has when the batch is dispatched. The model must outlive the
+/// batcher. Returns NULL if the thread cannot be started.
+DS_BATCHER_Batcher *
+DS_BATCHER_create(DS_MODEL_Model *const model,
+                  const DS_BATCHER_Options *const options);
+
+/// Predicts the rows still waiting and stops the thread. No thread may be
+/// predicting anymore.
+void DS_BATCHER_free(DS_BATCHER_Batcher *const batcher);
+
+/// A producer is a thread that will predict more rows soon, like a server
+/// worker with an open connection. Batches are dispatched early once all
+/// attached producers wait in them. Rows of threads that are not attached
+/// are predicted as well, they may wait for the deadline.
+void DS_BATCHER_attach(DS_BATCHER_Batcher *const batcher);
+
+void DS_BATCHER_detach(DS_BATCHER_Batcher *const batcher);
+
+/// Predicts the single row of `row`, of DS_DTYPE_U8 or DS_DTYPE_FLOAT, with
+/// the rows other threads submit at the same time and waits for it. Returns
+/// the share of the most active output like DS_network_predict_view, the
+/// result is the same as without batching. Thread safe.
+DS_FLOAT DS_BATCHER_predict(DS_BATCHER_Batcher *const batcher,
+                            const DS_LabelledView *const row,
+                            size_t *const prediction);
+
+DS_BATCHER_Stats DS_BATCHER_stats(DS_BATCHER_Batcher *const batcher);
+
+#endif // DEEPSEA_BATCHER_H
@@ -0,0 +1,267 @@
+#include "deepsea_checkpoint.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECKPOINT_MAGIC "DSCHKPT1"
+#define CHECKPOINT_MAGIC_LENGTH 8
+#define CHECKPOINT_BYTE_ORDER_MARK 0x01020304u
+#define CHECKPOINT_TEMP_SUFFIX ".tmp"
+#define NO_SNAPSHOT SIZE_MAX
+
+typedef struct {
+  char magic[CHECKPOINT_MAGIC_LENGTH];
+  uint32_t byte_order;
+  uint32_t float_size;
+  uint64_t num_layers;
+  uint64_t num_parameters;
+  DS_CHECKPOINT_State state;
+} CheckpointHeader;
+
+static_assert(sizeof(DS_CHECKPOINT_State) == 40,
+              "Checkpoint state must be packed.");
+static_assert(sizeof(CheckpointHeader) == 72,
+              "Checkpoint header must be packed.");
+
+// NOTE: Two snapshots, such that the trainer can take the next one while the
+// thread writes the other
+typedef struct {
+  DS_FLOAT *parameters;
+  DS_CHECKPOINT_State state;
+} Snapshot;
+
+struct DS_CHECKPOINT_Writer {
+  char *path;
+  char *temp_path;
+  uint64_t *layer_sizes;
+  size_t num_layers;
+  size_t num_parameters;
+  Snapshot snapshots[2];
+  size_t pending; // Snapshot waiting to be written or NO_SNAPSHOT
+  size_t writing; // Snapshot being written or NO_SNAPSHOT
+  size_t written;
+  bool failed;
+  bool stop;
+  bool has_thread; // Otherwise checkpoints are written on save
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;
+};
+
+static bool write_checkpoint(const DS_CHECKPOINT_Writer *const writer,
+                             const Snapshot *const snapshot) {
+  CheckpointHeader header = {
+      .byte_order = CHECKPOINT_BYTE_ORDER_MARK,
+      .float_size = sizeof(DS_FLOAT),
+      .num_layers = writer->num_layers,
+      .num_parameters = writer->num_parameters,
+      .state = snapshot->state,
+  };
+  memcpy(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH);
+
+  FILE *f = fopen(writer->temp_path, "wb");
+  if (!f) {
+    DS_ERROR("Could not open file \"%s\": %s", writer->temp_path,
+             strerror(errno));
+    return false;
+  }
+  bool success =
+      fwrite(&header, sizeof(header), 1, f) == 1 &&
+      fwrite(writer->layer_sizes, sizeof(writer->layer_sizes[0]),
+             writer->num_layers, f) == writer->num_layers &&
+      fwrite(snapshot->parameters, sizeof(DS_FLOAT), writer->num_parameters,
+             f) == writer->num_parameters &&
+      fflush(f) == 0 && fsync(fileno(f)) == 0;
+  if (fclose(f) != 0)
+    success = false;
+  // NOTE: The rename replaces the previous checkpoint in one step
+  if (!success || rename(writer->temp_path, writer->path) != 0) {
+    DS_ERROR("Could not write checkpoint \"%s\": %s", writer->path,
+             strerror(errno));
+    unlink(writer->temp_path);
+    return false;
+  }
+  return true;
+}
+
+static void *writer_main(void *const arg) {
+  DS_CHECKPOINT_Writer *const writer = arg;
+  pthread_mutex_lock(&writer->mutex);
+  while (1) {
+    while (!writer->stop && writer->pending == NO_SNAPSHOT)
+      pthread_cond_wait(&writer->changed, &writer->mutex);
+    if (writer->pending == NO_SNAPSHOT)
+      break; // NOTE: Stopped and nothing left to write
+    writer->writing = writer->pending;
+    writer->pending = NO_SNAPSHOT;
+    pthread_mutex_unlock(&writer->mutex);
+
+    const bool success =
+        write_checkpoint(writer, &writer->snapshots[writer->writing]);
+
+    pthread_mutex_lock(&writer->mutex);
+    writer->writing = NO_SNAPSHOT;
+    if (success)
+      ++writer->written;
+    else
+      writer->failed = true;
+    pthread_cond_broadcast(&writer->changed);
+  }
+  pthread_mutex_unlock(&writer->mutex);
+  return NULL;
+}
+
+DS_CHECKPOINT_Writer *
+DS_CHECKPOINT_writer_create(const char *const path,
+                            const DS_Network *const network) {
+  DS_CHECKPOINT_Writer *writer = DS_CALLOC(1, sizeof(*writer));
+  DS_ASSERT(writer, "Could not create checkpoint writer. Out of memory.");
+  const size_t path_length = strlen(path);
+  writer->path = DS_MALLOC(path_length + 1);
+  writer->temp_path =
+      DS_MALLOC(path_length + strlen(CHECKPOINT_TEMP_SUFFIX) + 1);
+  writer->num_layers = DS_network_num_layers(network);
+  writer->num_parameters = DS_network_num_parameters(network);
+  writer->layer_sizes =
+      DS_MALLOC(writer->num_layers * sizeof(writer->layer_sizes[0]));
+  DS_ASSERT(writer->path && writer->temp_path && writer->layer_sizes,
+            "Could not create checkpoint writer. Out of memory.");
+  strcpy(writer->path, path);
+  strcpy(writer->temp_path, path);
+  strcat(writer->temp_path, CHECKPOINT_TEMP_SUFFIX);
+  for (size_t l = 0; l < writer->num_layers; ++l)
+    writer->layer_sizes[l] = DS_network_layer_size(network, l);
+  for (size_t s = 0; s < 2; ++s) {
+    writer->snapshots[s].parameters =
+        DS_MALLOC(writer->num_parameters * sizeof(DS_FLOAT));
+    DS_ASSERT(writer->snapshots[s].parameters,
+              "Could not create checkpoint writer. Out of memory.");
+  }
+  writer->pending = NO_SNAPSHOT;
+  writer->writing = NO_SNAPSHOT;
+
+  pthread_mutex_init(&writer->mutex, NULL);
+  pthread_cond_init(&writer->changed, NULL);
+  const int error =
+      pthread_create(&writer->thread, NULL, &writer_main, writer);
+  if (error != 0)
+    DS_ERROR("Could not start checkpoint thread, checkpoints are written "
+             "while training: %s",
+             strerror(error));
+  writer->has_thread = error == 0;
+  return writer;
+}
+
+void DS_CHECKPOINT_writer_free(DS_CHECKPOINT_Writer *const writer) {
+  if (writer->has_thread) {
+    pthread_mutex_lock(&writer->mutex);
+    writer->stop = true;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->mutex);
+    pthread_join(writer->thread, NULL);
+  }
+  pthread_cond_destroy(&writer->changed);
+  pthread_mutex_destroy(&writer->mutex);
+  for (size_t s = 0; s < 2; ++s)
+    DS_FREE(writer->snapshots[s].parameters);
+  DS_FREE(writer->layer_sizes);
+  DS_FREE(writer->temp_path);
+  DS_FREE(writer->path);
+  DS_FREE(writer);
+}
+
+void DS_CHECKPOINT_save(DS_CHECKPOINT_Writer *const writer,
+                        const DS_Network *const network,
+                        const DS_CHECKPOINT_State *const state) {
+  DS_ASSERT(DS_network_num_parameters(network) == writer->num_parameters,
+            "Network does not fit the checkpoint writer.");
+  if (!writer->has_thread) {
+    Snapshot *const snapshot = &writer->snapshots[0];
+    DS_network_copy_parameters(network, snapshot->parameters);
+    snapshot->state = *state;
+    if (write_checkpoint(writer, snapshot))
+      ++writer->written;
+    else
+      writer->failed = true;
+    return;
+  }
+
+  // NOTE: Copying the parameters takes far less time than writing them, so
+  // the lock keeps the thread from picking up a half-taken snapshot
+  pthread_mutex_lock(&writer->mutex);
+  const size_t s = writer->writing == 0 ? 1 : 0;
+  DS_network_copy_parameters(network, writer->snapshots[s].parameters);
+  writer->snapshots[s].state = *state;
+  writer->pending = s;
+  pthread_cond_broadcast(&writer->changed);
+  pthread_mutex_unlock(&writer->mutex);
+}
+
+bool DS_CHECKPOINT_writer_wait(DS_CHECKPOINT_Writer *const writer) {
+  pthread_mutex_lock(&writer->mutex);
+  while (writer->pending != NO_SNAPSHOT || writer->writing != NO_SNAPSHOT)
+    pthread_cond_wait(&writer->changed, &writer->mutex);
+  const bool success = !writer->failed;
+  pthread_mutex_unlock(&writer->mutex);
+  return success;
+}
+
+size_t DS_CHECKPOINT_writer_count(DS_CHECKPOINT_Writer *const writer) {
+  pthread_mutex_lock(&writer->mutex);
+  const size_t written = writer->written;
+  pthread_mutex_unlock(&writer->mutex);
+  return written;
+}
+
+bool DS_CHECKPOINT_exists(const char *const path) {
+  return access(path, F_OK) == 0;
+}
+
+bool DS_CHECKPOINT_load(const char *const path, DS_Backprop *const backprop,
+                        DS_CHECKPOINT_State *const state) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    DS_ERROR("Could not open checkpoint \"%s\": %s", path, strerror(errno));
+    return false;
+  }
+  const DS_Network *const network = DS_backprop_network(backprop);
+  CheckpointHeader header = {0};
+  bool valid =
+      fread(&header, sizeof(header), 1, f) == 1 &&
+      memcmp(header.magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH) == 0 &&
+      header.byte_order == CHECKPOINT_BYTE_ORDER_MARK &&
+      header.float_size == sizeof(DS_FLOAT) &&
+      header.num_layers == DS_network_num_layers(network) &&
+      header.num_parameters == DS_network_num_parameters(network);
+  for (size_t l = 0; l < header.num_layers && valid; ++l) {
+    uint64_t size = 0;
+    valid = fread(&size, sizeof(size), 1, f) == 1 &&
+            size == DS_network_layer_size(network, l);
+  }
+  if (!valid) {
+    DS_ERROR("File \"%s\" is not a checkpoint of this network on this "
+             "machine.",
+             path);
+    fclose(f);
+    return false;
+  }
+
+  DS_FLOAT *parameters =
+      DS_MALLOC(DS_MAX(header.num_parameters, 1) * sizeof(DS_FLOAT));
+  DS_ASSERT(parameters, "Could not load checkpoint. Out of memory.");
+  valid = fread(parameters, sizeof(DS_FLOAT), header.num_parameters, f) ==
+              header.num_parameters &&
+          fgetc(f) == EOF;
+  fclose(f);
+  if (valid) {
+    DS_backprop_set_parameters(backprop, parameters);
+    *state = header.state;
+  } else {
+    DS_ERROR("Checkpoint \"%s\" is truncated or corrupt.", path);
+  }
+  DS_FREE(parameters);
+  return valid;
+}
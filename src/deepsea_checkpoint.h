@@ -0,0 +1,69 @@
+#ifndef DEEPSEA_CHECKPOINT_H
+#define DEEPSEA_CHECKPOINT_H
+
+#include "deepsea.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Checkpoints hold everything needed to continue an interrupted training
+/// run exactly where it stopped. Training uses plain stochastic gradient
+/// descent, so besides the parameters that is the position in the sample
+/// order and in the learning rate schedule. The binary layout is:
+///
+///   header:     magic "DSCHKPT1", u32 byte order mark 0x01020304,
+///               u32 size of DS_FLOAT, u64 number of layers, u64 number of
+///               parameters, the DS_CHECKPOINT_State
+///   layers:     u64 size of every layer
+///   parameters: DS_FLOAT biases and weights, see DS_network_copy_parameters
+///
+/// The parameters are stored bit for bit in the byte order of the writer.
+/// Checkpoints are written to a temporary file first, which replaces the
+/// previous checkpoint once it is complete, so a crash while writing never
+/// leaves a broken checkpoint behind.
+typedef struct {
+  uint64_t epoch;       // Number of completed epochs
+  uint64_t batch;       // Batches of epoch `epoch` already trained on
+  uint64_t seed;        // Of the sample order, see DS_PIPELINE_seed
+  uint64_t num_samples; // Size of the training set
+  double learning_rate; // Of the next batch
+} DS_CHECKPOINT_State;
+
+/// Writes checkpoints on a background thread, such that training does not
+/// wait for the disk.
+typedef struct DS_CHECKPOINT_Writer DS_CHECKPOINT_Writer;
+
+/// Creates a writer for checkpoints of networks shaped like `network`,
+/// which are written to `path`.
+DS_CHECKPOINT_Writer *
+DS_CHECKPOINT_writer_create(const char *const path,
+                            const DS_Network *const network);
+
+/// Waits until the last checkpoint is written.
+void DS_CHECKPOINT_writer_free(DS_CHECKPOINT_Writer *const writer);
+
+/// Takes a snapshot of the parameters of the network and the state and
+/// writes it in the background. Training may change the network as soon as
+/// this returns. A snapshot that has not been started to be written yet
+/// when the next one is taken is replaced by it.
+void DS_CHECKPOINT_save(DS_CHECKPOINT_Writer *const writer,
+                        const DS_Network *const network,
+                        const DS_CHECKPOINT_State *const state);
+
+/// Waits until all snapshots are written. Returns false if writing any
+/// checkpoint failed.
+bool DS_CHECKPOINT_writer_wait(DS_CHECKPOINT_Writer *const writer);
+
+/// Number of checkpoints written so far.
+size_t DS_CHECKPOINT_writer_count(DS_CHECKPOINT_Writer *const writer);
+
+/// Returns true if a checkpoint exists at path.
+bool DS_CHECKPOINT_exists(const char *const path);
+
+/// Restores the parameters of the network being trained and the state from
+/// the checkpoint at path. Returns false if it cannot be read or was written
+/// for a network of a different shape.
+bool DS_CHECKPOINT_load(const char *const path, DS_Backprop *const backprop,
+                        DS_CHECKPOINT_State *const state);
+
+#endif // DEEPSEA_CHECKPOINT_H
@@ -0,0 +1,111 @@
+#include "deepsea_data.h"
+#include "deepsea_file.h"
+#include <math.h>
+
+#define BYTES_PER_MIB (1024. * 1024.)
+
+size_t DS_DATA_memory_size(const size_t count, const size_t input_length) {
+  return count * (input_length * sizeof(uint8_t) + sizeof(uint16_t));
+}
+
+DS_DATA_Set *DS_DATA_set_create(const size_t count, const size_t input_length,
+                                uint8_t *const pixels) {
+  DS_DATA_Set *data_set = DS_MALLOC(sizeof(*data_set));
+  DS_ASSERT(data_set, "Could not create data set. Out of memory.");
+  data_set->count = count;
+  data_set->input_length = input_length;
+  data_set->_owns_pixels = pixels == NULL;
+  data_set->pixels =
+      pixels ? pixels
+             : DS_MALLOC(DS_MAX(count * input_length, 1) *
+                         sizeof(data_set->pixels[0]));
+  data_set->labels =
+      DS_MALLOC(DS_MAX(count, 1) * sizeof(data_set->labels[0]));
+  DS_ASSERT(data_set->pixels && data_set->labels,
+            "Could not create data set. Out of memory.");
+  return data_set;
+}
+
+void DS_DATA_set_free(DS_DATA_Set *const data_set) {
+  if (data_set->_owns_pixels)
+    DS_FREE(data_set->pixels);
+  DS_FREE(data_set->labels);
+  DS_FREE(data_set);
+}
+
+void DS_DATA_set_print_memory(const DS_DATA_Set *const data_set) {
+  DS_PRINTF("Data set with %lu samples uses %.1f MiB of memory.\n",
+            data_set->count,
+            DS_DATA_memory_size(data_set->count, data_set->input_length) /
+                BYTES_PER_MIB);
+}
+
+void DS_DATA_load_input(const DS_DATA_Set *const data_set, const size_t index,
+                        DS_FLOAT *const input) {
+  DS_grey_to_inputs(&data_set->pixels[index * data_set->input_length], input,
+                    data_set->input_length);
+}
+
+DS_LabelledView DS_DATA_set_view(const DS_DATA_Set *const data_set,
+                                 const size_t first, const size_t count) {
+  DS_ASSERT(first <= data_set->count && count <= data_set->count - first,
+            "View of samples %lu to %lu is out of range, data set has %lu "
+            "samples.",
+            first, first + count, data_set->count);
+  return (DS_LabelledView){
+      .inputs = &data_set->pixels[first * data_set->input_length],
+      .input_stride = data_set->input_length,
+      .input_length = data_set->input_length,
+      .input_type = DS_DTYPE_U8,
+      .labels = &data_set->labels[first],
+      .count = count,
+  };
+}
+
+DS_Labelled_Inputs *
+DS_DATA_set_to_labelled_inputs(const DS_DATA_Set *const data_set,
+                               const size_t *const indexes, const size_t count,
+                               const DS_Network *const network) {
+  const size_t input_length = DS_network_input_layer_size(network);
+  const size_t output_length = DS_network_output_layer_size(network);
+  const size_t max_label = output_length - 1;
+
+  if (data_set->input_length != input_length) {
+    DS_ERROR("Data set input length does not fit network input size, must be "
+             "%lu but got %lu",
+             input_length, data_set->input_length);
+    return NULL;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    DS_ASSERT(indexes[i] < data_set->count,
+              "Sample index %lu is out of range, data set has %lu samples.",
+              indexes[i], data_set->count);
+    if (data_set->labels[indexes[i]] > max_label) {
+      DS_ERROR("Label of sample %lu is bigger than maximum label "
+               "representable by the number of outputs: %lu",
+               indexes[i], max_label);
+      return NULL;
+    }
+  }
+
+  DS_Labelled_Inputs *labelled_input = DS_MALLOC(sizeof(*labelled_input));
+  DS_ASSERT(labelled_input, "Could not create labelled inputs. Out of memory.");
+  labelled_input->inputs = DS_MALLOC(count * sizeof(labelled_input->inputs[0]));
+  labelled_input->labels = DS_MALLOC(count * sizeof(labelled_input->labels[0]));
+  DS_ASSERT(labelled_input->inputs && labelled_input->labels,
+            "Could not create labelled inputs. Out of memory.");
+  for (size_t i = 0; i < count; ++i) {
+    labelled_input->inputs[i] =
+        DS_MALLOC(input_length * sizeof(labelled_input->inputs[i][0]));
+    labelled_input->labels[i] =
+        DS_MALLOC(output_length * sizeof(labelled_input->labels[i][0]));
+    DS_ASSERT(labelled_input->inputs[i] && labelled_input->labels[i],
+              "Could not create labelled inputs. Out of memory.");
+    DS_DATA_load_input(data_set, indexes[i], labelled_input->inputs[i]);
+    DS_FILE_file_label_to_deepsea_label(data_set->labels[indexes[i]],
+                                        labelled_input->labels[i],
+                                        output_length);
+  }
+  labelled_input->count = count;
+  return labelled_input;
+}
@@ -0,0 +1,51 @@
+#ifndef DEEPSEA_DATA_H
+#define DEEPSEA_DATA_H
+
+#include "deepsea.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Decoded data set held in memory. All samples are stored back to back in
+/// one contiguous matrix with one row of `input_length` grey values (0-255)
+/// per sample. Labels are stored as class indices.
+typedef struct {
+  uint8_t *pixels; // count * input_length values in row-major order
+  uint16_t *labels;
+  size_t count;
+  size_t input_length;
+
+  // NOTE: Private, false if the pixels are borrowed from somewhere else
+  bool _owns_pixels;
+} DS_DATA_Set;
+
+/// Number of bytes a data set with the given dimensions occupies.
+size_t DS_DATA_memory_size(const size_t count, const size_t input_length);
+
+/// Create an empty data set. If pixels is NULL, memory for the pixels is
+/// allocated and owned by the data set, otherwise the data set borrows them
+/// and they must outlive it.
+DS_DATA_Set *DS_DATA_set_create(const size_t count, const size_t input_length,
+                                uint8_t *const pixels);
+
+void DS_DATA_set_free(DS_DATA_Set *const data_set);
+
+void DS_DATA_set_print_memory(const DS_DATA_Set *const data_set);
+
+/// Writes the pixels of sample `index` scaled to \[0, 1\] into `input`.
+void DS_DATA_load_input(const DS_DATA_Set *const data_set, const size_t index,
+                        DS_FLOAT *const input);
+
+/// View of `count` samples starting at sample `first`, without copying.
+/// Stays valid as long as the data set.
+DS_LabelledView DS_DATA_set_view(const DS_DATA_Set *const data_set,
+                                 const size_t first, const size_t count);
+
+/// Create labelled inputs for the given sample indexes. Returns NULL if the
+/// data set does not fit the network.
+DS_Labelled_Inputs *
+DS_DATA_set_to_labelled_inputs(const DS_DATA_Set *const data_set,
+                               const size_t *const indexes, const size_t count,
+                               const DS_Network *const network);
+
+#endif // DEEPSEA_DATA_H
@@ -0,0 +1,166 @@
+#include "deepsea_eval.h"
+#include <stdio.h>
+#include <string.h>
+
+// NOTE: Rows scored by one task, small enough that a batch keeps all workers
+// busy
+#define ROWS_PER_TASK 32
+#define MIN_COLUMN_WIDTH 6
+
+typedef struct {
+  DS_Inference *inference;
+  size_t *confusion; // Tallies of this worker, merged at the end
+  size_t predictions[ROWS_PER_TASK];
+} Worker;
+
+typedef struct {
+  Worker *workers;
+  size_t num_workers;
+  size_t num_classes;
+  const DS_LabelledView *batch;
+  // NOTE: Cost of every task of the batch, summed in task order such that
+  // the cost does not depend on the number of workers
+  DS_FLOAT *task_costs;
+  size_t max_tasks;
+} Scoring;
+
+static void score_task(void *const context, const size_t index,
+                       const size_t worker) {
+  Scoring *const scoring = context;
+  Worker *const w = &scoring->workers[worker];
+  const size_t first = index * ROWS_PER_TASK;
+  DS_LabelledView rows = *scoring->batch;
+  rows.inputs = (const uint8_t *)rows.inputs + first * rows.input_stride;
+  rows.labels += first;
+  rows.count = DS_MIN(ROWS_PER_TASK, scoring->batch->count - first);
+
+  scoring->task_costs[index] =
+      DS_inference_score_view(w->inference, &rows, w->predictions);
+  for (size_t i = 0; i < rows.count; ++i)
+    ++w->confusion[rows.labels[i] * scoring->num_classes + w->predictions[i]];
+}
+
+static void scoring_free(Scoring *const scoring) {
+  for (size_t w = 0; w < scoring->num_workers; ++w) {
+    DS_inference_free(scoring->workers[w].inference);
+    DS_FREE(scoring->workers[w].confusion);
+  }
+  DS_FREE(scoring->workers);
+  DS_FREE(scoring->task_costs);
+}
+
+static DS_EVAL_Result *result_create(const size_t num_classes) {
+  DS_EVAL_Result *result = DS_CALLOC(1, sizeof(*result));
+  DS_ASSERT(result, "Could not create evaluation. Out of memory.");
+  result->num_classes = num_classes;
+  result->confusion =
+      DS_CALLOC(num_classes * num_classes, sizeof(result->confusion[0]));
+  DS_ASSERT(result->confusion, "Could not create evaluation. Out of memory.");
+  return result;
+}
+
+DS_EVAL_Result *DS_EVAL_pipeline(DS_PIPELINE_Pipeline *const pipeline,
+                                 const DS_Network *const network,
+                                 const DS_CostFunctionType cost_function_type,
+                                 const DS_FLOAT regularization_param,
+                                 DS_THREAD_Pool *const pool) {
+  const size_t num_classes = DS_network_output_layer_size(network);
+  Scoring scoring = {
+      .num_workers = DS_THREAD_pool_size(pool),
+      .num_classes = num_classes,
+  };
+  scoring.workers =
+      DS_MALLOC(scoring.num_workers * sizeof(scoring.workers[0]));
+  DS_ASSERT(scoring.workers, "Could not create evaluation. Out of memory.");
+  for (size_t w = 0; w < scoring.num_workers; ++w) {
+    scoring.workers[w].inference =
+        DS_inference_create(network, cost_function_type, ROWS_PER_TASK);
+    scoring.workers[w].confusion = DS_CALLOC(
+        num_classes * num_classes, sizeof(scoring.workers[w].confusion[0]));
+    DS_ASSERT(scoring.workers[w].confusion,
+              "Could not create evaluation. Out of memory.");
+  }
+
+  size_t count = 0;
+  DS_FLOAT cost = 0;
+  DS_PIPELINE_start_epoch(pipeline);
+  while ((scoring.batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+    const size_t num_tasks =
+        (scoring.batch->count + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+    if (num_tasks > scoring.max_tasks) {
+      // NOTE: Only grows with the first batch, all batches are as large
+      scoring.task_costs = DS_REALLOC(
+          scoring.task_costs, num_tasks * sizeof(scoring.task_costs[0]));
+      DS_ASSERT(scoring.task_costs,
+                "Could not create evaluation. Out of memory.");
+      scoring.max_tasks = num_tasks;
+    }
+    DS_THREAD_pool_for(pool, num_tasks, &score_task, &scoring);
+    for (size_t t = 0; t < num_tasks; ++t)
+      cost += scoring.task_costs[t];
+    count += scoring.batch->count;
+    DS_PIPELINE_release_batch(pipeline, scoring.batch);
+  }
+  if (DS_PIPELINE_failed(pipeline)) {
+    scoring_free(&scoring);
+    return NULL;
+  }
+
+  DS_EVAL_Result *result = result_create(num_classes);
+  for (size_t w = 0; w < scoring.num_workers; ++w)
+    for (size_t i = 0; i < num_classes * num_classes; ++i)
+      result->confusion[i] += scoring.workers[w].confusion[i];
+  for (size_t c = 0; c < num_classes; ++c)
+    result->correct += result->confusion[c * num_classes + c];
+  result->count = count;
+  if (count > 0)
+    result->cost = (cost + regularization_param *
+                               DS_network_regularization_cost(network)) /
+                   (DS_FLOAT)count;
+  scoring_free(&scoring);
+  return result;
+}
+
+void DS_EVAL_result_free(DS_EVAL_Result *const result) {
+  DS_FREE(result->confusion);
+  DS_FREE(result);
+}
+
+double DS_EVAL_accuracy(const DS_EVAL_Result *const result) {
+  return result->count ? (double)result->correct / (double)result->count : 0.;
+}
+
+static void print_class_name(const DS_Network *const network,
+                             const size_t index, const int width) {
+  const char *const label = DS_network_output_label(network, index);
+  if (label)
+    DS_PRINTF(" %*.*s", width, width, label);
+  else
+    DS_PRINTF(" %*lu", width, index);
+}
+
+void DS_EVAL_print_result(const DS_EVAL_Result *const result,
+                          const DS_Network *const network) {
+  DS_PRINTF("Correctly predicted %lu of %lu samples (%.1f%%).\n",
+            result->correct, result->count,
+            100. * DS_EVAL_accuracy(result));
+  DS_PRINTF("Cost of network for testing set: %.4f\n", result->cost);
+
+  const size_t n = result->num_classes;
+  size_t max_cell = 0;
+  for (size_t i = 0; i < n * n; ++i)
+    max_cell = DS_MAX(max_cell, result->confusion[i]);
+  const int digits = snprintf(NULL, 0, "%lu", max_cell);
+  const int width = DS_MAX(digits, MIN_COLUMN_WIDTH);
+  DS_PRINTF("Confusion matrix (rows are labels, columns predictions):\n");
+  DS_PRINTF("%*s", width + 1, "");
+  for (size_t j = 0; j < n; ++j)
+    print_class_name(network, j, width);
+  DS_PRINTF("\n");
+  for (size_t i = 0; i < n; ++i) {
+    print_class_name(network, i, width);
+    for (size_t j = 0; j < n; ++j)
+      DS_PRINTF(" %*lu", width, result->confusion[i * n + j]);
+    DS_PRINTF("\n");
+  }
+}
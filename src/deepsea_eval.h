@@ -0,0 +1,38 @@
+#ifndef DEEPSEA_EVAL_H
+#define DEEPSEA_EVAL_H
+
+#include "deepsea.h"
+#include "deepsea_pipeline.h"
+#include "deepsea_thread.h"
+#include <stddef.h>
+
+/// How well a network classifies a labelled test set.
+typedef struct {
+  size_t count;       // Number of evaluated samples
+  size_t correct;     // Samples whose most active output is their label
+  DS_FLOAT cost;      // Normalized like DS_backprop_network_cost_view
+  size_t num_classes; // Number of outputs of the network
+  size_t *confusion;  // Samples of label i predicted as j at i * classes + j
+} DS_EVAL_Result;
+
+/// Evaluates the network on one epoch of a pipeline. The test set is
+/// streamed batch by batch, so the memory used does not depend on its size.
+/// The rows of every batch are scored in parallel on the pool, every worker
+/// with its own DS_Inference. Returns NULL if a sample could not be loaded.
+DS_EVAL_Result *DS_EVAL_pipeline(DS_PIPELINE_Pipeline *const pipeline,
+                                 const DS_Network *const network,
+                                 const DS_CostFunctionType cost_function_type,
+                                 const DS_FLOAT regularization_param,
+                                 DS_THREAD_Pool *const pool);
+
+void DS_EVAL_result_free(DS_EVAL_Result *const result);
+
+/// Share of correctly classified samples in \[0, 1\].
+double DS_EVAL_accuracy(const DS_EVAL_Result *const result);
+
+/// Prints the accuracy, the cost and the confusion matrix, whose rows are
+/// the labels and whose columns are the predictions.
+void DS_EVAL_print_result(const DS_EVAL_Result *const result,
+                          const DS_Network *const network);
+
+#endif // DEEPSEA_EVAL_H
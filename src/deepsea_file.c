@@ -1,93 +1,337 @@
 #include "deepsea_file.h"
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-static void fill_file_list(const char *const dir_path,
-                           DS_FILE_FileList *const file_list) {
-  DIR *dir = opendir(dir_path);
-  if (!dir) {
-    DS_FPRINTF(stderr, "Could not open directory \"%s\": %s\n", dir_path,
-               strerror(errno));
+#if defined(__linux__)
+#include <sys/syscall.h>
+
+typedef struct {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+} LinuxDirent64;
+#endif
+
+// NOTE: Large enough for a few hundred entries per syscall
+#define DIRECTORY_BUFFER_SIZE (64 * 1024)
+#define INITIAL_ARENA_CAPACITY 4096
+#define INITIAL_OFFSETS_CAPACITY 256
+
+/// Paths stored back to back in one string arena. Paths are referenced by
+/// their offset, as the arena moves when it grows.
+typedef struct {
+  char *arena;
+  size_t size;
+  size_t capacity;
+  size_t *offsets;
+  size_t count;
+  size_t offsets_capacity;
+} PathArena;
+
+/// Files a worker found in one directory
+typedef struct {
+  size_t first; // Index of the first file, in the list of the worker
+  size_t count;
+  size_t dir_length;
+  char **paths; // First path, set once the lists are merged
+} DirectoryRange;
+
+typedef struct {
+  PathArena files; // Files found by this worker
+  DirectoryRange *ranges;
+  size_t num_ranges;
+  size_t ranges_capacity;
+  char *entries; // Directory entry buffer
+  char path[DS_FILE_MAX_PATH_LENGTH];
+} ScanWorker;
+
+typedef struct {
+  ScanWorker *workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_available;
+  PathArena directories; // Stack of directories still to be read
+  size_t busy_workers;   // Workers currently reading a directory
+} Scan;
+
+/// Appends a path with geometric growth, so n paths cost O(n) copying.
+/// NOTE: DS_REALLOC does not have to be thread-safe, so workers must hold the
+/// scan mutex while calling this. It is rarely contended as growth is rare.
+static void path_arena_push(PathArena *const paths, const char *const path,
+                            const size_t length) {
+  if (paths->size + length + 1 > paths->capacity) {
+    paths->capacity = DS_MAX(
+        2 * paths->capacity,
+        DS_MAX(paths->size + length + 1, (size_t)INITIAL_ARENA_CAPACITY));
+    paths->arena = DS_REALLOC(paths->arena, paths->capacity);
+    DS_ASSERT(paths->arena, "Could not load all files. Out of memory.");
+  }
+  if (paths->count == paths->offsets_capacity) {
+    paths->offsets_capacity = DS_MAX(2 * paths->offsets_capacity,
+                                     (size_t)INITIAL_OFFSETS_CAPACITY);
+    paths->offsets = DS_REALLOC(
+        paths->offsets, paths->offsets_capacity * sizeof(paths->offsets[0]));
+    DS_ASSERT(paths->offsets, "Could not load all files. Out of memory.");
+  }
+  paths->offsets[paths->count++] = paths->size;
+  memcpy(paths->arena + paths->size, path, length + 1);
+  paths->size += length + 1;
+}
+
+static bool path_arena_has_room(const PathArena *const paths,
+                                const size_t length) {
+  return paths->size + length + 1 <= paths->capacity &&
+         paths->count < paths->offsets_capacity;
+}
+
+static void path_arena_free(PathArena *const paths) {
+  DS_FREE(paths->arena);
+  DS_FREE(paths->offsets);
+}
+
+static void add_file(Scan *const scan, ScanWorker *const worker,
+                     const size_t length) {
+  if (path_arena_has_room(&worker->files, length)) {
+    path_arena_push(&worker->files, worker->path, length);
+  } else {
+    pthread_mutex_lock(&scan->mutex);
+    path_arena_push(&worker->files, worker->path, length);
+    pthread_mutex_unlock(&scan->mutex);
+  }
+}
+
+static void add_directory(Scan *const scan, const char *const path,
+                          const size_t length) {
+  pthread_mutex_lock(&scan->mutex);
+  path_arena_push(&scan->directories, path, length);
+  pthread_cond_signal(&scan->work_available);
+  pthread_mutex_unlock(&scan->mutex);
+}
+
+/// Handles one directory entry, following symbolic links like stat does.
+static void scan_entry(Scan *const scan, ScanWorker *const worker,
+                       const size_t dir_length, const char *const name,
+                       unsigned char type) {
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    return;
+  const size_t length = dir_length + 1 + strlen(name);
+  if (length + 1 > DS_FILE_MAX_PATH_LENGTH) {
+    worker->path[dir_length] = '\0';
+    DS_ERROR("File path for file \"%s/%s\" is longer than %d. Skipping...",
+             worker->path, name, DS_FILE_MAX_PATH_LENGTH);
     return;
   }
+  worker->path[dir_length] = '/';
+  memcpy(worker->path + dir_length + 1, name, length - dir_length);
 
-  struct dirent *entry;
-  while ((entry = readdir(dir)) != NULL) {
-    // Construct the full path of the entry
-    const size_t path_length = strlen(dir_path) + strlen(entry->d_name) +
-                               2; // Null terminating plus slash
-    if (path_length > DS_FILE_MAX_PATH_LENGTH) {
-      DS_ERROR("File path for file \"%s/%s\" is longer than %d. Skipping...",
-               dir_path, entry->d_name, DS_FILE_MAX_PATH_LENGTH);
-      continue;
+  if (type == DT_LNK || type == DT_UNKNOWN) {
+    struct stat path_stat;
+    if (stat(worker->path, &path_stat) == -1) {
+      DS_ERROR("Could not get file info for \"%s\": %s. Skipping...",
+               worker->path, strerror(errno));
+      return;
     }
-    char full_path[DS_FILE_MAX_PATH_LENGTH];
-    sprintf(full_path, "%s/%s", dir_path, entry->d_name);
-
-    if (entry->d_type == DT_REG) {
-      file_list->paths = (char **)DS_REALLOC(
-          file_list->paths, (file_list->count + 1) * sizeof(char *));
-      DS_ASSERT(file_list->paths, "Could not load all files. Out of memory.");
-      file_list->paths[file_list->count] = (char *)DS_MALLOC(path_length);
-      DS_ASSERT(file_list->paths[file_list->count],
-                "Could not load all files. Out of memory.");
-      strcpy(file_list->paths[file_list->count], full_path);
-      file_list->count++;
-    } else if (entry->d_type == DT_LNK) {
-
-      // Use lstat to get information about the file
-      struct stat path_stat;
-      if (stat(full_path, &path_stat) == -1) {
-        DS_ERROR("Could not get file info for \"%s\": %s. Skipping...",
-                 full_path, strerror(errno));
-        continue;
-      }
-
-      if (S_ISDIR(path_stat.st_mode)) {
-        fill_file_list(full_path, file_list);
-      } else {
-        file_list->paths = (char **)DS_REALLOC(
-            file_list->paths, (file_list->count + 1) * sizeof(char *));
-        DS_ASSERT(file_list->paths, "Could not load all files. Out of memory.");
-        file_list->paths[file_list->count] = (char *)DS_MALLOC(path_length);
-        DS_ASSERT(file_list->paths[file_list->count],
-                  "Could not load all files. Out of memory.");
-        strcpy(file_list->paths[file_list->count], full_path);
-        file_list->count++;
-      }
+    type = S_ISDIR(path_stat.st_mode) ? DT_DIR : DT_REG;
+  }
+  if (type == DT_REG)
+    add_file(scan, worker, length);
+  else if (type == DT_DIR)
+    add_directory(scan, worker->path, length);
+}
 
+/// Reads all entries of the directory in worker->path.
+static void scan_directory(Scan *const scan, ScanWorker *const worker) {
+  const size_t dir_length = strlen(worker->path);
+#if defined(__linux__)
+  // NOTE: getdents64 fetches many entries per syscall, readdir may not
+  const int fd = open(worker->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    DS_ERROR("Could not open directory \"%s\": %s", worker->path,
+             strerror(errno));
+    return;
+  }
+  while (1) {
+    const long read =
+        syscall(SYS_getdents64, fd, worker->entries, DIRECTORY_BUFFER_SIZE);
+    if (read < 0) {
+      worker->path[dir_length] = '\0';
+      DS_ERROR("Could not read directory \"%s\": %s", worker->path,
+               strerror(errno));
+      break;
     }
+    if (read == 0)
+      break;
+    for (long position = 0; position < read;) {
+      const LinuxDirent64 *const entry =
+          (const LinuxDirent64 *)(worker->entries + position);
+      scan_entry(scan, worker, dir_length, entry->d_name, entry->d_type);
+      position += entry->d_reclen;
+    }
+  }
+  close(fd);
+#else
+  DIR *dir = opendir(worker->path);
+  if (!dir) {
+    DS_ERROR("Could not open directory \"%s\": %s", worker->path,
+             strerror(errno));
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+    scan_entry(scan, worker, dir_length, entry->d_name, entry->d_type);
+  closedir(dir);
+#endif
+}
+
+/// NOTE: Must be called with the scan mutex held, see path_arena_push
+static void add_range(ScanWorker *const worker, const DirectoryRange range) {
+  if (worker->num_ranges == worker->ranges_capacity) {
+    worker->ranges_capacity = DS_MAX(2 * worker->ranges_capacity,
+                                     (size_t)INITIAL_OFFSETS_CAPACITY);
+    worker->ranges = DS_REALLOC(
+        worker->ranges, worker->ranges_capacity * sizeof(worker->ranges[0]));
+    DS_ASSERT(worker->ranges, "Could not load all files. Out of memory.");
+  }
+  worker->ranges[worker->num_ranges++] = range;
+}
+
+/// Every worker takes directories from the shared stack until it is empty
+/// and no other worker can push new ones anymore.
+static void scan_task(void *const context, const size_t index,
+                      const size_t worker_index) {
+  (void)index;
+  Scan *const scan = context;
+  ScanWorker *const worker = &scan->workers[worker_index];
 
-    else if (entry->d_type == DT_DIR) { // Check if the entry is a directory
-      // Skip "." and ".." to avoid infinite recursion
-      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-        // Recursively get files in the subdirectory
-        fill_file_list(full_path, file_list);
-      }
+  pthread_mutex_lock(&scan->mutex);
+  while (1) {
+    while (scan->directories.count == 0 && scan->busy_workers > 0)
+      pthread_cond_wait(&scan->work_available, &scan->mutex);
+    if (scan->directories.count == 0)
+      break;
+    PathArena *const directories = &scan->directories;
+    const size_t offset = directories->offsets[--directories->count];
+    strcpy(worker->path, directories->arena + offset);
+    directories->size = offset;
+    ++scan->busy_workers;
+    pthread_mutex_unlock(&scan->mutex);
+
+    const size_t first = worker->files.count;
+    const size_t dir_length = strlen(worker->path);
+    scan_directory(scan, worker);
+
+    pthread_mutex_lock(&scan->mutex);
+    if (worker->files.count > first) {
+      add_range(worker, (DirectoryRange){.first = first,
+                                         .count = worker->files.count - first,
+                                         .dir_length = dir_length});
     }
+    --scan->busy_workers;
+    if (scan->busy_workers == 0 && scan->directories.count == 0)
+      pthread_cond_broadcast(&scan->work_available);
   }
+  pthread_mutex_unlock(&scan->mutex);
+}
 
-  closedir(dir);
+static int compare_directories(const void *const a, const void *const b) {
+  const DirectoryRange *const range_a = a;
+  const DirectoryRange *const range_b = b;
+  const int order =
+      memcmp(range_a->paths[0], range_b->paths[0],
+             DS_MIN(range_a->dir_length, range_b->dir_length));
+  if (order != 0)
+    return order;
+  return (range_a->dir_length > range_b->dir_length) -
+         (range_a->dir_length < range_b->dir_length);
 }
 
-DS_FILE_FileList *DS_FILE_get_files(const char *const dir_path) {
+DS_FILE_FileList *DS_FILE_get_files(const char *const dir_path,
+                                    DS_THREAD_Pool *const pool) {
+  const size_t num_workers = DS_THREAD_pool_size(pool);
+  Scan scan = {0};
+  scan.workers = DS_CALLOC(num_workers, sizeof(scan.workers[0]));
+  DS_ASSERT(scan.workers, "Could not load all files. Out of memory.");
+  for (size_t w = 0; w < num_workers; ++w) {
+    scan.workers[w].entries = DS_MALLOC(DIRECTORY_BUFFER_SIZE);
+    DS_ASSERT(scan.workers[w].entries,
+              "Could not load all files. Out of memory.");
+  }
+  pthread_mutex_init(&scan.mutex, NULL);
+  pthread_cond_init(&scan.work_available, NULL);
+  const size_t dir_length = strlen(dir_path);
+  if (dir_length + 1 > DS_FILE_MAX_PATH_LENGTH)
+    DS_ERROR("Directory path \"%s\" is longer than %d.", dir_path,
+             DS_FILE_MAX_PATH_LENGTH);
+  else
+    path_arena_push(&scan.directories, dir_path, dir_length);
+
+  // NOTE: One loop index per worker, each one runs until all work is done
+  DS_THREAD_pool_for(pool, num_workers, &scan_task, &scan);
+
   DS_FILE_FileList *file_list =
       DS_CALLOC(1, sizeof(*file_list)); // Sets file count to 0
   DS_ASSERT(file_list, "Could not create file list. Out of memory.");
-  fill_file_list(dir_path, file_list);
+  size_t arena_size = 0;
+  size_t num_ranges = 0;
+  for (size_t w = 0; w < num_workers; ++w) {
+    file_list->count += scan.workers[w].files.count;
+    arena_size += scan.workers[w].files.size;
+    num_ranges += scan.workers[w].num_ranges;
+  }
+  char **unsorted = DS_MALLOC(DS_MAX(file_list->count, 1) * sizeof(char *));
+  DirectoryRange *ranges = DS_MALLOC(DS_MAX(num_ranges, 1) * sizeof(*ranges));
+  file_list->paths = DS_MALLOC(DS_MAX(file_list->count, 1) * sizeof(char *));
+  file_list->_arena = DS_MALLOC(DS_MAX(arena_size, 1));
+  DS_ASSERT(unsorted && ranges && file_list->paths && file_list->_arena,
+            "Could not create file list. Out of memory.");
+  for (size_t w = 0, i = 0, r = 0, position = 0; w < num_workers; ++w) {
+    ScanWorker *const worker = &scan.workers[w];
+    memcpy(file_list->_arena + position, worker->files.arena,
+           worker->files.size);
+    for (size_t k = 0; k < worker->num_ranges; ++k) {
+      ranges[r] = worker->ranges[k];
+      ranges[r++].paths = &unsorted[i + worker->ranges[k].first];
+    }
+    for (size_t f = 0; f < worker->files.count; ++f)
+      unsorted[i++] = file_list->_arena + position + worker->files.offsets[f];
+    position += worker->files.size;
+    path_arena_free(&worker->files);
+    DS_FREE(worker->ranges);
+    DS_FREE(worker->entries);
+  }
+
+  // NOTE: Which worker reads which directory depends on the thread timing,
+  // the order within a directory does not. Sorting the directories makes the
+  // result reproducible without sorting every path.
+  qsort(ranges, num_ranges, sizeof(ranges[0]), &compare_directories);
+  for (size_t r = 0, i = 0; r < num_ranges; ++r) {
+    memcpy(&file_list->paths[i], ranges[r].paths,
+           ranges[r].count * sizeof(char *));
+    i += ranges[r].count;
+  }
+  DS_FREE(ranges);
+  DS_FREE(unsorted);
+
+  pthread_cond_destroy(&scan.work_available);
+  pthread_mutex_destroy(&scan.mutex);
+  path_arena_free(&scan.directories);
+  DS_FREE(scan.workers);
   return file_list;
 }
 
 void DS_FILE_file_list_free(DS_FILE_FileList *const file_list) {
-  for (size_t i = 0; i < file_list->count; ++i) {
-    DS_FREE(file_list->paths[i]);
-  }
+  DS_FREE(file_list->labels);
+  DS_FREE(file_list->_arena);
   DS_FREE(file_list->paths);
-
   DS_FREE(file_list);
 }
 
@@ -105,8 +349,7 @@ void DS_FILE_file_list_print_labelled(const DS_FILE_FileList *const file_list,
 
   const size_t stop = file_list->count > cut ? cut : file_list->count;
   for (size_t i = 0; i < stop; ++i)
-    DS_PRINTF("%7lu: %s\n",
-              DS_FILE_get_label_from_directory_name(file_list->paths[i]),
+    DS_PRINTF("%7lu: %s\n", DS_FILE_file_list_label(file_list, i),
               file_list->paths[i]);
 }
 
@@ -149,83 +392,227 @@ size_t DS_FILE_get_label_from_directory_name(const char *const file_path) {
   return label;
 }
 
+size_t DS_FILE_file_list_label(const DS_FILE_FileList *const file_list,
+                               const size_t index) {
+  if (file_list->labels) {
+    errno = 0;
+    return file_list->labels[index];
+  }
+  return DS_FILE_get_label_from_directory_name(file_list->paths[index]);
+}
+
 void DS_FILE_file_label_to_deepsea_label(size_t file_label,
                                          DS_FLOAT *deepsea_label,
                                          const size_t num_outputs) {
-  for (size_t i = 0; i < num_outputs; i++) {
-    // Set the current bit in the array (0 or 1)
-    deepsea_label[i] = (DS_FLOAT)(file_label & 1);
-    file_label >>= 1;
-  }
+  DS_label_to_outputs(file_label, deepsea_label, num_outputs);
 }
 
-static void shuffle(size_t *shuffled, size_t length) {
-  for (size_t i = 0, j = 0, k = 0, aux = 0; i < length; ++i) {
-    do {
-      j = rand() % length;
-      k = rand() % length;
-    } while (j == k);
+/// SplitMix64, a small generator whose whole state is one word. Every
+/// iterator owns its state, so iterators do not share rand()'s global state.
+static uint64_t splitmix64(uint64_t *const state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
 
-    aux = shuffled[j];
-    shuffled[j] = shuffled[k];
-    shuffled[k] = aux;
+/// Fisher-Yates shuffle of values\[0..length)
+static void shuffle(size_t *const values, const size_t length,
+                    uint64_t *const state) {
+  for (size_t i = length; i > 1; --i) {
+    const size_t j = (size_t)(splitmix64(state) % i);
+    const size_t aux = values[i - 1];
+    values[i - 1] = values[j];
+    values[j] = aux;
   }
 }
 
-static void shuffelled_indexes(size_t *indexes, size_t length) {
+struct DS_BatchIterator {
+  size_t *indexes; // Permutation of all samples of the current epoch
+  size_t count;
+  size_t batch_size;
+  uint64_t seed;
+  size_t epoch; // Number of started epochs
 
-  for (size_t i = 0; i < length; ++i) {
-    indexes[i] = i;
-  }
+  size_t block_size; // 0 or 1 for a full shuffle
+  size_t window;     // Blocks whose samples are mixed
+  size_t *blocks;    // Block permutation of the current epoch
+
+  // NOTE: Every shard shuffles all samples the same way and takes its slice
+  size_t shard_start;
+  size_t shard_end;
+
+  bool running;
+  size_t next_batch; // Of DS_batch_iterator_next
 
-  shuffle(indexes, length);
+  // NOTE: Reused by DS_batch_iterator_next_files
+  DS_FILE_FileList files;
+  size_t *labels;
+};
+
+uint64_t DS_batch_iterator_random_seed(void) {
+  DS_init_rand(-1);
+  return ((uint64_t)rand() << 32) ^ (uint64_t)rand();
 }
 
-static size_t *_random_file_array_indexes = NULL;
-static size_t _current_random_bucket_count = 0;
-static DS_FILE_FileList _current_random_file_list = {0};
-DS_FILE_FileList *
-DS_FILE_get_random_bucket(const DS_FILE_FileList *const file_list,
-                          const size_t max_count) {
-  if (_current_random_bucket_count ==
-      0) { // This gets reset when we drained a full file list
-    DS_init_rand(-1);
-    _random_file_array_indexes =
-        DS_MALLOC(file_list->count * sizeof(_random_file_array_indexes[0]));
-    DS_ASSERT(_random_file_array_indexes,
-              "Could not create random file array. Out of memory.");
-    shuffelled_indexes(_random_file_array_indexes, file_list->count);
-  }
+DS_BatchIterator *DS_batch_iterator_create(const size_t count,
+                                           const size_t batch_size,
+                                           const uint64_t seed) {
+  return DS_batch_iterator_create_sharded(count, batch_size, seed, 0, 1);
+}
 
-  const size_t start = _current_random_bucket_count;
-  size_t stop = _current_random_bucket_count + max_count;
-  if (stop > file_list->count)
-    stop = file_list->count;
+DS_BatchIterator *
+DS_batch_iterator_create_sharded(const size_t count, const size_t batch_size,
+                                 const uint64_t seed, const size_t shard,
+                                 const size_t num_shards) {
+  DS_ASSERT(batch_size > 0, "Batch size must be positive.");
+  DS_ASSERT(shard < num_shards, "Shard %lu does not exist.", shard);
+  DS_BatchIterator *iterator = DS_CALLOC(1, sizeof(*iterator));
+  DS_ASSERT(iterator, "Could not create batch iterator. Out of memory.");
+  iterator->indexes = DS_MALLOC(DS_MAX(count, 1) * sizeof(size_t));
+  DS_ASSERT(iterator->indexes,
+            "Could not create batch iterator. Out of memory.");
+  iterator->count = count;
+  iterator->batch_size = batch_size;
+  iterator->seed = seed;
+  iterator->shard_start = count * shard / num_shards;
+  iterator->shard_end = count * (shard + 1) / num_shards;
+  return iterator;
+}
 
-  if (_current_random_file_list.paths) {
-    DS_FREE(_current_random_file_list.paths);
-    _current_random_file_list.paths = NULL;
+void DS_batch_iterator_free(DS_BatchIterator *const iterator) {
+  if (!iterator)
+    return;
+  DS_FREE(iterator->files.paths);
+  DS_FREE(iterator->labels);
+  DS_FREE(iterator->blocks);
+  DS_FREE(iterator->indexes);
+  DS_FREE(iterator);
+}
+
+uint64_t DS_batch_iterator_seed(const DS_BatchIterator *const iterator) {
+  return iterator->seed;
+}
+
+void DS_batch_iterator_seek(DS_BatchIterator *const iterator,
+                            const uint64_t seed, const size_t epoch) {
+  iterator->seed = seed;
+  iterator->epoch = epoch;
+  iterator->running = false;
+}
+
+void DS_batch_iterator_set_block_shuffle(DS_BatchIterator *const iterator,
+                                         const size_t block_size,
+                                         const size_t window) {
+  DS_ASSERT(window > 0, "Shuffle window must be at least one block.");
+  iterator->block_size = block_size;
+  iterator->window = window;
+  DS_FREE(iterator->blocks);
+  iterator->blocks = NULL;
+}
+
+/// Shuffles the order of the blocks of block_size consecutive samples and
+/// then the samples within every window of consecutive blocks of that order.
+/// Every sample still appears once per epoch, but a minibatch only touches
+/// about `window` contiguous regions of the data instead of one random
+/// location per sample.
+static void block_shuffle(DS_BatchIterator *const iterator,
+                          uint64_t *const state) {
+  const size_t count = iterator->count;
+  const size_t block_size = iterator->block_size;
+  const size_t num_blocks = (count + block_size - 1) / block_size;
+  if (!iterator->blocks) {
+    iterator->blocks =
+        DS_MALLOC(DS_MAX(num_blocks, 1) * sizeof(iterator->blocks[0]));
+    DS_ASSERT(iterator->blocks, "Could not shuffle blocks. Out of memory.");
   }
+  for (size_t b = 0; b < num_blocks; ++b)
+    iterator->blocks[b] = b;
+  shuffle(iterator->blocks, num_blocks, state);
 
-  if (stop <= start) {
-    _current_random_bucket_count = 0;
-    DS_FREE(_random_file_array_indexes);
-    _random_file_array_indexes = NULL;
-    return NULL;
+  for (size_t b = 0, position = 0; b < num_blocks; ++b) {
+    const size_t first = iterator->blocks[b] * block_size;
+    const size_t stop = DS_MIN(first + block_size, count);
+    for (size_t i = first; i < stop; ++i)
+      iterator->indexes[position++] = i;
   }
+  const size_t window_length = block_size * iterator->window;
+  for (size_t start = 0; start < count; start += window_length)
+    shuffle(&iterator->indexes[start], DS_MIN(window_length, count - start),
+            state);
+}
 
-  const size_t count = stop - start; // we know this is at least 1
+void DS_batch_iterator_start_epoch(DS_BatchIterator *const iterator) {
+  // NOTE: The permutation only depends on the seed and the epoch, such that
+  // the shards of one seed agree on it without talking to each other
+  uint64_t state = iterator->seed ^ (iterator->epoch * 0xd1b54a32d192ed03ull);
+  if (iterator->block_size > 1) {
+    block_shuffle(iterator, &state);
+  } else {
+    for (size_t i = 0; i < iterator->count; ++i)
+      iterator->indexes[i] = i;
+    shuffle(iterator->indexes, iterator->count, &state);
+  }
+  ++iterator->epoch;
+  iterator->running = true;
+  iterator->next_batch = 0;
+}
 
-  _current_random_file_list.paths =
-      DS_MALLOC(count * sizeof(_current_random_file_list.paths));
-  DS_ASSERT(_current_random_file_list.paths,
-            "Could not get new random bucket. Out of memory.");
+size_t DS_batch_iterator_num_batches(const DS_BatchIterator *const iterator) {
+  const size_t length = iterator->shard_end - iterator->shard_start;
+  return (length + iterator->batch_size - 1) / iterator->batch_size;
+}
+
+size_t DS_batch_iterator_batch(const DS_BatchIterator *const iterator,
+                               const size_t batch_index,
+                               const size_t **const indexes) {
+  DS_ASSERT(batch_index < DS_batch_iterator_num_batches(iterator),
+            "Batch %lu is out of range.", batch_index);
+  const size_t start =
+      iterator->shard_start + batch_index * iterator->batch_size;
+  *indexes = &iterator->indexes[start];
+  return DS_MIN(iterator->batch_size, iterator->shard_end - start);
+}
 
-  for (size_t i = start, j = 0; i < stop; ++i, ++j) {
-    _current_random_file_list.paths[j] =
-        file_list->paths[_random_file_array_indexes[i]];
+size_t DS_batch_iterator_next(DS_BatchIterator *const iterator,
+                              const size_t **const indexes) {
+  if (!iterator->running)
+    DS_batch_iterator_start_epoch(iterator);
+  if (iterator->next_batch == DS_batch_iterator_num_batches(iterator)) {
+    iterator->running = false;
+    *indexes = NULL;
+    return 0;
+  }
+  return DS_batch_iterator_batch(iterator, iterator->next_batch++, indexes);
+}
+
+const DS_FILE_FileList *
+DS_batch_iterator_next_files(DS_BatchIterator *const iterator,
+                             const DS_FILE_FileList *const file_list) {
+  DS_ASSERT(file_list->count == iterator->count,
+            "File list does not match the batch iterator.");
+  const size_t *indexes = NULL;
+  const size_t count = DS_batch_iterator_next(iterator, &indexes);
+  if (count == 0)
+    return NULL;
+
+  DS_FILE_FileList *const files = &iterator->files;
+  if (!files->paths) {
+    files->paths = DS_MALLOC(iterator->batch_size * sizeof(files->paths[0]));
+    DS_ASSERT(files->paths, "Could not get next batch. Out of memory.");
+  }
+  if (file_list->labels && !iterator->labels) {
+    iterator->labels =
+        DS_MALLOC(iterator->batch_size * sizeof(iterator->labels[0]));
+    DS_ASSERT(iterator->labels, "Could not get next batch. Out of memory.");
+  }
+  for (size_t i = 0; i < count; ++i) {
+    files->paths[i] = file_list->paths[indexes[i]];
+    if (file_list->labels)
+      iterator->labels[i] = file_list->labels[indexes[i]];
   }
-  _current_random_file_list.count = count;
-  _current_random_bucket_count += count;
-  return &_current_random_file_list;
+  // NOTE: Without labels of the list, they are read from the paths
+  files->labels = file_list->labels ? iterator->labels : NULL;
+  files->count = count;
+  return files;
 }
@@ -2,22 +2,39 @@
 #define DEEPSEE_FILE_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include "deepsea.h"
+#include "deepsea_thread.h"
 
 #define DS_FILE_MAX_PATH_LENGTH 1024
 
 typedef struct {
   char **paths;
   size_t count;
+  size_t *labels; // NULL if the labels are given by the directory names
+
+  // NOTE: Private, all paths of a scanned list are stored in here
+  char *_arena;
 } DS_FILE_FileList;
 
 size_t DS_FILE_get_label_from_directory_name(const char *const file_path);
 
+/// Label of file `index` of the list. Like
+/// DS_FILE_get_label_from_directory_name, errno is set on failure.
+size_t DS_FILE_file_list_label(const DS_FILE_FileList *const file_list,
+                               const size_t index);
+
+/// One-hot encodes a file label, see DS_label_to_outputs.
 void DS_FILE_file_label_to_deepsea_label(size_t file_label,
                                          DS_FLOAT *deepsea_label,
                                          const size_t num_outputs);
 
-DS_FILE_FileList *DS_FILE_get_files(const char *const dir_path);
+/// Recursively collects all files below dir_path, following symbolic links.
+/// Subdirectories are read in parallel if a pool is given. The directories
+/// are sorted by path and the files of a directory keep the order in which
+/// the file system lists them, so the result does not depend on the walk.
+DS_FILE_FileList *DS_FILE_get_files(const char *const dir_path,
+                                    DS_THREAD_Pool *const pool);
 
 void DS_FILE_file_list_free(DS_FILE_FileList *const file_list);
 
@@ -27,8 +44,72 @@ void DS_FILE_file_list_print(const DS_FILE_FileList *const file_list);
 void DS_FILE_file_list_print_labelled(const DS_FILE_FileList *const file_list,
                                       const size_t cut);
 
-DS_FILE_FileList *
-DS_FILE_get_random_bucket(const DS_FILE_FileList *const file_list,
-                          const size_t max_count);
+/// Iterates over the minibatches of a data set of `count` samples in a new
+/// random order every epoch. An iterator owns its permutation, its random
+/// state and its batch buffers, so any number of iterators can be used at the
+/// same time, e.g. one for training and one for validation.
+typedef struct DS_BatchIterator DS_BatchIterator;
+
+/// A seed from the process wide random state, see DS_init_rand.
+uint64_t DS_batch_iterator_random_seed(void);
+
+DS_BatchIterator *DS_batch_iterator_create(const size_t count,
+                                           const size_t batch_size,
+                                           const uint64_t seed);
+
+/// Iterator over the shard `shard` of `num_shards`. Iterators of all shards
+/// created with the same seed see disjoint slices of the same permutation
+/// every epoch, which together cover all samples once.
+DS_BatchIterator *
+DS_batch_iterator_create_sharded(const size_t count, const size_t batch_size,
+                                 const uint64_t seed, const size_t shard,
+                                 const size_t num_shards);
+
+void DS_batch_iterator_free(DS_BatchIterator *const iterator);
+
+uint64_t DS_batch_iterator_seed(const DS_BatchIterator *const iterator);
+
+/// Continue with the sample order of another seed: the next epoch that is
+/// started is epoch `epoch` (counted from 0) of the iterators of that seed.
+/// Used to resume an interrupted training run.
+void DS_batch_iterator_seek(DS_BatchIterator *const iterator,
+                            const uint64_t seed, const size_t epoch);
+
+#define DS_BATCH_ITERATOR_DEFAULT_WINDOW 16
+
+/// Trade randomness for locality in data sets larger than the caches: from
+/// the next epoch on, contiguous blocks of block_size samples are shuffled
+/// and then the samples within each window of `window` consecutive blocks.
+/// Larger blocks and smaller windows give more locality, a block_size of 0 or
+/// 1 restores the full shuffle.
+void DS_batch_iterator_set_block_shuffle(DS_BatchIterator *const iterator,
+                                         const size_t block_size,
+                                         const size_t window);
+
+/// Shuffle the samples for the next epoch. The permutation only depends on
+/// the seed and the number of the epoch.
+void DS_batch_iterator_start_epoch(DS_BatchIterator *const iterator);
+
+/// Number of batches of the shard in every epoch.
+size_t DS_batch_iterator_num_batches(const DS_BatchIterator *const iterator);
+
+/// Sample indexes of batch `batch_index` of the current epoch. Returns the
+/// number of samples of the batch. Does not modify the iterator, so loader
+/// threads may fetch different batches of an epoch concurrently.
+size_t DS_batch_iterator_batch(const DS_BatchIterator *const iterator,
+                               const size_t batch_index,
+                               const size_t **const indexes);
+
+/// Sample indexes of the next batch. Returns 0 at the end of an epoch, the
+/// following call starts the next epoch.
+size_t DS_batch_iterator_next(DS_BatchIterator *const iterator,
+                              const size_t **const indexes);
+
+/// The next batch as file list of the files of file_list, which must have
+/// `count` files. Returns NULL at the end of an epoch. The batch is stored in
+/// the iterator and stays valid until the next call.
+const DS_FILE_FileList *
+DS_batch_iterator_next_files(DS_BatchIterator *const iterator,
+                             const DS_FILE_FileList *const file_list);
 
 #endif // DEEPSEE_FILE_H
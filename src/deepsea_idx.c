@@ -0,0 +1,246 @@
+#include "deepsea_idx.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define IDX_TYPE_UNSIGNED_BYTE 0x08
+#define IDX_IMAGES_NUM_DIMS 3
+#define IDX_LABELS_NUM_DIMS 1
+#define IDX_IMAGES_TAG "images-idx3"
+#define IDX_LABELS_TAG "labels-idx1"
+#define GZIP_READ_CHUNK_SIZE (1 << 20)
+
+static bool is_gzip_file(const char *const path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  unsigned char magic[2] = {0};
+  const size_t read = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  return read == sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+static void *map_file(const char *const path, size_t *const size) {
+  const int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    DS_ERROR("Could not open file \"%s\": %s", path, strerror(errno));
+    return NULL;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    DS_ERROR("Could not get file info for \"%s\": %s", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  if (file_stat.st_size == 0) {
+    DS_ERROR("File \"%s\" is empty.", path);
+    close(fd);
+    return NULL;
+  }
+  void *memory =
+      mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // NOTE: The mapping stays valid after closing
+  if (memory == MAP_FAILED) {
+    DS_ERROR("Could not map file \"%s\": %s", path, strerror(errno));
+    return NULL;
+  }
+  *size = (size_t)file_stat.st_size;
+  return memory;
+}
+
+static void *inflate_file(const char *const path, size_t *const size) {
+  gzFile gz = gzopen(path, "rb");
+  if (!gz) {
+    DS_ERROR("Could not open gzip file \"%s\"", path);
+    return NULL;
+  }
+  gzbuffer(gz, GZIP_READ_CHUNK_SIZE);
+
+  size_t capacity = GZIP_READ_CHUNK_SIZE;
+  size_t length = 0;
+  unsigned char *buffer = DS_MALLOC(capacity);
+  DS_ASSERT(buffer, "Could not inflate IDX file. Out of memory.");
+  while (1) {
+    if (capacity - length < GZIP_READ_CHUNK_SIZE) {
+      capacity *= 2;
+      buffer = DS_REALLOC(buffer, capacity);
+      DS_ASSERT(buffer, "Could not inflate IDX file. Out of memory.");
+    }
+    const int read = gzread(gz, buffer + length, GZIP_READ_CHUNK_SIZE);
+    if (read < 0) {
+      int error = 0;
+      DS_ERROR("Could not inflate \"%s\": %s", path, gzerror(gz, &error));
+      DS_FREE(buffer);
+      gzclose(gz);
+      return NULL;
+    }
+    if (read == 0)
+      break;
+    length += (size_t)read;
+  }
+  gzclose(gz);
+
+  if (length == 0) {
+    DS_ERROR("File \"%s\" is empty.", path);
+    DS_FREE(buffer);
+    return NULL;
+  }
+  *size = length;
+  return buffer;
+}
+
+static void release_memory(void *const memory, const size_t size,
+                           const bool mapped) {
+  if (!memory)
+    return;
+  if (mapped)
+    munmap(memory, size);
+  else
+    DS_FREE(memory);
+}
+
+static uint32_t read_big_endian_u32(const uint8_t *const bytes) {
+  return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+         (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3];
+}
+
+/// Loads an IDX file and checks its header. On success `data` points to the
+/// first data byte and `dims` holds the size of every dimension.
+static bool load_idx_file(const char *const path, const size_t num_dims,
+                          size_t *const dims, const uint8_t **const data,
+                          void **const memory, size_t *const memory_size,
+                          bool *const mapped) {
+  *mapped = !is_gzip_file(path);
+  *memory = *mapped ? map_file(path, memory_size)
+                    : inflate_file(path, memory_size);
+  if (!*memory)
+    return false;
+
+  const uint8_t *const bytes = *memory;
+  const size_t header_size = 4 + 4 * num_dims;
+  if (*memory_size < header_size || bytes[0] != 0 || bytes[1] != 0) {
+    DS_ERROR("File \"%s\" is not an IDX file.", path);
+    goto load_idx_file_error;
+  }
+  if (bytes[2] != IDX_TYPE_UNSIGNED_BYTE) {
+    DS_ERROR("IDX file \"%s\" must contain unsigned bytes but has type 0x%02x.",
+             path, bytes[2]);
+    goto load_idx_file_error;
+  }
+  if (bytes[3] != num_dims) {
+    DS_ERROR("IDX file \"%s\" must have %lu dimensions but has %d.", path,
+             num_dims, bytes[3]);
+    goto load_idx_file_error;
+  }
+
+  size_t data_size = 1;
+  for (size_t d = 0; d < num_dims; ++d) {
+    dims[d] = read_big_endian_u32(&bytes[4 + 4 * d]);
+    data_size *= dims[d];
+  }
+  if (*memory_size - header_size < data_size) {
+    DS_ERROR("IDX file \"%s\" is truncated, expected %lu data bytes but got "
+             "%lu.",
+             path, data_size, *memory_size - header_size);
+    goto load_idx_file_error;
+  }
+
+  *data = bytes + header_size;
+  return true;
+
+load_idx_file_error:
+  release_memory(*memory, *memory_size, *mapped);
+  *memory = NULL;
+  return false;
+}
+
+bool DS_IDX_is_images_file(const char *const path) {
+  const char *const base_name = strrchr(path, '/');
+  return strstr(base_name ? base_name : path, "-" IDX_IMAGES_TAG "-") != NULL;
+}
+
+static char *labels_path_from_images_path(const char *const images_path) {
+  // NOTE: Only the file name, the directories may contain the tag as well
+  const char *const base_name = strrchr(images_path, '/');
+  const char *const tag =
+      strstr(base_name ? base_name : images_path, IDX_IMAGES_TAG);
+  if (!tag) {
+    DS_ERROR("Could not derive labels file from \"%s\".", images_path);
+    return NULL;
+  }
+  char *labels_path = DS_MALLOC(strlen(images_path) + 1);
+  DS_ASSERT(labels_path, "Could not create labels path. Out of memory.");
+  strcpy(labels_path, images_path);
+  memcpy(labels_path + (tag - images_path), IDX_LABELS_TAG,
+         strlen(IDX_LABELS_TAG)); // NOTE: Both tags have the same length
+  return labels_path;
+}
+
+DS_IDX_DataSet *DS_IDX_data_set_load(const char *const images_path,
+                                     const char *const labels_path) {
+  char *derived_labels_path = NULL;
+  if (!labels_path) {
+    derived_labels_path = labels_path_from_images_path(images_path);
+    if (!derived_labels_path)
+      return NULL;
+  }
+
+  DS_IDX_DataSet *data_set = DS_CALLOC(1, sizeof(*data_set));
+  DS_ASSERT(data_set, "Could not load IDX data set. Out of memory.");
+
+  size_t image_dims[IDX_IMAGES_NUM_DIMS] = {0};
+  size_t label_dims[IDX_LABELS_NUM_DIMS] = {0};
+  if (!load_idx_file(images_path, IDX_IMAGES_NUM_DIMS, image_dims,
+                     &data_set->images, &data_set->_image_memory,
+                     &data_set->_image_memory_size,
+                     &data_set->_image_memory_mapped))
+    goto data_set_load_error;
+  if (!load_idx_file(labels_path ? labels_path : derived_labels_path,
+                     IDX_LABELS_NUM_DIMS, label_dims, &data_set->labels,
+                     &data_set->_label_memory, &data_set->_label_memory_size,
+                     &data_set->_label_memory_mapped))
+    goto data_set_load_error;
+
+  if (image_dims[0] != label_dims[0]) {
+    DS_ERROR("IDX images and labels do not match, got %lu images and %lu "
+             "labels.",
+             image_dims[0], label_dims[0]);
+    goto data_set_load_error;
+  }
+  data_set->count = image_dims[0];
+  data_set->rows = image_dims[1];
+  data_set->cols = image_dims[2];
+
+  DS_FREE(derived_labels_path);
+  return data_set;
+
+data_set_load_error:
+  DS_FREE(derived_labels_path);
+  DS_IDX_data_set_free(data_set);
+  return NULL;
+}
+
+void DS_IDX_data_set_free(DS_IDX_DataSet *const data_set) {
+  release_memory(data_set->_image_memory, data_set->_image_memory_size,
+                 data_set->_image_memory_mapped);
+  release_memory(data_set->_label_memory, data_set->_label_memory_size,
+                 data_set->_label_memory_mapped);
+  DS_FREE(data_set);
+}
+
+size_t DS_IDX_input_length(const DS_IDX_DataSet *const data_set) {
+  return data_set->rows * data_set->cols;
+}
+
+DS_DATA_Set *DS_IDX_to_data_set(const DS_IDX_DataSet *const data_set) {
+  DS_DATA_Set *view =
+      DS_DATA_set_create(data_set->count, DS_IDX_input_length(data_set),
+                         (uint8_t *)data_set->images); // NOTE: Read-only
+  for (size_t i = 0; i < data_set->count; ++i)
+    view->labels[i] = data_set->labels[i];
+  return view;
+}
@@ -0,0 +1,52 @@
+#ifndef DEEPSEA_IDX_H
+#define DEEPSEA_IDX_H
+
+#include "deepsea.h"
+#include "deepsea_data.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Labelled data set stored in the MNIST/EMNIST IDX format. The images are
+/// read from an `*-images-idx3-ubyte[.gz]` file and the labels from the
+/// matching `*-labels-idx1-ubyte[.gz]` file.
+/// Uncompressed files are memory mapped and `images` and `labels` point
+/// directly into the mapping. Gzip compressed files are inflated once into
+/// memory. In both cases no per sample copies are made.
+/// NOTE: EMNIST stores its images transposed, MNIST does not.
+typedef struct {
+  const uint8_t *images; // count * rows * cols pixels in row-major order
+  const uint8_t *labels; // count class indices
+  size_t count;
+  size_t rows;
+  size_t cols;
+
+  // NOTE: Private, used to release the underlying memory
+  void *_image_memory;
+  size_t _image_memory_size;
+  bool _image_memory_mapped;
+  void *_label_memory;
+  size_t _label_memory_size;
+  bool _label_memory_mapped;
+} DS_IDX_DataSet;
+
+/// Returns true if the path names an IDX images file, i.e. the file name
+/// contains "-images-idx3-ubyte".
+bool DS_IDX_is_images_file(const char *const path);
+
+/// Load an IDX data set. If labels_path is NULL, it is derived from the
+/// images path by replacing "images-idx3" with "labels-idx1".
+/// Returns NULL on error.
+DS_IDX_DataSet *DS_IDX_data_set_load(const char *const images_path,
+                                     const char *const labels_path);
+
+void DS_IDX_data_set_free(DS_IDX_DataSet *const data_set);
+
+size_t DS_IDX_input_length(const DS_IDX_DataSet *const data_set);
+
+/// Create an in-memory data set view of the IDX data set. The pixels are
+/// borrowed from the IDX data set, which must outlive the view, and must not
+/// be modified.
+DS_DATA_Set *DS_IDX_to_data_set(const DS_IDX_DataSet *const data_set);
+
+#endif // DEEPSEA_IDX_H
@@ -0,0 +1,458 @@
+#include "deepsea_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_URING 1
+#endif
+#endif
+#ifndef IO_URING
+#define IO_URING 0
+#endif
+
+#if IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define RING_ENTRIES 256
+// NOTE: Opening a file needs two entries, an open and a size query
+#define RING_WINDOW (RING_ENTRIES / 2)
+#define PROBE_NUM_OPS 256
+
+typedef struct {
+  int fd;
+  void *sq_memory;
+  size_t sq_memory_size;
+  void *cq_memory;
+  size_t cq_memory_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  struct statx *statx_buffers; // One per file of a window
+} Ring;
+
+typedef enum {
+  RING_OP_OPEN,
+  RING_OP_STATX,
+  RING_OP_READ,
+  RING_OP_CLOSE,
+  RING_OP_COUNT,
+} RingOp;
+#endif
+
+typedef struct {
+  int fd;
+  size_t size;
+  size_t offset; // Into the buffer of the reader
+  int error;     // errno of the first failed operation, 0 on success
+} FileState;
+
+struct DS_IO_Reader {
+  DS_THREAD_Pool *pool;
+  uint8_t *buffer;
+  size_t buffer_capacity;
+  FileState *states;
+  size_t states_capacity;
+  char *const *paths; // Of the current read
+#if IO_URING
+  Ring ring;
+  bool has_ring;
+#endif
+};
+
+static void set_error(FileState *const state, const int error) {
+  if (state->error == 0)
+    state->error = error;
+}
+
+/// Reads the remaining bytes of a file with pread, used for short reads.
+static void read_rest(FileState *const state, uint8_t *const buffer,
+                      size_t done) {
+  while (done < state->size && state->error == 0) {
+    const ssize_t n =
+        pread(state->fd, buffer + done, state->size - done, (off_t)done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      set_error(state, errno);
+    else if (n == 0)
+      set_error(state, EIO); // NOTE: File shrank after its size was queried
+    else
+      done += (size_t)n;
+  }
+}
+
+static void open_task(void *const context, const size_t index,
+                      const size_t worker) {
+  (void)worker;
+  DS_IO_Reader *const reader = context;
+  FileState *const state = &reader->states[index];
+  state->fd = open(reader->paths[index], O_RDONLY | O_CLOEXEC);
+  if (state->fd < 0) {
+    set_error(state, errno);
+    return;
+  }
+  struct stat file_stat;
+  if (fstat(state->fd, &file_stat) == -1) {
+    set_error(state, errno);
+    return;
+  }
+  state->size = (size_t)file_stat.st_size;
+}
+
+static void read_task(void *const context, const size_t index,
+                      const size_t worker) {
+  (void)worker;
+  DS_IO_Reader *const reader = context;
+  FileState *const state = &reader->states[index];
+  read_rest(state, reader->buffer + state->offset, 0);
+  close(state->fd);
+  state->fd = -1;
+}
+
+#if IO_URING
+
+static int ring_enter(const int fd, const unsigned to_submit,
+                      const unsigned min_complete) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static void ring_close(Ring *const ring) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_memory && ring->cq_memory != ring->sq_memory)
+    munmap(ring->cq_memory, ring->cq_memory_size);
+  if (ring->sq_memory)
+    munmap(ring->sq_memory, ring->sq_memory_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+  DS_FREE(ring->statx_buffers);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+/// Checks that the kernel supports every operation the reader needs, the
+/// file operations were only added in Linux 5.6.
+static bool ring_supports_file_ops(const Ring *const ring) {
+  struct io_uring_probe *probe = DS_CALLOC(
+      1, sizeof(*probe) + PROBE_NUM_OPS * sizeof(struct io_uring_probe_op));
+  DS_ASSERT(probe, "Could not probe io_uring. Out of memory.");
+  bool supported = false;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe,
+              PROBE_NUM_OPS) == 0) {
+    const int ops[] = {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                       IORING_OP_CLOSE};
+    supported = true;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+      supported = supported && ops[i] <= probe->last_op &&
+                  (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+  }
+  DS_FREE(probe);
+  return supported;
+}
+
+static bool ring_open(Ring *const ring) {
+  memset(ring, 0, sizeof(*ring));
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (ring->fd < 0)
+    return false; // NOTE: Not supported or disabled, e.g. by seccomp
+
+  ring->sq_memory_size =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_memory_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    ring->sq_memory_size = ring->cq_memory_size =
+        DS_MAX(ring->sq_memory_size, ring->cq_memory_size);
+
+  ring->sq_memory =
+      mmap(NULL, ring->sq_memory_size, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_memory == MAP_FAILED) {
+    ring->sq_memory = NULL;
+    goto ring_open_error;
+  }
+  ring->cq_memory =
+      single_mmap ? ring->sq_memory
+                  : mmap(NULL, ring->cq_memory_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+  if (ring->cq_memory == MAP_FAILED) {
+    ring->cq_memory = NULL;
+    goto ring_open_error;
+  }
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto ring_open_error;
+  }
+
+  uint8_t *const sq = ring->sq_memory;
+  uint8_t *const cq = ring->cq_memory;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  if (!ring_supports_file_ops(ring))
+    goto ring_open_error;
+
+  ring->statx_buffers = DS_MALLOC(RING_WINDOW * sizeof(struct statx));
+  DS_ASSERT(ring->statx_buffers, "Could not create io_uring. Out of memory.");
+  return true;
+
+ring_open_error:
+  ring_close(ring);
+  return false;
+}
+
+static void ring_push(Ring *const ring, const struct io_uring_sqe *const sqe,
+                      const size_t index, const RingOp op) {
+  const unsigned tail = *ring->sq_tail; // NOTE: Only written by us
+  const unsigned slot = tail & *ring->sq_mask;
+  ring->sqes[slot] = *sqe;
+  ring->sqes[slot].user_data = (uint64_t)index * RING_OP_COUNT + op;
+  ring->sq_array[slot] = slot;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void ring_complete(DS_IO_Reader *const reader, const size_t first,
+                          const struct io_uring_cqe *const cqe) {
+  const size_t index = cqe->user_data / RING_OP_COUNT;
+  FileState *const state = &reader->states[index];
+  if (cqe->res < 0) {
+    set_error(state, -cqe->res);
+    return;
+  }
+  switch ((RingOp)(cqe->user_data % RING_OP_COUNT)) {
+  case RING_OP_OPEN:
+    state->fd = cqe->res;
+    break;
+  case RING_OP_STATX:
+    state->size = reader->ring.statx_buffers[index - first].stx_size;
+    break;
+  case RING_OP_READ:
+    // NOTE: Short reads are rare for regular files, finish them directly
+    read_rest(state, reader->buffer + state->offset, (size_t)cqe->res);
+    break;
+  case RING_OP_CLOSE:
+    state->fd = -1;
+    break;
+  default:
+    DS_ASSERT(false, "Unreachable");
+  }
+}
+
+/// Submits all queued entries and waits until `count` completions have been
+/// handled.
+static bool ring_run(DS_IO_Reader *const reader, const size_t first,
+                     size_t count) {
+  Ring *const ring = &reader->ring;
+  while (count > 0) {
+    const unsigned to_submit =
+        *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring_enter(ring->fd, to_submit, 1) < 0 && errno != EINTR) {
+      DS_ERROR("io_uring_enter failed: %s", strerror(errno));
+      return false;
+    }
+    unsigned head = *ring->cq_head;
+    const unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head, --count)
+      ring_complete(reader, first, &ring->cqes[head & *ring->cq_mask]);
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+static bool ring_open_files(DS_IO_Reader *const reader, const size_t count) {
+  for (size_t first = 0; first < count; first += RING_WINDOW) {
+    const size_t window = DS_MIN(RING_WINDOW, count - first);
+    for (size_t i = first; i < first + window; ++i) {
+      struct io_uring_sqe sqe;
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_OPENAT;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = (uint64_t)(uintptr_t)reader->paths[i];
+      sqe.open_flags = O_RDONLY | O_CLOEXEC;
+      ring_push(&reader->ring, &sqe, i, RING_OP_OPEN);
+
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_STATX;
+      sqe.fd = AT_FDCWD;
+      sqe.addr = (uint64_t)(uintptr_t)reader->paths[i];
+      sqe.len = STATX_SIZE;
+      sqe.off = (uint64_t)(uintptr_t)&reader->ring.statx_buffers[i - first];
+      ring_push(&reader->ring, &sqe, i, RING_OP_STATX);
+    }
+    if (!ring_run(reader, first, 2 * window))
+      return false;
+  }
+  return true;
+}
+
+static bool ring_read_files(DS_IO_Reader *const reader, const size_t count) {
+  for (size_t first = 0; first < count; first += RING_WINDOW) {
+    const size_t window = DS_MIN(RING_WINDOW, count - first);
+    for (size_t i = first; i < first + window; ++i) {
+      const FileState *const state = &reader->states[i];
+      struct io_uring_sqe sqe;
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_READ;
+      sqe.fd = state->fd;
+      sqe.addr = (uint64_t)(uintptr_t)(reader->buffer + state->offset);
+      sqe.len = (uint32_t)state->size;
+      ring_push(&reader->ring, &sqe, i, RING_OP_READ);
+    }
+    if (!ring_run(reader, first, window))
+      return false;
+
+    // NOTE: Closing only after all reads keeps short reads easy to finish
+    for (size_t i = first; i < first + window; ++i) {
+      struct io_uring_sqe sqe;
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_CLOSE;
+      sqe.fd = reader->states[i].fd;
+      ring_push(&reader->ring, &sqe, i, RING_OP_CLOSE);
+    }
+    if (!ring_run(reader, first, window))
+      return false;
+  }
+  return true;
+}
+
+#endif // IO_URING
+
+DS_IO_Reader *DS_IO_reader_create(DS_THREAD_Pool *const pool,
+                                  const bool use_io_uring) {
+  DS_IO_Reader *reader = DS_CALLOC(1, sizeof(*reader));
+  DS_ASSERT(reader, "Could not create file reader. Out of memory.");
+  reader->pool = pool;
+#if IO_URING
+  reader->has_ring = use_io_uring && ring_open(&reader->ring);
+#else
+  (void)use_io_uring;
+#endif
+  return reader;
+}
+
+void DS_IO_reader_free(DS_IO_Reader *const reader) {
+#if IO_URING
+  if (reader->has_ring)
+    ring_close(&reader->ring);
+#endif
+  DS_FREE(reader->states);
+  DS_FREE(reader->buffer);
+  DS_FREE(reader);
+}
+
+bool DS_IO_reader_uses_io_uring(const DS_IO_Reader *const reader) {
+#if IO_URING
+  return reader->has_ring;
+#else
+  (void)reader;
+  return false;
+#endif
+}
+
+static void close_files(DS_IO_Reader *const reader, const size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (reader->states[i].fd >= 0)
+      close(reader->states[i].fd);
+    reader->states[i].fd = -1;
+  }
+}
+
+static bool report_failure(const DS_IO_Reader *const reader,
+                           const size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (reader->states[i].error != 0) {
+      DS_ERROR("Could not read file \"%s\": %s", reader->paths[i],
+               strerror(reader->states[i].error));
+      return true;
+    }
+  }
+  return false;
+}
+
+bool DS_IO_read_files(DS_IO_Reader *const reader, char *const *const paths,
+                      const size_t count, DS_IO_File *const files) {
+  if (count > reader->states_capacity) {
+    reader->states =
+        DS_REALLOC(reader->states, count * sizeof(reader->states[0]));
+    DS_ASSERT(reader->states, "Could not read files. Out of memory.");
+    reader->states_capacity = count;
+  }
+  for (size_t i = 0; i < count; ++i)
+    reader->states[i] = (FileState){.fd = -1};
+  reader->paths = paths;
+
+  // NOTE: Sizes first, such that the buffer can be grown on this thread
+#if IO_URING
+  if (reader->has_ring) {
+    if (!ring_open_files(reader, count))
+      goto read_files_error;
+  } else
+#endif
+    DS_THREAD_pool_for(reader->pool, count, &open_task, reader);
+  if (report_failure(reader, count))
+    goto read_files_error;
+
+  size_t total_size = 0;
+  for (size_t i = 0; i < count; ++i) {
+    reader->states[i].offset = total_size;
+    total_size += reader->states[i].size;
+  }
+  if (total_size > reader->buffer_capacity) {
+    DS_FREE(reader->buffer); // NOTE: The old contents are not needed anymore
+    reader->buffer = DS_MALLOC(total_size);
+    DS_ASSERT(reader->buffer, "Could not read files. Out of memory.");
+    reader->buffer_capacity = total_size;
+  }
+
+#if IO_URING
+  if (reader->has_ring) {
+    if (!ring_read_files(reader, count))
+      goto read_files_error;
+  } else
+#endif
+    DS_THREAD_pool_for(reader->pool, count, &read_task, reader);
+  if (report_failure(reader, count))
+    goto read_files_error;
+
+  for (size_t i = 0; i < count; ++i)
+    files[i] = (DS_IO_File){.data = reader->buffer + reader->states[i].offset,
+                            .size = reader->states[i].size};
+  reader->paths = NULL;
+  return true;
+
+read_files_error:
+  close_files(reader, count);
+  reader->paths = NULL;
+  return false;
+}
@@ -0,0 +1,39 @@
+#ifndef DEEPSEA_IO_H
+#define DEEPSEA_IO_H
+
+#include "deepsea.h"
+#include "deepsea_thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Reads many small files completely into memory. On Linux the opens, size
+/// queries, reads and closes of a whole batch of files are submitted at once
+/// through io_uring, so a batch costs a handful of syscalls instead of four
+/// per file. Where io_uring is not available the files are read with pread
+/// on a thread pool.
+typedef struct DS_IO_Reader DS_IO_Reader;
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} DS_IO_File;
+
+/// Create a reader. If use_io_uring is false or io_uring is not supported by
+/// the kernel, the pool is used to read the files in parallel. The pool may
+/// be NULL, then the files are read serially.
+DS_IO_Reader *DS_IO_reader_create(DS_THREAD_Pool *const pool,
+                                  const bool use_io_uring);
+
+void DS_IO_reader_free(DS_IO_Reader *const reader);
+
+bool DS_IO_reader_uses_io_uring(const DS_IO_Reader *const reader);
+
+/// Reads the files paths\[0..count) into memory. `files[i]` points into a
+/// buffer of the reader, which stays valid until the next read.
+/// Returns false and reports the first failing file if any file cannot be
+/// read.
+bool DS_IO_read_files(DS_IO_Reader *const reader, char *const *const paths,
+                      const size_t count, DS_IO_File *const files);
+
+#endif // DEEPSEA_IO_H
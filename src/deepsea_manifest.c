@@ -0,0 +1,338 @@
+#include "deepsea_manifest.h"
+#include "deepsea_io.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MANIFEST_MAGIC "DSMANIF1"
+#define MANIFEST_MAGIC_LENGTH 8
+#define MANIFEST_BYTE_ORDER_MARK 0x01020304u
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+// NOTE: Bounds the memory of the raw files while hashing
+#define HASH_CHUNK_FILES 4096
+
+typedef struct {
+  char magic[MANIFEST_MAGIC_LENGTH];
+  uint32_t byte_order;
+  uint32_t flags;
+  uint64_t count;
+  uint64_t strings_size;
+} ManifestHeader;
+
+typedef struct {
+  uint64_t path_offset;
+  uint64_t size;
+  uint64_t hash;
+  uint32_t label;
+  uint32_t reserved;
+} ManifestEntry;
+
+static_assert(sizeof(ManifestHeader) == 32, "Manifest header must be packed.");
+static_assert(sizeof(ManifestEntry) == 32, "Manifest entry must be packed.");
+
+bool DS_MANIFEST_is_manifest_file(const char *const path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  char magic[MANIFEST_MAGIC_LENGTH] = {0};
+  const size_t read = fread(magic, 1, sizeof(magic), f);
+  fclose(f);
+  return read == sizeof(magic) &&
+         memcmp(magic, MANIFEST_MAGIC, MANIFEST_MAGIC_LENGTH) == 0;
+}
+
+char *DS_MANIFEST_path_for_directory(const char *const dir_path) {
+  char *manifest_path =
+      DS_MALLOC(strlen(dir_path) + strlen(DS_MANIFEST_EXTENSION) + 1);
+  DS_ASSERT(manifest_path, "Could not create manifest path. Out of memory.");
+  strcpy(manifest_path, dir_path);
+  strcat(manifest_path, DS_MANIFEST_EXTENSION);
+  return manifest_path;
+}
+
+typedef struct {
+  const DS_FILE_FileList *file_list;
+  const DS_IO_File *files; // Contents of the current chunk when hashing
+  ManifestEntry *entries;  // Of the current chunk when hashing
+  int *errors;             // errno of stat per file
+} ManifestJob;
+
+static void stat_task(void *const context, const size_t index,
+                      const size_t worker) {
+  (void)worker;
+  ManifestJob *const job = context;
+  struct stat file_stat;
+  if (stat(job->file_list->paths[index], &file_stat) == -1)
+    job->errors[index] = errno;
+  else
+    job->entries[index].size = (uint64_t)file_stat.st_size;
+}
+
+static void hash_task(void *const context, const size_t index,
+                      const size_t worker) {
+  (void)worker;
+  ManifestJob *const job = context;
+  const DS_IO_File *const file = &job->files[index];
+  uint64_t hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < file->size; ++i)
+    hash = (hash ^ file->data[i]) * FNV_PRIME;
+  job->entries[index].hash = hash;
+  job->entries[index].size = file->size;
+}
+
+static bool fill_sizes(ManifestJob *const job, DS_THREAD_Pool *const pool) {
+  const DS_FILE_FileList *const file_list = job->file_list;
+  job->errors = DS_CALLOC(file_list->count, sizeof(job->errors[0]));
+  DS_ASSERT(job->errors, "Could not write manifest. Out of memory.");
+  DS_THREAD_pool_for(pool, file_list->count, &stat_task, job);
+
+  bool success = true;
+  for (size_t i = 0; i < file_list->count && success; ++i) {
+    if (job->errors[i] != 0) {
+      DS_ERROR("Could not get file info for \"%s\": %s", file_list->paths[i],
+               strerror(job->errors[i]));
+      success = false;
+    }
+  }
+  DS_FREE(job->errors);
+  job->errors = NULL;
+  return success;
+}
+
+static bool fill_hashes(ManifestJob *const job, DS_THREAD_Pool *const pool) {
+  const DS_FILE_FileList *const file_list = job->file_list;
+  ManifestEntry *const entries = job->entries;
+  DS_IO_Reader *reader = DS_IO_reader_create(pool, true);
+  DS_IO_File *files =
+      DS_MALLOC(DS_MIN(HASH_CHUNK_FILES, file_list->count) * sizeof(files[0]));
+  DS_ASSERT(files, "Could not write manifest. Out of memory.");
+
+  bool success = true;
+  for (size_t first = 0; first < file_list->count && success;
+       first += HASH_CHUNK_FILES) {
+    const size_t count = DS_MIN(HASH_CHUNK_FILES, file_list->count - first);
+    success =
+        DS_IO_read_files(reader, &file_list->paths[first], count, files);
+    if (success) {
+      job->files = files;
+      job->entries = &entries[first];
+      DS_THREAD_pool_for(pool, count, &hash_task, job);
+    }
+  }
+  job->entries = entries;
+  DS_FREE(files);
+  DS_IO_reader_free(reader);
+  return success;
+}
+
+bool DS_MANIFEST_write(const char *const path, const bool with_hashes,
+                       DS_THREAD_Pool *const pool) {
+  char *dir_path = DS_MALLOC(strlen(path) + 1);
+  DS_ASSERT(dir_path, "Could not write manifest. Out of memory.");
+  strcpy(dir_path, path);
+  for (size_t length = strlen(dir_path);
+       length > 1 && dir_path[length - 1] == '/'; --length)
+    dir_path[length - 1] = '\0';
+
+  DS_FILE_FileList *file_list = DS_FILE_get_files(dir_path, pool);
+  if (file_list->count == 0) {
+    DS_ERROR("No files found in \"%s\".", dir_path);
+    DS_FILE_file_list_free(file_list);
+    DS_FREE(dir_path);
+    return false;
+  }
+  char *manifest_path = DS_MANIFEST_path_for_directory(dir_path);
+  ManifestEntry *entries = DS_CALLOC(file_list->count, sizeof(entries[0]));
+  DS_ASSERT(entries, "Could not write manifest. Out of memory.");
+  FILE *f = NULL;
+  bool success = false;
+
+  // NOTE: Paths are stored relative to the directory of the manifest, which
+  // is the parent of dir_path
+  const size_t dir_length = strlen(dir_path);
+  const char *const last_slash = strrchr(dir_path, '/');
+  const char *const base_name = last_slash ? last_slash + 1 : dir_path;
+  const size_t base_name_length = strlen(base_name);
+
+  uint64_t strings_size = 0;
+  for (size_t i = 0; i < file_list->count; ++i) {
+    errno = 0;
+    const size_t label =
+        DS_FILE_get_label_from_directory_name(file_list->paths[i]);
+    if ((label == 0 && errno != 0) || label > UINT32_MAX) {
+      DS_ERROR("Could not get a valid label for file \"%s\"",
+               file_list->paths[i]);
+      goto manifest_write_error;
+    }
+    entries[i].label = (uint32_t)label;
+    entries[i].path_offset = strings_size;
+    strings_size +=
+        base_name_length + strlen(file_list->paths[i]) - dir_length + 1;
+  }
+
+  ManifestJob job = {.file_list = file_list, .entries = entries};
+  if (!(with_hashes ? fill_hashes(&job, pool) : fill_sizes(&job, pool)))
+    goto manifest_write_error;
+
+  f = fopen(manifest_path, "wb");
+  if (!f) {
+    DS_ERROR("Could not open manifest \"%s\": %s", manifest_path,
+             strerror(errno));
+    goto manifest_write_error;
+  }
+  ManifestHeader header = {.byte_order = MANIFEST_BYTE_ORDER_MARK,
+                           .flags = with_hashes ? DS_MANIFEST_HAS_HASHES : 0,
+                           .count = file_list->count,
+                           .strings_size = strings_size};
+  memcpy(header.magic, MANIFEST_MAGIC, MANIFEST_MAGIC_LENGTH);
+  bool written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                 fwrite(entries, sizeof(entries[0]), file_list->count, f) ==
+                     file_list->count;
+  for (size_t i = 0; i < file_list->count && written; ++i) {
+    const char *const relative_path = file_list->paths[i] + dir_length;
+    written = fwrite(base_name, 1, base_name_length, f) == base_name_length &&
+              fwrite(relative_path, 1, strlen(relative_path) + 1, f) ==
+                  strlen(relative_path) + 1;
+  }
+  if (fclose(f) != 0 || !written) {
+    DS_ERROR("Could not write manifest \"%s\"", manifest_path);
+    goto manifest_write_error;
+  }
+  success = true;
+
+manifest_write_error:
+  DS_FREE(entries);
+  DS_FREE(manifest_path);
+  DS_FILE_file_list_free(file_list);
+  DS_FREE(dir_path);
+  return success;
+}
+
+static uint8_t *read_whole_file(const char *const path, size_t *const size) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    DS_ERROR("Could not open file \"%s\": %s", path, strerror(errno));
+    return NULL;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    DS_ERROR("Could not get file info for \"%s\": %s", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+  *size = (size_t)file_stat.st_size;
+  uint8_t *buffer = DS_MALLOC(DS_MAX(*size, 1));
+  DS_ASSERT(buffer, "Could not read \"%s\". Out of memory.", path);
+  size_t done = 0;
+  while (done < *size) {
+    const ssize_t n = read(fd, buffer + done, *size - done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      DS_ERROR("Could not read file \"%s\": %s", path,
+               n < 0 ? strerror(errno) : "File is truncated");
+      DS_FREE(buffer);
+      close(fd);
+      return NULL;
+    }
+    done += (size_t)n;
+  }
+  close(fd);
+  return buffer;
+}
+
+DS_FILE_FileList *DS_MANIFEST_load(const char *const manifest_path) {
+  size_t size = 0;
+  uint8_t *buffer = read_whole_file(manifest_path, &size);
+  if (!buffer)
+    return NULL;
+
+  ManifestHeader header = {0};
+  if (size < sizeof(header)) {
+    DS_ERROR("File \"%s\" is not a manifest.", manifest_path);
+    DS_FREE(buffer);
+    return NULL;
+  }
+  memcpy(&header, buffer, sizeof(header));
+  if (memcmp(header.magic, MANIFEST_MAGIC, MANIFEST_MAGIC_LENGTH) != 0 ||
+      header.byte_order != MANIFEST_BYTE_ORDER_MARK) {
+    DS_ERROR("File \"%s\" is not a manifest of this machine.", manifest_path);
+    DS_FREE(buffer);
+    return NULL;
+  }
+  const size_t body_size = size - sizeof(header);
+  if (header.count > body_size / sizeof(ManifestEntry) ||
+      header.strings_size !=
+          body_size - header.count * sizeof(ManifestEntry) ||
+      header.strings_size == 0) {
+    DS_ERROR("Manifest \"%s\" is truncated or corrupt.", manifest_path);
+    DS_FREE(buffer);
+    return NULL;
+  }
+  const ManifestEntry *const entries =
+      (const ManifestEntry *)(buffer + sizeof(header));
+  char *const strings = (char *)(entries + header.count);
+  if (strings[header.strings_size - 1] != '\0') {
+    DS_ERROR("Manifest \"%s\" is truncated or corrupt.", manifest_path);
+    DS_FREE(buffer);
+    return NULL;
+  }
+
+  const char *const last_slash = strrchr(manifest_path, '/');
+  const size_t prefix_length = last_slash ? last_slash - manifest_path + 1 : 0;
+  size_t arena_size = 0;
+  for (size_t i = 0; i < header.count; ++i) {
+    if (entries[i].path_offset >= header.strings_size) {
+      DS_ERROR("Manifest \"%s\" is truncated or corrupt.", manifest_path);
+      DS_FREE(buffer);
+      return NULL;
+    }
+    arena_size += prefix_length + strlen(strings + entries[i].path_offset) + 1;
+  }
+
+  DS_FILE_FileList *file_list = DS_CALLOC(1, sizeof(*file_list));
+  DS_ASSERT(file_list, "Could not create file list. Out of memory.");
+  file_list->count = header.count;
+  file_list->paths = DS_MALLOC(DS_MAX(header.count, 1) * sizeof(char *));
+  file_list->labels =
+      DS_MALLOC(DS_MAX(header.count, 1) * sizeof(file_list->labels[0]));
+  DS_ASSERT(file_list->paths && file_list->labels,
+            "Could not create file list. Out of memory.");
+  if (prefix_length == 0) {
+    // NOTE: The paths are usable as they are, keep them in the read buffer
+    file_list->_arena = (char *)buffer;
+  } else {
+    file_list->_arena = DS_MALLOC(arena_size);
+    DS_ASSERT(file_list->_arena, "Could not create file list. Out of memory.");
+  }
+
+  for (size_t i = 0, position = 0; i < header.count; ++i) {
+    char *const path = strings + entries[i].path_offset;
+    file_list->labels[i] = entries[i].label;
+    if (prefix_length == 0) {
+      file_list->paths[i] = path;
+    } else {
+      const size_t length = strlen(path) + 1;
+      file_list->paths[i] = file_list->_arena + position;
+      memcpy(file_list->paths[i], manifest_path, prefix_length);
+      memcpy(file_list->paths[i] + prefix_length, path, length);
+      position += prefix_length + length;
+    }
+  }
+  if (prefix_length != 0)
+    DS_FREE(buffer);
+  return file_list;
+}
+
+DS_FILE_FileList *DS_MANIFEST_load_or_scan(const char *const path,
+                                           DS_THREAD_Pool *const pool) {
+  if (DS_MANIFEST_is_manifest_file(path))
+    return DS_MANIFEST_load(path);
+  return DS_FILE_get_files(path, pool);
+}
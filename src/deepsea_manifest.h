@@ -0,0 +1,49 @@
+#ifndef DEEPSEA_MANIFEST_H
+#define DEEPSEA_MANIFEST_H
+
+#include "deepsea.h"
+#include "deepsea_file.h"
+#include "deepsea_thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// A manifest indexes a labelled PNG directory once, such that later runs
+/// skip the directory walk and the label parsing. It is loaded with a single
+/// read. The binary layout is:
+///
+///   header:  magic "DSMANIF1", u32 byte order mark 0x01020304, u32 flags,
+///            u64 number of entries, u64 size of the string table
+///   entries: u64 path offset into the string table, u64 file size in bytes,
+///            u64 FNV-1a hash of the contents (0 without
+///            DS_MANIFEST_HAS_HASHES), u32 label, u32 reserved
+///   strings: zero terminated paths, relative to the manifest's directory
+///
+/// All numbers are stored in the byte order of the writer; manifests are not
+/// meant to be moved between machines of different endianness.
+#define DS_MANIFEST_EXTENSION ".manifest"
+#define DS_MANIFEST_HAS_HASHES 0x1u
+
+/// Returns true if the file at path starts with the manifest magic.
+bool DS_MANIFEST_is_manifest_file(const char *const path);
+
+/// Path of the manifest of a directory, it is stored next to the directory:
+/// "data/png" -> "data/png.manifest". Must be freed with DS_FREE.
+char *DS_MANIFEST_path_for_directory(const char *const dir_path);
+
+/// Scans dir_path and writes its manifest to
+/// DS_MANIFEST_path_for_directory(dir_path). The labels are taken from the
+/// directory names. If with_hashes is set, every file is read to compute the
+/// hash of its contents. Returns false on error.
+bool DS_MANIFEST_write(const char *const dir_path, const bool with_hashes,
+                       DS_THREAD_Pool *const pool);
+
+/// Loads a manifest as a file list with labels. Returns NULL on error.
+DS_FILE_FileList *DS_MANIFEST_load(const char *const manifest_path);
+
+/// Loads path as a manifest if it is one, otherwise scans it as a labelled
+/// PNG directory with DS_FILE_get_files. Returns NULL if a manifest cannot be
+/// loaded.
+DS_FILE_FileList *DS_MANIFEST_load_or_scan(const char *const path,
+                                           DS_THREAD_Pool *const pool);
+
+#endif // DEEPSEA_MANIFEST_H
@@ -0,0 +1,264 @@
+#include "deepsea_model.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define MODEL_CACHE_LINE 64
+// NOTE: How often a publisher looks whether the readers left the old epoch
+#define RECLAIM_POLL_NS 20000L
+
+struct DS_MODEL_Reader {
+  _Atomic uint64_t epoch; // Epoch the reader entered in, 0 outside
+  // NOTE: Keeps the epochs of different readers off one cache line
+  char padding[MODEL_CACHE_LINE - sizeof(uint64_t)];
+  DS_MODEL_Model *model;
+  DS_MODEL_Reader *next;
+};
+
+struct DS_MODEL_Model {
+  _Atomic(DS_Network *) network;
+  _Atomic uint64_t epoch; // Starts at 1, advanced by every publish
+  _Atomic size_t generation;
+  pthread_mutex_t mutex; // Guards the readers, one publish at a time
+  DS_MODEL_Reader *readers;
+  // NOTE: DS_network_load parses with strtok, so one load at a time
+  pthread_mutex_t loading;
+};
+
+DS_MODEL_Model *DS_MODEL_create(DS_Network *const network) {
+  DS_MODEL_Model *model = DS_CALLOC(1, sizeof(*model));
+  DS_ASSERT(model, "Could not create model. Out of memory.");
+  atomic_init(&model->network, network);
+  atomic_init(&model->epoch, 1);
+  atomic_init(&model->generation, 0);
+  pthread_mutex_init(&model->mutex, NULL);
+  pthread_mutex_init(&model->loading, NULL);
+  return model;
+}
+
+void DS_MODEL_free(DS_MODEL_Model *const model) {
+  DS_ASSERT(!model->readers, "Freed a model that still has readers.");
+  DS_network_free(atomic_load(&model->network));
+  pthread_mutex_destroy(&model->mutex);
+  pthread_mutex_destroy(&model->loading);
+  DS_FREE(model);
+}
+
+size_t DS_MODEL_generation(DS_MODEL_Model *const model) {
+  return atomic_load(&model->generation);
+}
+
+DS_MODEL_Reader *DS_MODEL_reader_register(DS_MODEL_Model *const model) {
+  DS_MODEL_Reader *reader = DS_CALLOC(1, sizeof(*reader));
+  DS_ASSERT(reader, "Could not register reader. Out of memory.");
+  atomic_init(&reader->epoch, 0);
+  reader->model = model;
+  pthread_mutex_lock(&model->mutex);
+  reader->next = model->readers;
+  model->readers = reader;
+  pthread_mutex_unlock(&model->mutex);
+  return reader;
+}
+
+void DS_MODEL_reader_unregister(DS_MODEL_Reader *const reader) {
+  DS_ASSERT(atomic_load(&reader->epoch) == 0,
+            "Unregistered a reader that did not leave.");
+  DS_MODEL_Model *const model = reader->model;
+  pthread_mutex_lock(&model->mutex);
+  DS_MODEL_Reader **link = &model->readers;
+  while (*link != reader)
+    link = &(*link)->next;
+  *link = reader->next;
+  pthread_mutex_unlock(&model->mutex);
+  DS_FREE(reader);
+}
+
+const DS_Network *DS_MODEL_enter(DS_MODEL_Reader *const reader) {
+  DS_ASSERT(atomic_load_explicit(&reader->epoch, memory_order_relaxed) == 0,
+            "Reader entered twice.");
+  // NOTE: Sequentially consistent: a publisher that did not see this store
+  // swapped the network before the load below, which then gets the new one
+  atomic_store(&reader->epoch, atomic_load(&reader->model->epoch));
+  return atomic_load(&reader->model->network);
+}
+
+void DS_MODEL_leave(DS_MODEL_Reader *const reader) {
+  atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/// Whether both networks have equal output labels, or neither has any.
+static bool same_output_labels(const DS_Network *const a,
+                               const DS_Network *const b) {
+  const size_t num_outputs = DS_network_output_layer_size(a);
+  for (size_t i = 0; i < num_outputs; ++i) {
+    const char *const label_a = DS_network_output_label(a, i);
+    const char *const label_b = DS_network_output_label(b, i);
+    if ((label_a == NULL) != (label_b == NULL) ||
+        (label_a && strcmp(label_a, label_b) != 0))
+      return false;
+  }
+  return true;
+}
+
+/// DS_MODEL_fits with the lock held, so the current network is not freed.
+static bool fits_locked(DS_MODEL_Model *const model,
+                        const DS_Network *const network) {
+  const DS_Network *const current = atomic_load(&model->network);
+  return DS_network_same_layers(current, network) &&
+         same_output_labels(current, network);
+}
+
+bool DS_MODEL_fits(DS_MODEL_Model *const model,
+                   const DS_Network *const network) {
+  pthread_mutex_lock(&model->mutex);
+  const bool fits = fits_locked(model, network);
+  pthread_mutex_unlock(&model->mutex);
+  return fits;
+}
+
+bool DS_MODEL_publish(DS_MODEL_Model *const model, DS_Network *const network) {
+  pthread_mutex_lock(&model->mutex);
+  if (!fits_locked(model, network)) {
+    pthread_mutex_unlock(&model->mutex);
+    return false;
+  }
+  DS_Network *const old = atomic_exchange(&model->network, network);
+  const uint64_t epoch = atomic_fetch_add(&model->epoch, 1) + 1;
+  atomic_fetch_add(&model->generation, 1);
+  // NOTE: A reader in an older epoch may have entered with the old network,
+  // it finishes its prediction on it
+  for (DS_MODEL_Reader *reader = model->readers; reader;
+       reader = reader->next) {
+    uint64_t entered = 0;
+    while ((entered = atomic_load(&reader->epoch)) != 0 && entered < epoch) {
+      const struct timespec pause = {.tv_nsec = RECLAIM_POLL_NS};
+      nanosleep(&pause, NULL);
+    }
+  }
+  pthread_mutex_unlock(&model->mutex);
+  DS_network_free(old);
+  return true;
+}
+
+bool DS_MODEL_reload(DS_MODEL_Model *const model, const char *const path) {
+  pthread_mutex_lock(&model->loading);
+  DS_Network *network = DS_network_load(path);
+  pthread_mutex_unlock(&model->loading);
+  if (!network) {
+    DS_ERROR("Could not reload network \"%s\", keeping the current one.",
+             path);
+    return false;
+  }
+  if (!DS_MODEL_publish(model, network)) {
+    DS_ERROR("Network \"%s\" has other layers or outputs than the one "
+             "served, keeping the current one.",
+             path);
+    DS_network_free(network);
+    return false;
+  }
+  return true;
+}
+
+struct DS_MODEL_Watcher {
+  DS_MODEL_Model *model;
+  char *path;
+  unsigned long long interval_ns;
+  pthread_t thread;
+  struct stat seen; // NOTE: Zero if the file did not exist
+
+  pthread_mutex_t mutex; // Guards stop
+  pthread_cond_t stopped;
+  bool stop;
+};
+
+static unsigned long long watch_now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (unsigned long long)time.tv_sec * 1000000000ull +
+         (unsigned long long)time.tv_nsec;
+}
+
+/// Whether the file was modified since it was last seen, which it then is.
+static bool file_changed(DS_MODEL_Watcher *const watcher) {
+  struct stat info;
+  if (stat(watcher->path, &info) != 0)
+    return false; // NOTE: Between removing the old file and renaming the new
+  const bool changed = info.st_mtim.tv_sec != watcher->seen.st_mtim.tv_sec ||
+                       info.st_mtim.tv_nsec != watcher->seen.st_mtim.tv_nsec ||
+                       info.st_size != watcher->seen.st_size ||
+                       info.st_ino != watcher->seen.st_ino;
+  watcher->seen = info;
+  return changed;
+}
+
+static void *watcher_main(void *const arg) {
+  DS_MODEL_Watcher *const watcher = arg;
+  pthread_mutex_lock(&watcher->mutex);
+  while (!watcher->stop) {
+    const unsigned long long deadline_ns =
+        watch_now_ns() + watcher->interval_ns;
+    const struct timespec deadline = {
+        .tv_sec = (time_t)(deadline_ns / 1000000000ull),
+        .tv_nsec = (long)(deadline_ns % 1000000000ull),
+    };
+    pthread_cond_timedwait(&watcher->stopped, &watcher->mutex, &deadline);
+    if (watcher->stop)
+      break;
+    pthread_mutex_unlock(&watcher->mutex);
+    if (file_changed(watcher) &&
+        DS_MODEL_reload(watcher->model, watcher->path))
+      DS_PRINTF("Reloaded network \"%s\".\n", watcher->path);
+    pthread_mutex_lock(&watcher->mutex);
+  }
+  pthread_mutex_unlock(&watcher->mutex);
+  return NULL;
+}
+
+static void watcher_free_memory(DS_MODEL_Watcher *const watcher) {
+  pthread_cond_destroy(&watcher->stopped);
+  pthread_mutex_destroy(&watcher->mutex);
+  DS_FREE(watcher->path);
+  DS_FREE(watcher);
+}
+
+DS_MODEL_Watcher *DS_MODEL_watch(DS_MODEL_Model *const model,
+                                 const char *const path,
+                                 const double interval_seconds) {
+  DS_MODEL_Watcher *watcher = DS_CALLOC(1, sizeof(*watcher));
+  DS_ASSERT(watcher, "Could not watch network. Out of memory.");
+  watcher->path = DS_MALLOC(strlen(path) + 1);
+  DS_ASSERT(watcher->path, "Could not watch network. Out of memory.");
+  strcpy(watcher->path, path);
+  watcher->model = model;
+  watcher->interval_ns =
+      (unsigned long long)(DS_MAX(interval_seconds, 1e-3) * 1e9);
+  // NOTE: The file as it is now is the one already served
+  file_changed(watcher);
+  pthread_mutex_init(&watcher->mutex, NULL);
+  pthread_condattr_t attributes;
+  pthread_condattr_init(&attributes);
+  pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+  pthread_cond_init(&watcher->stopped, &attributes);
+  pthread_condattr_destroy(&attributes);
+
+  const int error =
+      pthread_create(&watcher->thread, NULL, &watcher_main, watcher);
+  if (error != 0) {
+    DS_ERROR("Could not watch network \"%s\": %s", path, strerror(error));
+    watcher_free_memory(watcher);
+    return NULL;
+  }
+  return watcher;
+}
+
+void DS_MODEL_watcher_free(DS_MODEL_Watcher *const watcher) {
+  pthread_mutex_lock(&watcher->mutex);
+  watcher->stop = true;
+  pthread_cond_signal(&watcher->stopped);
+  pthread_mutex_unlock(&watcher->mutex);
+  pthread_join(watcher->thread, NULL);
+  watcher_free_memory(watcher);
+}
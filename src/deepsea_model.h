@@ -0,0 +1,73 @@
+#ifndef DEEPSEA_MODEL_H
+#define DEEPSEA_MODEL_H
+
+#include "deepsea.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Network that can be replaced while threads predict with it. A thread
+/// registers a reader once and brackets every use of the network with
+/// DS_MODEL_enter and DS_MODEL_leave, which costs two atomic stores and
+/// never waits. A new network is published with an atomic pointer swap:
+/// threads that enter afterwards get the new one, those inside keep the one
+/// they entered with. The replaced network is freed by the publisher once
+/// every reader has left the epoch it may have entered in, so a swap never
+/// stalls a prediction.
+///
+/// A replacement must keep the serving contract: as many layers of the same
+/// sizes, so the activations of every DS_Inference fit, and the same output
+/// labels, so clients see the same classes.
+typedef struct DS_MODEL_Model DS_MODEL_Model;
+typedef struct DS_MODEL_Reader DS_MODEL_Reader;
+
+/// Takes ownership of the network.
+DS_MODEL_Model *DS_MODEL_create(DS_Network *const network);
+
+/// Frees the current network. Every reader must be unregistered.
+void DS_MODEL_free(DS_MODEL_Model *const model);
+
+/// Number of networks published since the model was created.
+size_t DS_MODEL_generation(DS_MODEL_Model *const model);
+
+/// Registers a reader for one thread.
+DS_MODEL_Reader *DS_MODEL_reader_register(DS_MODEL_Model *const model);
+
+void DS_MODEL_reader_unregister(DS_MODEL_Reader *const reader);
+
+/// Returns the current network, which stays valid until DS_MODEL_leave. A
+/// reader cannot enter twice before leaving.
+const DS_Network *DS_MODEL_enter(DS_MODEL_Reader *const reader);
+
+void DS_MODEL_leave(DS_MODEL_Reader *const reader);
+
+/// Whether the network keeps the serving contract of the model.
+bool DS_MODEL_fits(DS_MODEL_Model *const model,
+                   const DS_Network *const network);
+
+/// Replaces the network of the model and frees the old one once no reader
+/// uses it any more, which this call waits for. Returns false and leaves the
+/// network to the caller if it does not keep the serving contract.
+bool DS_MODEL_publish(DS_MODEL_Model *const model, DS_Network *const network);
+
+/// Loads the network saved at `path` in the calling thread and publishes
+/// it. Returns false, keeping the current network, if it cannot be loaded
+/// or does not keep the serving contract.
+bool DS_MODEL_reload(DS_MODEL_Model *const model, const char *const path);
+
+/// Thread that reloads the model whenever the modification time or size of
+/// a file changes. A file should be replaced by renaming a complete one
+/// over it, a half written file that cannot be loaded is only retried once
+/// it changes again.
+typedef struct DS_MODEL_Watcher DS_MODEL_Watcher;
+
+#define DS_MODEL_DEFAULT_WATCH_INTERVAL_SECONDS 1.
+
+/// Looks at the file every interval_seconds. The model must outlive the
+/// watcher. Returns NULL if the thread cannot be started.
+DS_MODEL_Watcher *DS_MODEL_watch(DS_MODEL_Model *const model,
+                                 const char *const path,
+                                 const double interval_seconds);
+
+void DS_MODEL_watcher_free(DS_MODEL_Watcher *const watcher);
+
+#endif // DEEPSEA_MODEL_H
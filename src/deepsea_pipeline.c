@@ -0,0 +1,753 @@
+#include "deepsea_pipeline.h"
+#include "deepsea_alloc.h"
+#include "deepsea_png.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SPINS_BEFORE_SLEEP 64
+#define STALL_SLEEP_NS 50000
+#define NS_PER_SECOND 1000000000ull
+// NOTE: Out-of-core streaming reads chunks of consecutive files of about this
+// size and keeps at least a few of them in every shuffle buffer
+#define STREAM_CHUNK_SIZE (8ul << 20)
+#define STREAM_MIN_WINDOW_CHUNKS 4
+
+// Bounded lock-free multi-producer multi-consumer queue of buffer indexes
+// (Dmitry Vyukov's design). Every cell carries a sequence number that tells
+// producers and consumers whether it is theirs to use.
+typedef struct {
+  atomic_size_t sequence;
+  size_t value;
+} QueueCell;
+
+typedef struct {
+  QueueCell *cells;
+  size_t mask;
+  atomic_size_t enqueue_position;
+  atomic_size_t dequeue_position;
+} Queue;
+
+static void queue_init(Queue *const queue, const size_t min_capacity) {
+  size_t capacity = 1;
+  while (capacity < min_capacity)
+    capacity <<= 1;
+  queue->cells = DS_MALLOC(capacity * sizeof(queue->cells[0]));
+  DS_ASSERT(queue->cells, "Could not create queue. Out of memory.");
+  for (size_t i = 0; i < capacity; ++i)
+    atomic_init(&queue->cells[i].sequence, i);
+  queue->mask = capacity - 1;
+  atomic_init(&queue->enqueue_position, 0);
+  atomic_init(&queue->dequeue_position, 0);
+}
+
+static void queue_free(Queue *const queue) { DS_FREE(queue->cells); }
+
+static bool queue_push(Queue *const queue, const size_t value) {
+  size_t position =
+      atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+  QueueCell *cell = NULL;
+  while (1) {
+    cell = &queue->cells[position & queue->mask];
+    const size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &queue->enqueue_position, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      return false; // Full
+    } else {
+      position =
+          atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+    }
+  }
+  cell->value = value;
+  atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+  return true;
+}
+
+static bool queue_pop(Queue *const queue, size_t *const value) {
+  size_t position =
+      atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+  QueueCell *cell = NULL;
+  while (1) {
+    cell = &queue->cells[position & queue->mask];
+    const size_t sequence =
+        atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &queue->dequeue_position, &position, position + 1,
+              memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      return false; // Empty
+    } else {
+      position =
+          atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+    }
+  }
+  *value = cell->value;
+  atomic_store_explicit(&cell->sequence, position + queue->mask + 1,
+                        memory_order_release);
+  return true;
+}
+
+static unsigned long long now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (unsigned long long)time.tv_sec * NS_PER_SECOND +
+         (unsigned long long)time.tv_nsec;
+}
+
+/// Pops a value, waiting until one is available. Returns the time spent
+/// waiting or ULLONG_MAX if `stop` was set while waiting.
+static unsigned long long queue_pop_waiting(Queue *const queue,
+                                            size_t *const value,
+                                            const atomic_bool *const stop) {
+  if (queue_pop(queue, value))
+    return 0;
+
+  const unsigned long long start = now_ns();
+  for (size_t spins = 0; !queue_pop(queue, value); ++spins) {
+    if (stop && atomic_load(stop))
+      return ULLONG_MAX;
+    if (spins < SPINS_BEFORE_SLEEP) {
+      sched_yield();
+    } else {
+      const struct timespec pause = {.tv_sec = 0, .tv_nsec = STALL_SLEEP_NS};
+      nanosleep(&pause, NULL);
+    }
+  }
+  return now_ns() - start;
+}
+
+typedef enum {
+  SOURCE_DATA_SET,
+  SOURCE_FILE_LIST,
+  SOURCE_SHARD_SET,
+} SourceType;
+
+typedef struct {
+  DS_LabelledView view; // NOTE: Must be the first member
+  uint8_t *pixels;
+  uint16_t *classes;
+  size_t batch_index; // Of the current epoch
+  bool failed;
+} BatchSlot;
+
+typedef struct {
+  DS_PIPELINE_Pipeline *pipeline;
+  size_t loader;
+} LoaderArgs;
+
+struct DS_PIPELINE_Pipeline {
+  SourceType source_type;
+  const DS_DATA_Set *data_set;
+  const DS_FILE_FileList *file_list;
+  size_t *file_labels; // Labels of the file list, determined up front
+  const DS_SHARD_Set *shard_set;
+  uint8_t *file_buffers; // One file of the shards per loader
+  DS_PNG_Decoder **decoders; // One per loader if resampling, otherwise NULL
+  size_t num_decoders;
+  // NOTE: Out-of-core streaming of the shards, see
+  // DS_PIPELINE_set_memory_budget
+  size_t chunk_files;    // Consecutive files shuffled as a chunk, 0 if off
+  size_t window_chunks;  // Chunks of a shuffle buffer
+  size_t window_samples; // Samples of a shuffle buffer
+  size_t num_windows;
+  size_t *chunk_stamps; // Last advice given for every chunk
+  size_t count;
+  size_t input_length;
+  size_t batch_size;
+  size_t num_batches;
+  DS_BatchIterator *samples; // Sample permutation of the current epoch
+  size_t first_batch;        // Of the next epoch, see DS_PIPELINE_resume
+
+  BatchSlot *slots;
+  DS_ALLOC_Arena *batch_arena; // Inputs and labels of all slots
+  size_t batch_arena_size;
+  size_t depth;
+  Queue free_slots;
+  Queue full_slots;
+  // NOTE: Slot + 1 of every batch that arrived ahead of its turn, by batch
+  // index modulo depth, 0 if none. Only touched by the trainer.
+  size_t *early_slots;
+
+  pthread_t *loaders;
+  LoaderArgs *loader_args;
+  size_t num_loaders;
+  pthread_mutex_t mutex;
+  pthread_cond_t epoch_started;
+  size_t epoch;
+  atomic_bool stop;
+
+  atomic_size_t next_batch; // Next batch of the epoch to be claimed
+  size_t consumed_batches;
+  atomic_bool failed;
+  atomic_ullong loader_stall_ns;
+  unsigned long long trainer_stall_ns;
+  size_t batches;
+};
+
+/// Prints why a loader's decoder failed, a NULL decoder printed it already.
+static bool sample_decode_failed(const DS_PNG_Decoder *const decoder) {
+  if (decoder)
+    DS_ERROR("%s", DS_PNG_decoder_error(decoder));
+  return false;
+}
+
+/// Loads the grey values and the class of a sample.
+static bool load_sample(DS_PIPELINE_Pipeline *const pipeline,
+                        const size_t loader, const size_t sample,
+                        uint8_t *const pixels, uint16_t *const class) {
+  switch (pipeline->source_type) {
+  case SOURCE_DATA_SET: {
+    memcpy(pixels,
+           &pipeline->data_set->pixels[sample * pipeline->input_length],
+           pipeline->input_length);
+    *class = pipeline->data_set->labels[sample];
+  } break;
+  case SOURCE_FILE_LIST: {
+    DS_PNG_Decoder *const decoder =
+        pipeline->decoders ? pipeline->decoders[loader] : NULL;
+    if (!DS_PNG_decode_grey_pixels(decoder, pipeline->file_list->paths[sample],
+                                   pixels, pipeline->input_length))
+      return sample_decode_failed(decoder);
+    *class = (uint16_t)pipeline->file_labels[sample];
+  } break;
+  case SOURCE_SHARD_SET: {
+    const uint8_t *file = NULL;
+    size_t size = 0;
+    if (pipeline->chunk_files > 0) {
+      // NOTE: Streaming decodes straight from the mapped shard
+      file = DS_SHARD_set_file_data(pipeline->shard_set, sample, &size);
+    } else {
+      const size_t max_size = DS_SHARD_set_max_file_size(pipeline->shard_set);
+      uint8_t *const buffer = &pipeline->file_buffers[loader * max_size];
+      if (!DS_SHARD_set_read_file(pipeline->shard_set, sample, buffer, &size))
+        return false;
+      file = buffer;
+    }
+    DS_PNG_Decoder *const decoder =
+        pipeline->decoders ? pipeline->decoders[loader] : NULL;
+    if (!DS_PNG_decode_grey_pixels_from_memory(decoder, file, size, pixels,
+                                               pipeline->input_length))
+      return sample_decode_failed(decoder);
+    *class = (uint16_t)pipeline->file_labels[sample];
+  } break;
+  default:
+    DS_ASSERT(false, "Unreachable");
+  }
+  return true;
+}
+
+/// Gives the same advice for all chunks with samples in shuffle buffer
+/// `window` of the current epoch, once per chunk. The caller must hold the
+/// mutex.
+static void advise_window(DS_PIPELINE_Pipeline *const pipeline,
+                          const size_t window, const bool will_need) {
+  if (window >= pipeline->num_windows)
+    return;
+  const size_t stamp =
+      (((pipeline->epoch * pipeline->num_windows + window) << 1) | will_need) +
+      1;
+  const size_t first = window * pipeline->window_samples;
+  const size_t end = DS_MIN(first + pipeline->window_samples, pipeline->count);
+  for (size_t position = first; position < end;) {
+    const size_t *indexes = NULL;
+    const size_t batch_start = position - position % pipeline->batch_size;
+    const size_t count = DS_batch_iterator_batch(
+        pipeline->samples, position / pipeline->batch_size, &indexes);
+    const size_t stop = DS_MIN(end, batch_start + count);
+    for (; position < stop; ++position) {
+      const size_t chunk = indexes[position - batch_start] /
+                           pipeline->chunk_files;
+      if (pipeline->chunk_stamps[chunk] == stamp)
+        continue;
+      pipeline->chunk_stamps[chunk] = stamp;
+      const size_t chunk_first = chunk * pipeline->chunk_files;
+      DS_SHARD_set_advise(
+          pipeline->shard_set, chunk_first,
+          DS_MIN(pipeline->chunk_files, pipeline->count - chunk_first),
+          will_need);
+    }
+  }
+}
+
+/// The batch that enters a shuffle buffer prefetches the chunks of the next
+/// one and drops those of the previous one, such that about two buffers are
+/// resident while the loaders move through an epoch.
+static void advise_entered_windows(DS_PIPELINE_Pipeline *const pipeline,
+                                   const size_t batch_index,
+                                   const size_t count) {
+  const size_t start = batch_index * pipeline->batch_size;
+  const size_t window_samples = pipeline->window_samples;
+  pthread_mutex_lock(&pipeline->mutex);
+  for (size_t window = (start + window_samples - 1) / window_samples;
+       window * window_samples < start + count; ++window) {
+    if (window > 0)
+      advise_window(pipeline, window - 1, false);
+    advise_window(pipeline, window + 1, true);
+  }
+  pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static void fill_slot(DS_PIPELINE_Pipeline *const pipeline,
+                      const size_t loader, BatchSlot *const slot,
+                      const size_t batch_index) {
+  const size_t *indexes = NULL;
+  const size_t count =
+      DS_batch_iterator_batch(pipeline->samples, batch_index, &indexes);
+  if (pipeline->chunk_files > 0)
+    advise_entered_windows(pipeline, batch_index, count);
+  slot->failed = false;
+  for (size_t i = 0; i < count && !slot->failed; ++i) {
+    slot->failed =
+        !load_sample(pipeline, loader, indexes[i],
+                     &slot->pixels[i * pipeline->input_length],
+                     &slot->classes[i]);
+  }
+  slot->view.count = count;
+  slot->batch_index = batch_index;
+}
+
+static void *loader_main(void *const arg) {
+  const LoaderArgs *const args = arg;
+  DS_PIPELINE_Pipeline *const pipeline = args->pipeline;
+  size_t seen_epoch = 0;
+
+  while (1) {
+    pthread_mutex_lock(&pipeline->mutex);
+    while (!atomic_load(&pipeline->stop) && pipeline->epoch == seen_epoch)
+      pthread_cond_wait(&pipeline->epoch_started, &pipeline->mutex);
+    seen_epoch = pipeline->epoch;
+    pthread_mutex_unlock(&pipeline->mutex);
+    if (atomic_load(&pipeline->stop))
+      break;
+
+    while (1) {
+      // NOTE: A batch is only claimed with a buffer at hand, so the claimed
+      // batches that are not consumed yet fit into the buffers and the
+      // trainer never waits for a batch whose loader waits for a buffer
+      size_t slot = 0;
+      const unsigned long long stall =
+          queue_pop_waiting(&pipeline->free_slots, &slot, &pipeline->stop);
+      if (stall == ULLONG_MAX)
+        return NULL;
+      atomic_fetch_add(&pipeline->loader_stall_ns, stall);
+      const size_t batch_index = atomic_fetch_add(&pipeline->next_batch, 1);
+      if (batch_index >= pipeline->num_batches) {
+        queue_push(&pipeline->free_slots, slot);
+        break;
+      }
+
+      fill_slot(pipeline, args->loader, &pipeline->slots[slot], batch_index);
+      DS_ASSERT(queue_push(&pipeline->full_slots, slot),
+                "Pipeline queue overflow.");
+    }
+  }
+  return NULL;
+}
+
+static DS_PIPELINE_Pipeline *
+pipeline_create(const SourceType source_type, const size_t count,
+                const DS_Network *const network, const size_t batch_size,
+                const size_t depth, size_t num_loaders) {
+  DS_ASSERT(batch_size > 0 && depth > 0,
+            "Batch size and pipeline depth must be positive.");
+  if (num_loaders == 0) {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_loaders = online > 0 ? (size_t)online : 1;
+  }
+
+  DS_PIPELINE_Pipeline *pipeline = DS_CALLOC(1, sizeof(*pipeline));
+  DS_ASSERT(pipeline, "Could not create pipeline. Out of memory.");
+  pipeline->source_type = source_type;
+  pipeline->count = count;
+  pipeline->input_length = DS_network_input_layer_size(network);
+  pipeline->batch_size = batch_size;
+  pipeline->num_batches = (count + batch_size - 1) / batch_size;
+  pipeline->consumed_batches = pipeline->num_batches; // No epoch running
+  pipeline->depth = depth;
+
+  pipeline->samples = DS_batch_iterator_create(
+      count, batch_size, DS_batch_iterator_random_seed());
+  pipeline->slots = DS_CALLOC(depth, sizeof(pipeline->slots[0]));
+  pipeline->early_slots = DS_CALLOC(depth, sizeof(pipeline->early_slots[0]));
+  pipeline->loaders = DS_MALLOC(num_loaders * sizeof(pipeline->loaders[0]));
+  pipeline->loader_args =
+      DS_MALLOC(num_loaders * sizeof(pipeline->loader_args[0]));
+  DS_ASSERT(pipeline->slots && pipeline->early_slots && pipeline->loaders &&
+                pipeline->loader_args,
+            "Could not create pipeline. Out of memory.");
+  // NOTE: All batch buffers live in one arena, every batch is one contiguous
+  // block of grey values and one of classes
+  const size_t pixels_size = batch_size * pipeline->input_length;
+  const size_t classes_size = batch_size * sizeof(uint16_t);
+  pipeline->batch_arena_size =
+      depth * (DS_ALLOC_arena_size(pixels_size) +
+               DS_ALLOC_arena_size(classes_size));
+  pipeline->batch_arena = DS_ALLOC_arena_create(pipeline->batch_arena_size);
+  for (size_t s = 0; s < depth; ++s) {
+    uint8_t *const pixels =
+        DS_ALLOC_arena_alloc(pipeline->batch_arena, pixels_size);
+    uint16_t *const classes =
+        DS_ALLOC_arena_alloc(pipeline->batch_arena, classes_size);
+    DS_ASSERT(pixels && classes, "Pipeline arena is too small.");
+    pipeline->slots[s].pixels = pixels;
+    pipeline->slots[s].classes = classes;
+    pipeline->slots[s].view = (DS_LabelledView){
+        .inputs = pixels,
+        .input_stride = pipeline->input_length,
+        .input_length = pipeline->input_length,
+        .input_type = DS_DTYPE_U8,
+        .labels = classes,
+    };
+  }
+
+  queue_init(&pipeline->free_slots, depth);
+  queue_init(&pipeline->full_slots, depth);
+  for (size_t s = 0; s < depth; ++s)
+    queue_push(&pipeline->free_slots, s);
+
+  pthread_mutex_init(&pipeline->mutex, NULL);
+  pthread_cond_init(&pipeline->epoch_started, NULL);
+  atomic_init(&pipeline->stop, false);
+  atomic_init(&pipeline->next_batch, 0);
+  atomic_init(&pipeline->failed, false);
+  atomic_init(&pipeline->loader_stall_ns, 0);
+
+  for (size_t l = 0; l < num_loaders; ++l) {
+    pipeline->loader_args[l] =
+        (LoaderArgs){.pipeline = pipeline, .loader = l};
+    const int error = pthread_create(&pipeline->loaders[l], NULL, &loader_main,
+                                     &pipeline->loader_args[l]);
+    if (error != 0) {
+      DS_ERROR("Could only start %lu of %lu loader threads: %s", l,
+               num_loaders, strerror(error));
+      break;
+    }
+    pipeline->num_loaders = l + 1;
+  }
+  return pipeline;
+}
+
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_data_set(const DS_DATA_Set *const data_set,
+                                 const DS_Network *const network,
+                                 const size_t batch_size, const size_t depth,
+                                 const size_t num_loaders) {
+  const size_t output_length = DS_network_output_layer_size(network);
+  const size_t max_label = output_length - 1;
+  if (data_set->input_length != DS_network_input_layer_size(network)) {
+    DS_ERROR("Data set input length does not fit network input size, must be "
+             "%lu but got %lu",
+             DS_network_input_layer_size(network), data_set->input_length);
+    return NULL;
+  }
+  for (size_t i = 0; i < data_set->count; ++i) {
+    if (data_set->labels[i] > max_label) {
+      DS_ERROR("Label of sample %lu is bigger than maximum label "
+               "representable by the number of outputs: %lu",
+               i, max_label);
+      return NULL;
+    }
+  }
+
+  DS_PIPELINE_Pipeline *pipeline =
+      pipeline_create(SOURCE_DATA_SET, data_set->count, network, batch_size,
+                      depth, num_loaders);
+  pipeline->data_set = data_set;
+  return pipeline;
+}
+
+/// Labels of all files of the list, NULL if any is invalid.
+static size_t *file_list_labels(const DS_FILE_FileList *const file_list,
+                                const DS_Network *const network) {
+  const size_t output_length = DS_network_output_layer_size(network);
+  const size_t max_label = output_length - 1;
+  size_t *labels = DS_MALLOC(DS_MAX(file_list->count, 1) * sizeof(labels[0]));
+  DS_ASSERT(labels, "Could not create pipeline. Out of memory.");
+  for (size_t i = 0; i < file_list->count; ++i) {
+    errno = 0;
+    labels[i] = DS_FILE_file_list_label(file_list, i);
+    if ((labels[i] == 0 && errno != 0) || labels[i] > max_label ||
+        labels[i] > UINT16_MAX) {
+      DS_ERROR("Could not get a valid output label for file \"%s\"",
+               file_list->paths[i]);
+      DS_FREE(labels);
+      return NULL;
+    }
+  }
+  return labels;
+}
+
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_file_list(const DS_FILE_FileList *const file_list,
+                                  const DS_Network *const network,
+                                  const size_t batch_size, const size_t depth,
+                                  const size_t num_loaders) {
+  size_t *labels = file_list_labels(file_list, network);
+  if (!labels)
+    return NULL;
+
+  DS_PIPELINE_Pipeline *pipeline =
+      pipeline_create(SOURCE_FILE_LIST, file_list->count, network, batch_size,
+                      depth, num_loaders);
+  pipeline->file_list = file_list;
+  pipeline->file_labels = labels;
+  return pipeline;
+}
+
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_shard_set(const DS_SHARD_Set *const shard_set,
+                                  const DS_Network *const network,
+                                  const size_t batch_size, const size_t depth,
+                                  const size_t num_loaders) {
+  const DS_FILE_FileList *const file_list = DS_SHARD_set_file_list(shard_set);
+  size_t *labels = file_list_labels(file_list, network);
+  if (!labels)
+    return NULL;
+
+  DS_PIPELINE_Pipeline *pipeline =
+      pipeline_create(SOURCE_SHARD_SET, file_list->count, network, batch_size,
+                      depth, num_loaders);
+  pipeline->file_list = file_list;
+  pipeline->file_labels = labels;
+  pipeline->shard_set = shard_set;
+  // NOTE: The loaders wait for the first epoch, so their buffers can be set
+  // up after they started. Without loader threads the caller uses buffer 0.
+  pipeline->file_buffers =
+      DS_MALLOC(DS_MAX(pipeline->num_loaders, 1) *
+                DS_MAX(DS_SHARD_set_max_file_size(shard_set), 1));
+  DS_ASSERT(pipeline->file_buffers,
+            "Could not create pipeline. Out of memory.");
+  return pipeline;
+}
+
+void DS_PIPELINE_free(DS_PIPELINE_Pipeline *const pipeline) {
+  pthread_mutex_lock(&pipeline->mutex);
+  atomic_store(&pipeline->stop, true);
+  pthread_cond_broadcast(&pipeline->epoch_started);
+  pthread_mutex_unlock(&pipeline->mutex);
+  for (size_t l = 0; l < pipeline->num_loaders; ++l)
+    pthread_join(pipeline->loaders[l], NULL);
+
+  pthread_cond_destroy(&pipeline->epoch_started);
+  pthread_mutex_destroy(&pipeline->mutex);
+  queue_free(&pipeline->full_slots);
+  queue_free(&pipeline->free_slots);
+  DS_ALLOC_arena_free(pipeline->batch_arena);
+  DS_FREE(pipeline->early_slots);
+  DS_FREE(pipeline->slots);
+  DS_FREE(pipeline->loader_args);
+  DS_FREE(pipeline->loaders);
+  DS_batch_iterator_free(pipeline->samples);
+  for (size_t d = 0; d < pipeline->num_decoders; ++d)
+    DS_PNG_decoder_free(pipeline->decoders[d]);
+  DS_FREE(pipeline->decoders);
+  DS_FREE(pipeline->chunk_stamps);
+  DS_FREE(pipeline->file_buffers);
+  DS_FREE(pipeline->file_labels);
+  DS_FREE(pipeline);
+}
+
+void DS_PIPELINE_set_block_shuffle(DS_PIPELINE_Pipeline *const pipeline,
+                                   const size_t block_size,
+                                   const size_t window) {
+  DS_ASSERT(pipeline->consumed_batches == pipeline->num_batches,
+            "Cannot change the shuffling during an epoch.");
+  DS_ASSERT(pipeline->chunk_files == 0,
+            "Streaming out of core already shuffles in chunks.");
+  DS_batch_iterator_set_block_shuffle(pipeline->samples, block_size, window);
+}
+
+void DS_PIPELINE_set_resampling(DS_PIPELINE_Pipeline *const pipeline,
+                                const DS_RESAMPLE_Options *const options) {
+  DS_ASSERT(pipeline->source_type != SOURCE_DATA_SET,
+            "Only PNGs can be resampled while loading.");
+  DS_ASSERT(pipeline->consumed_batches == pipeline->num_batches,
+            "Cannot change the resampling during an epoch.");
+  if (!pipeline->decoders) {
+    // NOTE: Without loader threads the calling thread uses decoder 0
+    pipeline->num_decoders = DS_MAX(pipeline->num_loaders, 1);
+    pipeline->decoders =
+        DS_MALLOC(pipeline->num_decoders * sizeof(pipeline->decoders[0]));
+    DS_ASSERT(pipeline->decoders, "Could not create decoders. Out of memory.");
+    for (size_t d = 0; d < pipeline->num_decoders; ++d)
+      pipeline->decoders[d] = DS_PNG_decoder_create();
+  }
+  for (size_t d = 0; d < pipeline->num_decoders; ++d)
+    DS_PNG_decoder_set_resampling(pipeline->decoders[d], options);
+}
+
+bool DS_PIPELINE_set_memory_budget(DS_PIPELINE_Pipeline *const pipeline,
+                                   const size_t memory_budget) {
+  DS_ASSERT(pipeline->source_type == SOURCE_SHARD_SET,
+            "Only shards can be streamed out of core.");
+  DS_ASSERT(pipeline->consumed_batches == pipeline->num_batches,
+            "Cannot change the memory budget during an epoch.");
+  const DS_SHARD_Set *const set = pipeline->shard_set;
+  const size_t count = pipeline->count;
+  const size_t max_file_size = DS_SHARD_set_max_file_size(set);
+  // NOTE: Besides the shuffle buffers, the batch buffers, one file buffer
+  // per loader and per sample its label, its place in the permutation and
+  // at most one chunk stamp and one chunk in the chunk permutation
+  const size_t fixed_size = pipeline->batch_arena_size +
+                            DS_MAX(pipeline->num_loaders, 1) * max_file_size +
+                            count * 4 * sizeof(size_t);
+  // NOTE: The loaders work on one shuffle buffer while the next is read
+  const size_t window_size =
+      memory_budget > fixed_size ? (memory_budget - fixed_size) / 2 : 0;
+  if (window_size < STREAM_MIN_WINDOW_CHUNKS * 2 * max_file_size) {
+    DS_ERROR("Memory budget of %lu bytes is too small to stream the shards, "
+             "the pipeline alone needs %lu bytes.",
+             memory_budget, fixed_size);
+    return false;
+  }
+
+  const size_t average_size = (size_t)DS_MAX(
+      DS_SHARD_set_data_size(set) / DS_MAX(count, 1), 1);
+  const size_t chunk_size =
+      DS_MIN(STREAM_CHUNK_SIZE, window_size / STREAM_MIN_WINDOW_CHUNKS);
+  // NOTE: A chunk of one file would turn the block shuffle into a full one
+  pipeline->chunk_files = DS_MAX(chunk_size / average_size, 2);
+  pipeline->window_chunks =
+      DS_MAX(window_size / (pipeline->chunk_files * average_size), 1);
+  pipeline->window_samples = pipeline->chunk_files * pipeline->window_chunks;
+  pipeline->num_windows =
+      (count + pipeline->window_samples - 1) / pipeline->window_samples;
+  DS_FREE(pipeline->chunk_stamps);
+  pipeline->chunk_stamps =
+      DS_CALLOC(DS_MAX(count / pipeline->chunk_files + 1, 1),
+                sizeof(pipeline->chunk_stamps[0]));
+  DS_ASSERT(pipeline->chunk_stamps,
+            "Could not stream the shards. Out of memory.");
+  DS_batch_iterator_set_block_shuffle(pipeline->samples, pipeline->chunk_files,
+                                      pipeline->window_chunks);
+  return true;
+}
+
+uint64_t DS_PIPELINE_seed(const DS_PIPELINE_Pipeline *const pipeline) {
+  return DS_batch_iterator_seed(pipeline->samples);
+}
+
+void DS_PIPELINE_resume(DS_PIPELINE_Pipeline *const pipeline,
+                        const uint64_t seed, const size_t epoch,
+                        const size_t batch) {
+  DS_ASSERT(pipeline->consumed_batches == pipeline->num_batches,
+            "Cannot resume during an epoch.");
+  DS_ASSERT(batch <= pipeline->num_batches,
+            "Batch %lu is out of range of the epoch.", batch);
+  DS_batch_iterator_seek(pipeline->samples, seed, epoch);
+  pipeline->first_batch = batch;
+}
+
+void DS_PIPELINE_start_epoch(DS_PIPELINE_Pipeline *const pipeline) {
+  DS_ASSERT(pipeline->consumed_batches == pipeline->num_batches,
+            "Previous epoch has not been consumed completely.");
+  DS_batch_iterator_start_epoch(pipeline->samples);
+  // NOTE: The batches before first_batch count as consumed, no loader
+  // claims them
+  pipeline->consumed_batches = pipeline->first_batch;
+  atomic_store(&pipeline->next_batch, pipeline->first_batch);
+
+  pthread_mutex_lock(&pipeline->mutex);
+  ++pipeline->epoch;
+  if (pipeline->chunk_files > 0) {
+    // NOTE: Drop what is left of the last epoch and read the first buffer
+    DS_SHARD_set_advise(pipeline->shard_set, 0, pipeline->count, false);
+    advise_window(pipeline,
+                  pipeline->first_batch * pipeline->batch_size /
+                      pipeline->window_samples,
+                  true);
+  }
+  pipeline->first_batch = 0;
+  pthread_cond_broadcast(&pipeline->epoch_started);
+  pthread_mutex_unlock(&pipeline->mutex);
+}
+
+const DS_LabelledView *
+DS_PIPELINE_next_batch(DS_PIPELINE_Pipeline *const pipeline) {
+  if (pipeline->consumed_batches == pipeline->num_batches ||
+      atomic_load(&pipeline->failed))
+    return NULL;
+
+  size_t slot = 0;
+  if (pipeline->num_loaders == 0) {
+    // NOTE: No loader threads, load on the calling thread
+    const size_t batch_index = atomic_fetch_add(&pipeline->next_batch, 1);
+    DS_ASSERT(queue_pop(&pipeline->free_slots, &slot),
+              "All batch buffers are in use.");
+    fill_slot(pipeline, 0, &pipeline->slots[slot], batch_index);
+  } else {
+    // NOTE: Batches are handed out in the order of the epoch, whichever
+    // loader finishes first
+    size_t *const expected =
+        &pipeline->early_slots[pipeline->consumed_batches % pipeline->depth];
+    while (*expected == 0) {
+      pipeline->trainer_stall_ns +=
+          queue_pop_waiting(&pipeline->full_slots, &slot, NULL);
+      pipeline->early_slots[pipeline->slots[slot].batch_index %
+                            pipeline->depth] = slot + 1;
+    }
+    slot = *expected - 1;
+    *expected = 0;
+  }
+  ++pipeline->consumed_batches;
+  ++pipeline->batches;
+
+  if (pipeline->slots[slot].failed) {
+    atomic_store(&pipeline->failed, true);
+    queue_push(&pipeline->free_slots, slot);
+    return NULL;
+  }
+  return &pipeline->slots[slot].view;
+}
+
+void DS_PIPELINE_release_batch(DS_PIPELINE_Pipeline *const pipeline,
+                               const DS_LabelledView *const batch) {
+  const BatchSlot *const slot = (const BatchSlot *)batch;
+  DS_ASSERT(slot >= pipeline->slots && slot < pipeline->slots + pipeline->depth,
+            "Batch does not belong to the pipeline.");
+  DS_ASSERT(queue_push(&pipeline->free_slots, (size_t)(slot - pipeline->slots)),
+            "Pipeline queue overflow.");
+}
+
+bool DS_PIPELINE_failed(const DS_PIPELINE_Pipeline *const pipeline) {
+  return atomic_load(&pipeline->failed);
+}
+
+DS_PIPELINE_Stats DS_PIPELINE_stats(const DS_PIPELINE_Pipeline *const pipeline) {
+  return (DS_PIPELINE_Stats){
+      .batches = pipeline->batches,
+      .trainer_stall_seconds =
+          (double)pipeline->trainer_stall_ns / NS_PER_SECOND,
+      .loader_stall_seconds =
+          (double)atomic_load(&pipeline->loader_stall_ns) / NS_PER_SECOND,
+  };
+}
+
+void DS_PIPELINE_print_stats(const DS_PIPELINE_Pipeline *const pipeline) {
+  const DS_PIPELINE_Stats stats = DS_PIPELINE_stats(pipeline);
+  DS_PRINTF("Pipeline: %lu batches with %lu loader threads. Trainer waited "
+            "%.2fs for data (I/O-bound), loaders waited %.2fs for free "
+            "buffers (compute-bound).\n",
+            stats.batches, pipeline->num_loaders, stats.trainer_stall_seconds,
+            stats.loader_stall_seconds);
+  if (pipeline->chunk_files > 0)
+    DS_PRINTF("Streamed the shards in chunks of %lu files with %lu chunks "
+              "per shuffle buffer.\n",
+              pipeline->chunk_files, pipeline->window_chunks);
+}
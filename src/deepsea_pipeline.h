@@ -0,0 +1,114 @@
+#ifndef DEEPSEA_PIPELINE_H
+#define DEEPSEA_PIPELINE_H
+
+#include "deepsea.h"
+#include "deepsea_data.h"
+#include "deepsea_file.h"
+#include "deepsea_resample.h"
+#include "deepsea_shard.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/// Background data loading for training. Loader threads assemble the next
+/// minibatches of an epoch into a fixed set of preallocated batch buffers
+/// while the trainer works on the current one. Full and free buffers are
+/// passed between the threads through bounded lock-free queues. The trainer
+/// gets the batches in the order of the epoch, no matter which loader
+/// finishes first, so training runs are reproducible.
+typedef struct DS_PIPELINE_Pipeline DS_PIPELINE_Pipeline;
+
+typedef struct {
+  size_t batches;               // Number of batches handed to the trainer
+  double trainer_stall_seconds; // Time the trainer waited for a full batch
+  double loader_stall_seconds;  // Time the loaders waited for a free buffer
+} DS_PIPELINE_Stats;
+
+/// Load the minibatches from the rows of an in-memory data set, which must
+/// outlive the pipeline.
+/// `depth` is the number of batch buffers, i.e. how many batches are loaded
+/// ahead. If num_loaders is 0, one loader per processor is started. If no
+/// loader thread can be started, batches are loaded on the calling thread.
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_data_set(const DS_DATA_Set *const data_set,
+                                 const DS_Network *const network,
+                                 const size_t batch_size, const size_t depth,
+                                 const size_t num_loaders);
+
+/// Load the minibatches by decoding the PNGs of a file list, which must
+/// outlive the pipeline. Returns NULL if a label cannot be determined.
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_file_list(const DS_FILE_FileList *const file_list,
+                                  const DS_Network *const network,
+                                  const size_t batch_size, const size_t depth,
+                                  const size_t num_loaders);
+
+/// Load the minibatches by reading the PNGs of a set of shards one by one,
+/// which must outlive the pipeline. Returns NULL if a label is invalid.
+DS_PIPELINE_Pipeline *
+DS_PIPELINE_create_from_shard_set(const DS_SHARD_Set *const shard_set,
+                                  const DS_Network *const network,
+                                  const size_t batch_size, const size_t depth,
+                                  const size_t num_loaders);
+
+void DS_PIPELINE_free(DS_PIPELINE_Pipeline *const pipeline);
+
+/// Shuffle blocks of samples instead of single samples from the next epoch
+/// on, see DS_batch_iterator_set_block_shuffle.
+void DS_PIPELINE_set_block_shuffle(DS_PIPELINE_Pipeline *const pipeline,
+                                   const size_t block_size,
+                                   const size_t window);
+
+/// Resample the PNGs of a file list to the given size while loading them
+/// from the next epoch on, see DS_PNG_decoder_set_resampling. NULL turns it
+/// off.
+void DS_PIPELINE_set_resampling(DS_PIPELINE_Pipeline *const pipeline,
+                                const DS_RESAMPLE_Options *const options);
+
+/// Stream the shards out of core from the next epoch on, for data sets that
+/// do not fit into memory. The samples are decoded straight from the mapped
+/// shards and shuffled in chunks of a few MiB of consecutive files: every
+/// epoch permutes the chunks and mixes the samples within every shuffle
+/// buffer of consecutive chunks of that order, see
+/// DS_batch_iterator_set_block_shuffle. While the loaders work on one
+/// buffer, the chunks of the next one are read ahead with large sequential
+/// reads and those of the previous one are dropped, such that the pipeline
+/// keeps about memory_budget bytes resident however large the shards are.
+/// Returns false if the budget is too small to hold two shuffle buffers.
+bool DS_PIPELINE_set_memory_budget(DS_PIPELINE_Pipeline *const pipeline,
+                                   const size_t memory_budget);
+
+/// Shuffle the samples and start loading the batches of the next epoch. All
+/// batches of the previous epoch must have been released.
+void DS_PIPELINE_start_epoch(DS_PIPELINE_Pipeline *const pipeline);
+
+/// Seed of the sample order of every epoch.
+uint64_t DS_PIPELINE_seed(const DS_PIPELINE_Pipeline *const pipeline);
+
+/// Continue an interrupted training run: the next DS_PIPELINE_start_epoch
+/// starts epoch `epoch` (counted from 0) of the sample order of `seed` at
+/// batch `batch`, such that the batches are the same as if it had never
+/// stopped. See DS_batch_iterator_seek.
+void DS_PIPELINE_resume(DS_PIPELINE_Pipeline *const pipeline,
+                        const uint64_t seed, const size_t epoch,
+                        const size_t batch);
+
+/// Returns the next batch of the current epoch as a view of its contiguous
+/// grey values and classes, blocking until it is loaded. Returns NULL at the
+/// end of the epoch or if a sample could not be loaded (see
+/// DS_PIPELINE_failed). The batch stays valid until it is released.
+const DS_LabelledView *
+DS_PIPELINE_next_batch(DS_PIPELINE_Pipeline *const pipeline);
+
+/// Hand the buffer of a batch back to the loaders.
+void DS_PIPELINE_release_batch(DS_PIPELINE_Pipeline *const pipeline,
+                               const DS_LabelledView *const batch);
+
+bool DS_PIPELINE_failed(const DS_PIPELINE_Pipeline *const pipeline);
+
+DS_PIPELINE_Stats DS_PIPELINE_stats(const DS_PIPELINE_Pipeline *const pipeline);
+
+/// Prints the stall times, which tell whether training is I/O- or
+/// compute-bound.
+void DS_PIPELINE_print_stats(const DS_PIPELINE_Pipeline *const pipeline);
+
+#endif // DEEPSEA_PIPELINE_H
@@ -1,43 +1,563 @@
 #include "deepsea_png.h"
+#include "deepsea_io.h"
+#include "deepsea_resample.h"
+#include "deepsea_shard.h"
 
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
 #include <png.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
-#define MAX_PNG_GRAY_VALUE 255.
+#define PNG_ERROR_MESSAGE_LENGTH 256
+// NOTE: Bounds the memory of the raw files, which are read before decoding
+#define DECODE_CHUNK_FILES 4096
+// NOTE: Limits of the fast path, all buffers of which live on the stack
+#define FAST_MAX_FILE_SIZE 4096
+#define FAST_MAX_WIDTH 1024
+#define FAST_MAX_FILTERED (16 * 1024) // Filter bytes and rows of the image
+#define FAST_ZLIB_MEMORY (48 * 1024) // Inflate state and a 32 KiB window
 
-DS_PNG_Input *DS_PNG_input_load_grey(const char *const png_image_path) {
+static bool get_label(const DS_FILE_FileList *const png_file_list,
+                      const size_t index, const size_t max_label,
+                      size_t *const label) {
+  const char *const png_file_path = png_file_list->paths[index];
+  errno = 0;
+  *label = DS_FILE_file_list_label(png_file_list, index);
+  if (*label == 0 && errno != 0) {
+    DS_ERROR("Could not get output label for file \"%s\"", png_file_path);
+    return false;
+  }
+  if (*label > max_label) {
+    DS_ERROR("Label of PNG \"%s\" is bigger than maximum label representable "
+             "by the number of outputs: %lu",
+             png_file_path, max_label);
+    return false;
+  }
+  return true;
+}
+
+/// Finishes decoding an image whose header has been read. Does not print
+/// anything such that it can run on any thread. On failure the reason is
+/// written to message.
+static bool finish_grey_pixels(png_image *const image, uint8_t *const pixels,
+                               const size_t length,
+                               char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  image->format = PNG_FORMAT_GRAY;
+  if (PNG_IMAGE_SIZE(*image) != length) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH,
+             "PNG data length does not fit network input size, must be %lu "
+             "but got %lu",
+             length, (size_t)PNG_IMAGE_SIZE(*image));
+    png_image_free(image);
+    return false;
+  }
+  if (!png_image_finish_read(image, NULL, pixels, 0, NULL)) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image->message);
+    return false;
+  }
+  return true;
+}
+
+// Fast path for the profile of nearly all samples: small 8-bit grey,
+// non-interlaced PNGs without colour management chunks. The chunks are parsed
+// here, the image data is inflated with zlib in one go onto the stack and
+// then unfiltered into the destination. Anything else is left to libpng.
+
+/// Bump allocator on the stack for zlib's state and window, such that the
+/// fast path does not allocate.
+typedef struct {
+  uint8_t memory[FAST_ZLIB_MEMORY];
+  size_t used;
+} FastZlibMemory;
+
+static voidpf fast_zlib_alloc(voidpf const opaque, const uInt items,
+                              const uInt size) {
+  FastZlibMemory *const zlib_memory = opaque;
+  const size_t bytes = ((size_t)items * size + 15) & ~(size_t)15;
+  if (bytes > FAST_ZLIB_MEMORY - zlib_memory->used)
+    return Z_NULL; // NOTE: Lets inflateInit fail, which falls back to libpng
+  void *const memory = &zlib_memory->memory[zlib_memory->used];
+  zlib_memory->used += bytes;
+  return memory;
+}
+
+static void fast_zlib_free(voidpf const opaque, voidpf const address) {
+  (void)opaque;
+  (void)address;
+}
+
+static uint32_t read_u32_be(const uint8_t *const data) {
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 |
+         (uint32_t)data[2] << 8 | (uint32_t)data[3];
+}
+
+static bool chunk_is(const uint8_t *const type, const char *const name) {
+  return memcmp(type, name, 4) == 0;
+}
+
+/// Chunks that make libpng transform the grey values.
+static bool chunk_changes_values(const uint8_t *const type) {
+  return chunk_is(type, "gAMA") || chunk_is(type, "cHRM") ||
+         chunk_is(type, "iCCP") || chunk_is(type, "sRGB") ||
+         chunk_is(type, "sBIT") || chunk_is(type, "tRNS");
+}
+
+static inline uint8_t paeth(const uint8_t a, const uint8_t b,
+                            const uint8_t c) {
+  const int p = (int)a + (int)b - (int)c;
+  const int pa = abs(p - (int)a);
+  const int pb = abs(p - (int)b);
+  const int pc = abs(p - (int)c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+/// Reverses the filter of one row of one byte per pixel. `previous` is the
+/// unfiltered row above, all zeros for the first row.
+static bool unfilter_row(const uint8_t filter, const uint8_t *restrict row,
+                         const uint8_t *restrict previous,
+                         uint8_t *restrict out, const size_t width) {
+  switch (filter) {
+  case 0: // None
+    memcpy(out, row, width);
+    break;
+  case 1: // Sub
+    out[0] = row[0];
+    for (size_t i = 1; i < width; ++i)
+      out[i] = (uint8_t)(row[i] + out[i - 1]);
+    break;
+  case 2: // Up, independent per byte and vectorized by the compiler
+    for (size_t i = 0; i < width; ++i)
+      out[i] = (uint8_t)(row[i] + previous[i]);
+    break;
+  case 3: // Average
+    out[0] = (uint8_t)(row[0] + (previous[0] >> 1));
+    for (size_t i = 1; i < width; ++i)
+      out[i] = (uint8_t)(row[i] + ((out[i - 1] + previous[i]) >> 1));
+    break;
+  case 4: // Paeth
+    out[0] = (uint8_t)(row[0] + previous[0]);
+    for (size_t i = 1; i < width; ++i)
+      out[i] = (uint8_t)(row[i] + paeth(out[i - 1], previous[i],
+                                        previous[i - 1]));
+    break;
+  default:
+    return false;
+  }
+  return true;
+}
+
+/// Decodes an in-memory PNG of the fast profile into `pixels`. Returns false
+/// if the file is outside the profile, the image does not have `length`
+/// pixels (and is not `expected_width` wide, unless that is 0) or anything
+/// about it is invalid; libpng then decodes the file and reports the problem.
+static bool decode_grey8_fast(const uint8_t *const data, const size_t size,
+                              uint8_t *const pixels, const size_t length,
+                              const size_t expected_width) {
+  static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  if (size < sizeof(signature) + 25 ||
+      memcmp(data, signature, sizeof(signature)) != 0)
+    return false;
+
+  size_t width = 0;
+  size_t height = 0;
+  uint8_t filtered[FAST_MAX_FILTERED];
+  FastZlibMemory zlib_memory = {.used = 0};
+  z_stream stream = {.zalloc = &fast_zlib_alloc,
+                     .zfree = &fast_zlib_free,
+                     .opaque = &zlib_memory};
+  bool inflating = false;
+  bool done = false;
+  bool success = false;
+
+  for (size_t offset = sizeof(signature); offset + 12 <= size;) {
+    const size_t chunk_length = read_u32_be(&data[offset]);
+    const uint8_t *const type = &data[offset + 4];
+    const uint8_t *const chunk = &data[offset + 8];
+    if (chunk_length > size - offset - 12)
+      break;
+    if (read_u32_be(&chunk[chunk_length]) !=
+        crc32(0, type, (uInt)chunk_length + 4))
+      break;
+    offset += chunk_length + 12;
+
+    if (chunk_is(type, "IHDR")) {
+      if (width != 0 || chunk_length != 13)
+        break;
+      width = read_u32_be(&chunk[0]);
+      height = read_u32_be(&chunk[4]);
+      // NOTE: 8 bit grey, deflate, adaptive filtering, no interlacing
+      if (width == 0 || width > FAST_MAX_WIDTH || height == 0 ||
+          width * height != length ||
+          (expected_width != 0 && width != expected_width) ||
+          (width + 1) * height > FAST_MAX_FILTERED || chunk[8] != 8 ||
+          chunk[9] != 0 || chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0)
+        break;
+      if (inflateInit(&stream) != Z_OK)
+        break;
+      inflating = true;
+      stream.next_out = filtered;
+      stream.avail_out = (uInt)((width + 1) * height);
+    } else if (chunk_is(type, "IDAT")) {
+      if (!inflating || done)
+        break;
+      stream.next_in = (Bytef *)chunk;
+      stream.avail_in = (uInt)chunk_length;
+      const int status = inflate(&stream, Z_NO_FLUSH);
+      if (status == Z_STREAM_END)
+        done = stream.avail_out == 0;
+      if ((status != Z_OK && status != Z_STREAM_END) ||
+          (status == Z_STREAM_END && !done))
+        break;
+    } else if (chunk_is(type, "IEND")) {
+      static const uint8_t zeros[FAST_MAX_WIDTH] = {0}; // Above the first row
+      success = done;
+      for (size_t row = 0; row < height && success; ++row) {
+        uint8_t *const out = &pixels[row * width];
+        const uint8_t *const in = &filtered[row * (width + 1)];
+        success = unfilter_row(in[0], &in[1], row > 0 ? out - width : zeros,
+                               out, width);
+      }
+      break;
+    } else if (!(type[0] & 0x20) || chunk_changes_values(type)) {
+      break; // NOTE: Unknown critical chunk or colour management
+    }
+  }
+  if (inflating)
+    inflateEnd(&stream);
+  return success;
+}
+
+/// Reads a file into `data` if it is smaller than FAST_MAX_FILE_SIZE.
+static bool read_small_file(const char *const path,
+                            uint8_t data[FAST_MAX_FILE_SIZE],
+                            size_t *const size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  *size = fread(data, 1, FAST_MAX_FILE_SIZE, file);
+  const bool whole = *size < FAST_MAX_FILE_SIZE && !ferror(file);
+  fclose(file);
+  return whole;
+}
+
+/// Decodes a PNG file with libpng alone, without trying the fast path.
+static bool decode_grey_pixels_libpng(const char *const png_image_path,
+                                      uint8_t *const pixels,
+                                      const size_t length,
+                                      char message[PNG_ERROR_MESSAGE_LENGTH]) {
   png_image image;
   memset(&image, 0, sizeof(image));
   image.version = PNG_IMAGE_VERSION;
 
   if (!png_image_begin_read_from_file(&image, png_image_path)) {
-    DS_ERROR("%s", image.message);
-    return NULL;
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image.message);
+    return false;
+  }
+  return finish_grey_pixels(&image, pixels, length, message);
+}
+
+static bool decode_grey_pixels(const char *const png_image_path,
+                               uint8_t *const pixels, const size_t length,
+                               char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  // NOTE: Small files are read whole for the fast path
+  uint8_t data[FAST_MAX_FILE_SIZE];
+  size_t size = 0;
+  if (read_small_file(png_image_path, data, &size) &&
+      decode_grey8_fast(data, size, pixels, length, 0))
+    return true;
+  return decode_grey_pixels_libpng(png_image_path, pixels, length, message);
+}
+
+static bool decode_grey_pixels_from_memory(
+    const uint8_t *const data, const size_t size, uint8_t *const pixels,
+    const size_t length, char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  if (decode_grey8_fast(data, size, pixels, length, 0))
+    return true;
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_memory(&image, data, size)) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image.message);
+    return false;
+  }
+  return finish_grey_pixels(&image, pixels, length, message);
+}
+
+struct DS_PNG_Decoder {
+  uint8_t *staging; // Grey values before they are converted into inputs
+  size_t capacity;
+  bool resample;
+  DS_RESAMPLE_Options resampling;
+  uint8_t *image; // Whole image before it is resampled
+  size_t image_capacity;
+  void *scratch; // Of DS_RESAMPLE_grey
+  size_t scratch_capacity;
+  char message[PNG_ERROR_MESSAGE_LENGTH]; // Of the last failure
+};
+
+DS_PNG_Decoder *DS_PNG_decoder_create(void) {
+  DS_PNG_Decoder *decoder = DS_CALLOC(1, sizeof(*decoder));
+  DS_ASSERT(decoder, "Could not create PNG decoder. Out of memory.");
+  return decoder;
+}
+
+void DS_PNG_decoder_free(DS_PNG_Decoder *const decoder) {
+  DS_FREE(decoder->scratch);
+  DS_FREE(decoder->image);
+  DS_FREE(decoder->staging);
+  DS_FREE(decoder);
+}
+
+const char *DS_PNG_decoder_error(const DS_PNG_Decoder *const decoder) {
+  return decoder->message;
+}
+
+void DS_PNG_decoder_set_resampling(DS_PNG_Decoder *const decoder,
+                                   const DS_RESAMPLE_Options *const options) {
+  decoder->resample = options != NULL;
+  if (options)
+    decoder->resampling = *options;
+}
+
+/// Grows a buffer of the decoder to at least `size` bytes.
+static void *decoder_buffer(void **const buffer, size_t *const capacity,
+                            const size_t size) {
+  if (size > *capacity) {
+    void *grown = DS_REALLOC(*buffer, size);
+    DS_ASSERT(grown, "Could not grow PNG decoder. Out of memory.");
+    *buffer = grown;
+    *capacity = size;
+  }
+  return *buffer;
+}
+
+static uint8_t *decoder_staging(DS_PNG_Decoder *const decoder,
+                                const size_t length) {
+  return decoder_buffer((void **)&decoder->staging, &decoder->capacity,
+                        length);
+}
+
+/// Resamples the image in decoder->image into `pixels`.
+static void resample_image(DS_PNG_Decoder *const decoder, const size_t width,
+                           const size_t height, uint8_t *const pixels) {
+  void *const scratch = decoder_buffer(
+      &decoder->scratch, &decoder->scratch_capacity,
+      DS_RESAMPLE_scratch_size(&decoder->resampling, width, height));
+  DS_RESAMPLE_grey(&decoder->resampling, decoder->image, width, height,
+                   pixels, scratch);
+}
+
+/// Width and height of a PNG from its IHDR chunk, which must come first.
+static bool peek_size(const uint8_t *const data, const size_t size,
+                      size_t *const width, size_t *const height) {
+  if (size < 24 || !chunk_is(&data[12], "IHDR"))
+    return false;
+  *width = read_u32_be(&data[16]);
+  *height = read_u32_be(&data[20]);
+  return *width > 0 && *height > 0 && *width <= FAST_MAX_WIDTH &&
+         (*width + 1) * *height <= FAST_MAX_FILTERED;
+}
+
+/// The fast path for resampling: the whole image is decoded into the decoder.
+static bool resample_fast(DS_PNG_Decoder *const decoder,
+                          const uint8_t *const data, const size_t size,
+                          uint8_t *const pixels) {
+  size_t width = 0;
+  size_t height = 0;
+  if (!peek_size(data, size, &width, &height))
+    return false;
+  uint8_t *const image =
+      decoder_buffer((void **)&decoder->image, &decoder->image_capacity,
+                     width * height);
+  if (!decode_grey8_fast(data, size, image, width * height, width))
+    return false;
+  resample_image(decoder, width, height, pixels);
+  return true;
+}
+
+/// Finishes reading a PNG of any size with libpng and resamples it.
+static bool resample_libpng(DS_PNG_Decoder *const decoder,
+                            png_image *const image, uint8_t *const pixels,
+                            char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  image->format = PNG_FORMAT_GRAY;
+  uint8_t *const buffer =
+      decoder_buffer((void **)&decoder->image, &decoder->image_capacity,
+                     PNG_IMAGE_SIZE(*image));
+  if (!png_image_finish_read(image, NULL, buffer, 0, NULL)) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image->message);
+    return false;
+  }
+  resample_image(decoder, image->width, image->height, pixels);
+  return true;
+}
+
+static bool resampling_fits(const DS_PNG_Decoder *const decoder,
+                            const size_t length,
+                            char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  const size_t size = decoder->resampling.width * decoder->resampling.height;
+  if (size != length) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH,
+             "Resampling size does not fit network input size, must be %lu "
+             "but got %lu",
+             length, size);
+    return false;
+  }
+  return true;
+}
+
+/// Decodes a file like decode_grey_pixels, resampled if the decoder is set up
+/// for it. A NULL decoder does not resample.
+static bool decoder_decode(DS_PNG_Decoder *const decoder,
+                           const char *const png_image_path,
+                           uint8_t *const pixels, const size_t length,
+                           char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  if (!decoder || !decoder->resample)
+    return decode_grey_pixels(png_image_path, pixels, length, message);
+  if (!resampling_fits(decoder, length, message))
+    return false;
+
+  uint8_t data[FAST_MAX_FILE_SIZE];
+  size_t size = 0;
+  if (read_small_file(png_image_path, data, &size) &&
+      resample_fast(decoder, data, size, pixels))
+    return true;
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file(&image, png_image_path)) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image.message);
+    return false;
   }
+  return resample_libpng(decoder, &image, pixels, message);
+}
+
+/// The in-memory version of decoder_decode.
+static bool decoder_decode_from_memory(
+    DS_PNG_Decoder *const decoder, const uint8_t *const data,
+    const size_t size, uint8_t *const pixels, const size_t length,
+    char message[PNG_ERROR_MESSAGE_LENGTH]) {
+  if (!decoder || !decoder->resample)
+    return decode_grey_pixels_from_memory(data, size, pixels, length,
+                                          message);
+  if (!resampling_fits(decoder, length, message))
+    return false;
+  if (resample_fast(decoder, data, size, pixels))
+    return true;
+
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&image, data, size)) {
+    snprintf(message, PNG_ERROR_MESSAGE_LENGTH, "%s", image.message);
+    return false;
+  }
+  return resample_libpng(decoder, &image, pixels, message);
+}
+
+/// Keeps the reason of a failure in the decoder or, for a temporary one,
+/// prints it. Returns false.
+static bool decode_failed(DS_PNG_Decoder *const decoder,
+                          const char *const message) {
+  if (decoder)
+    snprintf(decoder->message, sizeof(decoder->message), "%s", message);
+  else
+    DS_ERROR("%s", message);
+  return false;
+}
+
+bool DS_PNG_decode_grey_pixels(DS_PNG_Decoder *const decoder,
+                               const char *const png_image_path,
+                               uint8_t *const pixels, const size_t length) {
+  // NOTE: Without resampling no buffer of the decoder is needed, so a NULL
+  // decoder does not even need a temporary one
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  return decoder_decode(decoder, png_image_path, pixels, length, message) ||
+         decode_failed(decoder, message);
+}
+
+bool DS_PNG_decode_grey_pixels_from_memory(DS_PNG_Decoder *const decoder,
+                                           const uint8_t *const data,
+                                           const size_t size,
+                                           uint8_t *const pixels,
+                                           const size_t length) {
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  return decoder_decode_from_memory(decoder, data, size, pixels, length,
+                                    message) ||
+         decode_failed(decoder, message);
+}
 
+bool DS_PNG_decode_grey_inputs(DS_PNG_Decoder *const decoder,
+                               const char *const png_image_path,
+                               DS_FLOAT *const inputs, const size_t length) {
+  DS_PNG_Decoder *const used = decoder ? decoder : DS_PNG_decoder_create();
+  uint8_t *const pixels = decoder_staging(used, length);
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  const bool decoded =
+      decoder_decode(used, png_image_path, pixels, length, message);
+  if (decoded)
+    DS_grey_to_inputs(pixels, inputs, length);
+  if (!decoder)
+    DS_PNG_decoder_free(used);
+  return decoded || decode_failed(decoder, message);
+}
+
+bool DS_PNG_decode_grey_inputs_from_memory(DS_PNG_Decoder *const decoder,
+                                           const uint8_t *const data,
+                                           const size_t size,
+                                           DS_FLOAT *const inputs,
+                                           const size_t length) {
+  DS_PNG_Decoder *const used = decoder ? decoder : DS_PNG_decoder_create();
+  uint8_t *const pixels = decoder_staging(used, length);
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  const bool decoded = decoder_decode_from_memory(used, data, size, pixels,
+                                                  length, message);
+  if (decoded)
+    DS_grey_to_inputs(pixels, inputs, length);
+  if (!decoder)
+    DS_PNG_decoder_free(used);
+  return decoded || decode_failed(decoder, message);
+}
+
+DS_PNG_Input *DS_PNG_input_load_grey(DS_PNG_Decoder *const decoder,
+                                     const char *const png_image_path) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+
+  if (!png_image_begin_read_from_file(&image, png_image_path)) {
+    decode_failed(decoder, image.message);
+    return NULL;
+  }
   image.format = PNG_FORMAT_GRAY;
   const size_t image_size = PNG_IMAGE_SIZE(image);
-  png_bytep const buffer = DS_MALLOC(image_size);
-  if (!buffer) {
+  DS_FLOAT *const data = DS_MALLOC(image_size * sizeof(data[0]));
+  if (!data) {
     png_image_free(&image);
     DS_ASSERT(false, "Could not allocate input buffer, out of memory.");
   }
-  if (!png_image_finish_read(&image, NULL, buffer, 0, NULL)) {
-    DS_ERROR("%s", image.message);
-    DS_FREE(buffer);
+  DS_PNG_Decoder *const used = decoder ? decoder : DS_PNG_decoder_create();
+  uint8_t *const pixels = decoder_staging(used, image_size);
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  const bool decoded = finish_grey_pixels(&image, pixels, image_size, message);
+  if (decoded)
+    DS_grey_to_inputs(pixels, data, image_size);
+  if (!decoder)
+    DS_PNG_decoder_free(used);
+  if (!decoded) {
+    decode_failed(decoder, message);
+    DS_FREE(data);
     return NULL;
   }
 
-  DS_FLOAT *const data = DS_MALLOC(image_size * sizeof(data[0]));
-  for (size_t i = 0; i < image_size; ++i)
-    data[i] = (DS_FLOAT)buffer[i] / MAX_PNG_GRAY_VALUE;
-  DS_FREE(buffer);
-
   DS_PNG_Input *png_input = DS_MALLOC(sizeof(*png_input));
   DS_ASSERT(png_input, "Could not create png input, out of memory.");
   png_input->data = data;
@@ -48,13 +568,133 @@ DS_PNG_Input *DS_PNG_input_load_grey(const char *const png_image_path) {
   return png_input;
 }
 
+typedef struct {
+  size_t index; // Index of the first file this worker failed on
+  char message[PNG_ERROR_MESSAGE_LENGTH];
+} DecodeFailure;
+
+typedef struct {
+  const DS_IO_File *files; // Contents of the files of the current chunk
+  size_t first;            // Index of the first file of the chunk
+  size_t input_length;
+  uint8_t *pixels;   // If set, file i is decoded into row i of pixels
+  uint8_t *staging;  // Otherwise into the row of the worker ...
+  DS_FLOAT **inputs; // ... and then converted into inputs[i]
+  DecodeFailure *failures; // One slot per worker
+  DS_PNG_Decoder **decoders; // One per worker if resampling, otherwise NULL
+  atomic_size_t first_failure;
+} DecodeJob;
+
+static void decode_task(void *const context, const size_t chunk_index,
+                        const size_t worker) {
+  DecodeJob *const job = context;
+  const size_t index = job->first + chunk_index;
+  if (index > atomic_load(&job->first_failure))
+    return; // NOTE: The result is discarded anyway
+
+  const size_t length = job->input_length;
+  uint8_t *const pixels = job->pixels ? &job->pixels[index * length]
+                                      : &job->staging[worker * length];
+  DecodeFailure *const failure = &job->failures[worker];
+  const DS_IO_File *const file = &job->files[chunk_index];
+  DS_PNG_Decoder *const decoder = job->decoders ? job->decoders[worker] : NULL;
+  if (!decoder_decode_from_memory(decoder, file->data, file->size, pixels,
+                                  length, failure->message)) {
+    // NOTE: Every worker gets increasing indexes, so this is its first failure
+    failure->index = index;
+    size_t first_failure = atomic_load(&job->first_failure);
+    while (index < first_failure &&
+           !atomic_compare_exchange_weak(&job->first_failure, &first_failure,
+                                         index))
+      ;
+    return;
+  }
+
+  if (!job->pixels)
+    DS_grey_to_inputs(pixels, job->inputs[index], length);
+}
+
+/// Reads the files of the list in chunks and decodes every chunk in
+/// parallel, either into the rows of pixels or, if pixels is NULL, into
+/// inputs. If `shards` is given, the list is the one of the shards and the
+/// chunks are read from them. Only the first failing file is reported.
+static bool decode_file_list(const DS_FILE_FileList *const png_file_list,
+                             DS_SHARD_Set *const shards,
+                             const size_t input_length, uint8_t *const pixels,
+                             DS_FLOAT **const inputs,
+                             const DS_RESAMPLE_Options *const resampling,
+                             DS_THREAD_Pool *const pool) {
+  const size_t num_workers = DS_THREAD_pool_size(pool);
+  DecodeJob job = {.input_length = input_length,
+                   .pixels = pixels,
+                   .inputs = inputs};
+  atomic_init(&job.first_failure, SIZE_MAX);
+  job.failures = DS_MALLOC(num_workers * sizeof(job.failures[0]));
+  DS_ASSERT(job.failures, "Could not decode PNGs. Out of memory.");
+  for (size_t w = 0; w < num_workers; ++w)
+    job.failures[w].index = SIZE_MAX;
+  if (!pixels) {
+    job.staging = DS_MALLOC(num_workers * input_length);
+    DS_ASSERT(job.staging, "Could not decode PNGs. Out of memory.");
+  }
+  if (resampling) {
+    job.decoders = DS_MALLOC(num_workers * sizeof(job.decoders[0]));
+    DS_ASSERT(job.decoders, "Could not decode PNGs. Out of memory.");
+    for (size_t w = 0; w < num_workers; ++w) {
+      job.decoders[w] = DS_PNG_decoder_create();
+      DS_PNG_decoder_set_resampling(job.decoders[w], resampling);
+    }
+  }
+
+  DS_IO_Reader *reader = shards ? NULL : DS_IO_reader_create(pool, true);
+  DS_IO_File *files = DS_MALLOC(
+      DS_MIN(DECODE_CHUNK_FILES, DS_MAX(png_file_list->count, 1)) *
+      sizeof(files[0]));
+  DS_ASSERT(files, "Could not decode PNGs. Out of memory.");
+  job.files = files;
+  bool read = true;
+  for (job.first = 0; job.first < png_file_list->count && read &&
+                      atomic_load(&job.first_failure) == SIZE_MAX;
+       job.first += DECODE_CHUNK_FILES) {
+    const size_t count =
+        DS_MIN(DECODE_CHUNK_FILES, png_file_list->count - job.first);
+    read = shards ? DS_SHARD_set_read_files(shards, job.first, count, files)
+                  : DS_IO_read_files(reader, &png_file_list->paths[job.first],
+                                     count, files);
+    if (read)
+      DS_THREAD_pool_for(pool, count, &decode_task, &job);
+  }
+  DS_FREE(files);
+  if (reader)
+    DS_IO_reader_free(reader);
+
+  const size_t first_failure = atomic_load(&job.first_failure);
+  for (size_t w = 0; w < num_workers && first_failure != SIZE_MAX; ++w) {
+    if (job.failures[w].index == first_failure) {
+      DS_ERROR("%s", job.failures[w].message);
+      DS_ERROR("Could not load PNG \"%s\"",
+               png_file_list->paths[first_failure]);
+      break;
+    }
+  }
+
+  for (size_t w = 0; w < num_workers && job.decoders; ++w)
+    DS_PNG_decoder_free(job.decoders[w]);
+  DS_FREE(job.decoders);
+  DS_FREE(job.staging);
+  DS_FREE(job.failures);
+  return read && first_failure == SIZE_MAX;
+}
+
 DS_Labelled_Inputs *
 DS_PNG_file_list_to_labelled_inputs(const DS_FILE_FileList *const png_file_list,
-                                    const DS_Network *const network) {
+                                    const DS_Network *const network,
+                                    const DS_RESAMPLE_Options *const resampling,
+                                    DS_THREAD_Pool *const pool) {
 
   const size_t input_length = DS_network_input_layer_size(network);
   const size_t output_length = DS_network_output_layer_size(network);
-  const size_t max_label = (size_t)powl(2, output_length) - 1;
+  const size_t max_label = output_length - 1;
 
   DS_Labelled_Inputs *labelled_input = DS_MALLOC(sizeof(*labelled_input));
   DS_ASSERT(labelled_input, "Could not create file list. Out of memory.");
@@ -68,54 +708,31 @@ DS_PNG_file_list_to_labelled_inputs(const DS_FILE_FileList *const png_file_list,
   DS_ASSERT(labelled_input->labels,
             "Could not create file list. Out of memory.");
   for (size_t i = 0; i < png_file_list->count; ++i) {
-    // NOTE: Do not malloc for inputs this will be moved from PNG!
-
+    // NOTE: Everything is allocated here, the workers only decode
+    labelled_input->inputs[i] =
+        DS_MALLOC(input_length * sizeof(labelled_input->inputs[0][0]));
     labelled_input->labels[i] =
-        DS_MALLOC(output_length * sizeof(labelled_input->labels[0]));
-    DS_ASSERT(labelled_input->labels[i],
+        DS_MALLOC(output_length * sizeof(labelled_input->labels[0][0]));
+    DS_ASSERT(labelled_input->inputs[i] && labelled_input->labels[i],
               "Could not create file list. Out of memory.");
   }
-  DS_PNG_Input *png_input = NULL;
   for (size_t i = 0; i < png_file_list->count; ++i) {
-    const char *const png_file_path = png_file_list->paths[i];
-    errno = 0;
-    size_t label = DS_FILE_get_label_from_directory_name(png_file_path);
-    if (label == 0 && errno != 0) {
-      DS_ERROR("Could not get output label for file \"%s\"", png_file_path);
-      goto file_list_to_labelled_inputs_error;
-    }
-    if (label > max_label) {
-      DS_ERROR("Label of PNG \"s\" is bigger than maximum label representable "
-               "by the number of outputs: %lu",
-               max_label);
-      goto file_list_to_labelled_inputs_error;
-    }
-
-    png_input = DS_PNG_input_load_grey(png_file_path);
-    if (!png_input) {
-      DS_ERROR("Could not load PNG \"%s\"", png_file_path);
+    size_t label = 0;
+    if (!get_label(png_file_list, i, max_label, &label))
       goto file_list_to_labelled_inputs_error;
-    }
-    if (png_input->width * png_input->height != input_length) {
-      DS_ERROR("PNG data length does not fit network input size, must be %lu "
-               "but got %lu",
-               input_length, png_input->width * png_input->height);
-      goto file_list_to_labelled_inputs_error;
-    }
-
-    labelled_input->inputs[i] = png_input->data;
-    png_input->data = NULL; // Move the data
     DS_FILE_file_label_to_deepsea_label(label, labelled_input->labels[i],
                                         output_length);
-    DS_PNG_input_free(png_input);
   }
+  if (!decode_file_list(png_file_list, NULL, input_length, NULL,
+                        labelled_input->inputs, resampling, pool))
+    goto file_list_to_labelled_inputs_error;
+
   labelled_input->count = png_file_list->count;
   return labelled_input;
 
 file_list_to_labelled_inputs_error:
-  DS_FREE(png_input);
   for (size_t i = 0; i < png_file_list->count; ++i) {
-    // NOTE: Inputs are only set when there are no errors anymore
+    DS_FREE(labelled_input->inputs[i]);
     DS_FREE(labelled_input->labels[i]);
   }
   DS_FREE(labelled_input->inputs);
@@ -124,6 +741,52 @@ file_list_to_labelled_inputs_error:
   return NULL;
 }
 
+static DS_DATA_Set *
+file_list_to_data_set(const DS_FILE_FileList *const png_file_list,
+                      DS_SHARD_Set *const shards,
+                      const DS_Network *const network,
+                      const DS_RESAMPLE_Options *const resampling,
+                      DS_THREAD_Pool *const pool) {
+  const size_t input_length = DS_network_input_layer_size(network);
+  const size_t output_length = DS_network_output_layer_size(network);
+  const size_t max_label =
+      DS_MIN(output_length - 1, (size_t)UINT16_MAX);
+
+  DS_DATA_Set *data_set =
+      DS_DATA_set_create(png_file_list->count, input_length, NULL);
+  for (size_t i = 0; i < png_file_list->count; ++i) {
+    size_t label = 0;
+    if (!get_label(png_file_list, i, max_label, &label))
+      goto file_list_to_data_set_error;
+    data_set->labels[i] = (uint16_t)label;
+  }
+  if (!decode_file_list(png_file_list, shards, input_length, data_set->pixels,
+                        NULL, resampling, pool))
+    goto file_list_to_data_set_error;
+  return data_set;
+
+file_list_to_data_set_error:
+  DS_DATA_set_free(data_set);
+  return NULL;
+}
+
+DS_DATA_Set *
+DS_PNG_file_list_to_data_set(const DS_FILE_FileList *const png_file_list,
+                             const DS_Network *const network,
+                             const DS_RESAMPLE_Options *const resampling,
+                             DS_THREAD_Pool *const pool) {
+  return file_list_to_data_set(png_file_list, NULL, network, resampling, pool);
+}
+
+DS_DATA_Set *
+DS_PNG_shard_set_to_data_set(DS_SHARD_Set *const shards,
+                             const DS_Network *const network,
+                             const DS_RESAMPLE_Options *const resampling,
+                             DS_THREAD_Pool *const pool) {
+  return file_list_to_data_set(DS_SHARD_set_file_list(shards), shards,
+                               network, resampling, pool);
+}
+
 DS_PixelsBW DS_PNG_load_pixels_bw(const DS_PNG_Input *const png_input) {
   DS_ASSERT(png_input->type == DS_PNG_Gray, "PNG must be of type gray.");
   const size_t total_bytes =
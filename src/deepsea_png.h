@@ -2,7 +2,11 @@
 #define LOAD_PNG_H
 
 #include "deepsea.h"
+#include "deepsea_data.h"
 #include "deepsea_file.h"
+#include "deepsea_resample.h"
+#include "deepsea_shard.h"
+#include "deepsea_thread.h"
 
 typedef enum {
   DS_PNG_Gray,
@@ -15,11 +19,85 @@ typedef struct {
   DS_PNG_Type type;
 } DS_PNG_Input;
 
-DS_PNG_Input *DS_PNG_input_load_grey(const char *const image_path);
+/// Decodes grey PNGs straight into rows of network inputs. The bytes are
+/// staged in a buffer owned by the decoder, which is reused for every image,
+/// so decoding does not allocate once the buffer has grown to the image size.
+/// A decoder must only be used by one thread at a time.
+///
+/// Every function below takes a decoder. Given one, a failure is not printed
+/// but kept for DS_PNG_decoder_error, so the caller can report it once. A NULL
+/// decoder stands for a temporary one that does not resample, then the
+/// failure is printed.
+typedef struct DS_PNG_Decoder DS_PNG_Decoder;
 
+DS_PNG_Decoder *DS_PNG_decoder_create(void);
+
+void DS_PNG_decoder_free(DS_PNG_Decoder *const decoder);
+
+/// Reason of the last failure of the decoder.
+const char *DS_PNG_decoder_error(const DS_PNG_Decoder *const decoder);
+
+/// Resample every following image of any size to the given size, cropped if
+/// the options say so. NULL turns resampling off, then images must already
+/// have the requested number of pixels.
+void DS_PNG_decoder_set_resampling(DS_PNG_Decoder *const decoder,
+                                   const DS_RESAMPLE_Options *const options);
+
+/// Decodes a grey PNG into `pixels` without converting the values. Fails if
+/// the (resampled) image does not have exactly `length` pixels.
+bool DS_PNG_decode_grey_pixels(DS_PNG_Decoder *const decoder,
+                               const char *const image_path,
+                               uint8_t *const pixels, const size_t length);
+
+/// Decodes an in-memory grey PNG file, see DS_PNG_decode_grey_pixels.
+bool DS_PNG_decode_grey_pixels_from_memory(DS_PNG_Decoder *const decoder,
+                                           const uint8_t *const data,
+                                           const size_t size,
+                                           uint8_t *const pixels,
+                                           const size_t length);
+
+/// Decodes a grey PNG and writes its pixels scaled to \[0, 1\] into
+/// `inputs`. Fails if the image does not have exactly `length` pixels.
+bool DS_PNG_decode_grey_inputs(DS_PNG_Decoder *const decoder,
+                               const char *const image_path,
+                               DS_FLOAT *const inputs, const size_t length);
+
+/// Decodes an in-memory grey PNG file, see DS_PNG_decode_grey_inputs.
+bool DS_PNG_decode_grey_inputs_from_memory(DS_PNG_Decoder *const decoder,
+                                           const uint8_t *const data,
+                                           const size_t size,
+                                           DS_FLOAT *const inputs,
+                                           const size_t length);
+
+/// Decodes a grey PNG of any size into a newly allocated DS_PNG_Input.
+/// Returns NULL on failure.
+DS_PNG_Input *DS_PNG_input_load_grey(DS_PNG_Decoder *const decoder,
+                                     const char *const image_path);
+
+/// Decodes all PNGs of the list, in parallel if a pool is given. The files
+/// are read in batches through DS_IO_Reader. If any file cannot be loaded, the first failing one is reported and NULL is returned.
+/// If `resampling` is given, images of any size are resampled to it.
 DS_Labelled_Inputs *
 DS_PNG_file_list_to_labelled_inputs(const DS_FILE_FileList *const png_file_list,
-                                    const DS_Network *const network);
+                                    const DS_Network *const network,
+                                    const DS_RESAMPLE_Options *const resampling,
+                                    DS_THREAD_Pool *const pool);
+
+/// Decodes all PNGs once into an in-memory data set, in parallel if a pool is
+/// given, and resampled if `resampling` is given.
+DS_DATA_Set *
+DS_PNG_file_list_to_data_set(const DS_FILE_FileList *const png_file_list,
+                             const DS_Network *const network,
+                             const DS_RESAMPLE_Options *const resampling,
+                             DS_THREAD_Pool *const pool);
+
+/// Decodes all PNGs of a set of shards into an in-memory data set, see
+/// DS_PNG_file_list_to_data_set. The shards are read in large chunks.
+DS_DATA_Set *
+DS_PNG_shard_set_to_data_set(DS_SHARD_Set *const shards,
+                             const DS_Network *const network,
+                             const DS_RESAMPLE_Options *const resampling,
+                             DS_THREAD_Pool *const pool);
 
 void DS_PNG_input_print(const DS_PNG_Input *const png_input);
 
@@ -0,0 +1,392 @@
+#include "deepsea_predict.h"
+#include "deepsea_png.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+// NOTE: Rows predicted by one task, see ROWS_PER_TASK of the evaluation
+#define PREDICT_ROWS_PER_TASK 32
+#define STREAM_BUFFER_SIZE (64 << 10)
+#define CONFIDENCE_DIGITS 6
+
+typedef struct {
+  char source[DS_FILE_MAX_PATH_LENGTH]; // Path of the PNG or frame number
+  bool is_file;      // Decoded into its row when the batch is predicted
+  const char *error; // NULL if the sample was predicted
+} PredictSlot;
+
+struct DS_PREDICT_Stream {
+  const DS_Network *network;
+  DS_PREDICT_Format format;
+  DS_THREAD_Pool *pool;
+  FILE *out;
+  size_t input_length;
+  size_t batch_size;
+  size_t count; // Samples waiting in the batch
+  PredictSlot *slots;
+  uint8_t *pixels; // One row per slot
+  size_t *predictions;
+  DS_FLOAT *confidences;
+  DS_PNG_Decoder **decoders; // One per worker of the pool
+  DS_Inference **inferences; // One per worker of the pool
+  size_t frames;             // Frames added so far
+  DS_PREDICT_Stats stats;
+};
+
+DS_PREDICT_Stream *
+DS_PREDICT_stream_create(const DS_Network *const network,
+                         const DS_PREDICT_Format format,
+                         const size_t batch_size,
+                         const DS_RESAMPLE_Options *const resampling,
+                         DS_THREAD_Pool *const pool, FILE *const out) {
+  DS_ASSERT(batch_size > 0, "Batches must have room for at least one sample.");
+  DS_PREDICT_Stream *stream = DS_CALLOC(1, sizeof(*stream));
+  DS_ASSERT(stream, "Could not create prediction stream. Out of memory.");
+  const size_t num_workers = DS_THREAD_pool_size(pool);
+  stream->network = network;
+  stream->format = format;
+  stream->pool = pool;
+  stream->out = out;
+  stream->input_length = DS_network_input_layer_size(network);
+  stream->batch_size = batch_size;
+  stream->slots = DS_MALLOC(batch_size * sizeof(stream->slots[0]));
+  stream->pixels = DS_MALLOC(batch_size * stream->input_length);
+  stream->predictions =
+      DS_MALLOC(batch_size * sizeof(stream->predictions[0]));
+  stream->confidences =
+      DS_MALLOC(batch_size * sizeof(stream->confidences[0]));
+  stream->decoders = DS_MALLOC(num_workers * sizeof(stream->decoders[0]));
+  stream->inferences =
+      DS_MALLOC(num_workers * sizeof(stream->inferences[0]));
+  DS_ASSERT(stream->slots && stream->pixels && stream->predictions &&
+                stream->confidences && stream->decoders &&
+                stream->inferences,
+            "Could not create prediction stream. Out of memory.");
+  for (size_t w = 0; w < num_workers; ++w) {
+    stream->decoders[w] = DS_PNG_decoder_create();
+    DS_PNG_decoder_set_resampling(stream->decoders[w], resampling);
+    // NOTE: Only predicts, the cost function is never used
+    stream->inferences[w] = DS_inference_create(
+        network, DS_QUADRATIC, DS_MIN(batch_size, PREDICT_ROWS_PER_TASK));
+  }
+  if (format == DS_PREDICT_CSV)
+    DS_FPRINTF(out, "source,prediction,confidence,error\n");
+  return stream;
+}
+
+void DS_PREDICT_stream_free(DS_PREDICT_Stream *const stream) {
+  DS_PREDICT_flush(stream);
+  for (size_t w = 0; w < DS_THREAD_pool_size(stream->pool); ++w) {
+    DS_PNG_decoder_free(stream->decoders[w]);
+    DS_inference_free(stream->inferences[w]);
+  }
+  DS_FREE(stream->slots);
+  DS_FREE(stream->pixels);
+  DS_FREE(stream->predictions);
+  DS_FREE(stream->confidences);
+  DS_FREE(stream->decoders);
+  DS_FREE(stream->inferences);
+  DS_FREE(stream);
+}
+
+/// Next free slot of the batch, the batch is predicted first if it is full.
+static PredictSlot *next_slot(DS_PREDICT_Stream *const stream) {
+  if (stream->count == stream->batch_size)
+    DS_PREDICT_flush(stream);
+  PredictSlot *const slot = &stream->slots[stream->count++];
+  slot->error = NULL;
+  return slot;
+}
+
+void DS_PREDICT_add_file(DS_PREDICT_Stream *const stream,
+                         const char *const path) {
+  PredictSlot *const slot = next_slot(stream);
+  slot->is_file = true;
+  const int length = snprintf(slot->source, sizeof(slot->source), "%s", path);
+  if (length < 0 || (size_t)length >= sizeof(slot->source))
+    slot->error = "path too long";
+}
+
+void DS_PREDICT_add_file_list(DS_PREDICT_Stream *const stream,
+                              const DS_FILE_FileList *const file_list) {
+  for (size_t i = 0; i < file_list->count; ++i)
+    DS_PREDICT_add_file(stream, file_list->paths[i]);
+}
+
+void DS_PREDICT_add_frame(DS_PREDICT_Stream *const stream,
+                          const uint8_t *const pixels) {
+  PredictSlot *const slot = next_slot(stream);
+  const size_t row = stream->count - 1;
+  slot->is_file = false;
+  snprintf(slot->source, sizeof(slot->source), "%lu", stream->frames++);
+  memcpy(&stream->pixels[row * stream->input_length], pixels,
+         stream->input_length);
+}
+
+static void decode_slot_task(void *const context, const size_t index,
+                             const size_t worker) {
+  DS_PREDICT_Stream *const stream = context;
+  PredictSlot *const slot = &stream->slots[index];
+  uint8_t *const row = &stream->pixels[index * stream->input_length];
+  if (!slot->is_file || slot->error)
+    return;
+  if (!DS_PNG_decode_grey_pixels(stream->decoders[worker], slot->source, row,
+                                 stream->input_length)) {
+    slot->error = "could not decode";
+    // NOTE: The row is still predicted with the others, its result dropped
+    memset(row, 0, stream->input_length);
+  }
+}
+
+static void predict_slots_task(void *const context, const size_t index,
+                               const size_t worker) {
+  DS_PREDICT_Stream *const stream = context;
+  const size_t first = index * PREDICT_ROWS_PER_TASK;
+  const DS_LabelledView rows = {
+      .inputs = &stream->pixels[first * stream->input_length],
+      .input_stride = stream->input_length,
+      .input_length = stream->input_length,
+      .input_type = DS_DTYPE_U8,
+      .count = DS_MIN(PREDICT_ROWS_PER_TASK, stream->count - first)};
+  DS_inference_predict_view(stream->inferences[worker], &rows,
+                            &stream->predictions[first],
+                            &stream->confidences[first]);
+}
+
+/// Writes a CSV field, quoted if it contains a separator, quote or line
+/// break.
+static void write_csv_field(FILE *const out, const char *const field) {
+  if (!strpbrk(field, ",\"\r\n")) {
+    DS_FPRINTF(out, "%s", field);
+    return;
+  }
+  fputc('"', out);
+  for (const char *c = field; *c; ++c) {
+    if (*c == '"')
+      fputc('"', out);
+    fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+static void write_json_string(FILE *const out, const char *const string) {
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *)string; *c; ++c) {
+    if (*c == '"' || *c == '\\')
+      DS_FPRINTF(out, "\\%c", *c);
+    else if (*c < 0x20)
+      DS_FPRINTF(out, "\\u%04x", *c);
+    else
+      fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+static void write_line(DS_PREDICT_Stream *const stream, const size_t index) {
+  FILE *const out = stream->out;
+  const PredictSlot *const slot = &stream->slots[index];
+  char prediction[MAX_OUTPUT_LABEL_STRLEN + 1] = {0};
+  if (!slot->error) {
+    const char *const label =
+        DS_network_output_label(stream->network, stream->predictions[index]);
+    if (label)
+      snprintf(prediction, sizeof(prediction), "%s", label);
+    else
+      snprintf(prediction, sizeof(prediction), "%lu",
+               stream->predictions[index]);
+  }
+
+  switch (stream->format) {
+  case DS_PREDICT_CSV: {
+    write_csv_field(out, slot->source);
+    if (slot->error) {
+      DS_FPRINTF(out, ",,,%s\n", slot->error);
+      break;
+    }
+    fputc(',', out);
+    write_csv_field(out, prediction);
+    DS_FPRINTF(out, ",%.*f,\n", CONFIDENCE_DIGITS,
+               stream->confidences[index]);
+  } break;
+  case DS_PREDICT_JSONL: {
+    DS_FPRINTF(out, "{\"source\":");
+    write_json_string(out, slot->source);
+    if (slot->error) {
+      DS_FPRINTF(out, ",\"error\":\"%s\"}\n", slot->error);
+      break;
+    }
+    DS_FPRINTF(out, ",\"prediction\":");
+    write_json_string(out, prediction);
+    DS_FPRINTF(out, ",\"confidence\":%.*f}\n", CONFIDENCE_DIGITS,
+               stream->confidences[index]);
+  } break;
+  default: {
+    DS_ASSERT(false, "Unreachable");
+  } break;
+  }
+}
+
+void DS_PREDICT_flush(DS_PREDICT_Stream *const stream) {
+  if (stream->count == 0)
+    return;
+  DS_THREAD_pool_for(stream->pool, stream->count, &decode_slot_task, stream);
+  const size_t num_tasks =
+      (stream->count + PREDICT_ROWS_PER_TASK - 1) / PREDICT_ROWS_PER_TASK;
+  DS_THREAD_pool_for(stream->pool, num_tasks, &predict_slots_task, stream);
+  for (size_t i = 0; i < stream->count; ++i) {
+    write_line(stream, i);
+    stream->stats.failed += stream->slots[i].error != NULL;
+  }
+  stream->stats.samples += stream->count;
+  stream->count = 0;
+  fflush(stream->out);
+}
+
+DS_PREDICT_Stats
+DS_PREDICT_stream_stats(const DS_PREDICT_Stream *const stream) {
+  return stream->stats;
+}
+
+typedef enum {
+  STREAM_READ,
+  STREAM_WOULD_BLOCK, // Nothing ready and not asked to wait
+  STREAM_END,
+  STREAM_FAILED,
+} StreamStatus;
+
+/// Buffered reads from a file descriptor which can tell whether more data
+/// is ready without blocking.
+typedef struct {
+  int fd;
+  uint8_t *buffer; // One byte more than the capacity to terminate lines
+  size_t capacity;
+  size_t begin; // Unconsumed bytes are in [begin, end)
+  size_t end;
+  bool eof;
+} StreamReader;
+
+static StreamReader stream_reader_create(const int fd, const size_t capacity) {
+  StreamReader reader = {.fd = fd, .capacity = capacity};
+  reader.buffer = DS_MALLOC(capacity + 1);
+  DS_ASSERT(reader.buffer, "Could not create reader. Out of memory.");
+  return reader;
+}
+
+/// Reads more bytes behind the unconsumed ones. Without `wait`, returns
+/// STREAM_WOULD_BLOCK if the descriptor has nothing ready.
+static StreamStatus stream_fill(StreamReader *const reader, const bool wait) {
+  if (reader->begin > 0) {
+    memmove(reader->buffer, &reader->buffer[reader->begin],
+            reader->end - reader->begin);
+    reader->end -= reader->begin;
+    reader->begin = 0;
+  }
+  if (!wait) {
+    struct pollfd ready = {.fd = reader->fd, .events = POLLIN};
+    if (poll(&ready, 1, 0) == 0)
+      return STREAM_WOULD_BLOCK;
+  }
+  while (true) {
+    const ssize_t n = read(reader->fd, &reader->buffer[reader->end],
+                           reader->capacity - reader->end);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      DS_ERROR("Could not read input: %s", strerror(errno));
+      return STREAM_FAILED;
+    }
+    if (n == 0) {
+      reader->eof = true;
+      return STREAM_END;
+    }
+    reader->end += (size_t)n;
+    return STREAM_READ;
+  }
+}
+
+/// Next line without its line break, terminated in place. A last line
+/// without a line break is returned as well.
+static StreamStatus stream_next_line(StreamReader *const reader,
+                                     const bool wait, char **const line) {
+  while (true) {
+    uint8_t *const start = &reader->buffer[reader->begin];
+    const size_t available = reader->end - reader->begin;
+    uint8_t *const newline = memchr(start, '\n', available);
+    if (newline || (reader->eof && available > 0)) {
+      const size_t length = newline ? (size_t)(newline - start) : available;
+      start[length] = '\0';
+      if (length > 0 && start[length - 1] == '\r')
+        start[length - 1] = '\0';
+      reader->begin += newline ? length + 1 : length;
+      *line = (char *)start;
+      return STREAM_READ;
+    }
+    if (reader->eof)
+      return STREAM_END;
+    if (available == reader->capacity) {
+      DS_ERROR("Input line is longer than %lu bytes.", reader->capacity);
+      return STREAM_FAILED;
+    }
+    const StreamStatus status = stream_fill(reader, wait);
+    if (status == STREAM_WOULD_BLOCK || status == STREAM_FAILED)
+      return status;
+  }
+}
+
+/// Next `length` bytes, which stay valid until the next read.
+static StreamStatus stream_next_frame(StreamReader *const reader,
+                                      const bool wait, const size_t length,
+                                      const uint8_t **const frame) {
+  while (reader->end - reader->begin < length) {
+    if (reader->eof) {
+      if (reader->end == reader->begin)
+        return STREAM_END;
+      DS_ERROR("Input ends within a frame, %lu of %lu bytes were read.",
+               reader->end - reader->begin, length);
+      return STREAM_FAILED;
+    }
+    const StreamStatus status = stream_fill(reader, wait);
+    if (status == STREAM_WOULD_BLOCK || status == STREAM_FAILED)
+      return status;
+  }
+  *frame = &reader->buffer[reader->begin];
+  reader->begin += length;
+  return STREAM_READ;
+}
+
+bool DS_PREDICT_read_paths(DS_PREDICT_Stream *const stream, const int fd) {
+  StreamReader reader = stream_reader_create(fd, STREAM_BUFFER_SIZE);
+  StreamStatus status = STREAM_READ;
+  while (status != STREAM_END && status != STREAM_FAILED) {
+    // NOTE: Waits only with an empty batch, otherwise the batch is
+    // predicted while the producer is busy
+    char *line = NULL;
+    status = stream_next_line(&reader, stream->count == 0, &line);
+    if (status == STREAM_READ && line[0] != '\0')
+      DS_PREDICT_add_file(stream, line);
+    else if (status == STREAM_WOULD_BLOCK)
+      DS_PREDICT_flush(stream);
+  }
+  DS_PREDICT_flush(stream);
+  DS_FREE(reader.buffer);
+  return status == STREAM_END;
+}
+
+bool DS_PREDICT_read_frames(DS_PREDICT_Stream *const stream, const int fd) {
+  StreamReader reader = stream_reader_create(
+      fd, DS_MAX((size_t)STREAM_BUFFER_SIZE, stream->input_length));
+  StreamStatus status = STREAM_READ;
+  while (status != STREAM_END && status != STREAM_FAILED) {
+    const uint8_t *frame = NULL;
+    status = stream_next_frame(&reader, stream->count == 0,
+                               stream->input_length, &frame);
+    if (status == STREAM_READ)
+      DS_PREDICT_add_frame(stream, frame);
+    else if (status == STREAM_WOULD_BLOCK)
+      DS_PREDICT_flush(stream);
+  }
+  DS_PREDICT_flush(stream);
+  DS_FREE(reader.buffer);
+  return status == STREAM_END;
+}
@@ -0,0 +1,75 @@
+#ifndef DEEPSEA_PREDICT_H
+#define DEEPSEA_PREDICT_H
+
+#include "deepsea.h"
+#include "deepsea_file.h"
+#include "deepsea_resample.h"
+#include "deepsea_thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// Predicts any number of samples with a fixed amount of memory. Samples
+/// are collected into batches, the PNGs of a batch are decoded in parallel,
+/// the batch is predicted at once and one line per sample is written in
+/// the order the samples were added, as soon as its batch is done. Streams
+/// read from a file descriptor are also predicted whenever the descriptor
+/// has no data ready, so a slow producer gets its results without waiting
+/// for a full batch.
+typedef struct DS_PREDICT_Stream DS_PREDICT_Stream;
+
+/// Line format of the results. CSV starts with the header
+///
+///   source,prediction,confidence,error
+///
+/// JSONL writes one object per line with the same keys, of which a sample
+/// has either prediction and confidence or error. The source is the path of
+/// a PNG or the number of a frame, counted from 0, the prediction the label
+/// of the most active output or its index.
+typedef enum { DS_PREDICT_CSV, DS_PREDICT_JSONL } DS_PREDICT_Format;
+
+typedef struct {
+  size_t samples; // Lines written
+  size_t failed;  // Lines with an error instead of a prediction
+} DS_PREDICT_Stats;
+
+/// PNGs are decoded with one decoder per worker of the pool, resampled if
+/// `resampling` is given. The network must outlive the stream.
+DS_PREDICT_Stream *
+DS_PREDICT_stream_create(const DS_Network *const network,
+                         const DS_PREDICT_Format format,
+                         const size_t batch_size,
+                         const DS_RESAMPLE_Options *const resampling,
+                         DS_THREAD_Pool *const pool, FILE *const out);
+
+/// Predicts the samples still waiting.
+void DS_PREDICT_stream_free(DS_PREDICT_Stream *const stream);
+
+/// Adds a PNG file, which is decoded once its batch is predicted.
+void DS_PREDICT_add_file(DS_PREDICT_Stream *const stream,
+                         const char *const path);
+
+void DS_PREDICT_add_file_list(DS_PREDICT_Stream *const stream,
+                              const DS_FILE_FileList *const file_list);
+
+/// Adds a frame of one grey value per network input, which is copied.
+void DS_PREDICT_add_frame(DS_PREDICT_Stream *const stream,
+                          const uint8_t *const pixels);
+
+/// Predicts the samples added so far and writes their lines.
+void DS_PREDICT_flush(DS_PREDICT_Stream *const stream);
+
+/// Adds the PNGs whose paths are read line by line from fd until its end.
+/// Empty lines are skipped. Returns false if fd cannot be read.
+bool DS_PREDICT_read_paths(DS_PREDICT_Stream *const stream, const int fd);
+
+/// Adds the frames read from fd until its end, each as many bytes as the
+/// network has inputs. Returns false if fd cannot be read or ends within a
+/// frame.
+bool DS_PREDICT_read_frames(DS_PREDICT_Stream *const stream, const int fd);
+
+DS_PREDICT_Stats
+DS_PREDICT_stream_stats(const DS_PREDICT_Stream *const stream);
+
+#endif // DEEPSEA_PREDICT_H
@@ -0,0 +1,166 @@
+#include "deepsea_resample.h"
+#include <math.h>
+#include <string.h>
+
+/// Contributions of the input pixels along one axis to one output pixel.
+/// Every output pixel has the same number of taps, unused taps weigh 0.
+typedef struct {
+  size_t first; // First input pixel
+  float *weights;
+} Taps;
+
+/// Taps per output pixel along an axis of `in` pixels resampled to `out`.
+static size_t taps_per_output(const size_t in, const size_t out) {
+  return in > out ? (in + out - 1) / out + 1 : 2;
+}
+
+static size_t axis_scratch_size(const size_t in, const size_t out) {
+  return out * (sizeof(Taps) + taps_per_output(in, out) * sizeof(float));
+}
+
+size_t DS_RESAMPLE_scratch_size(const DS_RESAMPLE_Options *const options,
+                                const size_t width, const size_t height) {
+  // NOTE: Cropping only shrinks the image, so the full size is an upper bound.
+  // The horizontally resampled rows are followed by one accumulator row.
+  return axis_scratch_size(width, options->width) +
+         axis_scratch_size(height, options->height) +
+         (height + 1) * options->width * sizeof(float);
+}
+
+/// Fills the taps to resample the input pixels [start, start + in) to `out`
+/// pixels. Returns the end of the memory used in `memory`.
+static uint8_t *axis_taps(const size_t start, const size_t in,
+                          const size_t out, Taps *const taps,
+                          uint8_t *memory) {
+  const size_t num_taps = taps_per_output(in, out);
+  const double scale = (double)in / (double)out;
+  for (size_t o = 0; o < out; ++o) {
+    float *const weights = (float *)memory;
+    memory += num_taps * sizeof(float);
+    memset(weights, 0, num_taps * sizeof(float));
+    if (in > out) {
+      // NOTE: Area average over [begin, end)
+      const double begin = (double)o * scale;
+      const double end = begin + scale;
+      const size_t first = (size_t)begin;
+      taps[o].first = start + first;
+      for (size_t t = 0; t < num_taps && first + t < in; ++t) {
+        const double overlap = fmin(end, (double)(first + t + 1)) -
+                               fmax(begin, (double)(first + t));
+        weights[t] = overlap > 0 ? (float)(overlap / scale) : 0.f;
+      }
+    } else {
+      // NOTE: Bilinear between the two input pixels around the center
+      const double center =
+          fmin(fmax(((double)o + 0.5) * scale - 0.5, 0.), (double)(in - 1));
+      const size_t first = DS_MIN((size_t)center, in - 1);
+      const float fraction = (float)(center - (double)first);
+      taps[o].first = start + first;
+      weights[0] = 1.f - fraction;
+      if (first + 1 < in)
+        weights[1] = fraction;
+      else
+        weights[0] = 1.f;
+    }
+    taps[o].weights = weights;
+  }
+  return memory;
+}
+
+/// Bounding box of all pixels that differ from the background, grown by the
+/// padding. The whole image if it is empty.
+static void crop_bounds(const DS_RESAMPLE_Options *const options,
+                        const uint8_t *const image, const size_t width,
+                        const size_t height, size_t *const x,
+                        size_t *const y, size_t *const crop_width,
+                        size_t *const crop_height) {
+  size_t min_x = width;
+  size_t min_y = height;
+  size_t max_x = 0;
+  size_t max_y = 0;
+  for (size_t row = 0; row < height; ++row) {
+    for (size_t column = 0; column < width; ++column) {
+      if (image[row * width + column] != options->background) {
+        min_x = DS_MIN(min_x, column);
+        max_x = DS_MAX(max_x, column);
+        min_y = DS_MIN(min_y, row);
+        max_y = DS_MAX(max_y, row);
+      }
+    }
+  }
+  if (min_x > max_x) {
+    *x = 0;
+    *y = 0;
+    *crop_width = width;
+    *crop_height = height;
+    return;
+  }
+  const size_t padding = (size_t)options->crop_padding;
+  *x = min_x > padding ? min_x - padding : 0;
+  *y = min_y > padding ? min_y - padding : 0;
+  *crop_width = DS_MIN(max_x + padding + 1, width) - *x;
+  *crop_height = DS_MIN(max_y + padding + 1, height) - *y;
+}
+
+void DS_RESAMPLE_grey(const DS_RESAMPLE_Options *const options,
+                      const uint8_t *const image, const size_t width,
+                      const size_t height, uint8_t *const out,
+                      void *const scratch) {
+  DS_ASSERT(width > 0 && height > 0 && options->width > 0 &&
+                options->height > 0,
+            "Cannot resample empty images.");
+  size_t x = 0;
+  size_t y = 0;
+  size_t crop_width = width;
+  size_t crop_height = height;
+  if (options->crop_padding >= 0)
+    crop_bounds(options, image, width, height, &x, &y, &crop_width,
+                &crop_height);
+
+  const size_t out_width = options->width;
+  const size_t out_height = options->height;
+  const size_t taps_x = taps_per_output(crop_width, out_width);
+  const size_t taps_y = taps_per_output(crop_height, out_height);
+  // NOTE: Layout of scratch: the taps of both axes, their weights and the
+  // horizontally resampled rows
+  uint8_t *memory = scratch;
+  Taps *const columns = (Taps *)memory;
+  memory += out_width * sizeof(Taps);
+  Taps *const rows = (Taps *)memory;
+  memory += out_height * sizeof(Taps);
+  memory = axis_taps(x, crop_width, out_width, columns, memory);
+  memory = axis_taps(y, crop_height, out_height, rows, memory);
+  float *const horizontal = (float *)memory;
+
+  for (size_t row = 0; row < crop_height; ++row) {
+    const uint8_t *const in = &image[(y + row) * width];
+    float *const resampled = &horizontal[row * out_width];
+    for (size_t o = 0; o < out_width; ++o) {
+      const Taps taps = columns[o];
+      const size_t count = DS_MIN(taps_x, width - taps.first);
+      float sum = 0.f;
+      for (size_t t = 0; t < count; ++t)
+        sum += taps.weights[t] * (float)in[taps.first + t];
+      resampled[o] = sum;
+    }
+  }
+
+  // NOTE: The vertical pass runs along whole rows, which vectorizes
+  float *const accumulator = &horizontal[crop_height * out_width];
+  for (size_t o = 0; o < out_height; ++o) {
+    const Taps taps = rows[o];
+    const size_t count = DS_MIN(taps_y, y + crop_height - taps.first);
+    memset(accumulator, 0, out_width * sizeof(float));
+    for (size_t t = 0; t < count; ++t) {
+      const float weight = taps.weights[t];
+      const float *const in = &horizontal[(taps.first - y + t) * out_width];
+      for (size_t column = 0; column < out_width; ++column)
+        accumulator[column] += weight * in[column];
+    }
+    for (size_t column = 0; column < out_width; ++column) {
+      const float value = accumulator[column] + 0.5f;
+      out[o * out_width + column] =
+          (uint8_t)(value < 0.f ? 0.f : (value > 255.f ? 255.f : value));
+    }
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef DEEPSEA_RESAMPLE_H
+#define DEEPSEA_RESAMPLE_H
+
+#include "deepsea.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/// How images of any size are brought to the input size of a network.
+/// Shrinking averages the area every output pixel covers, enlarging
+/// interpolates bilinearly, independently per axis. The aspect ratio is not
+/// kept, like the GUI does.
+typedef struct {
+  size_t width; // Output size
+  size_t height;
+  // If not negative, the image is first cropped to the bounding box of all
+  // pixels that differ from the background, grown by this many pixels
+  int crop_padding;
+  uint8_t background;
+} DS_RESAMPLE_Options;
+
+/// Bytes of scratch memory DS_RESAMPLE_grey needs for an image of the given
+/// size.
+size_t DS_RESAMPLE_scratch_size(const DS_RESAMPLE_Options *const options,
+                                const size_t width, const size_t height);
+
+/// Resamples a grey image into `out`, which holds options->width *
+/// options->height values. `scratch` must be DS_RESAMPLE_scratch_size bytes
+/// aligned for floats; nothing is allocated.
+void DS_RESAMPLE_grey(const DS_RESAMPLE_Options *const options,
+                      const uint8_t *const image, const size_t width,
+                      const size_t height, uint8_t *const out,
+                      void *const scratch);
+
+#endif // DEEPSEA_RESAMPLE_H
@@ -0,0 +1,371 @@
+#include "deepsea_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define RING_MAGIC 0x31474e52u // "RNG1"
+#define RING_CACHE_LINE 64
+// NOTE: Loads of the other side's count before going to sleep, a few
+// microseconds, so a frame that follows right away costs no system call
+#define RING_SPINS 4096
+// NOTE: Bounds a sleep, so a side that missed the stop notices it anyway
+#define RING_SLEEP_NS 10000000L
+#define RING_POLL_NS 50000L
+
+/// Start of the shared memory object. The input slots follow it, each
+/// RingHeader.slot_stride bytes, then one DS_RING_Result per slot. The
+/// counts only ever grow, modulo 2^32, a frame submitted as count c lies
+/// in slot c % num_slots. Each count is written by one side only and shares
+/// its cache line with nothing the other side writes.
+typedef struct {
+  _Atomic uint32_t magic; // RING_MAGIC once the object is set up
+  uint32_t num_slots;     // Power of two
+  uint32_t frame_size;    // Bytes of a frame
+  uint32_t slot_stride;   // Bytes from one input slot to the next
+
+  _Alignas(RING_CACHE_LINE) _Atomic uint32_t submitted; // By the client
+  _Atomic uint32_t client_sleeps; // Client waits for `answered`
+
+  _Alignas(RING_CACHE_LINE) _Atomic uint32_t answered; // By the server
+  _Atomic uint32_t server_sleeps; // Server waits for `submitted`
+
+  _Alignas(RING_CACHE_LINE) _Atomic uint32_t stopped;
+} RingHeader;
+
+struct DS_RING_Server {
+  char *name;
+  RingHeader *header;
+  size_t size; // Of the mapping
+  uint8_t *inputs;
+  DS_RING_Result *results;
+  // NOTE: Copies of the header fields, which the client could overwrite
+  uint32_t num_slots;
+  uint32_t frame_size;
+  uint32_t slot_stride;
+  pthread_t thread;
+
+  // NOTE: Only used by the thread of the server
+  DS_MODEL_Reader *reader;
+  DS_Inference *inference;
+  size_t *predictions;
+  DS_FLOAT *probabilities;
+
+  _Atomic size_t requests;
+  _Atomic size_t batches;
+};
+
+struct DS_RING_Client {
+  RingHeader *header;
+  size_t size;
+  uint8_t *inputs;
+  const DS_RING_Result *results;
+  uint32_t num_slots;
+  uint32_t frame_size;
+  uint32_t slot_stride;
+  uint32_t submitted; // NOTE: Only the client writes the shared count
+};
+
+static size_t ring_size(const size_t num_slots, const size_t slot_stride) {
+  return sizeof(RingHeader) + num_slots * slot_stride +
+         num_slots * sizeof(DS_RING_Result);
+}
+
+/// Sleeps until *counter may differ from `seen`, at most RING_SLEEP_NS.
+static void ring_sleep(_Atomic uint32_t *const counter, const uint32_t seen) {
+#if defined(__linux__)
+  // NOTE: Not FUTEX_PRIVATE_FLAG, the sides are different processes
+  const struct timespec timeout = {.tv_nsec = RING_SLEEP_NS};
+  syscall(SYS_futex, (uint32_t *)counter, FUTEX_WAIT, seen, &timeout, NULL,
+          0);
+#else
+  (void)counter;
+  (void)seen;
+  const struct timespec pause = {.tv_nsec = RING_POLL_NS};
+  nanosleep(&pause, NULL);
+#endif
+}
+
+static void ring_wake(_Atomic uint32_t *const counter) {
+#if defined(__linux__)
+  syscall(SYS_futex, (uint32_t *)counter, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void)counter;
+#endif
+}
+
+/// Waits until *counter differs from `seen` or the ring stops. Spins first,
+/// then announces in *sleeps that the other side has to wake it.
+static void ring_wait(RingHeader *const header,
+                      _Atomic uint32_t *const counter,
+                      _Atomic uint32_t *const sleeps, const uint32_t seen) {
+  for (size_t spin = 0; spin < RING_SPINS; ++spin)
+    if (atomic_load(counter) != seen || atomic_load(&header->stopped))
+      return;
+  // NOTE: Sequentially consistent, so either the other side sees the
+  // announcement after advancing or this side sees the advanced count
+  atomic_store(sleeps, 1);
+  while (atomic_load(counter) == seen && !atomic_load(&header->stopped))
+    ring_sleep(counter, seen);
+  atomic_store(sleeps, 0);
+}
+
+/// Publishes `count` more frames on *counter and wakes the other side if it
+/// sleeps.
+static void ring_advance(_Atomic uint32_t *const counter,
+                         _Atomic uint32_t *const sleeps,
+                         const uint32_t count) {
+  atomic_fetch_add(counter, count);
+  if (atomic_load(sleeps))
+    ring_wake(counter);
+}
+
+/// Predicts the frames submitted so far where they lie, as one batch up to
+/// the end of the slots, and answers them.
+static void *ring_main(void *const arg) {
+  DS_RING_Server *const server = arg;
+  RingHeader *const header = server->header;
+  uint32_t answered = atomic_load(&header->answered);
+  while (!atomic_load(&header->stopped)) {
+    const uint32_t submitted = atomic_load(&header->submitted);
+    if (submitted == answered) {
+      ring_wait(header, &header->submitted, &header->server_sleeps,
+                answered);
+      continue;
+    }
+    const uint32_t first = answered & (server->num_slots - 1);
+    const uint32_t count =
+        DS_MIN(submitted - answered, server->num_slots - first);
+    const DS_LabelledView view = {
+        .inputs = &server->inputs[(size_t)first * server->slot_stride],
+        .input_stride = server->slot_stride,
+        .input_length = server->frame_size,
+        .input_type = DS_DTYPE_U8,
+        .count = count};
+    DS_inference_set_network(server->inference,
+                             DS_MODEL_enter(server->reader));
+    DS_inference_predict_view(server->inference, &view, server->predictions,
+                              server->probabilities);
+    DS_MODEL_leave(server->reader);
+    for (uint32_t r = 0; r < count; ++r)
+      server->results[first + r] = (DS_RING_Result){
+          .prediction = (uint32_t)server->predictions[r],
+          .confidence = (float)server->probabilities[r]};
+    answered += count;
+    // NOTE: Counted before the answers are published, so a client that got
+    // its results never sees stats without them
+    atomic_fetch_add(&server->requests, count);
+    atomic_fetch_add(&server->batches, 1);
+    ring_advance(&header->answered, &header->client_sleeps, count);
+  }
+  return NULL;
+}
+
+static void ring_server_free_memory(DS_RING_Server *const server) {
+  if (server->header) {
+    munmap(server->header, server->size);
+    shm_unlink(server->name);
+  }
+  DS_inference_free(server->inference);
+  DS_MODEL_reader_unregister(server->reader);
+  DS_FREE(server->predictions);
+  DS_FREE(server->probabilities);
+  DS_FREE(server->name);
+  DS_FREE(server);
+}
+
+DS_RING_Server *DS_RING_server_create(const char *const name,
+                                      DS_MODEL_Model *const model,
+                                      const size_t num_slots) {
+  DS_ASSERT(num_slots > 0 && num_slots <= (1u << 24),
+            "Ring must have between 1 and 2^24 slots, not %lu.", num_slots);
+  uint32_t slots = 1;
+  while (slots < num_slots)
+    slots <<= 1;
+  DS_MODEL_Reader *const reader = DS_MODEL_reader_register(model);
+  const DS_Network *const network = DS_MODEL_enter(reader);
+  const size_t frame_size = DS_network_input_layer_size(network);
+  // NOTE: Only predicts, the cost function is never used
+  DS_Inference *const inference =
+      DS_inference_create(network, DS_QUADRATIC, slots);
+  DS_MODEL_leave(reader);
+  // NOTE: Slots start on their own cache line, the server reads one while
+  // the client writes the next
+  const size_t slot_stride =
+      (frame_size + RING_CACHE_LINE - 1) / RING_CACHE_LINE * RING_CACHE_LINE;
+
+  DS_RING_Server *server = DS_CALLOC(1, sizeof(*server));
+  DS_ASSERT(server, "Could not create ring. Out of memory.");
+  server->name = DS_MALLOC(strlen(name) + 1);
+  DS_ASSERT(server->name, "Could not create ring. Out of memory.");
+  strcpy(server->name, name);
+  server->reader = reader;
+  server->inference = inference;
+  server->num_slots = slots;
+  server->frame_size = (uint32_t)frame_size;
+  server->slot_stride = (uint32_t)slot_stride;
+  server->size = ring_size(slots, slot_stride);
+
+  // NOTE: A ring left behind by a server that crashed
+  shm_unlink(name);
+  const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) {
+    DS_ERROR("Could not create ring \"%s\": %s", name, strerror(errno));
+    ring_server_free_memory(server);
+    return NULL;
+  }
+  void *memory = MAP_FAILED;
+  if (ftruncate(fd, (off_t)server->size) == 0)
+    memory = mmap(NULL, server->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  const int map_error = errno;
+  close(fd);
+  if (memory == MAP_FAILED) {
+    DS_ERROR("Could not map ring \"%s\": %s", name, strerror(map_error));
+    shm_unlink(name);
+    ring_server_free_memory(server);
+    return NULL;
+  }
+  server->header = memory;
+  server->inputs = (uint8_t *)memory + sizeof(RingHeader);
+  server->results =
+      (DS_RING_Result *)(server->inputs + (size_t)slots * slot_stride);
+  // NOTE: The object is zeroed, a client accepts it once the magic is set
+  server->header->num_slots = slots;
+  server->header->frame_size = server->frame_size;
+  server->header->slot_stride = server->slot_stride;
+  atomic_store(&server->header->magic, RING_MAGIC);
+
+  server->predictions = DS_MALLOC(slots * sizeof(server->predictions[0]));
+  server->probabilities = DS_MALLOC(slots * sizeof(server->probabilities[0]));
+  DS_ASSERT(server->predictions && server->probabilities,
+            "Could not create ring. Out of memory.");
+
+  const int error = pthread_create(&server->thread, NULL, &ring_main, server);
+  if (error != 0) {
+    DS_ERROR("Could not start ring server: %s", strerror(error));
+    ring_server_free_memory(server);
+    return NULL;
+  }
+  return server;
+}
+
+void DS_RING_server_free(DS_RING_Server *const server) {
+  atomic_store(&server->header->stopped, 1);
+  ring_wake(&server->header->submitted);
+  ring_wake(&server->header->answered);
+  pthread_join(server->thread, NULL);
+  ring_server_free_memory(server);
+}
+
+DS_RING_Stats DS_RING_server_stats(DS_RING_Server *const server) {
+  return (DS_RING_Stats){.requests = atomic_load(&server->requests),
+                         .batches = atomic_load(&server->batches)};
+}
+
+DS_RING_Client *DS_RING_client_open(const char *const name) {
+  const int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) {
+    DS_ERROR("Could not open ring \"%s\": %s", name, strerror(errno));
+    return NULL;
+  }
+  struct stat info;
+  void *memory = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(RingHeader))
+    memory = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    DS_ERROR("Could not map ring \"%s\".", name);
+    return NULL;
+  }
+  RingHeader *const header = memory;
+  const size_t num_slots = header->num_slots;
+  if (atomic_load(&header->magic) != RING_MAGIC || num_slots == 0 ||
+      (num_slots & (num_slots - 1)) != 0 ||
+      header->slot_stride < header->frame_size ||
+      ring_size(num_slots, header->slot_stride) > (size_t)info.st_size) {
+    DS_ERROR("\"%s\" is not a ring of a server.", name);
+    munmap(memory, (size_t)info.st_size);
+    return NULL;
+  }
+
+  DS_RING_Client *client = DS_CALLOC(1, sizeof(*client));
+  DS_ASSERT(client, "Could not open ring. Out of memory.");
+  client->header = header;
+  client->size = (size_t)info.st_size;
+  client->num_slots = header->num_slots;
+  client->frame_size = header->frame_size;
+  client->slot_stride = header->slot_stride;
+  client->inputs = (uint8_t *)memory + sizeof(RingHeader);
+  client->results =
+      (const DS_RING_Result *)(client->inputs +
+                               (size_t)client->num_slots *
+                                   client->slot_stride);
+  client->submitted = atomic_load(&header->submitted);
+  return client;
+}
+
+void DS_RING_client_free(DS_RING_Client *const client) {
+  munmap(client->header, client->size);
+  DS_FREE(client);
+}
+
+size_t DS_RING_client_frame_size(const DS_RING_Client *const client) {
+  return client->frame_size;
+}
+
+uint8_t *DS_RING_client_slot(DS_RING_Client *const client) {
+  RingHeader *const header = client->header;
+  uint32_t answered = atomic_load(&header->answered);
+  while (client->submitted - answered >= client->num_slots) {
+    if (atomic_load(&header->stopped))
+      return NULL;
+    ring_wait(header, &header->answered, &header->client_sleeps, answered);
+    answered = atomic_load(&header->answered);
+  }
+  if (atomic_load(&header->stopped))
+    return NULL;
+  const uint32_t slot = client->submitted & (client->num_slots - 1);
+  return &client->inputs[(size_t)slot * client->slot_stride];
+}
+
+uint32_t DS_RING_client_submit(DS_RING_Client *const client) {
+  RingHeader *const header = client->header;
+  DS_ASSERT(client->submitted - atomic_load(&header->answered) <
+                client->num_slots,
+            "Submitted a frame without taking a free slot.");
+  ring_advance(&header->submitted, &header->server_sleeps, 1);
+  return client->submitted++;
+}
+
+bool DS_RING_client_result(DS_RING_Client *const client,
+                           const uint32_t ticket,
+                           DS_RING_Result *const result) {
+  DS_ASSERT(client->submitted - ticket - 1 < client->num_slots,
+            "Ticket %u is not among the last %u submitted.", ticket,
+            client->num_slots);
+  RingHeader *const header = client->header;
+  uint32_t answered = atomic_load(&header->answered);
+  // NOTE: Counts wrap around, answered is past the ticket if the distance
+  // is at most the number of frames in flight
+  while (answered - ticket - 1 >= client->num_slots) {
+    if (atomic_load(&header->stopped))
+      return false;
+    ring_wait(header, &header->answered, &header->client_sleeps, answered);
+    answered = atomic_load(&header->answered);
+  }
+  *result = client->results[ticket & (client->num_slots - 1)];
+  return true;
+}
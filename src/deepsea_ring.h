@@ -0,0 +1,78 @@
+#ifndef DEEPSEA_RING_H
+#define DEEPSEA_RING_H
+
+#include "deepsea.h"
+#include "deepsea_model.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Prediction transport for a producer on the same machine, through a ring
+/// of slots in a POSIX shared memory object. The producer writes the grey
+/// values of a frame straight into the next input slot and submits it, the
+/// server predicts all frames submitted since its last look at once, reading
+/// them where they are, and writes the results into the result slots of
+/// the same index. Frames are answered in the order they were submitted.
+///
+/// The ring has one producer and one consumer and needs no lock: the
+/// producer only advances the count of submitted frames, the server only the
+/// count of answered ones. A side that has nothing to do spins briefly and
+/// then sleeps on a futex of the other side's count, which is only woken
+/// with a system call if it announced that it sleeps.
+typedef struct DS_RING_Server DS_RING_Server;
+typedef struct DS_RING_Client DS_RING_Client;
+
+typedef struct {
+  uint32_t prediction; // Index of the most active output
+  float confidence;    // Its share of all output activations
+} DS_RING_Result;
+
+typedef struct {
+  size_t requests; // Frames answered
+  size_t batches;  // Times the server found frames waiting
+} DS_RING_Stats;
+
+#define DS_RING_DEFAULT_NUM_SLOTS 64
+
+/// Creates the shared memory object `name`, e.g. "/ditect", replacing a
+/// stale one, with num_slots slots of one byte per network input, and
+/// starts the thread that answers its frames, each batch with the network
+/// the model has when it is predicted. num_slots is rounded up to a power
+/// of two. The model must outlive the server. Returns NULL if the object
+/// cannot be created.
+DS_RING_Server *DS_RING_server_create(const char *const name,
+                                      DS_MODEL_Model *const model,
+                                      const size_t num_slots);
+
+/// Stops answering, wakes a client waiting for a result and removes the
+/// shared memory object. A mapped client keeps its memory.
+void DS_RING_server_free(DS_RING_Server *const server);
+
+/// Includes at least every frame whose result a client has already taken.
+DS_RING_Stats DS_RING_server_stats(DS_RING_Server *const server);
+
+/// Maps the ring of a server as its only producer. Returns NULL if there is
+/// no such ring.
+DS_RING_Client *DS_RING_client_open(const char *const name);
+
+void DS_RING_client_free(DS_RING_Client *const client);
+
+/// Bytes of a frame, one grey value per network input.
+size_t DS_RING_client_frame_size(const DS_RING_Client *const client);
+
+/// Input slot to write the next frame into. Waits while every slot holds a
+/// frame that was not answered yet. Returns NULL if the server stopped.
+uint8_t *DS_RING_client_slot(DS_RING_Client *const client);
+
+/// Submits the frame written into the slot and returns its ticket. The
+/// result of a ticket must be taken before as many further frames are
+/// submitted as the ring has slots, which then reuse its result slot.
+uint32_t DS_RING_client_submit(DS_RING_Client *const client);
+
+/// Waits for the result of a ticket. Returns false if the server stopped
+/// before answering it.
+bool DS_RING_client_result(DS_RING_Client *const client,
+                           const uint32_t ticket,
+                           DS_RING_Result *const result);
+
+#endif // DEEPSEA_RING_H
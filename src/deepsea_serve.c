@@ -0,0 +1,471 @@
+#include "deepsea_serve.h"
+#include "deepsea_png.h"
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// NOTE: Latencies of the most recent requests every worker keeps
+#define LATENCY_SAMPLES 4096
+#define LISTEN_BACKLOG 64
+#define NO_CONNECTION -1
+
+static_assert(sizeof(DS_SERVE_Request) == 8,
+              "Serve request must be packed.");
+static_assert(sizeof(DS_SERVE_Response) == 268,
+              "Serve response must be packed.");
+
+typedef struct {
+  DS_SERVE_Server *server;
+  pthread_t thread;
+  DS_MODEL_Reader *reader;
+  DS_Inference *inference; // NULL if the server batches
+  DS_PNG_Decoder *decoder;
+  uint8_t *payload; // Grows up to DS_SERVE_MAX_PAYLOAD_SIZE
+  size_t payload_capacity;
+  uint8_t *pixels;  // Input of a PNG request
+  DS_FLOAT *inputs; // Input of a tensor request
+
+  pthread_mutex_t mutex; // Guards the connection, counters and latencies
+  int connection;        // Served right now or NO_CONNECTION
+  size_t requests;
+  size_t errors;
+  unsigned long long latencies_ns[LATENCY_SAMPLES]; // Ring of the last ones
+} ServeWorker;
+
+struct DS_SERVE_Server {
+  char *socket_path;
+  int listen_fd;
+  DS_MODEL_Model *model;
+  size_t input_length;
+  bool resample;
+  DS_RESAMPLE_Options resampling;
+  DS_BATCHER_Batcher *batcher; // NULL if every worker predicts alone
+  ServeWorker *workers;
+  size_t num_workers;
+  atomic_bool stop;
+  bool stopped;
+};
+
+static unsigned long long serve_now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (unsigned long long)time.tv_sec * 1000000000ull +
+         (unsigned long long)time.tv_nsec;
+}
+
+/// Reads exactly size bytes. Returns false at the end of the stream or on
+/// an error.
+static bool serve_read(const int fd, void *const data, const size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = recv(fd, (uint8_t *)data + done, size - done, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += (size_t)n;
+  }
+  return true;
+}
+
+static bool serve_write(const int fd, const void *const data,
+                        const size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    // NOTE: A peer that hung up must not kill the process with SIGPIPE
+    const ssize_t n =
+        send(fd, (const uint8_t *)data + done, size - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += (size_t)n;
+  }
+  return true;
+}
+
+static bool socket_address(const char *const socket_path,
+                           struct sockaddr_un *const address) {
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(address->sun_path)) {
+    DS_ERROR("Socket path \"%s\" is too long.", socket_path);
+    return false;
+  }
+  strcpy(address->sun_path, socket_path);
+  return true;
+}
+
+/// Predicts the payload of a request into the response.
+static DS_SERVE_Status predict(ServeWorker *const worker,
+                               const DS_SERVE_Request *const request,
+                               DS_SERVE_Response *const response) {
+  const DS_SERVE_Server *const server = worker->server;
+  const size_t length = server->input_length;
+  DS_LabelledView view = {.input_length = length, .count = 1};
+  switch (request->type) {
+  case DS_SERVE_TENSOR: {
+    if (request->size != length * sizeof(float))
+      return DS_SERVE_BAD_REQUEST;
+    const float *const values = (const float *)worker->payload;
+    for (size_t i = 0; i < length; ++i)
+      worker->inputs[i] = (DS_FLOAT)values[i];
+    view.inputs = worker->inputs;
+    view.input_stride = length * sizeof(worker->inputs[0]);
+    view.input_type = DS_DTYPE_FLOAT;
+  } break;
+  case DS_SERVE_PNG: {
+    if (!DS_PNG_decode_grey_pixels_from_memory(worker->decoder,
+                                               worker->payload, request->size,
+                                               worker->pixels, length))
+      return DS_SERVE_BAD_IMAGE;
+    view.inputs = worker->pixels;
+    view.input_stride = length;
+    view.input_type = DS_DTYPE_U8;
+  } break;
+  default:
+    return DS_SERVE_BAD_REQUEST;
+  }
+
+  size_t prediction = 0;
+  DS_FLOAT confidence = 0;
+  // NOTE: A network published meanwhile has the same labels, so the label
+  // fits a prediction of the batcher, which enters the model on its own
+  const DS_Network *const network = DS_MODEL_enter(worker->reader);
+  if (server->batcher) {
+    confidence = DS_BATCHER_predict(server->batcher, &view, &prediction);
+  } else {
+    DS_inference_set_network(worker->inference, network);
+    DS_inference_predict_view(worker->inference, &view, &prediction,
+                              &confidence);
+  }
+  response->prediction = (uint32_t)prediction;
+  response->confidence = (float)confidence;
+  const char *const label = DS_network_output_label(network, prediction);
+  if (label)
+    snprintf(response->label, sizeof(response->label), "%s", label);
+  else
+    snprintf(response->label, sizeof(response->label), "%lu", prediction);
+  DS_MODEL_leave(worker->reader);
+  return DS_SERVE_OK;
+}
+
+static void record_latency(ServeWorker *const worker,
+                           const DS_SERVE_Status status,
+                           const unsigned long long latency_ns) {
+  pthread_mutex_lock(&worker->mutex);
+  worker->latencies_ns[worker->requests % LATENCY_SAMPLES] = latency_ns;
+  ++worker->requests;
+  if (status != DS_SERVE_OK)
+    ++worker->errors;
+  pthread_mutex_unlock(&worker->mutex);
+}
+
+/// Answers the requests of one connection until the client hangs up.
+static void serve_connection(ServeWorker *const worker, const int fd) {
+  DS_SERVE_Request request = {0};
+  while (serve_read(fd, &request, sizeof(request))) {
+    const unsigned long long start = serve_now_ns();
+    DS_SERVE_Response response = {0};
+    if (request.size > DS_SERVE_MAX_PAYLOAD_SIZE) {
+      // NOTE: The payload is not read, so the stream cannot be resumed
+      response.status = DS_SERVE_TOO_LARGE;
+      serve_write(fd, &response, sizeof(response));
+      record_latency(worker, response.status, serve_now_ns() - start);
+      return;
+    }
+    if (request.size > worker->payload_capacity) {
+      worker->payload = DS_REALLOC(worker->payload, request.size);
+      DS_ASSERT(worker->payload, "Could not read request. Out of memory.");
+      worker->payload_capacity = request.size;
+    }
+    if (!serve_read(fd, worker->payload, request.size))
+      return;
+
+    response.status = predict(worker, &request, &response);
+    const bool sent = serve_write(fd, &response, sizeof(response));
+    record_latency(worker, response.status, serve_now_ns() - start);
+    if (!sent)
+      return;
+  }
+}
+
+static void *serve_worker_main(void *const arg) {
+  ServeWorker *const worker = arg;
+  DS_SERVE_Server *const server = worker->server;
+  while (!atomic_load(&server->stop)) {
+    const int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break; // NOTE: The socket was shut down by DS_SERVE_server_stop
+    }
+    // NOTE: Checked again under the lock, the stop may have missed the new
+    // connection
+    pthread_mutex_lock(&worker->mutex);
+    worker->connection = fd;
+    const bool stopping = atomic_load(&server->stop);
+    pthread_mutex_unlock(&worker->mutex);
+    if (!stopping && server->batcher) {
+      // NOTE: While connected, the worker is one of the producers whose
+      // requests the batcher waits for
+      DS_BATCHER_attach(server->batcher);
+      serve_connection(worker, fd);
+      DS_BATCHER_detach(server->batcher);
+    } else if (!stopping) {
+      serve_connection(worker, fd);
+    }
+    pthread_mutex_lock(&worker->mutex);
+    worker->connection = NO_CONNECTION;
+    close(fd);
+    pthread_mutex_unlock(&worker->mutex);
+  }
+  return NULL;
+}
+
+static void worker_free(ServeWorker *const worker) {
+  if (worker->inference)
+    DS_inference_free(worker->inference);
+  DS_MODEL_reader_unregister(worker->reader);
+  DS_PNG_decoder_free(worker->decoder);
+  DS_FREE(worker->payload);
+  DS_FREE(worker->pixels);
+  DS_FREE(worker->inputs);
+  pthread_mutex_destroy(&worker->mutex);
+}
+
+static void server_free_memory(DS_SERVE_Server *const server) {
+  DS_FREE(server->workers);
+  DS_FREE(server->socket_path);
+  DS_FREE(server);
+}
+
+DS_SERVE_Server *
+DS_SERVE_server_create(const char *const socket_path,
+                       DS_MODEL_Model *const model, size_t num_workers,
+                       const DS_RESAMPLE_Options *const resampling,
+                       const DS_BATCHER_Options *const batching) {
+  struct sockaddr_un address;
+  if (!socket_address(socket_path, &address))
+    return NULL;
+  // NOTE: Only a socket left behind by a previous server is replaced
+  struct stat info;
+  if (stat(socket_path, &info) == 0 && S_ISSOCK(info.st_mode))
+    unlink(socket_path);
+
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0 ||
+      bind(listen_fd, (const struct sockaddr *)&address, sizeof(address)) !=
+          0 ||
+      listen(listen_fd, LISTEN_BACKLOG) != 0) {
+    DS_ERROR("Could not listen on \"%s\": %s", socket_path, strerror(errno));
+    if (listen_fd >= 0)
+      close(listen_fd);
+    return NULL;
+  }
+
+  if (num_workers == 0) {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = online > 0 ? (size_t)online : 1;
+  }
+  DS_SERVE_Server *server = DS_CALLOC(1, sizeof(*server));
+  DS_ASSERT(server, "Could not create server. Out of memory.");
+  server->socket_path = DS_MALLOC(strlen(socket_path) + 1);
+  server->workers = DS_CALLOC(num_workers, sizeof(server->workers[0]));
+  DS_ASSERT(server->socket_path && server->workers,
+            "Could not create server. Out of memory.");
+  strcpy(server->socket_path, socket_path);
+  server->listen_fd = listen_fd;
+  server->model = model;
+  // NOTE: Every network the model may get has the same input size
+  DS_MODEL_Reader *const reader = DS_MODEL_reader_register(model);
+  server->input_length = DS_network_input_layer_size(DS_MODEL_enter(reader));
+  DS_MODEL_leave(reader);
+  DS_MODEL_reader_unregister(reader);
+  server->resample = resampling != NULL;
+  if (resampling)
+    server->resampling = *resampling;
+  atomic_init(&server->stop, false);
+  if (batching) {
+    server->batcher = DS_BATCHER_create(model, batching);
+    if (!server->batcher) {
+      close(listen_fd);
+      unlink(socket_path);
+      server_free_memory(server);
+      return NULL;
+    }
+  }
+
+  for (size_t w = 0; w < num_workers; ++w) {
+    ServeWorker *const worker = &server->workers[w];
+    worker->server = server;
+    worker->reader = DS_MODEL_reader_register(model);
+    // NOTE: Only predicts, the cost function is never used
+    if (!server->batcher) {
+      worker->inference = DS_inference_create(
+          DS_MODEL_enter(worker->reader), DS_QUADRATIC, 1);
+      DS_MODEL_leave(worker->reader);
+    }
+    worker->decoder = DS_PNG_decoder_create();
+    DS_PNG_decoder_set_resampling(
+        worker->decoder, server->resample ? &server->resampling : NULL);
+    worker->pixels = DS_MALLOC(server->input_length);
+    worker->inputs =
+        DS_MALLOC(server->input_length * sizeof(worker->inputs[0]));
+    DS_ASSERT(worker->pixels && worker->inputs,
+              "Could not create server. Out of memory.");
+    worker->connection = NO_CONNECTION;
+    pthread_mutex_init(&worker->mutex, NULL);
+    const int error =
+        pthread_create(&worker->thread, NULL, &serve_worker_main, worker);
+    if (error != 0) {
+      // NOTE: Serve with the workers that could be started
+      DS_ERROR("Could not start server worker %lu: %s", w, strerror(error));
+      worker_free(worker);
+      break;
+    }
+    ++server->num_workers;
+  }
+  if (server->num_workers == 0) {
+    close(listen_fd);
+    unlink(socket_path);
+    if (server->batcher)
+      DS_BATCHER_free(server->batcher);
+    server_free_memory(server);
+    return NULL;
+  }
+  return server;
+}
+
+void DS_SERVE_server_stop(DS_SERVE_Server *const server) {
+  if (server->stopped)
+    return;
+  atomic_store(&server->stop, true);
+  // NOTE: Wakes the workers waiting in accept and those waiting for the
+  // next request of a connection, a response being written still goes out
+  shutdown(server->listen_fd, SHUT_RDWR);
+  for (size_t w = 0; w < server->num_workers; ++w) {
+    ServeWorker *const worker = &server->workers[w];
+    pthread_mutex_lock(&worker->mutex);
+    if (worker->connection != NO_CONNECTION)
+      shutdown(worker->connection, SHUT_RD);
+    pthread_mutex_unlock(&worker->mutex);
+  }
+  for (size_t w = 0; w < server->num_workers; ++w)
+    pthread_join(server->workers[w].thread, NULL);
+  close(server->listen_fd);
+  server->stopped = true;
+}
+
+void DS_SERVE_server_free(DS_SERVE_Server *const server) {
+  DS_SERVE_server_stop(server);
+  unlink(server->socket_path);
+  for (size_t w = 0; w < server->num_workers; ++w)
+    worker_free(&server->workers[w]);
+  if (server->batcher)
+    DS_BATCHER_free(server->batcher);
+  server_free_memory(server);
+}
+
+size_t DS_SERVE_server_num_workers(const DS_SERVE_Server *const server) {
+  return server->num_workers;
+}
+
+static int compare_seconds(const void *const a, const void *const b) {
+  const double x = *(const double *)a;
+  const double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+double DS_SERVE_percentile(double *const seconds, const size_t count,
+                           const double q) {
+  if (count == 0)
+    return 0;
+  qsort(seconds, count, sizeof(seconds[0]), &compare_seconds);
+  return seconds[(size_t)(q * (double)(count - 1) + 0.5)];
+}
+
+DS_SERVE_Stats DS_SERVE_server_stats(DS_SERVE_Server *const server) {
+  DS_SERVE_Stats stats = {0};
+  double *seconds =
+      DS_MALLOC(server->num_workers * LATENCY_SAMPLES * sizeof(seconds[0]));
+  DS_ASSERT(seconds, "Could not collect server stats. Out of memory.");
+  size_t count = 0;
+  for (size_t w = 0; w < server->num_workers; ++w) {
+    ServeWorker *const worker = &server->workers[w];
+    pthread_mutex_lock(&worker->mutex);
+    stats.requests += worker->requests;
+    stats.errors += worker->errors;
+    const size_t kept = DS_MIN(worker->requests, LATENCY_SAMPLES);
+    for (size_t i = 0; i < kept; ++i)
+      seconds[count++] = (double)worker->latencies_ns[i] * 1e-9;
+    pthread_mutex_unlock(&worker->mutex);
+  }
+  stats.p50_seconds = DS_SERVE_percentile(seconds, count, 0.5);
+  stats.p99_seconds = DS_SERVE_percentile(seconds, count, 0.99);
+  DS_FREE(seconds);
+  if (server->batcher)
+    stats.batching = DS_BATCHER_stats(server->batcher);
+  return stats;
+}
+
+struct DS_SERVE_Client {
+  int fd;
+};
+
+DS_SERVE_Client *DS_SERVE_client_connect(const char *const socket_path) {
+  struct sockaddr_un address;
+  if (!socket_address(socket_path, &address))
+    return NULL;
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (const struct sockaddr *)&address,
+                        sizeof(address)) != 0) {
+    DS_ERROR("Could not connect to \"%s\": %s", socket_path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+  DS_SERVE_Client *client = DS_MALLOC(sizeof(*client));
+  DS_ASSERT(client, "Could not create client. Out of memory.");
+  client->fd = fd;
+  return client;
+}
+
+void DS_SERVE_client_free(DS_SERVE_Client *const client) {
+  close(client->fd);
+  DS_FREE(client);
+}
+
+static bool client_request(DS_SERVE_Client *const client,
+                           const DS_SERVE_RequestType type,
+                           const void *const payload, const size_t size,
+                           DS_SERVE_Response *const response) {
+  const DS_SERVE_Request request = {.type = type, .size = (uint32_t)size};
+  if (size > UINT32_MAX)
+    return false;
+  return serve_write(client->fd, &request, sizeof(request)) &&
+         serve_write(client->fd, payload, size) &&
+         serve_read(client->fd, response, sizeof(*response));
+}
+
+bool DS_SERVE_client_predict_tensor(DS_SERVE_Client *const client,
+                                    const float *const values,
+                                    const size_t length,
+                                    DS_SERVE_Response *const response) {
+  return client_request(client, DS_SERVE_TENSOR, values,
+                        length * sizeof(values[0]), response);
+}
+
+bool DS_SERVE_client_predict_png(DS_SERVE_Client *const client,
+                                 const uint8_t *const data, const size_t size,
+                                 DS_SERVE_Response *const response) {
+  return client_request(client, DS_SERVE_PNG, data, size, response);
+}
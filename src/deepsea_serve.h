@@ -0,0 +1,113 @@
+#ifndef DEEPSEA_SERVE_H
+#define DEEPSEA_SERVE_H
+
+#include "deepsea.h"
+#include "deepsea_batcher.h"
+#include "deepsea_model.h"
+#include "deepsea_resample.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Prediction server on a Unix domain socket, which keeps the network loaded
+/// between requests. A client may send any number of requests over one
+/// connection, every request is answered before the next one is read. A
+/// request is a DS_SERVE_Request followed by `size` bytes of payload:
+///
+///   DS_SERVE_TENSOR: one float32 per network input, scaled to \[0, 1\]
+///   DS_SERVE_PNG:    a grey PNG file of the input size, or of any size if
+///                    the server resamples
+///
+/// and is answered with a DS_SERVE_Response. All integers and floats are in
+/// the byte order of the machine, both ends run on it.
+typedef enum {
+  DS_SERVE_TENSOR = 1,
+  DS_SERVE_PNG = 2,
+} DS_SERVE_RequestType;
+
+typedef struct {
+  uint32_t type; // DS_SERVE_RequestType
+  uint32_t size; // Bytes of payload that follow
+} DS_SERVE_Request;
+
+typedef enum {
+  DS_SERVE_OK = 0,
+  DS_SERVE_BAD_REQUEST = 1, // Unknown type or wrong tensor size
+  DS_SERVE_BAD_IMAGE = 2,   // PNG could not be decoded to the input size
+  DS_SERVE_TOO_LARGE = 3,   // Payload too large, the connection is closed
+} DS_SERVE_Status;
+
+typedef struct {
+  uint32_t status;     // DS_SERVE_Status
+  uint32_t prediction; // Index of the most active output
+  float confidence;    // Its share of all output activations
+  char label[MAX_OUTPUT_LABEL_STRLEN + 1]; // Name of the output or its index
+} DS_SERVE_Response;
+
+/// Largest payload the server accepts.
+#define DS_SERVE_MAX_PAYLOAD_SIZE (16u << 20)
+
+typedef struct DS_SERVE_Server DS_SERVE_Server;
+
+typedef struct {
+  size_t requests;    // Answered requests
+  size_t errors;      // Answered with a status other than DS_SERVE_OK
+  double p50_seconds; // Median time from request to response
+  double p99_seconds;
+  DS_BATCHER_Stats batching; // All zero if the server does not batch
+} DS_SERVE_Stats;
+
+/// Listens on socket_path, replacing a stale socket, and answers requests
+/// with num_workers threads, each with its own PNG decoder. A worker serves
+/// one connection at a time. With batching, the workers predict their
+/// requests through one DS_BATCHER_Batcher, otherwise each with its own
+/// inference context. If num_workers is 0, one worker per processor is
+/// started. Every request is predicted with the network the model has when
+/// its prediction starts. The model must outlive the server. Returns NULL
+/// if the socket cannot be created.
+DS_SERVE_Server *
+DS_SERVE_server_create(const char *const socket_path,
+                       DS_MODEL_Model *const model,
+                       const size_t num_workers,
+                       const DS_RESAMPLE_Options *const resampling,
+                       const DS_BATCHER_Options *const batching);
+
+/// Stops accepting connections, closes the open ones and waits for the
+/// workers. Requests being answered are finished first.
+void DS_SERVE_server_stop(DS_SERVE_Server *const server);
+
+/// Stops the server if needed and removes the socket.
+void DS_SERVE_server_free(DS_SERVE_Server *const server);
+
+size_t DS_SERVE_server_num_workers(const DS_SERVE_Server *const server);
+
+/// Latencies are taken over the most recent requests of every worker.
+DS_SERVE_Stats DS_SERVE_server_stats(DS_SERVE_Server *const server);
+
+/// Percentile `q` in \[0, 1\] of `count` latencies, which are sorted in
+/// place.
+double DS_SERVE_percentile(double *const seconds, const size_t count,
+                           const double q);
+
+typedef struct DS_SERVE_Client DS_SERVE_Client;
+
+/// Connects to a server. Returns NULL if it cannot be reached.
+DS_SERVE_Client *DS_SERVE_client_connect(const char *const socket_path);
+
+void DS_SERVE_client_free(DS_SERVE_Client *const client);
+
+/// Sends the values of all inputs and waits for the answer. Returns false
+/// if the connection failed, the status of the response tells whether the
+/// server could predict.
+bool DS_SERVE_client_predict_tensor(DS_SERVE_Client *const client,
+                                    const float *const values,
+                                    const size_t length,
+                                    DS_SERVE_Response *const response);
+
+/// Sends a PNG file and waits for the answer, see
+/// DS_SERVE_client_predict_tensor.
+bool DS_SERVE_client_predict_png(DS_SERVE_Client *const client,
+                                 const uint8_t *const data, const size_t size,
+                                 DS_SERVE_Response *const response);
+
+#endif // DEEPSEA_SERVE_H
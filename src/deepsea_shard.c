@@ -0,0 +1,664 @@
+#include "deepsea_shard.h"
+#include "deepsea_manifest.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHARD_MAGIC "DSSHARD1"
+#define SHARD_END_MAGIC "DSSHEND1"
+#define SHARD_MAGIC_LENGTH 8
+#define SHARD_BYTE_ORDER_MARK 0x01020304u
+#define TAR_BLOCK_SIZE 512
+#define TAR_MAGIC "ustar"
+#define TAR_MAGIC_OFFSET 257
+// NOTE: Bounds the memory of the raw files while packing
+#define PACK_CHUNK_FILES 4096
+
+typedef struct {
+  char magic[SHARD_MAGIC_LENGTH];
+  uint32_t byte_order;
+  uint32_t reserved;
+} ShardHeader;
+
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+  uint64_t name_offset;
+  uint32_t label;
+  uint32_t reserved;
+} ShardEntry;
+
+typedef struct {
+  uint64_t index_offset;
+  uint64_t count;
+  uint64_t strings_size;
+  char magic[SHARD_MAGIC_LENGTH];
+} ShardTrailer;
+
+static_assert(sizeof(ShardHeader) == 16, "Shard header must be packed.");
+static_assert(sizeof(ShardEntry) == 32, "Shard entry must be packed.");
+static_assert(sizeof(ShardTrailer) == 32, "Shard trailer must be packed.");
+
+typedef struct {
+  uint64_t offset;
+  uint64_t size;
+  size_t shard;
+} FileLocation;
+
+struct DS_SHARD_Set {
+  int *fds;
+  uint8_t **maps; // Read-only mapping of every shard
+  size_t *map_sizes;
+  size_t num_shards;
+  FileLocation *locations;
+  size_t *path_offsets; // Into the arena of the file list while opening
+  size_t capacity;
+  char *arena;
+  size_t arena_size;
+  size_t arena_capacity;
+  DS_FILE_FileList file_list;
+  size_t max_file_size;
+  uint64_t data_size;
+  uint8_t *buffer; // Of DS_SHARD_set_read_files
+  size_t buffer_capacity;
+};
+
+static bool read_shard_at(const int fd, uint8_t *const buffer,
+                          const size_t size, const uint64_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t n = pread(fd, buffer + done, size - done,
+                            (off_t)(offset + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      if (n == 0)
+        errno = EIO; // NOTE: The shard is shorter than its index says
+      return false;
+    }
+    done += (size_t)n;
+  }
+  return true;
+}
+
+bool DS_SHARD_is_shard_pattern(const char *const pattern) {
+  glob_t matches;
+  if (glob(pattern, 0, NULL, &matches) != 0)
+    return false;
+  struct stat file_stat;
+  bool is_shard = false;
+  if (stat(matches.gl_pathv[0], &file_stat) == 0 &&
+      S_ISREG(file_stat.st_mode)) {
+    uint8_t block[TAR_BLOCK_SIZE] = {0};
+    FILE *f = fopen(matches.gl_pathv[0], "rb");
+    if (f) {
+      const size_t read = fread(block, 1, sizeof(block), f);
+      fclose(f);
+      is_shard = (read >= SHARD_MAGIC_LENGTH &&
+                  memcmp(block, SHARD_MAGIC, SHARD_MAGIC_LENGTH) == 0) ||
+                 (read == TAR_BLOCK_SIZE &&
+                  memcmp(&block[TAR_MAGIC_OFFSET], TAR_MAGIC,
+                         strlen(TAR_MAGIC)) == 0);
+    }
+  }
+  globfree(&matches);
+  return is_shard;
+}
+
+/// Appends a file of shard `shard` to the set, its path is "SHARD:NAME".
+static void add_shard_file(DS_SHARD_Set *const set, const size_t shard,
+                           const char *const shard_path, const char *const name,
+                           const size_t name_length, const uint64_t offset,
+                           const uint64_t size, const size_t label) {
+  DS_FILE_FileList *const file_list = &set->file_list;
+  if (file_list->count == set->capacity) {
+    set->capacity = DS_MAX(2 * set->capacity, 1024);
+    set->locations = DS_REALLOC(set->locations,
+                                set->capacity * sizeof(set->locations[0]));
+    set->path_offsets = DS_REALLOC(
+        set->path_offsets, set->capacity * sizeof(set->path_offsets[0]));
+    file_list->labels = DS_REALLOC(
+        file_list->labels, set->capacity * sizeof(file_list->labels[0]));
+    DS_ASSERT(set->locations && set->path_offsets && file_list->labels,
+              "Could not open shards. Out of memory.");
+  }
+  const size_t shard_path_length = strlen(shard_path);
+  const size_t path_size = shard_path_length + 1 + name_length + 1;
+  if (set->arena_size + path_size > set->arena_capacity) {
+    set->arena_capacity =
+        DS_MAX(2 * set->arena_capacity, set->arena_size + path_size);
+    set->arena = DS_REALLOC(set->arena, set->arena_capacity);
+    DS_ASSERT(set->arena, "Could not open shards. Out of memory.");
+  }
+  char *const path = &set->arena[set->arena_size];
+  memcpy(path, shard_path, shard_path_length);
+  path[shard_path_length] = ':';
+  memcpy(&path[shard_path_length + 1], name, name_length);
+  path[path_size - 1] = '\0';
+
+  set->locations[file_list->count] =
+      (FileLocation){.offset = offset, .size = size, .shard = shard};
+  set->path_offsets[file_list->count] = set->arena_size;
+  file_list->labels[file_list->count] = label;
+  set->arena_size += path_size;
+  set->max_file_size = DS_MAX(set->max_file_size, (size_t)size);
+  set->data_size += size;
+  ++file_list->count;
+}
+
+static bool open_shard(DS_SHARD_Set *const set, const size_t shard,
+                       const char *const path, const uint64_t file_size) {
+  const int fd = set->fds[shard];
+  ShardHeader header = {0};
+  ShardTrailer trailer = {0};
+  if (file_size < sizeof(header) + sizeof(trailer) ||
+      !read_shard_at(fd, (uint8_t *)&header, sizeof(header), 0) ||
+      !read_shard_at(fd, (uint8_t *)&trailer, sizeof(trailer),
+                     file_size - sizeof(trailer)) ||
+      memcmp(header.magic, SHARD_MAGIC, SHARD_MAGIC_LENGTH) != 0 ||
+      header.byte_order != SHARD_BYTE_ORDER_MARK ||
+      memcmp(trailer.magic, SHARD_END_MAGIC, SHARD_MAGIC_LENGTH) != 0) {
+    DS_ERROR("File \"%s\" is not a shard of this machine.", path);
+    return false;
+  }
+  const uint64_t body_size = file_size - sizeof(trailer);
+  if (trailer.index_offset < sizeof(header) ||
+      trailer.index_offset > body_size ||
+      trailer.count > (body_size - trailer.index_offset) / sizeof(ShardEntry) ||
+      trailer.strings_size != body_size - trailer.index_offset -
+                                  trailer.count * sizeof(ShardEntry) ||
+      (trailer.count > 0 && trailer.strings_size == 0)) {
+    DS_ERROR("Shard \"%s\" is truncated or corrupt.", path);
+    return false;
+  }
+
+  // NOTE: The index and the names are read in one go
+  const size_t index_size = (size_t)(body_size - trailer.index_offset);
+  uint8_t *index = DS_MALLOC(DS_MAX(index_size, 1));
+  DS_ASSERT(index, "Could not open shard \"%s\". Out of memory.", path);
+  if (!read_shard_at(fd, index, index_size, trailer.index_offset)) {
+    DS_ERROR("Could not read shard \"%s\": %s", path, strerror(errno));
+    DS_FREE(index);
+    return false;
+  }
+  const ShardEntry *const entries = (const ShardEntry *)index;
+  const char *const strings =
+      (const char *)&index[trailer.count * sizeof(ShardEntry)];
+  bool valid = trailer.count == 0 || strings[trailer.strings_size - 1] == '\0';
+  uint64_t end = sizeof(header);
+  for (size_t i = 0; i < trailer.count && valid; ++i) {
+    const ShardEntry *const entry = &entries[i];
+    valid = entry->offset >= end && entry->size <= trailer.index_offset &&
+            entry->offset <= trailer.index_offset - entry->size &&
+            entry->name_offset < trailer.strings_size;
+    if (valid) {
+      const char *const name = &strings[entry->name_offset];
+      add_shard_file(set, shard, path, name, strlen(name), entry->offset,
+                     entry->size, entry->label);
+      end = entry->offset + entry->size;
+    }
+  }
+  DS_FREE(index);
+  if (!valid)
+    DS_ERROR("Shard \"%s\" is truncated or corrupt.", path);
+  return valid;
+}
+
+/// Parses a zero or space terminated octal number of a tar header. Numbers
+/// that do not fit are stored in base 256, marked by the highest bit.
+static bool tar_number(const uint8_t *const field, const size_t length,
+                       uint64_t *const number) {
+  *number = 0;
+  if (field[0] & 0x80) {
+    for (size_t i = 1; i < length; ++i) {
+      if (*number >> 56)
+        return false;
+      *number = *number << 8 | field[i];
+    }
+    return true;
+  }
+  size_t i = 0;
+  while (i < length && field[i] == ' ')
+    ++i;
+  for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i)
+    *number = *number << 3 | (uint64_t)(field[i] - '0');
+  return i == length || field[i] == '\0' || field[i] == ' ';
+}
+
+static bool tar_checksum_matches(const uint8_t *const block) {
+  uint64_t expected = 0;
+  if (!tar_number(&block[148], 8, &expected))
+    return false;
+  uint64_t sum = 0;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i)
+    sum += (i >= 148 && i < 156) ? ' ' : block[i];
+  return sum == expected;
+}
+
+/// Walks the headers of a tar archive. Regular files become members of the
+/// set, GNU long names are supported, all other entries are skipped.
+static bool open_tar(DS_SHARD_Set *const set, const size_t shard,
+                     const char *const path, const uint64_t file_size) {
+  const int fd = set->fds[shard];
+  uint8_t block[TAR_BLOCK_SIZE];
+  char name[DS_FILE_MAX_PATH_LENGTH];
+  bool long_name = false;
+  bool success = false;
+  for (uint64_t offset = 0;;) {
+    if (offset + TAR_BLOCK_SIZE > file_size ||
+        !read_shard_at(fd, block, TAR_BLOCK_SIZE, offset))
+      break; // NOTE: Archives must end with a zero block
+    bool zero = true;
+    for (size_t i = 0; i < TAR_BLOCK_SIZE && zero; ++i)
+      zero = block[i] == 0;
+    if (zero) {
+      success = true;
+      break;
+    }
+    uint64_t size = 0;
+    if (!tar_checksum_matches(block) || !tar_number(&block[124], 12, &size))
+      break;
+    const uint64_t data = offset + TAR_BLOCK_SIZE;
+    if (size > file_size - data)
+      break;
+    offset = data + (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE *
+                        TAR_BLOCK_SIZE;
+
+    const char type = (char)block[156];
+    if (type == 'L') {
+      if (size >= sizeof(name) ||
+          !read_shard_at(fd, (uint8_t *)name, size, data))
+        break;
+      name[size] = '\0';
+      long_name = true;
+      continue;
+    }
+    if (type != '0' && type != '\0') {
+      long_name = false;
+      continue;
+    }
+    if (!long_name) {
+      // NOTE: ustar splits long paths into a prefix and a name
+      const size_t prefix_length = strnlen((const char *)&block[345], 155);
+      const size_t name_length = strnlen((const char *)&block[0], 100);
+      memcpy(name, &block[345], prefix_length);
+      size_t length = prefix_length;
+      if (prefix_length > 0)
+        name[length++] = '/';
+      memcpy(&name[length], &block[0], name_length);
+      name[length + name_length] = '\0';
+    }
+    long_name = false;
+
+    errno = 0;
+    const size_t label = DS_FILE_get_label_from_directory_name(name);
+    if (label == 0 && errno != 0) {
+      DS_ERROR("Could not get a valid label for member \"%s\" of \"%s\"", name,
+               path);
+      return false;
+    }
+    add_shard_file(set, shard, path, name, strlen(name), data, size, label);
+  }
+  if (!success)
+    DS_ERROR("Tar archive \"%s\" is truncated or corrupt.", path);
+  return success;
+}
+
+DS_SHARD_Set *DS_SHARD_set_open(const char *const pattern) {
+  glob_t matches;
+  if (glob(pattern, 0, NULL, &matches) != 0) {
+    DS_ERROR("No shards match \"%s\".", pattern);
+    return NULL;
+  }
+  DS_SHARD_Set *set = DS_CALLOC(1, sizeof(*set));
+  DS_ASSERT(set, "Could not open shards. Out of memory.");
+  set->fds = DS_MALLOC(matches.gl_pathc * sizeof(set->fds[0]));
+  set->maps = DS_CALLOC(matches.gl_pathc, sizeof(set->maps[0]));
+  set->map_sizes = DS_CALLOC(matches.gl_pathc, sizeof(set->map_sizes[0]));
+  DS_ASSERT(set->fds && set->maps && set->map_sizes,
+            "Could not open shards. Out of memory.");
+
+  bool success = true;
+  for (size_t s = 0; s < matches.gl_pathc && success; ++s) {
+    const char *const path = matches.gl_pathv[s];
+    set->fds[s] = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat file_stat;
+    if (set->fds[s] == -1 || fstat(set->fds[s], &file_stat) == -1) {
+      DS_ERROR("Could not open shard \"%s\": %s", path, strerror(errno));
+      if (set->fds[s] != -1)
+        close(set->fds[s]);
+      success = false;
+      break;
+    }
+    set->num_shards = s + 1;
+    // NOTE: Shards are read front to back in large chunks
+    posix_fadvise(set->fds[s], 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char magic[SHARD_MAGIC_LENGTH] = {0};
+    const uint64_t file_size = (uint64_t)file_stat.st_size;
+    const bool is_shard =
+        file_size >= SHARD_MAGIC_LENGTH &&
+        read_shard_at(set->fds[s], (uint8_t *)magic, sizeof(magic), 0) &&
+        memcmp(magic, SHARD_MAGIC, SHARD_MAGIC_LENGTH) == 0;
+    success = is_shard ? open_shard(set, s, path, file_size)
+                       : open_tar(set, s, path, file_size);
+    // NOTE: Mapping costs address space only, pages become resident when
+    // they are touched and can be dropped again with DS_SHARD_set_advise
+    if (success) {
+      void *const map = mmap(NULL, (size_t)file_size, PROT_READ, MAP_SHARED,
+                             set->fds[s], 0);
+      if (map == MAP_FAILED) {
+        DS_ERROR("Could not map shard \"%s\": %s", path, strerror(errno));
+        success = false;
+      } else {
+        set->maps[s] = map;
+        set->map_sizes[s] = (size_t)file_size;
+      }
+    }
+  }
+  globfree(&matches);
+  if (!success) {
+    DS_SHARD_set_free(set);
+    return NULL;
+  }
+
+  DS_FILE_FileList *const file_list = &set->file_list;
+  file_list->paths =
+      DS_MALLOC(DS_MAX(file_list->count, 1) * sizeof(file_list->paths[0]));
+  DS_ASSERT(file_list->paths, "Could not open shards. Out of memory.");
+  for (size_t i = 0; i < file_list->count; ++i)
+    file_list->paths[i] = &set->arena[set->path_offsets[i]];
+  file_list->_arena = set->arena;
+  DS_FREE(set->path_offsets);
+  set->path_offsets = NULL;
+  if (!file_list->labels) {
+    file_list->labels = DS_MALLOC(sizeof(file_list->labels[0]));
+    DS_ASSERT(file_list->labels, "Could not open shards. Out of memory.");
+  }
+  return set;
+}
+
+void DS_SHARD_set_free(DS_SHARD_Set *const set) {
+  for (size_t s = 0; s < set->num_shards; ++s) {
+    if (set->maps[s])
+      munmap(set->maps[s], set->map_sizes[s]);
+    close(set->fds[s]);
+  }
+  DS_FREE(set->map_sizes);
+  DS_FREE(set->maps);
+  DS_FREE(set->fds);
+  DS_FREE(set->locations);
+  DS_FREE(set->path_offsets);
+  DS_FREE(set->arena);
+  DS_FREE(set->file_list.paths);
+  DS_FREE(set->file_list.labels);
+  DS_FREE(set->buffer);
+  DS_FREE(set);
+}
+
+const DS_FILE_FileList *DS_SHARD_set_file_list(const DS_SHARD_Set *const set) {
+  return &set->file_list;
+}
+
+size_t DS_SHARD_set_max_file_size(const DS_SHARD_Set *const set) {
+  return set->max_file_size;
+}
+
+uint64_t DS_SHARD_set_data_size(const DS_SHARD_Set *const set) {
+  return set->data_size;
+}
+
+/// End of the run of files from `first` on that lie in one shard in
+/// ascending order, which is read with a single pread.
+static size_t shard_run_end(const DS_SHARD_Set *const set, const size_t first,
+                            const size_t end) {
+  const FileLocation *const locations = set->locations;
+  size_t i = first + 1;
+  while (i < end && locations[i].shard == locations[first].shard &&
+         locations[i].offset >= locations[i - 1].offset + locations[i - 1].size)
+    ++i;
+  return i;
+}
+
+static uint64_t shard_run_size(const DS_SHARD_Set *const set,
+                               const size_t first, const size_t end) {
+  return set->locations[end - 1].offset + set->locations[end - 1].size -
+         set->locations[first].offset;
+}
+
+bool DS_SHARD_set_read_files(DS_SHARD_Set *const set, const size_t first,
+                             const size_t count, DS_IO_File *const files) {
+  DS_ASSERT(first + count <= set->file_list.count,
+            "Files are out of the range of the shards.");
+  const size_t end = first + count;
+  size_t total = 0;
+  for (size_t i = first; i < end; i = shard_run_end(set, i, end))
+    total += (size_t)shard_run_size(set, i, shard_run_end(set, i, end));
+  if (total > set->buffer_capacity) {
+    uint8_t *buffer = DS_REALLOC(set->buffer, total);
+    DS_ASSERT(buffer, "Could not read shards. Out of memory.");
+    set->buffer = buffer;
+    set->buffer_capacity = total;
+  }
+
+  size_t position = 0;
+  for (size_t i = first; i < end;) {
+    const size_t run = shard_run_end(set, i, end);
+    const FileLocation *const start = &set->locations[i];
+    const size_t size = (size_t)shard_run_size(set, i, run);
+    if (!read_shard_at(set->fds[start->shard], &set->buffer[position], size,
+                       start->offset)) {
+      DS_ERROR("Could not read \"%s\": %s", set->file_list.paths[i],
+               strerror(errno));
+      return false;
+    }
+    for (size_t j = i; j < run; ++j) {
+      files[j - first].data =
+          &set->buffer[position + set->locations[j].offset - start->offset];
+      files[j - first].size = set->locations[j].size;
+    }
+    position += size;
+    i = run;
+  }
+  return true;
+}
+
+bool DS_SHARD_set_read_file(const DS_SHARD_Set *const set, const size_t index,
+                            uint8_t *const buffer, size_t *const size) {
+  const FileLocation *const location = &set->locations[index];
+  if (!read_shard_at(set->fds[location->shard], buffer, location->size,
+                     location->offset)) {
+    DS_ERROR("Could not read \"%s\": %s", set->file_list.paths[index],
+             strerror(errno));
+    return false;
+  }
+  *size = location->size;
+  return true;
+}
+
+const uint8_t *DS_SHARD_set_file_data(const DS_SHARD_Set *const set,
+                                      const size_t index, size_t *const size) {
+  const FileLocation *const location = &set->locations[index];
+  *size = location->size;
+  return &set->maps[location->shard][location->offset];
+}
+
+void DS_SHARD_set_advise(const DS_SHARD_Set *const set, const size_t first,
+                         const size_t count, const bool will_need) {
+  DS_ASSERT(first + count <= set->file_list.count,
+            "Files are out of the range of the shards.");
+  const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+  const size_t end = first + count;
+  for (size_t i = first; i < end;) {
+    const size_t run = shard_run_end(set, i, end);
+    const FileLocation *const start = &set->locations[i];
+    // NOTE: Advice applies to whole pages, so the neighbours of the run may
+    // lose or gain a page, which only costs a page fault
+    const uint64_t offset = start->offset / page_size * page_size;
+    const uint64_t stop = start->offset + shard_run_size(set, i, run);
+    madvise(&set->maps[start->shard][offset], (size_t)(stop - offset),
+            will_need ? MADV_WILLNEED : MADV_DONTNEED);
+    i = run;
+  }
+}
+
+typedef struct {
+  char *base_path; // Shards are named BASE-NNNNN.shard
+  size_t number;
+  FILE *f;
+  char *path;
+  uint64_t size;
+  ShardEntry *entries;
+  size_t count;
+  size_t capacity;
+  char *strings;
+  size_t strings_size;
+  size_t strings_capacity;
+} ShardWriter;
+
+static bool writer_start_shard(ShardWriter *const writer) {
+  const size_t path_size = strlen(writer->base_path) + 32;
+  writer->path = DS_MALLOC(path_size);
+  DS_ASSERT(writer->path, "Could not write shard. Out of memory.");
+  snprintf(writer->path, path_size, "%s-%05lu" DS_SHARD_EXTENSION,
+           writer->base_path, writer->number);
+  writer->f = fopen(writer->path, "wb");
+  if (!writer->f) {
+    DS_ERROR("Could not open shard \"%s\": %s", writer->path, strerror(errno));
+    return false;
+  }
+  ShardHeader header = {.byte_order = SHARD_BYTE_ORDER_MARK};
+  memcpy(header.magic, SHARD_MAGIC, SHARD_MAGIC_LENGTH);
+  writer->size = sizeof(header);
+  writer->count = 0;
+  writer->strings_size = 0;
+  return fwrite(&header, sizeof(header), 1, writer->f) == 1;
+}
+
+static bool writer_add(ShardWriter *const writer, const DS_IO_File *const file,
+                       const char *const name, const uint32_t label) {
+  const size_t name_size = strlen(name) + 1;
+  if (writer->count == writer->capacity) {
+    writer->capacity = DS_MAX(2 * writer->capacity, 1024);
+    writer->entries = DS_REALLOC(writer->entries,
+                                 writer->capacity * sizeof(writer->entries[0]));
+    DS_ASSERT(writer->entries, "Could not write shard. Out of memory.");
+  }
+  if (writer->strings_size + name_size > writer->strings_capacity) {
+    writer->strings_capacity =
+        DS_MAX(2 * writer->strings_capacity, writer->strings_size + name_size);
+    writer->strings = DS_REALLOC(writer->strings, writer->strings_capacity);
+    DS_ASSERT(writer->strings, "Could not write shard. Out of memory.");
+  }
+  writer->entries[writer->count++] =
+      (ShardEntry){.offset = writer->size,
+                   .size = file->size,
+                   .name_offset = writer->strings_size,
+                   .label = label};
+  memcpy(&writer->strings[writer->strings_size], name, name_size);
+  writer->strings_size += name_size;
+  writer->size += file->size;
+  return fwrite(file->data, 1, file->size, writer->f) == file->size;
+}
+
+static bool writer_finish_shard(ShardWriter *const writer) {
+  ShardTrailer trailer = {.index_offset = writer->size,
+                          .count = writer->count,
+                          .strings_size = writer->strings_size};
+  memcpy(trailer.magic, SHARD_END_MAGIC, SHARD_MAGIC_LENGTH);
+  bool written =
+      fwrite(writer->entries, sizeof(writer->entries[0]), writer->count,
+             writer->f) == writer->count &&
+      fwrite(writer->strings, 1, writer->strings_size, writer->f) ==
+          writer->strings_size &&
+      fwrite(&trailer, sizeof(trailer), 1, writer->f) == 1;
+  written = fclose(writer->f) == 0 && written;
+  writer->f = NULL;
+  if (!written)
+    DS_ERROR("Could not write shard \"%s\"", writer->path);
+  DS_FREE(writer->path);
+  writer->path = NULL;
+  ++writer->number;
+  return written;
+}
+
+bool DS_SHARD_write(const char *const path, const size_t max_shard_size,
+                    DS_THREAD_Pool *const pool) {
+  char *dir_path = DS_MALLOC(strlen(path) + 1);
+  DS_ASSERT(dir_path, "Could not write shards. Out of memory.");
+  strcpy(dir_path, path);
+  for (size_t length = strlen(dir_path);
+       length > 1 && dir_path[length - 1] == '/'; --length)
+    dir_path[length - 1] = '\0';
+
+  const bool is_manifest = DS_MANIFEST_is_manifest_file(dir_path);
+  DS_FILE_FileList *file_list = is_manifest ? DS_MANIFEST_load(dir_path)
+                                            : DS_FILE_get_files(dir_path, pool);
+  if (!file_list || file_list->count == 0) {
+    DS_ERROR("No files found in \"%s\".", dir_path);
+    if (file_list)
+      DS_FILE_file_list_free(file_list);
+    DS_FREE(dir_path);
+    return false;
+  }
+
+  // NOTE: The names are the paths relative to the parent of the directory,
+  // e.g. "png/3/103.png", and shards are named after the directory
+  const char *const last_slash = strrchr(dir_path, '/');
+  const size_t prefix_length = last_slash ? last_slash - dir_path + 1 : 0;
+  ShardWriter writer = {.base_path = dir_path};
+  const size_t extension_length = strlen(DS_MANIFEST_EXTENSION);
+  const size_t dir_length = strlen(dir_path);
+  if (is_manifest && dir_length > extension_length &&
+      strcmp(&dir_path[dir_length - extension_length],
+             DS_MANIFEST_EXTENSION) == 0)
+    dir_path[dir_length - extension_length] = '\0';
+
+  DS_IO_Reader *reader = DS_IO_reader_create(pool, true);
+  DS_IO_File *files = DS_MALLOC(DS_MIN(PACK_CHUNK_FILES, file_list->count) *
+                                sizeof(files[0]));
+  DS_ASSERT(files, "Could not write shards. Out of memory.");
+  bool success = true;
+  for (size_t first = 0; first < file_list->count && success;
+       first += PACK_CHUNK_FILES) {
+    const size_t count = DS_MIN(PACK_CHUNK_FILES, file_list->count - first);
+    success = DS_IO_read_files(reader, &file_list->paths[first], count, files);
+    for (size_t i = 0; i < count && success; ++i) {
+      const char *const file_path = file_list->paths[first + i];
+      errno = 0;
+      const size_t label = DS_FILE_file_list_label(file_list, first + i);
+      if ((label == 0 && errno != 0) || label > UINT32_MAX) {
+        DS_ERROR("Could not get a valid label for file \"%s\"", file_path);
+        success = false;
+        break;
+      }
+      if (writer.f && writer.count > 0 &&
+          writer.size + files[i].size > max_shard_size)
+        success = writer_finish_shard(&writer);
+      if (success && !writer.f)
+        success = writer_start_shard(&writer);
+      const bool relative = strncmp(file_path, path, prefix_length) == 0;
+      success = success && writer_add(&writer, &files[i],
+                                      file_path + (relative ? prefix_length
+                                                            : 0),
+                                      (uint32_t)label);
+    }
+  }
+  if (writer.f)
+    success = writer_finish_shard(&writer) && success;
+
+  DS_FREE(writer.strings);
+  DS_FREE(writer.entries);
+  DS_FREE(writer.path);
+  DS_FREE(files);
+  DS_IO_reader_free(reader);
+  DS_FILE_file_list_free(file_list);
+  DS_FREE(dir_path);
+  return success;
+}
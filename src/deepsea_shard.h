@@ -0,0 +1,86 @@
+#ifndef DEEPSEA_SHARD_H
+#define DEEPSEA_SHARD_H
+
+#include "deepsea.h"
+#include "deepsea_file.h"
+#include "deepsea_io.h"
+#include "deepsea_thread.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Shards pack many PNGs back to back into one file, such that a data set is
+/// read with a few large sequential reads instead of an open and a read per
+/// file, which is slow on every file system and worse on network mounts. The
+/// binary layout is:
+///
+///   header:  magic "DSSHARD1", u32 byte order mark 0x01020304, u32 reserved
+///   files:   the contents of the PNGs, back to back
+///   index:   per file: u64 offset of its contents, u64 size in bytes,
+///            u64 name offset into the string table, u32 label, u32 reserved
+///   strings: zero terminated names, relative to the parent of the packed
+///            directory
+///   trailer: u64 offset of the index, u64 number of files, u64 size of the
+///            string table, magic "DSSHEND1"
+///
+/// Like manifests, shards are stored in the byte order of the writer. Plain
+/// POSIX (ustar) tar archives are read as well, their headers serve as the
+/// index and the labels are taken from the directory names of the members.
+#define DS_SHARD_EXTENSION ".shard"
+
+typedef struct DS_SHARD_Set DS_SHARD_Set;
+
+/// Returns true if the pattern names shards or tar archives: a path or a
+/// glob like "data/train-*.shard" whose first match is one.
+bool DS_SHARD_is_shard_pattern(const char *const pattern);
+
+/// Opens all shards and tar archives matching the glob, in sorted order, and
+/// reads their indexes. Returns NULL on error.
+DS_SHARD_Set *DS_SHARD_set_open(const char *const pattern);
+
+void DS_SHARD_set_free(DS_SHARD_Set *const set);
+
+/// All files of the set as a labelled file list. The paths have the form
+/// "SHARD:NAME" and only identify the files in messages, they cannot be
+/// opened.
+const DS_FILE_FileList *DS_SHARD_set_file_list(const DS_SHARD_Set *const set);
+
+/// Size of the largest file of the set.
+size_t DS_SHARD_set_max_file_size(const DS_SHARD_Set *const set);
+
+/// Total size of all files of the set in bytes.
+uint64_t DS_SHARD_set_data_size(const DS_SHARD_Set *const set);
+
+/// Reads the files \[first, first + count) of the set into memory with one
+/// read per shard they span. `files[i]` points into a buffer of the set,
+/// which stays valid until the next call. Not thread-safe.
+bool DS_SHARD_set_read_files(DS_SHARD_Set *const set, const size_t first,
+                             const size_t count, DS_IO_File *const files);
+
+/// Reads file `index` into `buffer`, which must hold
+/// DS_SHARD_set_max_file_size bytes, and stores its size in `size`. Any
+/// number of threads may read at the same time. Returns false on error.
+bool DS_SHARD_set_read_file(const DS_SHARD_Set *const set, const size_t index,
+                            uint8_t *const buffer, size_t *const size);
+
+/// Contents of file `index` in the read-only memory mapping of its shard,
+/// which stays valid as long as the set. Its size is stored in `size`.
+/// Touching the contents faults them in from disk, see DS_SHARD_set_advise.
+const uint8_t *DS_SHARD_set_file_data(const DS_SHARD_Set *const set,
+                                      const size_t index, size_t *const size);
+
+/// Tells the kernel that the files \[first, first + count) will be needed
+/// soon, which starts reading them ahead in large sequential chunks, or that
+/// they are not needed anymore, which drops their pages from the resident
+/// memory of the process. Either is only a hint, the contents stay valid.
+void DS_SHARD_set_advise(const DS_SHARD_Set *const set, const size_t first,
+                         const size_t count, const bool will_need);
+
+/// Packs the PNGs of a labelled directory or manifest into the shards
+/// "DIR-00000.shard", "DIR-00001.shard", ... of up to max_shard_size bytes
+/// each, such that they can be opened with the glob "DIR-*.shard". Returns
+/// false on error.
+bool DS_SHARD_write(const char *const dir_path, const size_t max_shard_size,
+                    DS_THREAD_Pool *const pool);
+
+#endif // DEEPSEA_SHARD_H
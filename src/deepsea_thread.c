@@ -0,0 +1,148 @@
+#include "deepsea_thread.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+// NOTE: Every worker claims this many chunks per loop on average, more chunks
+// balance the load better, fewer reduce the contention on the index counter.
+#define CHUNKS_PER_WORKER 4
+
+typedef struct {
+  DS_THREAD_Pool *pool;
+  size_t worker;
+} WorkerArgs;
+
+struct DS_THREAD_Pool {
+  pthread_t *threads; // Workers 1..size-1, worker 0 is the calling thread
+  WorkerArgs *worker_args;
+  size_t size;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t work_available;
+  pthread_cond_t work_done;
+  size_t generation; // Incremented for every new loop
+  size_t busy_workers;
+  bool stop;
+
+  DS_THREAD_Task task;
+  void *context;
+  size_t count;
+  size_t chunk;
+  atomic_size_t next;
+};
+
+static void run_loop(DS_THREAD_Pool *const pool, const size_t worker) {
+  while (1) {
+    const size_t begin = atomic_fetch_add(&pool->next, pool->chunk);
+    if (begin >= pool->count)
+      break;
+    const size_t end = DS_MIN(begin + pool->chunk, pool->count);
+    for (size_t i = begin; i < end; ++i)
+      pool->task(pool->context, i, worker);
+  }
+}
+
+static void *worker_main(void *const arg) {
+  const WorkerArgs *const args = arg;
+  DS_THREAD_Pool *const pool = args->pool;
+  size_t seen_generation = 0;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (1) {
+    while (!pool->stop && pool->generation == seen_generation)
+      pthread_cond_wait(&pool->work_available, &pool->mutex);
+    if (pool->stop)
+      break;
+    seen_generation = pool->generation;
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_loop(pool, args->worker);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->busy_workers == 0)
+      pthread_cond_signal(&pool->work_done);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+DS_THREAD_Pool *DS_THREAD_pool_create(size_t num_threads) {
+  if (num_threads == 0) {
+    const long online = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = online > 0 ? (size_t)online : 1;
+  }
+
+  DS_THREAD_Pool *pool = DS_CALLOC(1, sizeof(*pool));
+  DS_ASSERT(pool, "Could not create thread pool. Out of memory.");
+  pool->threads = DS_MALLOC(num_threads * sizeof(pool->threads[0]));
+  pool->worker_args = DS_MALLOC(num_threads * sizeof(pool->worker_args[0]));
+  DS_ASSERT(pool->threads && pool->worker_args,
+            "Could not create thread pool. Out of memory.");
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->work_done, NULL);
+  atomic_init(&pool->next, 0);
+
+  pool->size = 1;
+  for (size_t t = 1; t < num_threads; ++t) {
+    pool->worker_args[t] = (WorkerArgs){.pool = pool, .worker = t};
+    const int error = pthread_create(&pool->threads[t], NULL, &worker_main,
+                                     &pool->worker_args[t]);
+    if (error != 0) {
+      DS_ERROR("Could only start %lu of %lu threads: %s", t, num_threads,
+               strerror(error));
+      break;
+    }
+    pool->size = t + 1;
+  }
+  return pool;
+}
+
+void DS_THREAD_pool_free(DS_THREAD_Pool *const pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->mutex);
+  for (size_t t = 1; t < pool->size; ++t)
+    pthread_join(pool->threads[t], NULL);
+
+  pthread_cond_destroy(&pool->work_done);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_mutex_destroy(&pool->mutex);
+  DS_FREE(pool->worker_args);
+  DS_FREE(pool->threads);
+  DS_FREE(pool);
+}
+
+size_t DS_THREAD_pool_size(const DS_THREAD_Pool *const pool) {
+  return pool ? pool->size : 1;
+}
+
+void DS_THREAD_pool_for(DS_THREAD_Pool *const pool, const size_t count,
+                        const DS_THREAD_Task task, void *const context) {
+  if (!pool || pool->size == 1 || count <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      task(context, i, 0);
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->task = task;
+  pool->context = context;
+  pool->count = count;
+  pool->chunk = DS_MAX(count / (pool->size * CHUNKS_PER_WORKER), (size_t)1);
+  atomic_store(&pool->next, 0);
+  pool->busy_workers = pool->size - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->mutex);
+
+  run_loop(pool, 0);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (pool->busy_workers > 0)
+    pthread_cond_wait(&pool->work_done, &pool->mutex);
+  pthread_mutex_unlock(&pool->mutex);
+}
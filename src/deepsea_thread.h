@@ -0,0 +1,32 @@
+#ifndef DEEPSEA_THREAD_H
+#define DEEPSEA_THREAD_H
+
+#include "deepsea.h"
+#include <stddef.h>
+
+typedef struct DS_THREAD_Pool DS_THREAD_Pool;
+
+/// Called once for every index of a parallel loop. `worker` identifies the
+/// thread executing the task and is smaller than DS_THREAD_pool_size(), so it
+/// can be used to index per thread buffers.
+typedef void (*DS_THREAD_Task)(void *const context, const size_t index,
+                               const size_t worker);
+
+/// Create a pool with num_threads workers, including the calling thread. If
+/// num_threads is 0 the number of online processors is used. If threads
+/// cannot be started, the pool falls back to fewer workers (at least one).
+DS_THREAD_Pool *DS_THREAD_pool_create(const size_t num_threads);
+
+void DS_THREAD_pool_free(DS_THREAD_Pool *const pool);
+
+/// Number of workers of the pool. A NULL pool has one worker.
+size_t DS_THREAD_pool_size(const DS_THREAD_Pool *const pool);
+
+/// Runs task for every index in \[0, count) and returns once all of them are
+/// done. The calling thread takes part in the work. With a NULL pool the
+/// loop runs serially on the calling thread.
+/// NOTE: Must not be called from within a task of the same pool.
+void DS_THREAD_pool_for(DS_THREAD_Pool *const pool, const size_t count,
+                        const DS_THREAD_Task task, void *const context);
+
+#endif // DEEPSEA_THREAD_H
@@ -1,16 +1,35 @@
 #include "deepsea.h"
+#include "deepsea_batcher.h"
+#include "deepsea_checkpoint.h"
+#include "deepsea_data.h"
+#include "deepsea_eval.h"
 #include "deepsea_file.h"
+#include "deepsea_idx.h"
+#include "deepsea_manifest.h"
+#include "deepsea_model.h"
+#include "deepsea_pipeline.h"
 #include "deepsea_png.h"
+#include "deepsea_predict.h"
 #include "deepsea_raylib.h"
+#include "deepsea_resample.h"
+#include "deepsea_ring.h"
+#include "deepsea_serve.h"
+#include "deepsea_shard.h"
+#include "deepsea_thread.h"
 #include "limits.h"
 #include "parser.h"
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <raylib.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #if defined(__EMSCRIPTEN__) || defined(__wasm__) || defined(__wasm32__) ||     \
     defined(__wasm64__)
@@ -29,6 +48,7 @@
 #define BATCH_SIZE 10
 #define LEARNING_RATE 0.5f
 #define TRAINED_NETWORK_PATH "trained_network.txt"
+#define CHECKPOINT_PATH "trained_network.checkpoint"
 
 #define FONT_FILE_PATH "./Lato-Regular.ttf"
 #define SCALING 20
@@ -103,7 +123,231 @@ Vector2 get_mouse_position(void) {
 #endif
 }
 
-void train(const char *const data_path) {
+#define BYTES_PER_MIB (1024 * 1024)
+
+#define PIPELINE_DEPTH 4
+#define EVAL_BATCH_SIZE 256
+#define SHARD_SIZE_MB 256
+
+/// Loads the file list of a PNG directory or of its manifest.
+static DS_FILE_FileList *load_file_list(const char *const data_path,
+                                        DS_THREAD_Pool *const pool) {
+  DS_FILE_FileList *file_list = DS_MANIFEST_load_or_scan(data_path, pool);
+  DS_ASSERT(file_list, "Could not load manifest \"%s\".", data_path);
+  return file_list;
+}
+
+/// The files of a directory, a manifest or, if `*shards` is set, of the
+/// shards matching data_path, which own the list.
+static const DS_FILE_FileList *load_files(const char *const data_path,
+                                          DS_SHARD_Set **const shards,
+                                          DS_THREAD_Pool *const pool) {
+  *shards = NULL;
+  if (!DS_SHARD_is_shard_pattern(data_path))
+    return load_file_list(data_path, pool);
+  *shards = DS_SHARD_set_open(data_path);
+  DS_ASSERT(*shards, "Could not open shards \"%s\".", data_path);
+  return DS_SHARD_set_file_list(*shards);
+}
+
+static void free_files(const DS_FILE_FileList *const file_list,
+                       DS_SHARD_Set *const shards) {
+  if (shards)
+    DS_SHARD_set_free(shards);
+  else
+    DS_FILE_file_list_free((DS_FILE_FileList *)file_list);
+}
+
+static DS_DATA_Set *decode_files(const DS_FILE_FileList *const file_list,
+                                 DS_SHARD_Set *const shards,
+                                 const DS_Network *const network,
+                                 const DS_RESAMPLE_Options *const resampling,
+                                 DS_THREAD_Pool *const pool) {
+  DS_DATA_Set *data_set =
+      shards ? DS_PNG_shard_set_to_data_set(shards, network, resampling, pool)
+             : DS_PNG_file_list_to_data_set(file_list, network, resampling,
+                                            pool);
+  DS_ASSERT(data_set, "Could not decode data set.");
+  return data_set;
+}
+
+/// Periodic checkpoints of a training run and where it resumes.
+typedef struct {
+  DS_CHECKPOINT_Writer *writer; // NULL for no checkpoints
+  size_t every;                 // Batches between two checkpoints
+  bool resume;
+  DS_CHECKPOINT_State state; // Where training resumes
+} Checkpointing;
+
+static void train_on_pipeline(DS_Backprop *const backprop,
+                              DS_PIPELINE_Pipeline *const pipeline,
+                              const size_t total_training_set_size,
+                              const Checkpointing *const checkpointing) {
+  size_t first_epoch = 0;
+  DS_FLOAT learning_rate = LEARNING_RATE;
+  if (checkpointing->resume) {
+    const DS_CHECKPOINT_State *const state = &checkpointing->state;
+    DS_ASSERT(state->num_samples == total_training_set_size,
+              "Checkpoint was written for %lu training samples, not %lu.",
+              (size_t)state->num_samples, total_training_set_size);
+    DS_PIPELINE_resume(pipeline, state->seed, state->epoch, state->batch);
+    first_epoch = state->epoch;
+    learning_rate = (DS_FLOAT)state->learning_rate;
+    DS_PRINTF("Resuming training at batch %lu of epoch %lu.\n",
+              (size_t)state->batch, first_epoch + 1);
+  }
+  DS_CHECKPOINT_State state = {
+      .seed = DS_PIPELINE_seed(pipeline),
+      .num_samples = total_training_set_size,
+      .learning_rate = learning_rate,
+  };
+#ifdef DS_COUNT_ALLOCATIONS
+  size_t warm_allocations = 0;
+  size_t warm_batches = 0;
+#endif
+  for (size_t i = first_epoch; i < EPOCHS; ++i) {
+#ifdef DS_COUNT_ALLOCATIONS
+    // NOTE: The first epoch warms up, afterwards nothing should be allocated
+    if (i == first_epoch + 1) {
+      warm_allocations = DS_allocation_count();
+      warm_batches = DS_PIPELINE_stats(pipeline).batches;
+    }
+#endif
+    state.epoch = i;
+    state.batch = i == first_epoch && checkpointing->resume
+                      ? checkpointing->state.batch
+                      : 0;
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *view = NULL;
+    while ((view = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      DS_backprop_learn_once_view(backprop, view, learning_rate,
+                                  total_training_set_size);
+      DS_FLOAT cost = DS_backprop_network_cost_view(backprop, view);
+      DS_PRINTF("Cost of network AFTER learing: %.2f\n", cost);
+      DS_PIPELINE_release_batch(pipeline, view);
+      ++state.batch;
+      if (checkpointing->writer && checkpointing->every > 0 &&
+          state.batch % checkpointing->every == 0)
+        DS_CHECKPOINT_save(checkpointing->writer,
+                           DS_backprop_network(backprop), &state);
+    }
+    DS_ASSERT(!DS_PIPELINE_failed(pipeline), "Could not load labelled inputs.");
+    if (checkpointing->writer) {
+      state.epoch = i + 1;
+      state.batch = 0;
+      DS_CHECKPOINT_save(checkpointing->writer, DS_backprop_network(backprop),
+                         &state);
+    }
+  }
+  DS_PIPELINE_print_stats(pipeline);
+#ifdef DS_COUNT_ALLOCATIONS
+  const size_t batches = DS_PIPELINE_stats(pipeline).batches - warm_batches;
+  DS_PRINTF("Allocations after the first epoch: %lu in %lu batches (%.2f per "
+            "batch).\n",
+            DS_allocation_count() - warm_allocations, batches,
+            batches > 0 ? (double)(DS_allocation_count() - warm_allocations) /
+                              (double)batches
+                        : 0.);
+#endif
+}
+
+static void train_on_file_list(DS_Backprop *const backprop,
+                               const DS_FILE_FileList *const data_file_paths,
+                               const DS_SHARD_Set *const shards,
+                               const DS_RESAMPLE_Options *const resampling,
+                               const size_t memory_budget_mb,
+                               const size_t num_loaders,
+                               const Checkpointing *const checkpointing) {
+  DS_PIPELINE_Pipeline *pipeline =
+      shards ? DS_PIPELINE_create_from_shard_set(
+                   shards, DS_backprop_network(backprop), BATCH_SIZE,
+                   PIPELINE_DEPTH, num_loaders)
+             : DS_PIPELINE_create_from_file_list(
+                   data_file_paths, DS_backprop_network(backprop), BATCH_SIZE,
+                   PIPELINE_DEPTH, num_loaders);
+  DS_ASSERT(pipeline, "Could not create data loading pipeline.");
+  if (resampling)
+    DS_PIPELINE_set_resampling(pipeline, resampling);
+  if (shards && !DS_PIPELINE_set_memory_budget(
+                    pipeline, memory_budget_mb * BYTES_PER_MIB))
+    DS_PRINTF("Reading the shards file by file instead.\n");
+  train_on_pipeline(backprop, pipeline, data_file_paths->count,
+                    checkpointing);
+  DS_PIPELINE_free(pipeline);
+}
+
+static void train_on_data_set(DS_Backprop *const backprop,
+                              const DS_DATA_Set *const data_set,
+                              const size_t shuffle_block,
+                              const size_t num_loaders,
+                              const Checkpointing *const checkpointing) {
+  DS_ASSERT(data_set->count > 0, "No samples found.");
+  DS_PIPELINE_Pipeline *pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH_SIZE, PIPELINE_DEPTH,
+      num_loaders);
+  DS_ASSERT(pipeline, "Could not create data loading pipeline.");
+  DS_PIPELINE_set_block_shuffle(pipeline, shuffle_block,
+                                DS_BATCH_ITERATOR_DEFAULT_WINDOW);
+  train_on_pipeline(backprop, pipeline, data_set->count, checkpointing);
+  DS_PIPELINE_free(pipeline);
+}
+
+static void train_on_idx(DS_Backprop *const backprop,
+                         const char *const data_path,
+                         const size_t shuffle_block,
+                         const size_t num_loaders,
+                         const Checkpointing *const checkpointing) {
+  DS_IDX_DataSet *idx_data_set = DS_IDX_data_set_load(data_path, NULL);
+  DS_ASSERT(idx_data_set, "Could not load IDX data set \"%s\".", data_path);
+  DS_DATA_Set *data_set = DS_IDX_to_data_set(idx_data_set);
+
+  train_on_data_set(backprop, data_set, shuffle_block, num_loaders,
+                    checkpointing);
+
+  DS_DATA_set_free(data_set);
+  DS_IDX_data_set_free(idx_data_set);
+}
+
+static void train_on_directory(DS_Backprop *const backprop,
+                               const char *const data_path,
+                               const size_t memory_budget_mb,
+                               const size_t shuffle_block,
+                               const DS_RESAMPLE_Options *const resampling,
+                               const Checkpointing *const checkpointing,
+                               DS_THREAD_Pool *const pool) {
+  DS_SHARD_Set *shards = NULL;
+  const DS_FILE_FileList *data_file_paths =
+      load_files(data_path, &shards, pool);
+  DS_ASSERT(data_file_paths->count > 0, "No files found.");
+
+  const size_t memory_size = DS_DATA_memory_size(
+      data_file_paths->count,
+      DS_network_input_layer_size(DS_backprop_network(backprop)));
+  if (memory_size > memory_budget_mb * BYTES_PER_MIB) {
+    DS_PRINTF("Decoded data set would need %.1f MiB, which exceeds the memory "
+              "budget of %lu MiB. Streaming from disk.\n",
+              (double)memory_size / BYTES_PER_MIB, memory_budget_mb);
+    train_on_file_list(backprop, data_file_paths, shards, resampling,
+                       memory_budget_mb, DS_THREAD_pool_size(pool),
+                       checkpointing);
+  } else {
+    DS_DATA_Set *data_set =
+        decode_files(data_file_paths, shards, DS_backprop_network(backprop),
+                     resampling, pool);
+    DS_DATA_set_print_memory(data_set);
+    train_on_data_set(backprop, data_set, shuffle_block,
+                      DS_THREAD_pool_size(pool), checkpointing);
+    DS_DATA_set_free(data_set);
+  }
+
+  free_files(data_file_paths, shards);
+}
+
+void train(const char *const data_path, const size_t memory_budget_mb,
+           const size_t shuffle_block,
+           const DS_RESAMPLE_Options *const resampling,
+           const size_t checkpoint_every, const bool resume,
+           DS_THREAD_Pool *const pool) {
   DS_PRINTF("Start training. May take a while.\n");
 
   size_t layer_sizes[NUM_LAYERS] = {NUM_INPUTS, 100, NUM_OUTPUTS};
@@ -112,27 +356,32 @@ void train(const char *const data_path) {
   DS_Backprop *backprop =
       DS_backprop_create(layer_sizes, NUM_LAYERS, output_labels, COST_FUNCTION,
                          REGULARIZATION_PARAM);
-
-  DS_FILE_FileList *data_file_paths = DS_FILE_get_files(data_path);
-  DS_ASSERT(data_file_paths->count > 0, "No files found.");
-  for (int i = 0; i < EPOCHS; ++i) {
-    DS_FILE_FileList *random_slice = NULL;
-    while ((random_slice = DS_FILE_get_random_bucket(data_file_paths,
-                                                     BATCH_SIZE)) != NULL) {
-      DS_Labelled_Inputs *labelled_inputs = DS_PNG_file_list_to_labelled_inputs(
-          random_slice, DS_backprop_network(backprop));
-      DS_ASSERT(labelled_inputs, "Could not labelled inputs.");
-
-      DS_backprop_learn_once(backprop, labelled_inputs, LEARNING_RATE,
-                             data_file_paths->count);
-      DS_FLOAT cost = DS_backprop_network_cost(backprop, labelled_inputs);
-      DS_PRINTF("Cost of network AFTER learing: %.2f\n", cost);
-      DS_labelled_inputs_free(labelled_inputs);
-    }
+  Checkpointing checkpointing = {.every = checkpoint_every, .resume = resume};
+  if (resume)
+    DS_ASSERT(DS_CHECKPOINT_load(CHECKPOINT_PATH, backprop,
+                                 &checkpointing.state),
+              "Could not resume from checkpoint \"%s\".", CHECKPOINT_PATH);
+  if (checkpoint_every > 0)
+    checkpointing.writer = DS_CHECKPOINT_writer_create(
+        CHECKPOINT_PATH, DS_backprop_network(backprop));
+
+  if (DS_IDX_is_images_file(data_path))
+    train_on_idx(backprop, data_path, shuffle_block,
+                 DS_THREAD_pool_size(pool), &checkpointing);
+  else
+    train_on_directory(backprop, data_path, memory_budget_mb, shuffle_block,
+                       resampling, &checkpointing, pool);
+
+  if (checkpointing.writer) {
+    if (DS_CHECKPOINT_writer_wait(checkpointing.writer))
+      DS_PRINTF("Wrote %lu checkpoints to \"%s\".\n",
+                DS_CHECKPOINT_writer_count(checkpointing.writer),
+                CHECKPOINT_PATH);
+    else
+      DS_PRINTF("Failed to write checkpoints!\n");
+    DS_CHECKPOINT_writer_free(checkpointing.writer);
   }
 
-  DS_FILE_file_list_free(data_file_paths);
-
   if (!DS_network_save(DS_backprop_network(backprop), TRAINED_NETWORK_PATH)) {
     DS_PRINTF("Failed to save network!\n");
   }
@@ -140,45 +389,371 @@ void train(const char *const data_path) {
   DS_backprop_free(backprop);
 }
 
-void test(const char *const data_path) {
-  DS_Network *network = DS_network_load(TRAINED_NETWORK_PATH);
-  DS_FILE_FileList *data_file_paths = DS_FILE_get_files(data_path);
+static DS_EVAL_Result *evaluate_pipeline(const DS_Network *const network,
+                                         DS_PIPELINE_Pipeline *const pipeline,
+                                         DS_THREAD_Pool *const pool) {
+  DS_ASSERT(pipeline, "Could not create data loading pipeline.");
+  DS_EVAL_Result *result = DS_EVAL_pipeline(pipeline, network, COST_FUNCTION,
+                                            REGULARIZATION_PARAM, pool);
+  DS_ASSERT(result, "Could not load the testing set.");
+  DS_PIPELINE_free(pipeline);
+  return result;
+}
+
+static DS_EVAL_Result *test_idx(const DS_Network *const network,
+                                const char *const data_path,
+                                DS_THREAD_Pool *const pool) {
+  DS_IDX_DataSet *idx_data_set = DS_IDX_data_set_load(data_path, NULL);
+  DS_ASSERT(idx_data_set, "Could not load IDX data set \"%s\".", data_path);
+  DS_ASSERT(idx_data_set->count > 0, "No samples found.");
+  DS_DATA_Set *data_set = DS_IDX_to_data_set(idx_data_set);
+  DS_ASSERT(data_set->input_length == DS_network_input_layer_size(network),
+            "IDX image size is not compatible with network input size.");
+
+  // NOTE: The pipeline copies the batches out of the mapped file, which the
+  // page cache may drop again behind it
+  DS_EVAL_Result *result = evaluate_pipeline(
+      network,
+      DS_PIPELINE_create_from_data_set(data_set, network, EVAL_BATCH_SIZE,
+                                       PIPELINE_DEPTH,
+                                       DS_THREAD_pool_size(pool)),
+      pool);
+
+  DS_DATA_set_free(data_set);
+  DS_IDX_data_set_free(idx_data_set);
+  return result;
+}
+
+static DS_EVAL_Result *
+test_directory(const DS_Network *const network, const char *const data_path,
+               const DS_RESAMPLE_Options *const resampling,
+               DS_THREAD_Pool *const pool) {
+  DS_SHARD_Set *shards = NULL;
+  const DS_FILE_FileList *data_file_paths =
+      load_files(data_path, &shards, pool);
   DS_ASSERT(data_file_paths->count > 0, "No files found.");
-  DS_Labelled_Inputs *labelled_inputs =
-      DS_PNG_file_list_to_labelled_inputs(data_file_paths, network);
-  DS_ASSERT(labelled_inputs, "Could not labelled inputs.");
 
-  DS_Backprop *backprop = DS_backprop_create_from_network(
-      network, COST_FUNCTION, REGULARIZATION_PARAM);
+  // NOTE: The PNGs are decoded batch by batch instead of all at once
+  DS_PIPELINE_Pipeline *pipeline =
+      shards ? DS_PIPELINE_create_from_shard_set(
+                   shards, network, EVAL_BATCH_SIZE, PIPELINE_DEPTH,
+                   DS_THREAD_pool_size(pool))
+             : DS_PIPELINE_create_from_file_list(
+                   data_file_paths, network, EVAL_BATCH_SIZE, PIPELINE_DEPTH,
+                   DS_THREAD_pool_size(pool));
+  if (pipeline && resampling)
+    DS_PIPELINE_set_resampling(pipeline, resampling);
+  DS_EVAL_Result *result = evaluate_pipeline(network, pipeline, pool);
+
+  free_files(data_file_paths, shards);
+  return result;
+}
+
+void test(const char *const data_path,
+          const DS_RESAMPLE_Options *const resampling,
+          DS_THREAD_Pool *const pool) {
+  DS_Network *network = DS_network_load(TRAINED_NETWORK_PATH);
 
-  DS_FLOAT cost = DS_backprop_network_cost(backprop, labelled_inputs);
-  DS_PRINTF("Quadratic cost of network for testing set: %.2f\n", cost);
-  DS_labelled_inputs_free(labelled_inputs);
-  DS_FILE_file_list_free(data_file_paths);
+  DS_EVAL_Result *result =
+      DS_IDX_is_images_file(data_path)
+          ? test_idx(network, data_path, pool)
+          : test_directory(network, data_path, resampling, pool);
+  DS_EVAL_print_result(result, network);
+  DS_EVAL_result_free(result);
   DS_network_free(network);
 }
 
-void predict(const char *const data_path) {
+static void predict_idx(DS_Network *const network,
+                        const char *const data_path) {
+  DS_IDX_DataSet *idx_data_set = DS_IDX_data_set_load(data_path, NULL);
+  DS_ASSERT(idx_data_set, "Could not load IDX data set \"%s\".", data_path);
+  DS_DATA_Set *data_set = DS_IDX_to_data_set(idx_data_set);
+  DS_ASSERT(data_set->input_length == DS_network_input_layer_size(network),
+            "IDX image size is not compatible with network input size.");
+
+  size_t correct = 0;
+  size_t predictions[BATCH_SIZE];
+  DS_FLOAT probabilities[BATCH_SIZE];
+  for (size_t first = 0; first < data_set->count; first += BATCH_SIZE) {
+    const DS_LabelledView view = DS_DATA_set_view(
+        data_set, first, DS_MIN(BATCH_SIZE, data_set->count - first));
+    DS_network_predict_view(network, &view, predictions, probabilities);
+    for (size_t i = 0; i < view.count; ++i) {
+      char prediction[MAX_OUTPUT_LABEL_STRLEN + 1] = {0};
+      char label[MAX_OUTPUT_LABEL_STRLEN + 1] = {0};
+      const char *output_label =
+          DS_network_output_label(network, predictions[i]);
+      if (output_label)
+        snprintf(prediction, MAX_OUTPUT_LABEL_STRLEN, "%s", output_label);
+      else
+        snprintf(prediction, MAX_OUTPUT_LABEL_STRLEN, "%lu", predictions[i]);
+      snprintf(label, MAX_OUTPUT_LABEL_STRLEN, "%d", view.labels[i]);
+      if (strcmp(prediction, label) == 0)
+        ++correct;
+      DS_PRINTF("%7lu: Prediction is %s with probability of %.1f%%, correct "
+                "label: %s\n",
+                first + i, prediction, probabilities[i] * 100, label);
+    }
+  }
+  DS_PRINTF("Correctly predicted %lu of %lu samples (%.1f%%).\n", correct,
+            data_set->count,
+            data_set->count ? 100. * correct / data_set->count : 0.);
 
-  DS_Network *network = DS_network_load(TRAINED_NETWORK_PATH);
-  DS_PNG_Input *png_input = DS_PNG_input_load_grey(data_path);
-  DS_ASSERT(png_input, "Could not load png input for file \"%s\"", data_path);
+  DS_DATA_set_free(data_set);
+  DS_IDX_data_set_free(idx_data_set);
+}
+
+static void predict_png(DS_Network *const network, const char *const data_path,
+                        const DS_RESAMPLE_Options *const resampling) {
+  const size_t input_length = DS_network_input_layer_size(network);
+  DS_FLOAT *input = DS_MALLOC(input_length * sizeof(input[0]));
+  DS_ASSERT(input, "Could not create input. Out of memory.");
+  DS_PNG_Decoder *decoder = DS_PNG_decoder_create();
+  DS_PNG_decoder_set_resampling(decoder, resampling);
+  const bool decoded =
+      DS_PNG_decode_grey_inputs(decoder, data_path, input, input_length);
+  DS_ASSERT(decoded, "Could not load png input for file \"%s\": %s", data_path,
+            DS_PNG_decoder_error(decoder));
   errno = 0;
   size_t label = DS_FILE_get_label_from_directory_name(data_path);
   DS_ASSERT(!(label == 0 && errno != 0), "Could not load label for file \"%s\"",
             data_path);
 
-  DS_ASSERT(png_input->width * png_input->height ==
-                DS_network_input_layer_size(network),
-            "PNG data size is not compatible with network input size.");
-
-  DS_network_print_prediction(network, png_input->data);
+  DS_network_print_prediction(network, input);
   DS_PRINTF("Correct label: %lu\n", label);
 
-  DS_PNG_input_free(png_input);
+  DS_PNG_decoder_free(decoder);
+  DS_FREE(input);
+}
+
+static bool is_directory(const char *const path) {
+  struct stat info;
+  return stat(path, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/// Writes one line per sample of every path to stdout: the PNGs of a
+/// directory or manifest, a PNG itself or, for "-", the PNGs or frames read
+/// from stdin. Only the paths of one directory or manifest are held at a
+/// time, the images a batch at a time.
+static void predict_stream(const DS_Network *const network,
+                           const char *const *const paths,
+                           const size_t num_paths,
+                           const DS_PREDICT_Format format, const bool frames,
+                           const DS_RESAMPLE_Options *const resampling,
+                           DS_THREAD_Pool *const pool) {
+  DS_PREDICT_Stream *stream = DS_PREDICT_stream_create(
+      network, format, EVAL_BATCH_SIZE, resampling, pool, stdout);
+  for (size_t p = 0; p < num_paths; ++p) {
+    const char *const path = paths[p];
+    if (strcmp(path, "-") == 0) {
+      const bool read = frames ? DS_PREDICT_read_frames(stream, STDIN_FILENO)
+                               : DS_PREDICT_read_paths(stream, STDIN_FILENO);
+      DS_ASSERT(read, "Could not read the samples from stdin.");
+    } else if (DS_MANIFEST_is_manifest_file(path)) {
+      DS_FILE_FileList *file_list = DS_MANIFEST_load(path);
+      DS_ASSERT(file_list, "Could not load manifest \"%s\".", path);
+      DS_PREDICT_add_file_list(stream, file_list);
+      DS_FILE_file_list_free(file_list);
+    } else if (is_directory(path)) {
+      DS_FILE_FileList *file_list = DS_FILE_get_files(path, pool);
+      DS_PREDICT_add_file_list(stream, file_list);
+      DS_FILE_file_list_free(file_list);
+    } else {
+      DS_PREDICT_add_file(stream, path);
+    }
+  }
+  DS_PREDICT_flush(stream);
+  const DS_PREDICT_Stats stats = DS_PREDICT_stream_stats(stream);
+  DS_PREDICT_stream_free(stream);
+  // NOTE: Reported on stderr, stdout only has the lines of the samples
+  DS_FPRINTF(stderr, "Predicted %lu samples, %lu of them failed.\n",
+             stats.samples, stats.failed);
+}
+
+void predict(const char *const data_path, char *const *const extra_data_paths,
+             const size_t num_extra_data_paths, const CommandLineFormat format,
+             const bool frames, const DS_RESAMPLE_Options *const resampling,
+             DS_THREAD_Pool *const pool) {
+  DS_Network *network = DS_network_load(TRAINED_NETWORK_PATH);
+  const bool single = num_extra_data_paths == 0;
+  if (single && DS_IDX_is_images_file(data_path)) {
+    predict_idx(network, data_path);
+  } else if (single && format == CLA_HUMAN && strcmp(data_path, "-") != 0 &&
+             !DS_MANIFEST_is_manifest_file(data_path) &&
+             !is_directory(data_path)) {
+    predict_png(network, data_path, resampling);
+  } else {
+    const char **paths =
+        DS_MALLOC((num_extra_data_paths + 1) * sizeof(paths[0]));
+    DS_ASSERT(paths, "Could not create path list. Out of memory.");
+    paths[0] = data_path;
+    for (size_t i = 0; i < num_extra_data_paths; ++i)
+      paths[i + 1] = extra_data_paths[i];
+    predict_stream(network, paths, num_extra_data_paths + 1,
+                   format == CLA_JSONL ? DS_PREDICT_JSONL : DS_PREDICT_CSV,
+                   frames, resampling, pool);
+    DS_FREE(paths);
+  }
   DS_network_free(network);
 }
 
+#define MICROSECONDS_PER_SECOND 1e6
+
+/// Prints the batch size histogram and queueing delay of a batching server.
+static void print_batching(const DS_BATCHER_Stats *const stats) {
+  DS_PRINTF("Predicted them in %lu batches at %.0f requests per second, "
+            "queued %.0f us on average, at most %.0f us.\n",
+            stats->batches, stats->requests_per_second,
+            stats->mean_queue_seconds * MICROSECONDS_PER_SECOND,
+            stats->max_queue_seconds * MICROSECONDS_PER_SECOND);
+  DS_PRINTF("Batch sizes:");
+  for (size_t b = 0; b < DS_BATCHER_HISTOGRAM_BUCKETS; ++b) {
+    if (stats->batch_sizes[b] == 0)
+      continue;
+    const size_t smallest = (size_t)1 << b;
+    if (b == DS_BATCHER_HISTOGRAM_BUCKETS - 1)
+      DS_PRINTF(" %lu+: %lu", smallest, stats->batch_sizes[b]);
+    else if (smallest == 1)
+      DS_PRINTF(" 1: %lu", stats->batch_sizes[b]);
+    else
+      DS_PRINTF(" %lu-%lu: %lu", smallest, 2 * smallest - 1,
+                stats->batch_sizes[b]);
+  }
+  DS_PRINTF("\n");
+}
+
+void serve(const char *const socket_path, const size_t num_workers,
+           const DS_RESAMPLE_Options *const resampling,
+           const DS_BATCHER_Options *const batching,
+           const char *const ring_name) {
+  DS_Network *network = DS_network_load(TRAINED_NETWORK_PATH);
+  DS_ASSERT(network, "Could not load network \"%s\".", TRAINED_NETWORK_PATH);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+
+  // NOTE: The workers inherit the blocked signals, so only sigwait gets them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  DS_SERVE_Server *server = DS_SERVE_server_create(
+      socket_path, model, num_workers, resampling, batching);
+  DS_ASSERT(server, "Could not serve predictions on \"%s\".", socket_path);
+  DS_PRINTF("Serving predictions on \"%s\" with %lu workers. Stop with "
+            "Ctrl+C.\n",
+            socket_path, DS_SERVE_server_num_workers(server));
+  DS_RING_Server *ring = NULL;
+  if (ring_name) {
+    ring = DS_RING_server_create(ring_name, model, DS_RING_DEFAULT_NUM_SLOTS);
+    DS_ASSERT(ring, "Could not serve frames on ring \"%s\".", ring_name);
+    DS_PRINTF("Serving frames on shared memory ring \"%s\".\n", ring_name);
+  }
+  DS_MODEL_Watcher *watcher = DS_MODEL_watch(
+      model, TRAINED_NETWORK_PATH, DS_MODEL_DEFAULT_WATCH_INTERVAL_SECONDS);
+  DS_PRINTF("Reloading \"%s\" when it changes or on SIGHUP.\n",
+            TRAINED_NETWORK_PATH);
+  fflush(stdout);
+  int received = 0;
+  // NOTE: A reload runs here, the workers keep predicting meanwhile
+  while (sigwait(&signals, &received) == 0 && received == SIGHUP) {
+    if (DS_MODEL_reload(model, TRAINED_NETWORK_PATH))
+      DS_PRINTF("Reloaded network \"%s\".\n", TRAINED_NETWORK_PATH);
+    fflush(stdout);
+  }
+  if (watcher)
+    DS_MODEL_watcher_free(watcher);
+
+  DS_SERVE_server_stop(server);
+  const DS_SERVE_Stats stats = DS_SERVE_server_stats(server);
+  DS_PRINTF("Answered %lu requests (%lu failed), latency p50 %.0f us, p99 "
+            "%.0f us.\n",
+            stats.requests, stats.errors,
+            stats.p50_seconds * MICROSECONDS_PER_SECOND,
+            stats.p99_seconds * MICROSECONDS_PER_SECOND);
+  if (batching)
+    print_batching(&stats.batching);
+  if (ring) {
+    const DS_RING_Stats ring_stats = DS_RING_server_stats(ring);
+    DS_PRINTF("Answered %lu frames on the ring in %lu batches.\n",
+              ring_stats.requests, ring_stats.batches);
+    DS_RING_server_free(ring);
+  }
+  DS_SERVE_server_free(server);
+  DS_PRINTF("Reloaded the network %lu times.\n", DS_MODEL_generation(model));
+  DS_MODEL_free(model);
+}
+
+/// Reads a whole file into `*data`, which grows as needed. Returns false if
+/// it cannot be read.
+static bool read_whole_file(const char *const path, uint8_t **const data,
+                            size_t *const capacity, size_t *const size) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  *size = 0;
+  while (1) {
+    if (*size == *capacity) {
+      *capacity = DS_MAX(2 * *capacity, 4096);
+      *data = DS_REALLOC(*data, *capacity);
+      DS_ASSERT(*data, "Could not read \"%s\". Out of memory.", path);
+    }
+    const size_t n = fread(*data + *size, 1, *capacity - *size, f);
+    *size += n;
+    if (n == 0)
+      break;
+  }
+  const bool success = !ferror(f);
+  fclose(f);
+  return success;
+}
+
+static double seconds_since(const struct timespec *const start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - start->tv_sec) +
+         (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+void client(const char *const socket_path, char *const *const paths,
+            const size_t num_paths) {
+  DS_SERVE_Client *connection = DS_SERVE_client_connect(socket_path);
+  DS_ASSERT(connection, "Could not connect to \"%s\".", socket_path);
+  double *seconds = DS_MALLOC(num_paths * sizeof(seconds[0]));
+  DS_ASSERT(seconds, "Could not create client. Out of memory.");
+  uint8_t *data = NULL;
+  size_t capacity = 0;
+  size_t sent = 0;
+  for (size_t i = 0; i < num_paths; ++i) {
+    size_t size = 0;
+    if (!read_whole_file(paths[i], &data, &capacity, &size)) {
+      DS_PRINTF("%s: Could not read file: %s\n", paths[i], strerror(errno));
+      continue;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    DS_SERVE_Response response;
+    DS_ASSERT(DS_SERVE_client_predict_png(connection, data, size, &response),
+              "Lost the connection to \"%s\".", socket_path);
+    seconds[sent++] = seconds_since(&start);
+    if (response.status == DS_SERVE_OK)
+      DS_PRINTF("%s: Prediction is %s with probability of %.1f%%\n",
+                paths[i], response.label, response.confidence * 100);
+    else
+      DS_PRINTF("%s: Server could not predict, status %u\n", paths[i],
+                response.status);
+  }
+  DS_PRINTF("Sent %lu requests, round trip p50 %.0f us, p99 %.0f us.\n",
+            sent,
+            DS_SERVE_percentile(seconds, sent, 0.5) * MICROSECONDS_PER_SECOND,
+            DS_SERVE_percentile(seconds, sent, 0.99) *
+                MICROSECONDS_PER_SECOND);
+  DS_FREE(data);
+  DS_FREE(seconds);
+  DS_SERVE_client_free(connection);
+}
+
 void draw_text_centered_x(Font font, const char *text, const int y,
                           const int font_size, Color color) {
   const Vector2 text_len = MeasureTextEx(font, text, font_size, 0);
@@ -320,21 +895,73 @@ void run_gui(void) {
 int main(int argc, char *argv[]) {
   CommandLineArgs cmd = {0};
   command_line_parse(&cmd, argc, argv);
+  // NOTE: PNGs of any size are brought to the input size like the GUI does
+  const DS_RESAMPLE_Options resampling_options = {
+      .width = PNG_WIDTH,
+      .height = PNG_WIDTH,
+      .crop_padding = cmd.crop_padding,
+      .background = 0,
+  };
+  const DS_RESAMPLE_Options *const resampling =
+      cmd.resample ? &resampling_options : NULL;
   switch (cmd.action) {
   case CLA_GUI: {
     run_gui();
 
   } break;
   case CLA_TESTING: {
-    test(cmd.data_path);
-
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(cmd.num_threads);
+    test(cmd.data_path, resampling, pool);
+    DS_THREAD_pool_free(pool);
   } break;
   case CLA_TRAINING: {
-    train(cmd.data_path);
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(cmd.num_threads);
+    train(cmd.data_path, cmd.memory_budget_mb, cmd.shuffle_block, resampling,
+          cmd.checkpoint_every, cmd.resume, pool);
+    DS_THREAD_pool_free(pool);
+  } break;
+
+  case CLA_MANIFEST: {
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(cmd.num_threads);
+    char *manifest_path = DS_MANIFEST_path_for_directory(cmd.data_path);
+    if (DS_MANIFEST_write(cmd.data_path, cmd.with_hashes, pool))
+      DS_PRINTF("Wrote manifest \"%s\".\n", manifest_path);
+    else
+      DS_PRINTF("Failed to write manifest!\n");
+    DS_FREE(manifest_path);
+    DS_THREAD_pool_free(pool);
+  } break;
+
+  case CLA_PACK: {
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(cmd.num_threads);
+    if (DS_SHARD_write(cmd.data_path, SHARD_SIZE_MB * BYTES_PER_MIB, pool))
+      DS_PRINTF("Wrote shards \"%s-*" DS_SHARD_EXTENSION "\".\n",
+                cmd.data_path);
+    else
+      DS_PRINTF("Failed to write shards!\n");
+    DS_THREAD_pool_free(pool);
+  } break;
+
+  case CLA_SERVE: {
+    // NOTE: Batches of one row are predicted by the workers themselves
+    const DS_BATCHER_Options batching = {
+        .max_batch_size = cmd.micro_batch,
+        .deadline_seconds =
+            (double)cmd.batch_deadline / MICROSECONDS_PER_SECOND,
+    };
+    serve(cmd.data_path, cmd.num_threads, resampling,
+          cmd.micro_batch > 1 ? &batching : NULL, cmd.ring_name);
+  } break;
+
+  case CLA_CLIENT: {
+    client(cmd.data_path, cmd.extra_data_paths, cmd.num_extra_data_paths);
   } break;
 
   case CLA_PREDICT: {
-    predict(cmd.data_path);
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(cmd.num_threads);
+    predict(cmd.data_path, cmd.extra_data_paths, cmd.num_extra_data_paths,
+            cmd.format, cmd.frames, resampling, pool);
+    DS_THREAD_pool_free(pool);
   } break;
   default:
     assert(false && "Unreachable!");
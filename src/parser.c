@@ -1,5 +1,7 @@
 #include "parser.h"
+#include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,6 +10,19 @@
 void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]) {
   CommandLineAction action = CLA_GUI;
   char *data_path = NULL;
+  size_t memory_budget_mb = CLA_DEFAULT_MEMORY_BUDGET_MB;
+  size_t num_threads = 0;
+  size_t shuffle_block = 0;
+  bool with_hashes = false;
+  bool resample = false;
+  int crop_padding = -1;
+  size_t checkpoint_every = CLA_DEFAULT_CHECKPOINT_EVERY;
+  bool resume = false;
+  size_t micro_batch = CLA_DEFAULT_MICRO_BATCH;
+  size_t batch_deadline_us = CLA_DEFAULT_BATCH_DEADLINE_US;
+  CommandLineFormat format = CLA_HUMAN;
+  bool frames = false;
+  const char *ring_name = NULL;
   const char err[] = "%s: Either specify testing or training, not both!\n";
 
   while (1) {
@@ -15,12 +30,28 @@ void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]) {
         {"train", required_argument, 0, 'T'},
         {"test", required_argument, 0, 't'},
         {"predict", required_argument, 0, 'p'},
+        {"manifest", required_argument, 0, 'M'},
+        {"pack", required_argument, 0, 'P'},
+        {"hash", no_argument, 0, 'H'},
+        {"memory-budget", required_argument, 0, 'm'},
+        {"threads", required_argument, 0, 'j'},
+        {"shuffle-block", required_argument, 0, 'b'},
+        {"resample", optional_argument, 0, 'r'},
+        {"checkpoint-every", required_argument, 0, 'C'},
+        {"resume", no_argument, 0, 'R'},
+        {"serve", optional_argument, 0, 'S'},
+        {"client", required_argument, 0, 'c'},
+        {"micro-batch", required_argument, 0, 'B'},
+        {"batch-deadline", required_argument, 0, 'D'},
+        {"format", required_argument, 0, 'F'},
+        {"frames", no_argument, 0, 'f'},
+        {"ring", required_argument, 0, 'g'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}};
     /* getopt_long stores the option index here. */
     int option_index = 0;
 
-    int c = getopt_long(argc, argv, "T:t:p:h", long_options, &option_index);
+    int c = getopt_long(argc, argv, "T:t:p:M:P:m:j:b:r::h", long_options, &option_index);
 
     /* Detect the end of the options. */
     if (c == -1)
@@ -54,6 +85,156 @@ void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]) {
       data_path = optarg;
       break;
 
+    case 'M':
+      if (data_path) {
+        fprintf(stderr, err, argv[0]);
+        exit(1);
+      }
+      action = CLA_MANIFEST;
+      data_path = optarg;
+      break;
+
+    case 'P':
+      if (data_path) {
+        fprintf(stderr, err, argv[0]);
+        exit(1);
+      }
+      action = CLA_PACK;
+      data_path = optarg;
+      break;
+
+    case 'S':
+      if (data_path) {
+        fprintf(stderr, err, argv[0]);
+        exit(1);
+      }
+      action = CLA_SERVE;
+      data_path = optarg ? optarg : CLA_DEFAULT_SOCKET;
+      break;
+
+    case 'c':
+      if (data_path) {
+        fprintf(stderr, err, argv[0]);
+        exit(1);
+      }
+      action = CLA_CLIENT;
+      data_path = optarg;
+      break;
+
+    case 'H':
+      with_hashes = true;
+      break;
+
+    case 'm': {
+      char *end = NULL;
+      errno = 0;
+      memory_budget_mb = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' ||
+          memory_budget_mb > CLA_MAX_MEMORY_BUDGET_MB) {
+        fprintf(stderr, "%s: Invalid memory budget \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'j': {
+      char *end = NULL;
+      errno = 0;
+      num_threads = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0') {
+        fprintf(stderr, "%s: Invalid number of threads \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'b': {
+      char *end = NULL;
+      errno = 0;
+      shuffle_block = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0') {
+        fprintf(stderr, "%s: Invalid shuffle block size \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'r': {
+      resample = true;
+      if (!optarg)
+        break;
+      char *end = NULL;
+      errno = 0;
+      const long padding = strtol(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || padding < 0 ||
+          padding > INT_MAX) {
+        fprintf(stderr, "%s: Invalid crop padding \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+      crop_padding = (int)padding;
+    } break;
+
+    case 'C': {
+      char *end = NULL;
+      errno = 0;
+      checkpoint_every = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0') {
+        fprintf(stderr, "%s: Invalid number of batches \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'R':
+      resume = true;
+      break;
+
+    case 'B': {
+      char *end = NULL;
+      errno = 0;
+      micro_batch = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0' || micro_batch == 0) {
+        fprintf(stderr, "%s: Invalid batch size \"%s\"!\n", argv[0], optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'D': {
+      char *end = NULL;
+      errno = 0;
+      batch_deadline_us = strtoul(optarg, &end, 10);
+      if (errno != 0 || end == optarg || *end != '\0') {
+        fprintf(stderr, "%s: Invalid batch deadline \"%s\"!\n", argv[0],
+                optarg);
+        exit(1);
+      }
+    } break;
+
+    case 'F':
+      if (strcmp(optarg, "csv") == 0) {
+        format = CLA_CSV;
+      } else if (strcmp(optarg, "jsonl") == 0) {
+        format = CLA_JSONL;
+      } else {
+        fprintf(stderr, "%s: Unknown format \"%s\"!\n", argv[0], optarg);
+        exit(1);
+      }
+      break;
+
+    case 'f':
+      frames = true;
+      break;
+
+    case 'g':
+      if (optarg[0] != '/' || strchr(optarg + 1, '/') || !optarg[1]) {
+        fprintf(stderr, "%s: Invalid ring name \"%s\", must be /NAME!\n",
+                argv[0], optarg);
+        exit(1);
+      }
+      ring_name = optarg;
+      break;
+
     case 'h':
       printf("Usage: %s [OPTION]...\n\n", argv[0]);
       printf(
@@ -66,7 +247,94 @@ void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]) {
              "FILE\n");
       printf("  -t, --test=FILE     Test the network with the data in "
              "FILE\n");
+      printf("  -p, --predict=FILE [FILE]...\n"
+             "                      Predict the labels of the PNGs or of all "
+             "samples in FILE;\n"
+             "                      a FILE of - reads paths of PNGs from "
+             "stdin, one per line\n");
+      printf("      --format=FORMAT Write one line per prediction as csv or "
+             "jsonl, as soon\n"
+             "                      as its batch is done (default: csv, a "
+             "sentence for a\n"
+             "                      single PNG)\n");
+      printf("      --frames        Read raw frames of one byte per network "
+             "input from stdin\n"
+             "                      instead of paths\n");
+      printf("  -M, --manifest=DIR  Index the PNGs in DIR once and write the "
+             "manifest\n"
+             "                      DIR.manifest, which can be used as FILE\n");
+      printf("  -P, --pack=DIR      Pack the PNGs of DIR or of a manifest "
+             "into the shards\n"
+             "                      DIR-00000.shard, ..., which can be used "
+             "as FILE\n");
+      printf("      --serve[=SOCKET]\n"
+             "                      Load the network once and answer "
+             "prediction requests\n"
+             "                      on the Unix socket SOCKET (default: "
+             "%s) until\n"
+             "                      interrupted, with one worker per "
+             "thread\n",
+             CLA_DEFAULT_SOCKET);
+      printf("      --micro-batch=N Let the server predict up to N "
+             "concurrent requests in\n"
+             "                      one batch (default: %d, 1 for no "
+             "batching)\n",
+             CLA_DEFAULT_MICRO_BATCH);
+      printf("      --batch-deadline=US\n"
+             "                      Dispatch a batch at the latest US "
+             "microseconds after its\n"
+             "                      first request arrived (default: %d)\n",
+             CLA_DEFAULT_BATCH_DEADLINE_US);
+      printf("      --ring=/NAME    Also answer frames that one process on "
+             "the same machine\n"
+             "                      writes into the shared memory ring "
+             "/NAME\n");
+      printf("      --client=SOCKET FILE...\n"
+             "                      Send the PNGs to the server on SOCKET "
+             "and print the\n"
+             "                      predictions and round trip times\n");
+      printf("      --hash          Store a hash of every file in the "
+             "manifest\n");
+      printf("  -m, --memory-budget=MB\n"
+             "                      Decode the training data once into "
+             "memory if it fits\n"
+             "                      into MB mebibytes, otherwise stream it "
+             "from disk,\n"
+             "                      shards with at most MB mebibytes "
+             "resident\n"
+             "                      (default: %d)\n",
+             CLA_DEFAULT_MEMORY_BUDGET_MB);
+      printf("  -j, --threads=N     Decode images and load training batches "
+             "with N\n"
+             "                      threads (default: one per processor)\n");
+      printf("  -b, --shuffle-block=N\n"
+             "                      Shuffle in-memory training data in blocks "
+             "of N samples\n"
+             "                      for cache locality (default: 0, shuffle "
+             "single samples)\n");
+      printf("  -r, --resample[=PADDING]\n"
+             "                      Resample PNGs of any size to the network "
+             "input size;\n"
+             "                      with PADDING, first crop them to the "
+             "drawing plus\n"
+             "                      PADDING pixels like the GUI does\n");
+      printf("      --checkpoint-every=N\n"
+             "                      Save a checkpoint of the training every "
+             "N batches and\n"
+             "                      after every epoch in the background "
+             "(default: %d,\n"
+             "                      0 for none)\n",
+             CLA_DEFAULT_CHECKPOINT_EVERY);
+      printf("      --resume        Continue training bit for bit from the "
+             "checkpoint, with\n"
+             "                      the same FILE and options\n");
       printf("  -h, --help          Display this help and exit\n");
+      printf("\nFILE is either a directory of PNGs, sorted into "
+             "sub-directories named after their label, a manifest of such a "
+             "directory, a quoted glob of shards or tar archives of such a "
+             "directory (\"DIR-*.shard\"), or an IDX images "
+             "file (\"*-images-idx3-ubyte[.gz]\") next to its labels "
+             "file.\n");
       exit(0);
 
     case '?':
@@ -79,6 +347,32 @@ void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]) {
   }
 
   command_line->action = action;
+  command_line->memory_budget_mb = memory_budget_mb;
+  command_line->num_threads = num_threads;
+  command_line->shuffle_block = shuffle_block;
+  command_line->with_hashes = with_hashes;
+  command_line->resample = resample;
+  command_line->crop_padding = crop_padding;
+  command_line->checkpoint_every = checkpoint_every;
+  command_line->resume = resume;
+  command_line->micro_batch = micro_batch;
+  command_line->batch_deadline = batch_deadline_us;
+  command_line->format = format;
+  command_line->frames = frames;
+  command_line->ring_name = ring_name;
+
+  if (optind < argc && action != CLA_PREDICT && action != CLA_CLIENT) {
+    fprintf(stderr,
+            "%s: Only --predict and --client accept more than one path!\n",
+            argv[0]);
+    exit(1);
+  }
+  if (optind == argc && action == CLA_CLIENT) {
+    fprintf(stderr, "%s: --client needs the PNGs to send!\n", argv[0]);
+    exit(1);
+  }
+  command_line->extra_data_paths = &argv[optind];
+  command_line->num_extra_data_paths = (size_t)(argc - optind);
 
   if (data_path) {
     const size_t len = strlen(data_path);
@@ -1,17 +1,54 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLA_DEFAULT_MEMORY_BUDGET_MB 1024
+// NOTE: The budget is used in bytes, which must fit into a size_t
+#define CLA_MAX_MEMORY_BUDGET_MB (SIZE_MAX / (1024 * 1024))
+#define CLA_DEFAULT_CHECKPOINT_EVERY 1000
+#define CLA_DEFAULT_SOCKET "ditect.sock"
+#define CLA_DEFAULT_MICRO_BATCH 32
+#define CLA_DEFAULT_BATCH_DEADLINE_US 500
+
 typedef enum {
   CLA_TESTING,
   CLA_TRAINING,
   CLA_PREDICT,
+  CLA_MANIFEST,
+  CLA_PACK,
+  CLA_SERVE,
+  CLA_CLIENT,
   CLA_GUI,
 
 } CommandLineAction;
 
+typedef enum {
+  CLA_HUMAN, // Sentences for a lone PNG, CSV for anything else
+  CLA_CSV,
+  CLA_JSONL,
+} CommandLineFormat;
+
 typedef struct {
   CommandLineAction action;
   const char *data_path;
+  char **extra_data_paths; // Further paths given after the options
+  size_t num_extra_data_paths;
+  size_t memory_budget_mb;  // Maximum size of a data set decoded into memory
+  size_t num_threads;       // 0 means one thread per processor
+  size_t shuffle_block;     // Samples per shuffled block, 0 for full shuffle
+  bool with_hashes;         // Store content hashes in the manifest
+  bool resample;            // Resample PNGs of any size to the input size
+  int crop_padding;         // Crop to the drawing plus padding, -1 for none
+  size_t checkpoint_every;  // Batches between checkpoints, 0 for none
+  bool resume;              // Continue training from the checkpoint
+  size_t micro_batch;       // Requests served at once, 1 for no batching
+  size_t batch_deadline;    // Microseconds a request waits for a batch
+  CommandLineFormat format; // Output of the predictions
+  bool frames;              // Read raw frames instead of paths from stdin
+  const char *ring_name;    // Shared memory ring the server answers, or NULL
 } CommandLineArgs;
 
 void command_line_parse(CommandLineArgs *command_line, int argc, char *argv[]);
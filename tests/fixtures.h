@@ -0,0 +1,113 @@
+#ifndef TEST_FIXTURES_H
+#define TEST_FIXTURES_H
+
+// Helpers shared by the test files. Include it after see.h, the sources under
+// test and common.h.
+
+#include "deepsea.h"
+#include "deepsea_data.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define TEST_PNG_PATH TEST_DATA_DIR "4.png"
+#define TEST_PNG_MAX_FILE_SIZE 4096
+#define LABELLED_DIR_NUM_FILES 4
+
+/// Data set whose rows differ from each other, labelled round robin.
+static inline DS_DATA_Set *create_data_set(const size_t count,
+                                           const size_t input_length,
+                                           const size_t num_outputs) {
+  DS_DATA_Set *data_set = DS_DATA_set_create(count, input_length, NULL);
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = 0; j < input_length; ++j)
+      data_set->pixels[i * input_length + j] = (uint8_t)(i * 13 + j * 71);
+    data_set->labels[i] = (uint16_t)(i % num_outputs);
+  }
+  return data_set;
+}
+
+/// Random network with a single hidden layer.
+static inline DS_Network *create_network(const size_t input_length,
+                                         const size_t num_hidden,
+                                         const size_t num_outputs) {
+  size_t sizes[3] = {input_length, num_hidden, num_outputs};
+  return DS_network_create_random(sizes, 3, NULL);
+}
+
+/// View of the single row `inputs` of type `type`.
+static inline DS_LabelledView row_view(const void *const inputs,
+                                       const DS_DType type,
+                                       const size_t input_length) {
+  return (DS_LabelledView){
+      .inputs = inputs,
+      .input_stride = type == DS_DTYPE_U8 ? input_length
+                                          : input_length * sizeof(DS_FLOAT),
+      .input_length = input_length,
+      .input_type = type,
+      .count = 1};
+}
+
+/// Prediction of the network itself for the single row `inputs`.
+static inline size_t predict_row(DS_Network *const network,
+                                 const void *const inputs, const DS_DType type,
+                                 const size_t input_length,
+                                 DS_FLOAT *const probability) {
+  const DS_LabelledView view = row_view(inputs, type, input_length);
+  size_t prediction = 0;
+  DS_network_predict_view(network, &view, &prediction, probability);
+  return prediction;
+}
+
+/// Reads the encoded test PNG and returns its size.
+static inline size_t read_test_png(uint8_t file[TEST_PNG_MAX_FILE_SIZE]) {
+  size_t size = 0;
+  FILE *f = fopen(TEST_PNG_PATH, "rb");
+  SEE_assert(f != NULL, "Could not open test PNG.");
+  if (f) {
+    size = fread(file, 1, TEST_PNG_MAX_FILE_SIZE, f);
+    fclose(f);
+  }
+  return size;
+}
+
+/// Grey values of row `index`, which differ from row to row.
+static inline void fill_grey_row(const size_t index, uint8_t *const grey,
+                                 const size_t input_length) {
+  for (size_t j = 0; j < input_length; ++j)
+    grey[j] = (uint8_t)(index * 29 + j * 83);
+}
+
+static inline void write_test_file(const char *const path,
+                                   const uint8_t *const data,
+                                   const size_t size) {
+  FILE *f = fopen(path, "wb");
+  SEE_assert(f != NULL, "Could not open %s.", path);
+  if (f) {
+    SEE_assert(fwrite(data, 1, size, f) == size, "Could not write %s.", path);
+    fclose(f);
+  }
+}
+
+/// Builds `dir`/5/{0,1,2}.png and `dir`/7/0.png from the test PNG, so it holds
+/// LABELLED_DIR_NUM_FILES files.
+static inline void create_labelled_dir(const char *const dir) {
+  uint8_t file[TEST_PNG_MAX_FILE_SIZE];
+  const size_t size = read_test_png(file);
+  char path[256];
+  mkdir(TEST_OUT_DIR, 0755);
+  mkdir(dir, 0755);
+  snprintf(path, sizeof(path), "%s/5", dir);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/7", dir);
+  mkdir(path, 0755);
+  for (size_t i = 0; i < LABELLED_DIR_NUM_FILES - 1; ++i) {
+    snprintf(path, sizeof(path), "%s/5/%lu.png", dir, i);
+    write_test_file(path, file, size);
+  }
+  snprintf(path, sizeof(path), "%s/7/0.png", dir);
+  write_test_file(path, file, size);
+}
+
+#endif
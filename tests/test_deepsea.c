@@ -334,6 +334,24 @@ void test_save_network_without_labels(void) {
   DS_network_free(network);
 }
 
+void test_load_truncated_network_fails(void) {
+  // NOTE: Cut within the weights, like a file that is still being written
+  FILE *in = fopen(TEST_DATA_DIR "network_with_labels.txt", "r");
+  FILE *out = fopen(TEST_OUT_DIR "truncated_network.txt", "w");
+  SEE_assert(in && out, "Could not open network files.");
+  char line[1024];
+  for (size_t l = 0; l < 5 && fgets(line, sizeof(line), in); ++l)
+    fputs(line, out);
+  fclose(in);
+  fclose(out);
+  SEE_assert(DS_network_load(TEST_OUT_DIR "truncated_network.txt") == NULL,
+             "Truncated network must not be loaded.");
+  DS_Network *network =
+      DS_network_load(TEST_DATA_DIR "network_with_labels.txt");
+  SEE_assert_neqp(network, NULL, "Complete network must be loaded.");
+  DS_network_free(network);
+}
+
 void test_network_feedforward(void) {
   DS_Network *network = create_test_network();
   const DS_FLOAT input[LAYER_1] = {.1, .2};
@@ -364,6 +382,89 @@ void test_network_feedforward(void) {
   DS_network_free(network);
 }
 
+void test_inference_score_view(void) {
+  DS_Network *network = create_test_network();
+  const DS_FLOAT inputs[2][LAYER_1] = {{.1, .2}, {.1, .2}};
+  const uint16_t labels[2] = {0, 1};
+  const DS_FLOAT res_activation_3[LAYER_3] = {0.77851856, 0.69807426};
+  const DS_LabelledView view = {.inputs = inputs,
+                                .input_stride = sizeof(inputs[0]),
+                                .input_length = LAYER_1,
+                                .input_type = DS_DTYPE_FLOAT,
+                                .labels = labels,
+                                .count = 2};
+
+  DS_Inference *inference = DS_inference_create(network, DS_QUADRATIC, 2);
+  size_t predictions[2] = {0};
+  const DS_FLOAT cost = DS_inference_score_view(inference, &view, predictions);
+  // NOTE: Both rows were fed forward at once, one after the other
+  for (size_t i = 0; i < 2 * LAYER_3; ++i)
+    SEE_assert_eqf(inference->activations[NUM_LAYERS - 1][i],
+                   res_activation_3[i % LAYER_3], "Activation for index %lu",
+                   i);
+  SEE_assert_eqlu(predictions[0], (size_t)0, "Wrong first prediction.");
+  SEE_assert_eqlu(predictions[1], (size_t)0, "Wrong second prediction.");
+  SEE_assert_eqf(cost,
+                 quadratic_cost_class(res_activation_3, 0, LAYER_3) +
+                     quadratic_cost_class(res_activation_3, 1, LAYER_3),
+                 "Wrong cost.");
+  // NOTE: Inference never touches the activations of the network
+  SEE_assert_eqf(network->result->activations[NUM_LAYERS - 1][0], 0.,
+                 "Network result was changed.");
+  DS_inference_free(inference);
+  DS_network_free(network);
+}
+
+void test_inference_batches_predict_like_rows(void) {
+  size_t sizes[4] = {7, 5, 4, 3};
+  DS_Network *network = DS_network_create_random(sizes, 4, NULL);
+  uint8_t grey[11][7];
+  DS_FLOAT values[11][7];
+  for (size_t i = 0; i < 11; ++i)
+    for (size_t j = 0; j < 7; ++j) {
+      grey[i][j] = (uint8_t)(i * 37 + j * 101);
+      values[i][j] = grey[i][j] / 255.;
+    }
+  DS_LabelledView views[2] = {{.inputs = grey,
+                               .input_stride = sizeof(grey[0]),
+                               .input_length = 7,
+                               .input_type = DS_DTYPE_U8,
+                               .count = 11},
+                              {.inputs = values,
+                               .input_stride = sizeof(values[0]),
+                               .input_length = 7,
+                               .input_type = DS_DTYPE_FLOAT,
+                               .count = 11}};
+  for (size_t v = 0; v < 2; ++v) {
+    size_t expected[11];
+    DS_FLOAT expected_probabilities[11];
+    DS_network_predict_view(network, &views[v], expected,
+                            expected_probabilities);
+    // NOTE: Batches that divide the rows, leave a remainder and exceed them
+    const size_t batch_sizes[4] = {1, 4, 11, 16};
+    for (size_t b = 0; b < 4; ++b) {
+      DS_Inference *inference =
+          DS_inference_create(network, DS_QUADRATIC, batch_sizes[b]);
+      SEE_assert_eqlu(DS_inference_batch_size(inference), batch_sizes[b],
+                      "Wrong batch size.");
+      size_t predictions[11];
+      DS_FLOAT probabilities[11];
+      DS_inference_predict_view(inference, &views[v], predictions,
+                                probabilities);
+      for (size_t i = 0; i < 11; ++i) {
+        SEE_assert_eqlu(predictions[i], expected[i],
+                        "Wrong prediction of row %lu in batches of %lu.", i,
+                        batch_sizes[b]);
+        SEE_assert(probabilities[i] == expected_probabilities[i],
+                   "Probability of row %lu changed in batches of %lu.", i,
+                   batch_sizes[b]);
+      }
+      DS_inference_free(inference);
+    }
+  }
+  DS_network_free(network);
+}
+
 void test_backprop_last_error_quadratic(void) {
   DS_FLOAT a = 0.3;
   DS_FLOAT z = 0.5;
@@ -749,7 +850,10 @@ SEE_RUN_TESTS(test_sigmoid_single, test_sigmoid_multi,
               test_create_test_network, test_network_eq,
               test_create_test_network_owned, test_check_two_files,
               test_save_network_with_labels, test_save_network_without_labels,
-              test_network_feedforward, test_backprop_create_quadratic,
+              test_load_truncated_network_fails,
+              test_network_feedforward, test_inference_score_view,
+              test_inference_batches_predict_like_rows,
+              test_backprop_create_quadratic,
               test_backprop_create_from_network_quadratic,
               test_backprop_last_error_quadratic,
               test_backprop_error_sums_single_input_quadratic,
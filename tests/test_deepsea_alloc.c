@@ -0,0 +1,93 @@
+#include "see.h"
+
+#define DS_COUNT_ALLOCATIONS
+#define DS_COUNTING_MALLOC SEE_DEBUG_MALLOC
+#define DS_COUNTING_CALLOC SEE_DEBUG_CALLOC
+#define DS_COUNTING_REALLOC SEE_DEBUG_REALLOC
+#define DS_FREE SEE_DEBUG_FREE
+
+#include "deepsea.c"
+#include "deepsea_alloc.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_pipeline.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define COUNT 37
+#define INPUT_LENGTH 4
+#define NUM_OUTPUTS 4
+#define BATCH 5
+#define EPOCHS 3
+
+void test_arena_alignment_and_capacity(void) {
+  const size_t capacity =
+      DS_ALLOC_arena_size(3) + DS_ALLOC_arena_size(100) + DS_ALLOC_arena_size(1);
+  DS_ALLOC_Arena *arena = DS_ALLOC_arena_create(capacity);
+  uint8_t *a = DS_ALLOC_arena_alloc(arena, 3);
+  uint8_t *b = DS_ALLOC_arena_alloc(arena, 100);
+  uint8_t *c = DS_ALLOC_arena_alloc(arena, 1);
+  SEE_assert(a && b && c, "Allocations must fit the computed capacity.");
+  SEE_assert_eqlu((uintptr_t)a % DS_ALLOC_ALIGNMENT, (size_t)0,
+                  "First allocation is not aligned.");
+  SEE_assert_eqlu((uintptr_t)b % DS_ALLOC_ALIGNMENT, (size_t)0,
+                  "Second allocation is not aligned.");
+  SEE_assert(b >= a + 3 && c >= b + 100, "Allocations must not overlap.");
+  SEE_assert_eqp(DS_ALLOC_arena_alloc(arena, 1), NULL,
+                 "A full arena must return NULL.");
+
+  DS_ALLOC_arena_reset(arena);
+  SEE_assert_eqp(DS_ALLOC_arena_alloc(arena, 3), a,
+                 "A reset arena must hand out its memory again.");
+  DS_ALLOC_arena_free(arena);
+}
+
+void test_training_steady_state_does_not_allocate(void) {
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, NULL);
+  for (size_t i = 0; i < COUNT * INPUT_LENGTH; ++i)
+    data_set->pixels[i] = (uint8_t)(i * 7);
+  for (size_t i = 0; i < COUNT; ++i)
+    data_set->labels[i] = (uint16_t)(i % 4);
+  size_t sizes[3] = {INPUT_LENGTH, 3, NUM_OUTPUTS};
+  DS_Backprop *backprop =
+      DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, 0.1);
+  DS_PIPELINE_Pipeline *pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH, 2, 2);
+  DS_PIPELINE_set_block_shuffle(pipeline, 4, 2);
+  // NOTE: Float rows built up front, the pipeline only hands out grey values
+  const size_t indexes[BATCH] = {0, 1, 2, 3, 4};
+  DS_Labelled_Inputs *rows = DS_DATA_set_to_labelled_inputs(
+      data_set, indexes, BATCH, DS_backprop_network(backprop));
+
+  size_t warm_allocations = 0;
+  for (size_t epoch = 0; epoch < EPOCHS; ++epoch) {
+    if (epoch == 1)
+      warm_allocations = DS_allocation_count();
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *batch = NULL;
+    while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      DS_backprop_learn_once_view(backprop, batch, 0.5, COUNT);
+      DS_backprop_network_cost_view(backprop, batch);
+      DS_backprop_network_cost(backprop, rows);
+      DS_PIPELINE_release_batch(pipeline, batch);
+    }
+  }
+  SEE_assert_eqlu(DS_allocation_count() - warm_allocations, (size_t)0,
+                  "Training allocated after the first epoch.");
+
+  DS_labelled_inputs_free(rows);
+  DS_PIPELINE_free(pipeline);
+  DS_backprop_free(backprop);
+  DS_DATA_set_free(data_set);
+}
+
+SEE_RUN_TESTS(test_arena_alignment_and_capacity,
+              test_training_steady_state_does_not_allocate)
@@ -0,0 +1,185 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_batcher.c"
+#include "deepsea_model.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define INPUT_LENGTH 9
+#define NUM_OUTPUTS 4
+#define NUM_THREADS 4
+#define ROWS_PER_THREAD 50
+#define LONG_DEADLINE 10.
+
+static void fill_row(const size_t index, uint8_t grey[INPUT_LENGTH],
+                     DS_FLOAT values[INPUT_LENGTH]) {
+  fill_grey_row(index, grey, INPUT_LENGTH);
+  for (size_t j = 0; j < INPUT_LENGTH; ++j)
+    values[j] = grey[j] / 255.;
+}
+
+static size_t histogram_total(const DS_BATCHER_Stats *const stats) {
+  size_t batches = 0;
+  for (size_t b = 0; b < DS_BATCHER_HISTOGRAM_BUCKETS; ++b)
+    batches += stats->batch_sizes[b];
+  return batches;
+}
+
+typedef struct {
+  DS_BATCHER_Batcher *batcher;
+  DS_Network *network;
+  size_t thread;
+  size_t rows; // Rows to predict
+  size_t wrong;
+} ProducerArgs;
+
+/// Predicts grey and DS_FLOAT rows in turn and compares them with an
+/// inference of its own, which predicts one row at a time.
+static void *producer_main(void *const arg) {
+  ProducerArgs *const args = arg;
+  DS_Inference *inference = DS_inference_create(args->network, DS_QUADRATIC, 1);
+  DS_BATCHER_attach(args->batcher);
+  for (size_t r = 0; r < args->rows; ++r) {
+    uint8_t grey[INPUT_LENGTH];
+    DS_FLOAT values[INPUT_LENGTH];
+    fill_row(args->thread * args->rows + r, grey, values);
+    const DS_LabelledView view =
+        r % 2 ? row_view(values, DS_DTYPE_FLOAT, INPUT_LENGTH)
+              : row_view(grey, DS_DTYPE_U8, INPUT_LENGTH);
+    size_t expected = 0;
+    DS_FLOAT expected_probability = 0;
+    DS_inference_predict_view(inference, &view, &expected,
+                              &expected_probability);
+    size_t prediction = 0;
+    const DS_FLOAT probability =
+        DS_BATCHER_predict(args->batcher, &view, &prediction);
+    args->wrong +=
+        prediction != expected || probability != expected_probability;
+  }
+  DS_BATCHER_detach(args->batcher);
+  DS_inference_free(inference);
+  return NULL;
+}
+
+void test_batches_predict_like_rows(void) {
+  DS_Network *network = create_network(INPUT_LENGTH, 6, NUM_OUTPUTS);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  const DS_BATCHER_Options options = {.max_batch_size = 3,
+                                      .deadline_seconds = 1e-3};
+  DS_BATCHER_Batcher *batcher = DS_BATCHER_create(model, &options);
+  pthread_t threads[NUM_THREADS];
+  ProducerArgs args[NUM_THREADS];
+  for (size_t t = 0; t < NUM_THREADS; ++t) {
+    args[t] = (ProducerArgs){.batcher = batcher,
+                             .network = network,
+                             .thread = t,
+                             .rows = ROWS_PER_THREAD};
+    pthread_create(&threads[t], NULL, &producer_main, &args[t]);
+  }
+  for (size_t t = 0; t < NUM_THREADS; ++t) {
+    pthread_join(threads[t], NULL);
+    SEE_assert_eqlu(args[t].wrong, (size_t)0,
+                    "Thread %lu got predictions that differ.", t);
+  }
+
+  const DS_BATCHER_Stats stats = DS_BATCHER_stats(batcher);
+  SEE_assert_eqlu(stats.requests, (size_t)(NUM_THREADS * ROWS_PER_THREAD),
+                  "Wrong number of requests.");
+  SEE_assert_eqlu(histogram_total(&stats), stats.batches,
+                  "Every batch must be counted once.");
+  // NOTE: Batches of up to three rows fall into the first two buckets
+  SEE_assert_eqlu(stats.batch_sizes[0] + stats.batch_sizes[1], stats.batches,
+                  "Batches must not exceed the maximum size.");
+  SEE_assert(stats.requests_per_second > 0, "Throughput must be measured.");
+  SEE_assert(stats.mean_queue_seconds <= stats.max_queue_seconds,
+             "Mean queueing delay exceeds the longest.");
+  DS_BATCHER_free(batcher);
+  DS_MODEL_free(model);
+}
+
+typedef struct {
+  DS_BATCHER_Batcher *batcher;
+  size_t index;
+} SubmitArgs;
+
+static void *submit_main(void *const arg) {
+  SubmitArgs *const args = arg;
+  uint8_t grey[INPUT_LENGTH];
+  fill_grey_row(args->index, grey, INPUT_LENGTH);
+  const DS_LabelledView view = row_view(grey, DS_DTYPE_U8, INPUT_LENGTH);
+  size_t prediction = 0;
+  DS_BATCHER_predict(args->batcher, &view, &prediction);
+  return NULL;
+}
+
+void test_full_batch_is_dispatched(void) {
+  DS_MODEL_Model *model =
+      DS_MODEL_create(create_network(INPUT_LENGTH, 6, NUM_OUTPUTS));
+  // NOTE: Without producers and with a deadline this long, only a full
+  // batch is dispatched
+  const DS_BATCHER_Options options = {.max_batch_size = 4,
+                                      .deadline_seconds = LONG_DEADLINE};
+  DS_BATCHER_Batcher *batcher = DS_BATCHER_create(model, &options);
+  pthread_t threads[4];
+  SubmitArgs args[4];
+  for (size_t t = 0; t < 4; ++t) {
+    args[t] = (SubmitArgs){.batcher = batcher, .index = t};
+    pthread_create(&threads[t], NULL, &submit_main, &args[t]);
+  }
+  for (size_t t = 0; t < 4; ++t)
+    pthread_join(threads[t], NULL);
+  const DS_BATCHER_Stats stats = DS_BATCHER_stats(batcher);
+  SEE_assert_eqlu(stats.batches, (size_t)1, "Rows must share one batch.");
+  SEE_assert_eqlu(stats.batch_sizes[2], (size_t)1,
+                  "Batch of four rows must be in the third bucket.");
+  SEE_assert(stats.max_queue_seconds < LONG_DEADLINE,
+             "Full batch waited for the deadline.");
+  DS_BATCHER_free(batcher);
+  DS_MODEL_free(model);
+}
+
+void test_deadline_dispatches_lone_row(void) {
+  DS_MODEL_Model *model =
+      DS_MODEL_create(create_network(INPUT_LENGTH, 6, NUM_OUTPUTS));
+  const DS_BATCHER_Options options = {.max_batch_size = 16,
+                                      .deadline_seconds = 2e-3};
+  DS_BATCHER_Batcher *batcher = DS_BATCHER_create(model, &options);
+  SubmitArgs args = {.batcher = batcher};
+  submit_main(&args);
+  const DS_BATCHER_Stats stats = DS_BATCHER_stats(batcher);
+  SEE_assert_eqlu(stats.batch_sizes[0], (size_t)1, "Wrong batch size.");
+  SEE_assert(stats.max_queue_seconds >= 2e-3,
+             "Lone row must wait for the deadline.");
+  DS_BATCHER_free(batcher);
+  DS_MODEL_free(model);
+}
+
+void test_attached_producer_is_not_delayed(void) {
+  DS_MODEL_Model *model =
+      DS_MODEL_create(create_network(INPUT_LENGTH, 6, NUM_OUTPUTS));
+  const DS_BATCHER_Options options = {.max_batch_size = 16,
+                                      .deadline_seconds = LONG_DEADLINE};
+  DS_BATCHER_Batcher *batcher = DS_BATCHER_create(model, &options);
+  // NOTE: The only producer waits in the batch, nothing else can join it
+  DS_BATCHER_attach(batcher);
+  SubmitArgs args = {.batcher = batcher};
+  for (size_t r = 0; r < 3; ++r)
+    submit_main(&args);
+  DS_BATCHER_detach(batcher);
+  const DS_BATCHER_Stats stats = DS_BATCHER_stats(batcher);
+  SEE_assert_eqlu(stats.batch_sizes[0], (size_t)3, "Wrong batch sizes.");
+  SEE_assert(stats.max_queue_seconds < 1., "Row waited for the deadline.");
+  DS_BATCHER_free(batcher);
+  DS_MODEL_free(model);
+}
+
+SEE_RUN_TESTS(test_batches_predict_like_rows, test_full_batch_is_dispatched,
+              test_deadline_dispatches_lone_row,
+              test_attached_producer_is_not_delayed)
@@ -0,0 +1,191 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_alloc.c"
+#include "deepsea_checkpoint.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_pipeline.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define CHECKPOINT_FILE TEST_OUT_DIR "test.checkpoint"
+#define COUNT 23
+#define INPUT_LENGTH 2
+#define NUM_OUTPUTS 4
+#define BATCH 5
+#define DEPTH 2
+#define EPOCHS 3
+#define SEED 1234
+#define LEARNING_RATE 0.5
+
+static DS_Backprop *create_backprop(void) {
+  size_t sizes[3] = {INPUT_LENGTH, 3, NUM_OUTPUTS};
+  return DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, 0.1);
+}
+
+/// Trains from where the pipeline was resumed until batch `stop_batch` of
+/// epoch `stop_epoch` or the end of the last epoch. Saves a checkpoint when
+/// it stops early.
+static void train(DS_Backprop *const backprop,
+                  DS_PIPELINE_Pipeline *const pipeline,
+                  const DS_CHECKPOINT_State *const start,
+                  const size_t stop_epoch, const size_t stop_batch,
+                  DS_CHECKPOINT_Writer *const writer) {
+  DS_CHECKPOINT_State state = *start;
+  for (; state.epoch < EPOCHS; ++state.epoch, state.batch = 0) {
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *batch = NULL;
+    while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      DS_backprop_learn_once_view(backprop, batch, state.learning_rate,
+                                  COUNT);
+      DS_PIPELINE_release_batch(pipeline, batch);
+      ++state.batch;
+      if (state.epoch == stop_epoch && state.batch == stop_batch) {
+        DS_CHECKPOINT_save(writer, DS_backprop_network(backprop), &state);
+        // NOTE: Drain the epoch, as if the process had died here
+        while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL)
+          DS_PIPELINE_release_batch(pipeline, batch);
+        return;
+      }
+    }
+  }
+}
+
+static DS_FLOAT *parameters_of(const DS_Backprop *const backprop) {
+  const DS_Network *const network = DS_backprop_network(backprop);
+  DS_FLOAT *parameters =
+      DS_MALLOC(DS_network_num_parameters(network) * sizeof(DS_FLOAT));
+  DS_network_copy_parameters(network, parameters);
+  return parameters;
+}
+
+void test_resume_bit_for_bit(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_DATA_Set *data_set = create_data_set(COUNT, INPUT_LENGTH, NUM_OUTPUTS);
+  const DS_CHECKPOINT_State start = {
+      .seed = SEED, .num_samples = COUNT, .learning_rate = LEARNING_RATE};
+
+  // NOTE: The uninterrupted run
+  DS_Backprop *backprop = create_backprop();
+  DS_FLOAT *initial = parameters_of(backprop);
+  DS_PIPELINE_Pipeline *pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH, DEPTH, 2);
+  DS_PIPELINE_resume(pipeline, SEED, 0, 0);
+  train(backprop, pipeline, &start, EPOCHS, 0, NULL);
+  DS_FLOAT *expected = parameters_of(backprop);
+  const size_t num_parameters =
+      DS_network_num_parameters(DS_backprop_network(backprop));
+  DS_PIPELINE_free(pipeline);
+  DS_backprop_free(backprop);
+
+  // NOTE: The same run, stopped after batch 2 of epoch 1
+  backprop = create_backprop();
+  DS_backprop_set_parameters(backprop, initial);
+  DS_CHECKPOINT_Writer *writer = DS_CHECKPOINT_writer_create(
+      CHECKPOINT_FILE, DS_backprop_network(backprop));
+  pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH, DEPTH, 2);
+  DS_PIPELINE_resume(pipeline, SEED, 0, 0);
+  train(backprop, pipeline, &start, 1, 2, writer);
+  SEE_assert(DS_CHECKPOINT_writer_wait(writer), "Could not write checkpoint.");
+  SEE_assert_eqlu(DS_CHECKPOINT_writer_count(writer), (size_t)1,
+                  "Wrong number of checkpoints.");
+  DS_CHECKPOINT_writer_free(writer);
+  DS_PIPELINE_free(pipeline);
+  DS_backprop_free(backprop);
+
+  // NOTE: A new process with other weights resumes
+  backprop = create_backprop();
+  DS_CHECKPOINT_State state = {0};
+  SEE_assert(DS_CHECKPOINT_load(CHECKPOINT_FILE, backprop, &state),
+             "Could not load checkpoint.");
+  SEE_assert_eqlu((size_t)state.epoch, (size_t)1, "Wrong epoch.");
+  SEE_assert_eqlu((size_t)state.batch, (size_t)2, "Wrong batch.");
+  SEE_assert_eqlu((size_t)state.seed, (size_t)SEED, "Wrong seed.");
+  SEE_assert_eqlu((size_t)state.num_samples, (size_t)COUNT,
+                  "Wrong number of samples.");
+  SEE_assert_eqf(state.learning_rate, LEARNING_RATE, "Wrong learning rate.");
+  pipeline = DS_PIPELINE_create_from_data_set(
+      data_set, DS_backprop_network(backprop), BATCH, DEPTH, 2);
+  DS_PIPELINE_resume(pipeline, state.seed, state.epoch, state.batch);
+  train(backprop, pipeline, &state, EPOCHS, 0, NULL);
+  DS_FLOAT *resumed = parameters_of(backprop);
+  SEE_assert(memcmp(resumed, expected, num_parameters * sizeof(DS_FLOAT)) ==
+                 0,
+             "Resumed training must end with the same parameters.");
+
+  DS_FREE(resumed);
+  DS_FREE(expected);
+  DS_FREE(initial);
+  DS_PIPELINE_free(pipeline);
+  DS_backprop_free(backprop);
+  DS_DATA_set_free(data_set);
+}
+
+void test_last_snapshot_wins(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Backprop *backprop = create_backprop();
+  DS_CHECKPOINT_Writer *writer = DS_CHECKPOINT_writer_create(
+      CHECKPOINT_FILE, DS_backprop_network(backprop));
+  DS_CHECKPOINT_State state = {.num_samples = COUNT};
+  for (state.batch = 1; state.batch <= 10; ++state.batch)
+    DS_CHECKPOINT_save(writer, DS_backprop_network(backprop), &state);
+  SEE_assert(DS_CHECKPOINT_writer_wait(writer), "Could not write checkpoint.");
+  const size_t written = DS_CHECKPOINT_writer_count(writer);
+  SEE_assert(written >= 1 && written <= 10, "Wrong number of checkpoints.");
+  DS_CHECKPOINT_writer_free(writer);
+
+  DS_CHECKPOINT_State loaded = {0};
+  SEE_assert(DS_CHECKPOINT_load(CHECKPOINT_FILE, backprop, &loaded),
+             "Could not load checkpoint.");
+  SEE_assert_eqlu((size_t)loaded.batch, (size_t)10,
+                  "The last snapshot must be written last.");
+  SEE_assert(!DS_CHECKPOINT_exists(CHECKPOINT_FILE ".tmp"),
+             "The temporary file must be renamed.");
+  DS_backprop_free(backprop);
+}
+
+void test_load_rejects_mismatch(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Backprop *backprop = create_backprop();
+  DS_CHECKPOINT_Writer *writer = DS_CHECKPOINT_writer_create(
+      CHECKPOINT_FILE, DS_backprop_network(backprop));
+  const DS_CHECKPOINT_State state = {.epoch = 2};
+  DS_CHECKPOINT_save(writer, DS_backprop_network(backprop), &state);
+  SEE_assert(DS_CHECKPOINT_writer_wait(writer), "Could not write checkpoint.");
+  DS_CHECKPOINT_writer_free(writer);
+
+  size_t sizes[3] = {INPUT_LENGTH, 5, NUM_OUTPUTS};
+  DS_Backprop *other = DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, 0);
+  DS_CHECKPOINT_State loaded = {0};
+  SEE_assert(!DS_CHECKPOINT_load(CHECKPOINT_FILE, other, &loaded),
+             "A network of another shape must be rejected.");
+  SEE_assert(truncate(CHECKPOINT_FILE, sizeof(CheckpointHeader) + 8) == 0,
+             "Could not truncate checkpoint.");
+  SEE_assert(!DS_CHECKPOINT_load(CHECKPOINT_FILE, backprop, &loaded),
+             "A truncated checkpoint must be rejected.");
+  SEE_assert_eqlu((size_t)loaded.epoch, (size_t)0,
+                  "A rejected checkpoint must not change the state.");
+  unlink(CHECKPOINT_FILE);
+  SEE_assert(!DS_CHECKPOINT_exists(CHECKPOINT_FILE), "Checkpoint is gone.");
+  SEE_assert(!DS_CHECKPOINT_load(CHECKPOINT_FILE, backprop, &loaded),
+             "A missing checkpoint must be rejected.");
+  DS_backprop_free(other);
+  DS_backprop_free(backprop);
+}
+
+SEE_RUN_TESTS(test_resume_bit_for_bit, test_last_snapshot_wins,
+              test_load_rejects_mismatch)
@@ -0,0 +1,130 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+
+#define COUNT 3
+#define INPUT_LENGTH 4
+#define NUM_OUTPUTS 4
+
+void test_memory_size(void) {
+  SEE_assert_eqlu(DS_DATA_memory_size(10, 784), (size_t)(10 * (784 + 2)),
+                  "Wrong memory size.");
+  SEE_assert_eqlu(DS_DATA_memory_size(0, 784), (size_t)0,
+                  "Empty data set must not use memory.");
+}
+
+void test_create_owned(void) {
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, NULL);
+  SEE_assert_neqp(data_set->pixels, NULL, "Pixels not allocated.");
+  SEE_assert_neqp(data_set->labels, NULL, "Labels not allocated.");
+  SEE_assert_eqlu(data_set->count, (size_t)COUNT, "Wrong count.");
+  SEE_assert_eqlu(data_set->input_length, (size_t)INPUT_LENGTH,
+                  "Wrong input length.");
+  DS_DATA_set_free(data_set);
+}
+
+void test_to_labelled_inputs(void) {
+  uint8_t pixels[COUNT * INPUT_LENGTH] = {0,  255, 51, 102, 1,   2,
+                                          3,  4,   5,  6,   7,   8};
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, pixels);
+  data_set->labels[0] = 1;
+  data_set->labels[1] = 3;
+  data_set->labels[2] = 2;
+
+  size_t sizes[2] = {INPUT_LENGTH, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+  const size_t indexes[2] = {1, 0};
+  DS_Labelled_Inputs *labelled_inputs =
+      DS_DATA_set_to_labelled_inputs(data_set, indexes, 2, network);
+  SEE_assert_neqp(labelled_inputs, NULL, "Could not create labelled inputs.");
+  SEE_assert_eqlu(labelled_inputs->count, (size_t)2, "Wrong count.");
+
+  for (size_t i = 0; i < 2; ++i) {
+    for (size_t j = 0; j < INPUT_LENGTH; ++j)
+      SEE_assert_eqf(labelled_inputs->inputs[i][j],
+                     pixels[indexes[i] * INPUT_LENGTH + j] / 255.,
+                     "Wrong input for sample %lu, pixel %lu.", i, j);
+    DS_FLOAT label[NUM_OUTPUTS] = {0};
+    DS_FILE_file_label_to_deepsea_label(data_set->labels[indexes[i]], label,
+                                        NUM_OUTPUTS);
+    for (size_t j = 0; j < NUM_OUTPUTS; ++j)
+      SEE_assert_eqf(labelled_inputs->labels[i][j], label[j],
+                     "Wrong label for sample %lu, index %lu.", i, j);
+  }
+  DS_labelled_inputs_free(labelled_inputs);
+
+  data_set->labels[2] = 4; // NOTE: Has no output with four outputs
+  const size_t too_big[1] = {2};
+  SEE_assert_eqp(DS_DATA_set_to_labelled_inputs(data_set, too_big, 1, network),
+                 NULL, "Label must be rejected.");
+
+  DS_network_free(network);
+  DS_DATA_set_free(data_set);
+}
+
+void test_view_matches_labelled_inputs(void) {
+  uint8_t pixels[COUNT * INPUT_LENGTH] = {0,  255, 51, 102, 1,   2,
+                                          3,  4,   5,  6,   7,   8};
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, pixels);
+  data_set->labels[0] = 1;
+  data_set->labels[1] = 3;
+  data_set->labels[2] = 2;
+
+  const DS_LabelledView view = DS_DATA_set_view(data_set, 1, 2);
+  SEE_assert_eqp(view.inputs, (const void *)&pixels[INPUT_LENGTH],
+                 "View must point into the data set.");
+  SEE_assert_eqlu(view.count, (size_t)2, "Wrong count.");
+  SEE_assert_eqlu((size_t)view.labels[0], (size_t)3, "Wrong label.");
+
+  size_t sizes[3] = {INPUT_LENGTH, 3, NUM_OUTPUTS};
+  srand(7); // NOTE: Same initial weights for both
+  DS_Backprop *from_view =
+      DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, 0.1);
+  srand(7);
+  DS_Backprop *from_rows =
+      DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, 0.1);
+  const size_t indexes[2] = {1, 2};
+  DS_Labelled_Inputs *labelled_inputs = DS_DATA_set_to_labelled_inputs(
+      data_set, indexes, 2, DS_backprop_network(from_rows));
+
+  for (size_t i = 0; i < 3; ++i) {
+    SEE_assert_eqf(DS_backprop_network_cost_view(from_view, &view),
+                   DS_backprop_network_cost(from_rows, labelled_inputs),
+                   "Costs differ in step %lu.", i);
+    DS_backprop_learn_once_view(from_view, &view, 0.5, COUNT);
+    DS_backprop_learn_once(from_rows, labelled_inputs, 0.5, COUNT);
+  }
+
+  size_t predictions[2] = {0};
+  DS_FLOAT probabilities[2] = {0};
+  DS_network_predict_view((DS_Network *)DS_backprop_network(from_view), &view,
+                          predictions, probabilities);
+  for (size_t i = 0; i < 2; ++i) {
+    char prediction[MAX_OUTPUT_LABEL_STRLEN + 1] = {0};
+    const DS_FLOAT probability =
+        DS_network_predict((DS_Network *)DS_backprop_network(from_rows),
+                           labelled_inputs->inputs[i], prediction);
+    SEE_assert_eqlu(predictions[i], strtoul(prediction, NULL, 10),
+                    "Predictions differ for sample %lu.", i);
+    SEE_assert_eqf(probabilities[i], probability,
+                   "Probabilities differ for sample %lu.", i);
+  }
+
+  DS_labelled_inputs_free(labelled_inputs);
+  DS_backprop_free(from_rows);
+  DS_backprop_free(from_view);
+  DS_DATA_set_free(data_set);
+}
+
+SEE_RUN_TESTS(test_memory_size, test_create_owned, test_to_labelled_inputs,
+              test_view_matches_labelled_inputs)
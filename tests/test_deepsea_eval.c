@@ -0,0 +1,116 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_alloc.c"
+#include "deepsea_data.c"
+#include "deepsea_eval.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_pipeline.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define COUNT 203
+#define INPUT_LENGTH 6
+#define NUM_OUTPUTS 3
+#define BATCH 50
+#define DEPTH 2
+#define REGULARIZATION 0.1
+
+/// Evaluates the data set serially, all at once, with the network itself.
+static DS_EVAL_Result *evaluate_serially(DS_Backprop *const backprop,
+                                         const DS_DATA_Set *const data_set) {
+  DS_EVAL_Result *expected = result_create(NUM_OUTPUTS);
+  const DS_LabelledView view = DS_DATA_set_view(data_set, 0, data_set->count);
+  size_t predictions[COUNT];
+  DS_network_predict_view(backprop->network, &view, predictions, NULL);
+  for (size_t i = 0; i < COUNT; ++i) {
+    ++expected->confusion[view.labels[i] * NUM_OUTPUTS + predictions[i]];
+    expected->correct += predictions[i] == view.labels[i];
+  }
+  expected->count = COUNT;
+  expected->cost = DS_backprop_network_cost_view(backprop, &view);
+  return expected;
+}
+
+void test_evaluate_in_parallel(void) {
+  DS_DATA_Set *data_set = create_data_set(COUNT, INPUT_LENGTH, NUM_OUTPUTS);
+  size_t sizes[3] = {INPUT_LENGTH, 5, NUM_OUTPUTS};
+  DS_Backprop *backprop =
+      DS_backprop_create(sizes, 3, NULL, DS_CROSS_ENTROPY, REGULARIZATION);
+  const DS_Network *const network = DS_backprop_network(backprop);
+  DS_EVAL_Result *expected = evaluate_serially(backprop, data_set);
+
+  const size_t num_threads[3] = {1, 2, 5};
+  DS_FLOAT first_cost = 0;
+  for (size_t t = 0; t < 3; ++t) {
+    DS_THREAD_Pool *pool = DS_THREAD_pool_create(num_threads[t]);
+    DS_PIPELINE_Pipeline *pipeline = DS_PIPELINE_create_from_data_set(
+        data_set, network, BATCH, DEPTH, num_threads[t]);
+    DS_EVAL_Result *result = DS_EVAL_pipeline(pipeline, network,
+                                              DS_CROSS_ENTROPY,
+                                              REGULARIZATION, pool);
+    SEE_assert_neqp(result, NULL, "Evaluation failed.");
+    if (result) {
+      SEE_assert_eqlu(result->count, (size_t)COUNT, "Wrong count.");
+      SEE_assert_eqlu(result->correct, expected->correct,
+                      "Wrong number of correct predictions.");
+      SEE_assert_eqf(result->cost, expected->cost, "Wrong cost.");
+      SEE_assert_eqf(DS_EVAL_accuracy(result),
+                     (double)expected->correct / COUNT, "Wrong accuracy.");
+      for (size_t i = 0; i < NUM_OUTPUTS * NUM_OUTPUTS; ++i)
+        SEE_assert_eqlu(result->confusion[i], expected->confusion[i],
+                        "Wrong confusion cell %lu with %lu threads.", i,
+                        num_threads[t]);
+      // NOTE: The costs are summed in the same order however many threads
+      if (t == 0)
+        first_cost = result->cost;
+      SEE_assert(result->cost == first_cost,
+                 "Cost depends on the number of threads.");
+      DS_EVAL_result_free(result);
+    }
+    DS_PIPELINE_free(pipeline);
+    DS_THREAD_pool_free(pool);
+  }
+
+  DS_EVAL_result_free(expected);
+  DS_backprop_free(backprop);
+  DS_DATA_set_free(data_set);
+}
+
+void test_evaluate_empty_confusion(void) {
+  DS_DATA_Set *data_set = create_data_set(COUNT, INPUT_LENGTH, NUM_OUTPUTS);
+  size_t sizes[2] = {INPUT_LENGTH, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_data_set(data_set, network, BATCH, DEPTH, 0);
+  DS_EVAL_Result *result =
+      DS_EVAL_pipeline(pipeline, network, DS_QUADRATIC, 0, NULL);
+  size_t total = 0;
+  for (size_t label = 0; label < NUM_OUTPUTS; ++label) {
+    size_t row = 0;
+    for (size_t p = 0; p < NUM_OUTPUTS; ++p)
+      row += result->confusion[label * NUM_OUTPUTS + p];
+    SEE_assert_eqlu(row, (size_t)(COUNT / NUM_OUTPUTS + (label < COUNT % 3)),
+                    "Wrong number of samples of label %lu.", label);
+    total += row;
+  }
+  SEE_assert_eqlu(total, (size_t)COUNT, "Every sample must be counted once.");
+  DS_EVAL_result_free(result);
+  DS_PIPELINE_free(pipeline);
+  DS_network_free(network);
+  DS_DATA_set_free(data_set);
+}
+
+SEE_RUN_TESTS(test_evaluate_in_parallel, test_evaluate_empty_confusion)
@@ -7,6 +7,7 @@
 
 #include "deepsea.c"
 #include "deepsea_file.c"
+#include "deepsea_thread.c"
 
 #include "common.h"
 
@@ -37,60 +38,177 @@ void test_get_label_from_directory_name(void) {
                   "Wrong label in short absolute directory with extention.");
 }
 
-void test_label_from_number_to_binary_array(void) {
-  DS_FLOAT correct1[4] = {1., 1., 0., 1.};
+void test_label_from_number_to_one_hot_array(void) {
+  DS_FLOAT correct1[4] = {0., 0., 0., 1.};
   DS_FLOAT out1[4] = {0};
-  DS_FILE_file_label_to_deepsea_label(11, out1, 4);
+  DS_FILE_file_label_to_deepsea_label(3, out1, 4);
   for (size_t i = 0; i < 4; ++i)
     SEE_assert_eqf(out1[i], correct1[i],
-                   "Wrong binary array for number 11 in index %lu.", i);
+                   "Wrong one-hot array for number 3 in index %lu.", i);
 
-  DS_FLOAT correct2[6] = {1., 1., 0., 1., 0., 0.};
+  DS_FLOAT correct2[6] = {1., 0., 0., 0., 0., 0.};
   DS_FLOAT out2[6] = {1., 1., 1., 1., 1., 1.};
-  DS_FILE_file_label_to_deepsea_label(11, out2, 6);
+  DS_FILE_file_label_to_deepsea_label(0, out2, 6);
   for (size_t i = 0; i < 6; ++i)
     SEE_assert_eqf(
         out2[i], correct2[i],
-        "Wrong binary array for number 11 with excess elements in index %lu.",
+        "Wrong one-hot array for number 0 with excess elements in index %lu.",
         i);
 
-  DS_FLOAT correct3[6] = {0., 1., 0., 0., 0., 0.};
+  DS_FLOAT correct3[6] = {0., 0., 1., 0., 0., 0.};
   DS_FLOAT out3[6] = {1., 1., 1., 1., 1., 1.};
   DS_FILE_file_label_to_deepsea_label(2, out3, 6);
   for (size_t i = 0; i < 6; ++i)
     SEE_assert_eqf(
         out3[i], correct3[i],
-        "Wrong binary array for number 2 with excess elements in index %lu.",
+        "Wrong one-hot array for number 2 with excess elements in index %lu.",
         i);
 
-  DS_FLOAT correct4[2] = {0., 1.};
-  DS_FLOAT out4[2] = {0};
+  DS_FLOAT correct4[2] = {0., 0.};
+  DS_FLOAT out4[2] = {1., 1.};
   DS_FILE_file_label_to_deepsea_label(10, out4, 2);
   for (size_t i = 0; i < 2; ++i)
     SEE_assert_eqf(
         out4[i], correct4[i],
-        "Wrong binary array for number 10 cropped output in index %lu.", i);
+        "Wrong one-hot array for number 10 without output in index %lu.", i);
 }
 
 void test_file_list_creation_leak(void) {
-  DS_FILE_FileList *file_list = DS_FILE_get_files(TEST_DIR);
+  DS_FILE_FileList *file_list = DS_FILE_get_files(TEST_DIR, NULL);
 
   DS_FILE_file_list_free(file_list);
 }
 
-void test_file_list_get_random_bucket_leak(void) {
-  DS_FILE_FileList *file_list = DS_FILE_get_files(TEST_DIR);
+void test_file_list_random_batches_leak(void) {
+  DS_FILE_FileList *file_list = DS_FILE_get_files(TEST_DIR, NULL);
+  DS_BatchIterator *iterator = DS_batch_iterator_create(
+      file_list->count, 2, DS_batch_iterator_random_seed());
   int i = 0;
-  while (DS_FILE_get_random_bucket(file_list, 2)) {
+  while (DS_batch_iterator_next_files(iterator, file_list)) {
     ++i;
   }
 
   SEE_assert(i > 0, "It did not return any bucket");
 
+  DS_batch_iterator_free(iterator);
   DS_FILE_file_list_free(file_list);
 }
 
+void test_batch_iterator_epochs(void) {
+  const size_t count = 103;
+  DS_BatchIterator *iterator = DS_batch_iterator_create(count, 10, 42);
+  DS_BatchIterator *same_seed = DS_batch_iterator_create(count, 10, 42);
+  SEE_assert_eqlu(DS_batch_iterator_num_batches(iterator), (size_t)11,
+                  "Wrong number of batches.");
+
+  size_t first_epoch[103] = {0};
+  bool differs = false;
+  for (size_t epoch = 0; epoch < 2; ++epoch) {
+    bool seen[103] = {0};
+    size_t total = 0, n = 0, m = 0;
+    const size_t *indexes = NULL, *other = NULL;
+    while ((n = DS_batch_iterator_next(iterator, &indexes)) > 0) {
+      m = DS_batch_iterator_next(same_seed, &other);
+      SEE_assert_eqlu(m, n, "Same seed must give the same batches.");
+      for (size_t i = 0; i < n; ++i) {
+        SEE_assert(indexes[i] < count && !seen[indexes[i]],
+                   "Index %lu is invalid or repeated.", indexes[i]);
+        seen[indexes[i]] = true;
+        SEE_assert_eqlu(other[i], indexes[i],
+                        "Same seed must give the same order.");
+        if (epoch == 0)
+          first_epoch[total + i] = indexes[i];
+        else
+          differs = differs || first_epoch[total + i] != indexes[i];
+      }
+      total += n;
+    }
+    SEE_assert_eqlu(DS_batch_iterator_next(same_seed, &other), (size_t)0,
+                    "Epochs must end together.");
+    SEE_assert_eqlu(total, count, "Every sample must be seen once.");
+  }
+  SEE_assert(differs, "Every epoch must be shuffled anew.");
+
+  DS_batch_iterator_free(same_seed);
+  DS_batch_iterator_free(iterator);
+}
+
+void test_batch_iterator_shards(void) {
+  const size_t count = 50, num_shards = 3;
+  bool seen[50] = {0};
+  size_t total = 0;
+  for (size_t shard = 0; shard < num_shards; ++shard) {
+    DS_BatchIterator *iterator =
+        DS_batch_iterator_create_sharded(count, 4, 7, shard, num_shards);
+    DS_batch_iterator_start_epoch(iterator);
+    for (size_t b = 0; b < DS_batch_iterator_num_batches(iterator); ++b) {
+      const size_t *indexes = NULL;
+      const size_t n = DS_batch_iterator_batch(iterator, b, &indexes);
+      for (size_t i = 0; i < n; ++i) {
+        SEE_assert(!seen[indexes[i]], "Shards must be disjoint at %lu.",
+                   indexes[i]);
+        seen[indexes[i]] = true;
+      }
+      total += n;
+    }
+    DS_batch_iterator_free(iterator);
+  }
+  SEE_assert_eqlu(total, count, "Shards must cover all samples.");
+}
+
+void test_batch_iterator_block_shuffle(void) {
+  const size_t count = 1000, block_size = 32, window = 4;
+  DS_BatchIterator *iterator = DS_batch_iterator_create(count, 16, 3);
+  DS_batch_iterator_set_block_shuffle(iterator, block_size, window);
+
+  bool seen[1000] = {0};
+  size_t total = 0, n = 0;
+  const size_t *indexes = NULL;
+  while ((n = DS_batch_iterator_next(iterator, &indexes)) > 0) {
+    size_t blocks[16] = {0}, num_blocks = 0;
+    for (size_t i = 0; i < n; ++i) {
+      SEE_assert(indexes[i] < count && !seen[indexes[i]],
+                 "Index %lu is invalid or repeated.", indexes[i]);
+      seen[indexes[i]] = true;
+      size_t b = 0;
+      while (b < num_blocks && blocks[b] != indexes[i] / block_size)
+        ++b;
+      if (b == num_blocks)
+        blocks[num_blocks++] = indexes[i] / block_size;
+    }
+    // NOTE: A batch may straddle two windows
+    SEE_assert(num_blocks <= 2 * window, "Batch touches %lu blocks.",
+               num_blocks);
+    total += n;
+  }
+  SEE_assert_eqlu(total, count, "Every sample must be seen once.");
+  DS_batch_iterator_free(iterator);
+}
+
+void test_file_list_parallel(void) {
+  DS_FILE_FileList *serial = DS_FILE_get_files(TEST_DIR, NULL);
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(4);
+  DS_FILE_FileList *parallel = DS_FILE_get_files(TEST_DIR, pool);
+
+  SEE_assert(serial->count > 0, "No files found.");
+  SEE_assert_eqlu(parallel->count, serial->count, "Wrong number of files.");
+  bool found = false;
+  for (size_t i = 0; i < serial->count && i < parallel->count; ++i) {
+    SEE_assert_eqstr(parallel->paths[i], serial->paths[i],
+                     "Files must be in the same order at %lu.", i);
+    found = found || strstr(serial->paths[i], "/data/4.png") != NULL;
+  }
+  SEE_assert(found, "File in subdirectory not found.");
+
+  DS_FILE_file_list_free(parallel);
+  DS_FILE_file_list_free(serial);
+  DS_THREAD_pool_free(pool);
+}
+
 SEE_RUN_TESTS(test_get_label_from_directory_name,
-              test_label_from_number_to_binary_array,
+              test_label_from_number_to_one_hot_array,
               test_file_list_creation_leak,
-              test_file_list_get_random_bucket_leak)
+              test_file_list_random_batches_leak,
+              test_batch_iterator_epochs, test_batch_iterator_shards,
+              test_batch_iterator_block_shuffle,
+              test_file_list_parallel)
@@ -0,0 +1,102 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_thread.c"
+#include "deepsea_idx.c"
+
+#include "common.h"
+
+#define IDX_COUNT 3
+#define IDX_ROWS 2
+#define IDX_COLS 3
+
+static const uint8_t idx_images[IDX_COUNT * IDX_ROWS * IDX_COLS] = {
+    0, 51, 102, 153, 204, 255, 10, 20, 30, 40, 50, 60, 255, 0, 255, 0, 255, 0};
+static const uint8_t idx_labels[IDX_COUNT] = {7, 0, 9};
+
+void check_idx_data_set(const DS_IDX_DataSet *const data_set) {
+  SEE_assert_neqp(data_set, NULL, "Data set could not be loaded.");
+  if (!data_set)
+    return;
+  SEE_assert_eqlu(data_set->count, (size_t)IDX_COUNT, "Wrong sample count.");
+  SEE_assert_eqlu(data_set->rows, (size_t)IDX_ROWS, "Wrong number of rows.");
+  SEE_assert_eqlu(data_set->cols, (size_t)IDX_COLS, "Wrong number of cols.");
+  for (size_t i = 0; i < IDX_COUNT * IDX_ROWS * IDX_COLS; ++i)
+    SEE_assert_eqi(data_set->images[i], idx_images[i], "Wrong pixel %lu.", i);
+  for (size_t i = 0; i < IDX_COUNT; ++i)
+    SEE_assert_eqi(data_set->labels[i], idx_labels[i], "Wrong label %lu.", i);
+}
+
+void test_is_images_file(void) {
+  SEE_assert(DS_IDX_is_images_file("data/train-images-idx3-ubyte"),
+             "Uncompressed images file not detected.");
+  SEE_assert(DS_IDX_is_images_file("data/t10k-images-idx3-ubyte.gz"),
+             "Compressed images file not detected.");
+  SEE_assert(!DS_IDX_is_images_file("data/train-labels-idx1-ubyte"),
+             "Labels file detected as images file.");
+  SEE_assert(!DS_IDX_is_images_file("some-images-idx3-ubyte/1/a.png"),
+             "Directory detected as images file.");
+}
+
+void test_labels_path_ignores_directories(void) {
+  char *labels_path = labels_path_from_images_path(
+      "/data/images-idx3-ubyte-sets/train-images-idx3-ubyte");
+  SEE_assert_eqstr(labels_path,
+                   "/data/images-idx3-ubyte-sets/train-labels-idx1-ubyte",
+                   "Wrong labels path.");
+  DS_FREE(labels_path);
+  SEE_assert_eqp(labels_path_from_images_path("images-idx3-ubyte-sets/data"),
+                 NULL, "Directory must not name the labels file.");
+}
+
+void test_load_mapped(void) {
+  DS_IDX_DataSet *data_set =
+      DS_IDX_data_set_load(TEST_DATA_DIR "train-images-idx3-ubyte", NULL);
+  check_idx_data_set(data_set);
+  SEE_assert(data_set->_image_memory_mapped, "Images should be mapped.");
+  SEE_assert(data_set->_label_memory_mapped, "Labels should be mapped.");
+  DS_IDX_data_set_free(data_set);
+}
+
+void test_load_gzip(void) {
+  DS_IDX_DataSet *data_set =
+      DS_IDX_data_set_load(TEST_DATA_DIR "t10k-images-idx3-ubyte.gz", NULL);
+  check_idx_data_set(data_set);
+  SEE_assert(!data_set->_image_memory_mapped, "Images should be inflated.");
+  DS_IDX_data_set_free(data_set);
+}
+
+void test_load_mismatching_files(void) {
+  DS_IDX_DataSet *data_set =
+      DS_IDX_data_set_load(TEST_DATA_DIR "train-images-idx3-ubyte",
+                           TEST_DATA_DIR "train-images-idx3-ubyte");
+  SEE_assert_eqp(data_set, NULL, "Images file accepted as labels file.");
+}
+
+void test_to_data_set(void) {
+  DS_IDX_DataSet *idx_data_set =
+      DS_IDX_data_set_load(TEST_DATA_DIR "train-images-idx3-ubyte", NULL);
+  DS_DATA_Set *data_set = DS_IDX_to_data_set(idx_data_set);
+
+  SEE_assert_eqlu(data_set->count, (size_t)IDX_COUNT, "Wrong sample count.");
+  SEE_assert_eqlu(data_set->input_length, (size_t)(IDX_ROWS * IDX_COLS),
+                  "Wrong input length.");
+  SEE_assert_eqp(data_set->pixels, idx_data_set->images,
+                 "Pixels must not be copied.");
+  for (size_t i = 0; i < IDX_COUNT; ++i)
+    SEE_assert_eqi(data_set->labels[i], idx_labels[i], "Wrong label %lu.", i);
+
+  DS_DATA_set_free(data_set);
+  DS_IDX_data_set_free(idx_data_set);
+}
+
+SEE_RUN_TESTS(test_is_images_file, test_labels_path_ignores_directories,
+              test_load_mapped, test_load_gzip, test_load_mismatching_files,
+              test_to_data_set)
@@ -0,0 +1,80 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_io.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+
+// NOTE: More than fit into one batch of the ring
+#define NUM_FILES 300
+#define MAX_FILE_SIZE 1024
+
+static char *const test_files[] = {TEST_DATA_DIR "4.png",
+                                   TEST_DATA_DIR "identical1.txt",
+                                   TEST_DATA_DIR "train-labels-idx1-ubyte"};
+#define NUM_TEST_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+static size_t read_whole_file(const char *const path, uint8_t *const data) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return 0;
+  const size_t size = fread(data, 1, MAX_FILE_SIZE, f);
+  fclose(f);
+  return size;
+}
+
+void check_read_files(DS_IO_Reader *const reader) {
+  char *paths[NUM_FILES] = {0};
+  for (size_t i = 0; i < NUM_FILES; ++i)
+    paths[i] = test_files[i % NUM_TEST_FILES];
+  uint8_t expected[NUM_TEST_FILES][MAX_FILE_SIZE] = {0};
+  size_t expected_size[NUM_TEST_FILES] = {0};
+  for (size_t i = 0; i < NUM_TEST_FILES; ++i)
+    expected_size[i] = read_whole_file(test_files[i], expected[i]);
+
+  DS_IO_File files[NUM_FILES] = {0};
+  // NOTE: Twice, to also read into the buffer of the previous read
+  for (size_t run = 0; run < 2; ++run) {
+    SEE_assert(DS_IO_read_files(reader, paths, NUM_FILES, files),
+               "Could not read files.");
+    for (size_t i = 0; i < NUM_FILES; ++i) {
+      const size_t t = i % NUM_TEST_FILES;
+      SEE_assert_eqlu(files[i].size, expected_size[t], "Wrong size of file %lu.",
+                      i);
+      SEE_assert(files[i].size == expected_size[t] &&
+                     memcmp(files[i].data, expected[t], files[i].size) == 0,
+                 "Wrong contents of file %lu.", i);
+    }
+  }
+
+  paths[NUM_FILES / 2] = TEST_DATA_DIR "does_not_exist.png";
+  SEE_assert(!DS_IO_read_files(reader, paths, NUM_FILES, files),
+             "Missing file must fail.");
+  SEE_assert(DS_IO_read_files(reader, paths, NUM_FILES / 2, files),
+             "Reader must be usable after a failure.");
+}
+
+void test_read_files_io_uring(void) {
+  DS_IO_Reader *reader = DS_IO_reader_create(NULL, true);
+  if (!DS_IO_reader_uses_io_uring(reader))
+    printf("io_uring is not available, testing the fallback instead.\n");
+  check_read_files(reader);
+  DS_IO_reader_free(reader);
+}
+
+void test_read_files_pread(void) {
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(3);
+  DS_IO_Reader *reader = DS_IO_reader_create(pool, false);
+  SEE_assert(!DS_IO_reader_uses_io_uring(reader), "Must not use io_uring.");
+  check_read_files(reader);
+  DS_IO_reader_free(reader);
+  DS_THREAD_pool_free(pool);
+}
+
+SEE_RUN_TESTS(test_read_files_io_uring, test_read_files_pread)
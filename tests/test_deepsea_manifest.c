@@ -0,0 +1,101 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define MANIFEST_DIR TEST_OUT_DIR "manifest"
+#define MANIFEST_PATH MANIFEST_DIR DS_MANIFEST_EXTENSION
+
+static void check_manifest(const bool with_hashes) {
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(2);
+  SEE_assert(DS_MANIFEST_write(MANIFEST_DIR "/", with_hashes, pool),
+             "Could not write manifest.");
+  SEE_assert(DS_MANIFEST_is_manifest_file(MANIFEST_PATH),
+             "Manifest not recognized.");
+
+  DS_FILE_FileList *scanned = DS_FILE_get_files(MANIFEST_DIR, pool);
+  DS_FILE_FileList *loaded = DS_MANIFEST_load(MANIFEST_PATH);
+  SEE_assert(loaded != NULL, "Could not load manifest.");
+  if (loaded) {
+    SEE_assert_eqlu(loaded->count, scanned->count, "Wrong number of files.");
+    SEE_assert(loaded->labels != NULL, "Labels must be precomputed.");
+    for (size_t i = 0; i < loaded->count && i < scanned->count; ++i) {
+      SEE_assert_eqstr(loaded->paths[i], scanned->paths[i],
+                       "Wrong path at %lu.", i);
+      errno = 0;
+      SEE_assert_eqlu(DS_FILE_file_list_label(loaded, i),
+                      DS_FILE_file_list_label(scanned, i),
+                      "Wrong label at %lu.", i);
+    }
+    DS_FILE_file_list_free(loaded);
+  }
+  DS_FILE_file_list_free(scanned);
+  DS_THREAD_pool_free(pool);
+}
+
+void test_manifest_round_trip(void) {
+  create_labelled_dir(MANIFEST_DIR);
+  check_manifest(false);
+}
+
+void test_manifest_round_trip_with_hashes(void) {
+  create_labelled_dir(MANIFEST_DIR);
+  check_manifest(true);
+}
+
+void test_manifest_rejects_other_files(void) {
+  SEE_assert(!DS_MANIFEST_is_manifest_file(TEST_DATA_DIR "4.png"),
+             "PNG is not a manifest.");
+  SEE_assert(!DS_MANIFEST_is_manifest_file(TEST_DATA_DIR "does_not_exist"),
+             "Missing file is not a manifest.");
+  SEE_assert(DS_MANIFEST_load(TEST_DATA_DIR "does_not_exist") == NULL,
+             "Missing manifest must fail.");
+
+  // NOTE: A manifest cut off in its entries
+  create_labelled_dir(MANIFEST_DIR);
+  SEE_assert(DS_MANIFEST_write(MANIFEST_DIR, false, NULL),
+             "Could not write manifest.");
+  SEE_assert(truncate(MANIFEST_PATH, 40) == 0, "Could not truncate manifest.");
+  SEE_assert(DS_MANIFEST_is_manifest_file(MANIFEST_PATH),
+             "Magic is still intact.");
+  SEE_assert(DS_MANIFEST_load(MANIFEST_PATH) == NULL,
+             "Truncated manifest must fail.");
+}
+
+void test_load_or_scan_directory_and_manifest(void) {
+  create_labelled_dir(MANIFEST_DIR);
+  unlink(MANIFEST_PATH);
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(2);
+  // NOTE: A directory is scanned, like --train, --test and --predict do
+  DS_FILE_FileList *scanned = DS_MANIFEST_load_or_scan(MANIFEST_DIR, pool);
+  SEE_assert_neqp(scanned, NULL, "Could not scan directory.");
+  SEE_assert_eqlu(scanned->count, (size_t)LABELLED_DIR_NUM_FILES,
+                  "Wrong number of scanned files.");
+  SEE_assert(scanned->labels == NULL, "Scanned labels come from the paths.");
+
+  SEE_assert(DS_MANIFEST_write(MANIFEST_DIR, false, pool),
+             "Could not write manifest.");
+  DS_FILE_FileList *loaded = DS_MANIFEST_load_or_scan(MANIFEST_PATH, pool);
+  SEE_assert_neqp(loaded, NULL, "Could not load manifest.");
+  SEE_assert_eqlu(loaded->count, scanned->count, "Wrong number of files.");
+  SEE_assert(loaded->labels != NULL, "Labels must be precomputed.");
+
+  DS_FILE_file_list_free(loaded);
+  DS_FILE_file_list_free(scanned);
+  DS_THREAD_pool_free(pool);
+}
+
+SEE_RUN_TESTS(test_manifest_round_trip, test_manifest_round_trip_with_hashes,
+              test_manifest_rejects_other_files,
+              test_load_or_scan_directory_and_manifest)
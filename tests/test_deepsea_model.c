@@ -0,0 +1,224 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_model.c"
+
+#include "common.h"
+#include "fixtures.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INPUT_LENGTH 9
+#define NUM_OUTPUTS 4
+#define PATH_A TEST_OUT_DIR "model_a.txt"
+#define PATH_B TEST_OUT_DIR "model_b.txt"
+#define WATCHED_PATH TEST_OUT_DIR "model_watched.txt"
+#define NUM_READERS 2
+#define NUM_SWAPS 40
+
+typedef struct {
+  DS_MODEL_Model *model;
+  DS_Network *network;
+  atomic_bool done;
+} PublishArgs;
+
+static void *publish_main(void *const arg) {
+  PublishArgs *const args = arg;
+  DS_MODEL_publish(args->model, args->network);
+  atomic_store(&args->done, true);
+  return NULL;
+}
+
+void test_reader_keeps_entered_network(void) {
+  DS_Network *old = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  DS_Network *new = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  DS_MODEL_Model *model = DS_MODEL_create(old);
+  DS_MODEL_Reader *inside = DS_MODEL_reader_register(model);
+  DS_MODEL_Reader *late = DS_MODEL_reader_register(model);
+  SEE_assert(DS_MODEL_enter(inside) == old, "Reader must get the network.");
+
+  PublishArgs args = {.model = model, .network = new};
+  pthread_t thread;
+  pthread_create(&thread, NULL, &publish_main, &args);
+  // NOTE: A reader entering after the swap gets the new network at once,
+  // while the old one is kept for the reader inside
+  while (DS_MODEL_generation(model) == 0)
+    usleep(100);
+  SEE_assert(DS_MODEL_enter(late) == new, "Late reader must get new network.");
+  DS_MODEL_leave(late);
+  usleep(10000);
+  SEE_assert(!atomic_load(&args.done),
+             "Old network must be kept while a reader uses it.");
+  DS_MODEL_leave(inside);
+  pthread_join(thread, NULL);
+  SEE_assert(atomic_load(&args.done), "Publish must finish.");
+
+  DS_MODEL_reader_unregister(inside);
+  DS_MODEL_reader_unregister(late);
+  DS_MODEL_free(model);
+}
+
+void test_publish_keeps_serving_contract(void) {
+  DS_Network *network = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  DS_Network *other_layers = create_network(INPUT_LENGTH, 6, NUM_OUTPUTS);
+  SEE_assert(!DS_MODEL_publish(model, other_layers),
+             "Network with other layers must be rejected.");
+  char *labels[NUM_OUTPUTS] = {"a", "b", "c", "d"};
+  size_t sizes[3] = {INPUT_LENGTH, 5, NUM_OUTPUTS};
+  DS_Network *other_labels = DS_network_create_random(sizes, 3, labels);
+  SEE_assert(!DS_MODEL_publish(model, other_labels),
+             "Network with other labels must be rejected.");
+  SEE_assert_eqlu(DS_MODEL_generation(model), (size_t)0,
+                  "Rejected networks must not be published.");
+  SEE_assert(!DS_MODEL_reload(model, TEST_OUT_DIR "missing_model.txt"),
+             "Missing file must not be reloaded.");
+  DS_network_free(other_layers);
+  DS_network_free(other_labels);
+  DS_MODEL_free(model);
+}
+
+typedef struct {
+  DS_MODEL_Model *model;
+  size_t expected[2]; // Prediction of either network
+  DS_FLOAT expected_probability[2];
+  atomic_bool *stop;
+  size_t predictions;
+  size_t wrong;
+} ReaderArgs;
+
+static const uint8_t reader_input[INPUT_LENGTH] = {0,   30,  60,  90, 120,
+                                                   150, 180, 210, 240};
+
+static DS_LabelledView reader_view(void) {
+  return (DS_LabelledView){.inputs = reader_input,
+                           .input_stride = INPUT_LENGTH,
+                           .input_length = INPUT_LENGTH,
+                           .input_type = DS_DTYPE_U8,
+                           .count = 1};
+}
+
+/// Predicts with whichever network is current until stopped and counts
+/// predictions that belong to neither.
+static void *reader_main(void *const arg) {
+  ReaderArgs *const args = arg;
+  DS_MODEL_Reader *reader = DS_MODEL_reader_register(args->model);
+  DS_Inference *inference =
+      DS_inference_create(DS_MODEL_enter(reader), DS_QUADRATIC, 1);
+  DS_MODEL_leave(reader);
+  const DS_LabelledView view = reader_view();
+  while (!atomic_load(args->stop)) {
+    DS_inference_set_network(inference, DS_MODEL_enter(reader));
+    size_t prediction = 0;
+    DS_FLOAT probability = 0;
+    DS_inference_predict_view(inference, &view, &prediction, &probability);
+    DS_MODEL_leave(reader);
+    const bool is_a = prediction == args->expected[0] &&
+                      probability == args->expected_probability[0];
+    const bool is_b = prediction == args->expected[1] &&
+                      probability == args->expected_probability[1];
+    args->wrong += !is_a && !is_b;
+    ++args->predictions;
+  }
+  DS_inference_free(inference);
+  DS_MODEL_reader_unregister(reader);
+  return NULL;
+}
+
+void test_swaps_during_predictions(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Network *a = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  DS_Network *b = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  SEE_assert(DS_network_save(a, PATH_A) && DS_network_save(b, PATH_B),
+             "Could not save networks.");
+  DS_network_free(a);
+  DS_network_free(b);
+
+  // NOTE: Expectations of the networks as loaded, which drops digits
+  const char *const paths[2] = {PATH_A, PATH_B};
+  const DS_LabelledView view = reader_view();
+  size_t expected[2] = {0};
+  DS_FLOAT expected_probability[2] = {0};
+  for (size_t n = 0; n < 2; ++n) {
+    DS_Network *network = DS_network_load(paths[n]);
+    DS_network_predict_view(network, &view, &expected[n],
+                            &expected_probability[n]);
+    DS_network_free(network);
+  }
+  DS_MODEL_Model *model = DS_MODEL_create(DS_network_load(PATH_A));
+  atomic_bool stop = false;
+  ReaderArgs args[NUM_READERS];
+  pthread_t threads[NUM_READERS];
+  for (size_t r = 0; r < NUM_READERS; ++r) {
+    args[r] = (ReaderArgs){
+        .model = model,
+        .expected = {expected[0], expected[1]},
+        .expected_probability = {expected_probability[0],
+                                 expected_probability[1]},
+        .stop = &stop};
+    pthread_create(&threads[r], NULL, &reader_main, &args[r]);
+  }
+  for (size_t s = 0; s < NUM_SWAPS; ++s)
+    SEE_assert(DS_MODEL_reload(model, paths[(s + 1) % 2]),
+               "Could not reload network.");
+  atomic_store(&stop, true);
+  for (size_t r = 0; r < NUM_READERS; ++r) {
+    pthread_join(threads[r], NULL);
+    SEE_assert_eqlu(args[r].wrong, (size_t)0,
+                    "Reader %lu predicted with a broken network.", r);
+  }
+  SEE_assert_eqlu(DS_MODEL_generation(model), (size_t)NUM_SWAPS,
+                  "Every reload must be published.");
+  DS_MODEL_free(model);
+}
+
+/// Waits up to a second for the model to reach `generation`.
+static bool wait_for_generation(DS_MODEL_Model *const model,
+                                const size_t generation) {
+  for (size_t i = 0; i < 1000 && DS_MODEL_generation(model) < generation;
+       ++i)
+    usleep(1000);
+  return DS_MODEL_generation(model) >= generation;
+}
+
+void test_watcher_reloads_changed_file(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Network *network = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  SEE_assert(DS_network_save(network, WATCHED_PATH), "Could not save.");
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  DS_MODEL_Watcher *watcher = DS_MODEL_watch(model, WATCHED_PATH, 5e-3);
+  SEE_assert_neqp(watcher, NULL, "Could not watch.");
+  usleep(20000);
+  SEE_assert_eqlu(DS_MODEL_generation(model), (size_t)0,
+                  "Unchanged file must not be reloaded.");
+
+  // NOTE: Renamed over the watched file, like a trainer should
+  DS_Network *next = create_network(INPUT_LENGTH, 5, NUM_OUTPUTS);
+  SEE_assert(DS_network_save(next, PATH_A), "Could not save.");
+  DS_network_free(next);
+  SEE_assert(rename(PATH_A, WATCHED_PATH) == 0, "Could not rename.");
+  SEE_assert(wait_for_generation(model, 1), "Changed file was not reloaded.");
+
+  // NOTE: A file of other layers is rejected and the model kept
+  DS_Network *other = create_network(INPUT_LENGTH, 7, NUM_OUTPUTS);
+  SEE_assert(DS_network_save(other, WATCHED_PATH), "Could not save.");
+  DS_network_free(other);
+  usleep(50000);
+  SEE_assert_eqlu(DS_MODEL_generation(model), (size_t)1,
+                  "File of other layers must not be published.");
+
+  DS_MODEL_watcher_free(watcher);
+  DS_MODEL_free(model);
+}
+
+SEE_RUN_TESTS(test_reader_keeps_entered_network,
+              test_publish_keeps_serving_contract,
+              test_swaps_during_predictions,
+              test_watcher_reloads_changed_file)
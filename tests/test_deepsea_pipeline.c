@@ -0,0 +1,273 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "data/4_png.h"
+#include "deepsea.c"
+#include "deepsea_alloc.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_pipeline.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define COUNT 23
+#define INPUT_LENGTH 2
+#define NUM_OUTPUTS 4
+#define BATCH 5
+#define DEPTH 2
+#define EPOCHS 3
+
+/// Grey value `i` of row `row` of a batch.
+static uint8_t batch_grey(const DS_LabelledView *const batch, const size_t row,
+                          const size_t i) {
+  return ((const uint8_t *)batch->inputs)[row * batch->input_stride + i];
+}
+
+void test_data_set_epochs(void) {
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, NULL);
+  for (size_t i = 0; i < COUNT; ++i) {
+    data_set->pixels[i * INPUT_LENGTH] = (uint8_t)i;
+    data_set->pixels[i * INPUT_LENGTH + 1] = 255;
+    data_set->labels[i] = (uint16_t)(i % 4);
+  }
+  size_t sizes[2] = {INPUT_LENGTH, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_data_set(data_set, network, BATCH, DEPTH, 2);
+  SEE_assert_neqp(pipeline, NULL, "Could not create pipeline.");
+
+  for (size_t epoch = 0; epoch < EPOCHS; ++epoch) {
+    size_t seen[COUNT] = {0};
+    size_t batches = 0;
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *batch = NULL;
+    while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      SEE_assert(batch->count == BATCH || batch->count == COUNT % BATCH,
+                 "Wrong batch size %lu.", batch->count);
+      SEE_assert(batch->input_type == DS_DTYPE_U8,
+                 "Batches must keep the grey values.");
+      for (size_t i = 0; i < batch->count; ++i) {
+        const size_t sample = batch_grey(batch, i, 0); // NOTE: Pixel is index
+        SEE_assert(sample < COUNT, "Wrong sample %lu.", sample);
+        if (sample >= COUNT)
+          continue;
+        ++seen[sample];
+        SEE_assert_eqlu((size_t)batch_grey(batch, i, 1), (size_t)255,
+                        "Wrong input of %lu.", sample);
+        SEE_assert_eqlu((size_t)batch->labels[i], sample % 4,
+                        "Wrong class of sample %lu.", sample);
+      }
+      DS_PIPELINE_release_batch(pipeline, batch);
+      ++batches;
+    }
+    SEE_assert(!DS_PIPELINE_failed(pipeline), "Pipeline must not fail.");
+    SEE_assert_eqlu(batches, (size_t)((COUNT + BATCH - 1) / BATCH),
+                    "Wrong number of batches in epoch %lu.", epoch);
+    for (size_t i = 0; i < COUNT; ++i)
+      SEE_assert_eqlu(seen[i], (size_t)1, "Sample %lu seen %lu times.", i,
+                      seen[i]);
+  }
+  SEE_assert_eqlu(DS_PIPELINE_stats(pipeline).batches,
+                  (size_t)(EPOCHS * ((COUNT + BATCH - 1) / BATCH)),
+                  "Wrong number of batches in stats.");
+
+  DS_PIPELINE_free(pipeline);
+
+  data_set->labels[3] = 4; // NOTE: Has no output with four outputs
+  SEE_assert_eqp(
+      DS_PIPELINE_create_from_data_set(data_set, network, BATCH, DEPTH, 2),
+      NULL, "Label must be rejected.");
+
+  DS_network_free(network);
+  DS_DATA_set_free(data_set);
+}
+
+void test_free_while_loading(void) {
+  DS_DATA_Set *data_set = DS_DATA_set_create(COUNT, INPUT_LENGTH, NULL);
+  for (size_t i = 0; i < COUNT; ++i)
+    data_set->labels[i] = 0;
+  size_t sizes[2] = {INPUT_LENGTH, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_data_set(data_set, network, 1, DEPTH, 3);
+  DS_PIPELINE_start_epoch(pipeline);
+  const DS_LabelledView *batch = DS_PIPELINE_next_batch(pipeline);
+  SEE_assert_neqp(batch, NULL, "Could not get batch.");
+  DS_PIPELINE_free(pipeline); // NOTE: Loaders are still waiting for buffers
+
+  DS_network_free(network);
+  DS_DATA_set_free(data_set);
+}
+
+#define NUM_FILES 12
+
+void test_file_list(void) {
+  char *paths[NUM_FILES] = {0};
+  for (size_t i = 0; i < NUM_FILES; ++i)
+    paths[i] = TEST_PNG_PATH;
+  DS_FILE_FileList file_list = {.paths = paths, .count = NUM_FILES};
+  size_t sizes[2] = {PNG_4_SIZE, 10};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_file_list(&file_list, network, BATCH, DEPTH, 2);
+  SEE_assert_neqp(pipeline, NULL, "Could not create pipeline.");
+  DS_PIPELINE_start_epoch(pipeline);
+  size_t count = 0;
+  const DS_LabelledView *batch = NULL;
+  while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+    for (size_t p = 0; p < batch->count; ++p)
+      for (size_t i = 0; i < PNG_4_SIZE; ++i)
+        SEE_assert_eqf(batch_grey(batch, p, i) / 255.,
+                       (DS_FLOAT)png_4_data[i],
+                       "Wrong png data for file %lu, index %lu", count + p, i);
+    count += batch->count;
+    DS_PIPELINE_release_batch(pipeline, batch);
+  }
+  SEE_assert_eqlu(count, (size_t)NUM_FILES, "Wrong number of samples.");
+  DS_PIPELINE_free(pipeline);
+
+  paths[7] = TEST_DATA_DIR "does_not_exist.png";
+  pipeline =
+      DS_PIPELINE_create_from_file_list(&file_list, network, BATCH, DEPTH, 2);
+  DS_PIPELINE_start_epoch(pipeline);
+  while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL)
+    DS_PIPELINE_release_batch(pipeline, batch);
+  SEE_assert(DS_PIPELINE_failed(pipeline), "Missing file must fail.");
+  DS_PIPELINE_free(pipeline);
+
+  DS_network_free(network);
+}
+
+#define SHARD_DIR TEST_OUT_DIR "pipeline_shard"
+#define STREAM_DIR TEST_OUT_DIR "pipeline_stream"
+
+/// Packs NUM_FILES copies of the test PNG in `dir` into shards of five files
+/// each. File i gets the label NUM_OUTPUTS - 1 - i % num_labels.
+static DS_SHARD_Set *pack_test_shards(const char *const dir,
+                                      const size_t num_labels,
+                                      size_t *const png_file_size) {
+  uint8_t png_file[TEST_PNG_MAX_FILE_SIZE];
+  *png_file_size = read_test_png(png_file);
+  if (*png_file_size == 0)
+    return NULL;
+  mkdir(TEST_OUT_DIR, 0755);
+  mkdir(dir, 0755);
+  char path[256];
+  for (size_t i = 0; i < NUM_FILES; ++i) {
+    const size_t label = NUM_OUTPUTS - 1 - i % num_labels;
+    snprintf(path, sizeof(path), "%s/%lu", dir, label);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%lu/%lu.png", dir, label, i);
+    write_test_file(path, png_file, *png_file_size);
+  }
+  SEE_assert(DS_SHARD_write(dir, 5 * *png_file_size, NULL),
+             "Could not pack the directory.");
+  snprintf(path, sizeof(path), "%s-*" DS_SHARD_EXTENSION, dir);
+  DS_SHARD_Set *set = DS_SHARD_set_open(path);
+  SEE_assert(set != NULL, "Could not open shards.");
+  return set;
+}
+
+void test_shard_set(void) {
+  // NOTE: NUM_FILES copies of the test PNG with label 3, packed into shards
+  size_t png_file_size = 0;
+  DS_SHARD_Set *set = pack_test_shards(SHARD_DIR, 1, &png_file_size);
+  if (!set)
+    return;
+
+  size_t sizes[2] = {PNG_4_SIZE, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_shard_set(set, network, BATCH, DEPTH, 2);
+  SEE_assert_neqp(pipeline, NULL, "Could not create pipeline.");
+  DS_PIPELINE_start_epoch(pipeline);
+  size_t count = 0;
+  const DS_LabelledView *batch = NULL;
+  while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+    for (size_t p = 0; p < batch->count; ++p) {
+      SEE_assert_eqlu((size_t)batch->labels[p], (size_t)3, "Wrong label.");
+      for (size_t i = 0; i < PNG_4_SIZE; ++i)
+        SEE_assert_eqf(batch_grey(batch, p, i) / 255.,
+                       (DS_FLOAT)png_4_data[i],
+                       "Wrong png data for file %lu, index %lu", count + p, i);
+    }
+    count += batch->count;
+    DS_PIPELINE_release_batch(pipeline, batch);
+  }
+  SEE_assert_eqlu(count, (size_t)NUM_FILES, "Wrong number of samples.");
+  SEE_assert(!DS_PIPELINE_failed(pipeline), "Shards must load.");
+  DS_PIPELINE_free(pipeline);
+  DS_network_free(network);
+  DS_SHARD_set_free(set);
+}
+
+void test_stream_shards_out_of_core(void) {
+  size_t png_file_size = 0;
+  DS_SHARD_Set *set =
+      pack_test_shards(STREAM_DIR, NUM_OUTPUTS, &png_file_size);
+  if (!set)
+    return;
+  size_t sizes[2] = {PNG_4_SIZE, NUM_OUTPUTS};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+  DS_PIPELINE_Pipeline *pipeline =
+      DS_PIPELINE_create_from_shard_set(set, network, BATCH, DEPTH, 2);
+  SEE_assert_neqp(pipeline, NULL, "Could not create pipeline.");
+  if (!pipeline)
+    return;
+  SEE_assert(!DS_PIPELINE_set_memory_budget(pipeline, 1024),
+             "A budget below the batch buffers must fail.");
+  // NOTE: Two shuffle buffers of four chunks of two files on top of what the
+  // pipeline holds anyway, such that an epoch spans two buffers
+  const size_t fixed_size = pipeline->batch_arena_size +
+                            pipeline->num_loaders * png_file_size +
+                            NUM_FILES * 4 * sizeof(size_t);
+  SEE_assert(DS_PIPELINE_set_memory_budget(
+                 pipeline, fixed_size + 2 * 8 * png_file_size),
+             "Could not stream the shards.");
+  SEE_assert_eqlu(pipeline->chunk_files, (size_t)2, "Wrong chunk size.");
+  SEE_assert_eqlu(pipeline->num_windows, (size_t)2,
+                  "Wrong number of shuffle buffers.");
+
+  for (size_t epoch = 0; epoch < EPOCHS; ++epoch) {
+    size_t label_counts[NUM_OUTPUTS] = {0};
+    size_t count = 0;
+    DS_PIPELINE_start_epoch(pipeline);
+    const DS_LabelledView *batch = NULL;
+    while ((batch = DS_PIPELINE_next_batch(pipeline)) != NULL) {
+      for (size_t p = 0; p < batch->count; ++p) {
+        ++label_counts[batch->labels[p]];
+        for (size_t i = 0; i < PNG_4_SIZE; ++i)
+          SEE_assert_eqf(batch_grey(batch, p, i) / 255.,
+                         (DS_FLOAT)png_4_data[i],
+                         "Wrong png data in epoch %lu, index %lu", epoch, i);
+      }
+      count += batch->count;
+      DS_PIPELINE_release_batch(pipeline, batch);
+    }
+    SEE_assert(!DS_PIPELINE_failed(pipeline), "Shards must stream.");
+    SEE_assert_eqlu(count, (size_t)NUM_FILES, "Wrong number of samples.");
+    for (size_t l = 0; l < NUM_OUTPUTS; ++l)
+      SEE_assert_eqlu(label_counts[l], (size_t)(NUM_FILES / NUM_OUTPUTS),
+                      "Every sample must appear once in epoch %lu.", epoch);
+  }
+  DS_PIPELINE_free(pipeline);
+  DS_network_free(network);
+  DS_SHARD_set_free(set);
+}
+
+SEE_RUN_TESTS(test_data_set_epochs, test_free_while_loading, test_file_list,
+              test_shard_set, test_stream_shards_out_of_core)
@@ -7,8 +7,14 @@
 
 #include "data/4_png.h"
 #include "deepsea.c"
+#include "deepsea_data.c"
 #include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
 #include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
 
 #include "common.h"
 
@@ -19,7 +25,7 @@ void test_load_png_gray(void) {
   SEE_assert_eqlu(width * height, (size_t)PNG_4_SIZE,
                   "Wrong with or height in test definition.");
 
-  DS_PNG_Input *png_input = DS_PNG_input_load_grey(TEST_DATA_DIR "4.png");
+  DS_PNG_Input *png_input = DS_PNG_input_load_grey(NULL, TEST_DATA_DIR "4.png");
 
   SEE_assert_eqi(png_input->type, DS_PNG_Gray, "Wrong png type.");
 
@@ -32,4 +38,323 @@ void test_load_png_gray(void) {
   DS_PNG_input_free(png_input);
 }
 
-SEE_RUN_TESTS(test_load_png_gray)
+void test_decoder_into_inputs(void) {
+  DS_FLOAT inputs[2 * PNG_4_SIZE] = {0};
+  DS_PNG_Decoder *decoder = DS_PNG_decoder_create();
+  // NOTE: The second decode reuses the staging buffer of the first
+  for (size_t row = 0; row < 2; ++row) {
+    SEE_assert(DS_PNG_decode_grey_inputs(decoder, TEST_DATA_DIR "4.png",
+                                         &inputs[row * PNG_4_SIZE],
+                                         PNG_4_SIZE),
+               "Could not decode into row %lu.", row);
+    for (size_t i = 0; i < PNG_4_SIZE; ++i)
+      SEE_assert_eqf(inputs[row * PNG_4_SIZE + i], (DS_FLOAT)png_4_data[i],
+                     "Wrong input in row %lu for index %lu", row, i);
+  }
+  SEE_assert(!DS_PNG_decode_grey_inputs(decoder, TEST_DATA_DIR "4.png",
+                                        inputs, PNG_4_SIZE - 1),
+             "Wrong input length must fail.");
+  SEE_assert(!DS_PNG_decode_grey_inputs(decoder, TEST_DATA_DIR "missing.png",
+                                        inputs, PNG_4_SIZE),
+             "Missing file must fail.");
+  SEE_assert(DS_PNG_decoder_error(decoder)[0] != '\0',
+             "Decoder must keep the reason of the failure.");
+
+  // NOTE: Without a decoder a temporary one is used
+  SEE_assert(DS_PNG_decode_grey_inputs(NULL, TEST_DATA_DIR "4.png", inputs,
+                                       PNG_4_SIZE),
+             "Could not decode without a decoder.");
+  SEE_assert_eqf(inputs[PNG_4_SIZE / 2], (DS_FLOAT)png_4_data[PNG_4_SIZE / 2],
+                 "Wrong input without a decoder.");
+  DS_PNG_decoder_free(decoder);
+}
+
+void test_load_png_gray_pixels(void) {
+  uint8_t pixels[PNG_4_SIZE] = {0};
+  SEE_assert(DS_PNG_decode_grey_pixels(NULL, TEST_DATA_DIR "4.png", pixels,
+                                       PNG_4_SIZE),
+             "Could not load pixels.");
+  for (size_t i = 0; i < PNG_4_SIZE; ++i)
+    SEE_assert_eqf(pixels[i] / 255., (DS_FLOAT)png_4_data[i],
+                   "Wrong pixel for index %lu", i);
+
+  SEE_assert(!DS_PNG_decode_grey_pixels(NULL, TEST_DATA_DIR "4.png", pixels,
+                                        10),
+             "Wrong length must be rejected.");
+}
+
+void test_load_png_gray_pixels_from_memory(void) {
+  uint8_t file[1024] = {0};
+  FILE *f = fopen(TEST_DATA_DIR "4.png", "rb");
+  SEE_assert_neqp(f, NULL, "Could not open PNG.");
+  if (!f)
+    return;
+  const size_t size = fread(file, 1, sizeof(file), f);
+  fclose(f);
+
+  uint8_t pixels[PNG_4_SIZE] = {0};
+  SEE_assert(DS_PNG_decode_grey_pixels_from_memory(NULL, file, size, pixels,
+                                                   PNG_4_SIZE),
+             "Could not decode pixels.");
+  for (size_t i = 0; i < PNG_4_SIZE; ++i)
+    SEE_assert_eqf(pixels[i] / 255., (DS_FLOAT)png_4_data[i],
+                   "Wrong pixel for index %lu", i);
+
+  SEE_assert(!DS_PNG_decode_grey_pixels_from_memory(NULL, file, size / 2,
+                                                    pixels, PNG_4_SIZE),
+             "Truncated PNG must be rejected.");
+}
+
+void test_file_list_to_data_set(void) {
+  char *paths[2] = {TEST_DATA_DIR "4.png", TEST_DATA_DIR "4.png"};
+  DS_FILE_FileList file_list = {.paths = paths, .count = 2};
+  size_t sizes[2] = {PNG_4_SIZE, 10};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+
+  DS_DATA_Set *data_set =
+      DS_PNG_file_list_to_data_set(&file_list, network, NULL, NULL);
+  SEE_assert_neqp(data_set, NULL, "Could not create data set.");
+  SEE_assert_eqlu(data_set->count, (size_t)2, "Wrong count.");
+  for (size_t p = 0; p < 2; ++p) {
+    SEE_assert_eqi(data_set->labels[p], 0, "Wrong label for sample %lu", p);
+    for (size_t i = 0; i < PNG_4_SIZE; ++i)
+      SEE_assert_eqf(data_set->pixels[p * PNG_4_SIZE + i] / 255.,
+                     (DS_FLOAT)png_4_data[i],
+                     "Wrong pixel for sample %lu, index %lu", p, i);
+  }
+
+  DS_DATA_set_free(data_set);
+  DS_network_free(network);
+}
+
+#define NUM_PARALLEL_FILES 37
+
+void test_file_list_to_labelled_inputs_parallel(void) {
+  char *paths[NUM_PARALLEL_FILES] = {0};
+  for (size_t i = 0; i < NUM_PARALLEL_FILES; ++i)
+    paths[i] = TEST_DATA_DIR "4.png";
+  DS_FILE_FileList file_list = {.paths = paths, .count = NUM_PARALLEL_FILES};
+  size_t sizes[2] = {PNG_4_SIZE, 10};
+  DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(4);
+
+  DS_Labelled_Inputs *labelled_inputs =
+      DS_PNG_file_list_to_labelled_inputs(&file_list, network, NULL, pool);
+  SEE_assert_neqp(labelled_inputs, NULL, "Could not create labelled inputs.");
+  SEE_assert_eqlu(labelled_inputs->count, (size_t)NUM_PARALLEL_FILES,
+                  "Wrong count.");
+  for (size_t p = 0; p < NUM_PARALLEL_FILES; ++p) {
+    for (size_t i = 0; i < PNG_4_SIZE; ++i)
+      SEE_assert_eqf(labelled_inputs->inputs[p][i], (DS_FLOAT)png_4_data[i],
+                     "Wrong png data for file %lu, index %lu", p, i);
+  }
+  DS_labelled_inputs_free(labelled_inputs);
+
+  paths[5] = TEST_DATA_DIR "does_not_exist.png";
+  paths[20] = TEST_DATA_DIR "does_not_exist_either.png";
+  SEE_assert_eqp(
+      DS_PNG_file_list_to_labelled_inputs(&file_list, network, NULL, pool),
+      NULL, "Missing file must fail.");
+
+  DS_THREAD_pool_free(pool);
+  DS_network_free(network);
+}
+
+#define ENCODED_CAPACITY 65536
+
+typedef struct {
+  uint8_t data[ENCODED_CAPACITY];
+  size_t size;
+} Encoded;
+
+static void write_encoded(png_structp png, png_bytep data, png_size_t size) {
+  Encoded *const encoded = png_get_io_ptr(png);
+  SEE_assert(encoded->size + size <= ENCODED_CAPACITY, "PNG is too big.");
+  if (encoded->size + size <= ENCODED_CAPACITY)
+    memcpy(&encoded->data[encoded->size], data, size);
+  encoded->size += size;
+}
+
+static void flush_encoded(png_structp png) { (void)png; }
+
+/// Encodes a grey image with libpng using only the given row filter.
+static void encode_grey(const uint8_t *const pixels, const size_t width,
+                        const size_t height, const int filter,
+                        const bool interlaced, const bool with_gamma,
+                        Encoded *const encoded) {
+  encoded->size = 0;
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info = png_create_info_struct(png);
+  SEE_assert(png && info, "Could not create PNG writer.");
+  if (setjmp(png_jmpbuf(png))) {
+    SEE_assert(false, "Could not encode PNG.");
+    png_destroy_write_struct(&png, &info);
+    return;
+  }
+  png_set_write_fn(png, encoded, &write_encoded, &flush_encoded);
+  png_set_IHDR(png, info, (png_uint_32)width, (png_uint_32)height, 8,
+               PNG_COLOR_TYPE_GRAY,
+               interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  png_set_filter(png, PNG_FILTER_TYPE_BASE, filter);
+  if (with_gamma)
+    png_set_gAMA(png, info, 1.0);
+  png_write_info(png, info);
+  for (int pass = png_set_interlace_handling(png); pass > 0; --pass)
+    for (size_t y = 0; y < height; ++y)
+      png_write_row(png, (png_const_bytep)&pixels[y * width]);
+  png_write_end(png, info);
+  png_destroy_write_struct(&png, &info);
+}
+
+static void decode_with_libpng(const Encoded *const encoded,
+                               uint8_t *const pixels, const size_t length) {
+  png_image image;
+  memset(&image, 0, sizeof(image));
+  image.version = PNG_IMAGE_VERSION;
+  SEE_assert(png_image_begin_read_from_memory(&image, encoded->data,
+                                              encoded->size),
+             "libpng could not read the header.");
+  char message[PNG_ERROR_MESSAGE_LENGTH] = {0};
+  SEE_assert(finish_grey_pixels(&image, pixels, length, message),
+             "libpng could not decode: %s", message);
+}
+
+void test_fast_decoder_matches_libpng(void) {
+  static const size_t sizes[][2] = {{28, 28}, {1, 1}, {1, 7}, {33, 5},
+                                    {257, 3}};
+  static const int filters[] = {PNG_FILTER_NONE, PNG_FILTER_SUB,
+                                PNG_FILTER_UP,   PNG_FILTER_AVG,
+                                PNG_FILTER_PAETH, PNG_ALL_FILTERS};
+  static Encoded encoded;
+  uint8_t pixels[257 * 28];
+  uint8_t fast[257 * 28];
+  uint8_t reference[257 * 28];
+  uint64_t state = 42;
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    const size_t width = sizes[s][0];
+    const size_t height = sizes[s][1];
+    const size_t length = width * height;
+    // NOTE: Smooth gradients with noise, such that every filter is useful
+    for (size_t i = 0; i < length; ++i)
+      pixels[i] = (uint8_t)((i % width) * 3 + (i / width) * 5 +
+                            splitmix64(&state) % 17);
+    for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); ++f) {
+      encode_grey(pixels, width, height, filters[f], false, false, &encoded);
+      memset(fast, 0, length);
+      SEE_assert(decode_grey8_fast(encoded.data, encoded.size, fast, length, 0),
+                 "Fast path rejected %lux%lu with filter %d.", width, height,
+                 filters[f]);
+      decode_with_libpng(&encoded, reference, length);
+      SEE_assert(memcmp(fast, reference, length) == 0,
+                 "Fast path differs from libpng for %lux%lu, filter %d.",
+                 width, height, filters[f]);
+      SEE_assert(memcmp(fast, pixels, length) == 0,
+                 "Fast path is lossy for %lux%lu, filter %d.", width, height,
+                 filters[f]);
+    }
+  }
+
+  // NOTE: The test corpus
+  FILE *file = fopen(TEST_DATA_DIR "4.png", "rb");
+  SEE_assert(file != NULL, "Could not open test PNG.");
+  if (file) {
+    encoded.size = fread(encoded.data, 1, ENCODED_CAPACITY, file);
+    fclose(file);
+  }
+  SEE_assert(decode_grey8_fast(encoded.data, encoded.size, fast, PNG_4_SIZE, 0),
+             "Fast path rejected the test PNG.");
+  decode_with_libpng(&encoded, reference, PNG_4_SIZE);
+  SEE_assert(memcmp(fast, reference, PNG_4_SIZE) == 0,
+             "Fast path differs from libpng for the test PNG.");
+}
+
+void test_fast_decoder_falls_back(void) {
+  static Encoded encoded;
+  uint8_t pixels[8 * 8];
+  uint8_t decoded[8 * 8];
+  for (size_t i = 0; i < sizeof(pixels); ++i)
+    pixels[i] = (uint8_t)(i * 4);
+
+  encode_grey(pixels, 8, 8, PNG_FILTER_NONE, true, false, &encoded);
+  SEE_assert(!decode_grey8_fast(encoded.data, encoded.size, decoded, 64, 0),
+             "Interlaced PNGs are not in the fast profile.");
+  SEE_assert(DS_PNG_decode_grey_pixels_from_memory(NULL, encoded.data,
+                                                   encoded.size, decoded, 64),
+             "libpng must decode interlaced PNGs.");
+  SEE_assert(memcmp(decoded, pixels, sizeof(pixels)) == 0,
+             "Wrong interlaced pixels.");
+
+  encode_grey(pixels, 8, 8, PNG_FILTER_NONE, false, true, &encoded);
+  SEE_assert(!decode_grey8_fast(encoded.data, encoded.size, decoded, 64, 0),
+             "PNGs with gamma are not in the fast profile.");
+
+  encode_grey(pixels, 8, 8, PNG_FILTER_NONE, false, false, &encoded);
+  SEE_assert(!decode_grey8_fast(encoded.data, encoded.size, decoded, 63, 0),
+             "Wrong length must be rejected.");
+  encoded.data[encoded.size - 20] ^= 0xff; // NOTE: Corrupt the last chunks
+  SEE_assert(!decode_grey8_fast(encoded.data, encoded.size, decoded, 64, 0),
+             "Corrupted PNG must be rejected.");
+}
+
+void test_decoder_resamples(void) {
+  static Encoded encoded;
+  static uint8_t pixels[56 * 56];
+  uint8_t expected[28 * 28];
+  uint8_t decoded[28 * 28];
+  uint64_t state = 3;
+  for (size_t i = 0; i < sizeof(pixels); ++i)
+    pixels[i] = (i / 56) % 40 < 10 ? 0 : (uint8_t)(splitmix64(&state) % 256);
+  const DS_RESAMPLE_Options options = {.width = 28, .height = 28,
+                                       .crop_padding = 2};
+  void *scratch = DS_MALLOC(DS_RESAMPLE_scratch_size(&options, 56, 56));
+  DS_RESAMPLE_grey(&options, pixels, 56, 56, expected, scratch);
+  DS_FREE(scratch);
+
+  DS_PNG_Decoder *decoder = DS_PNG_decoder_create();
+  SEE_assert(!DS_PNG_decode_grey_pixels_from_memory(
+                 decoder, encoded.data, 0, decoded, sizeof(decoded)),
+             "Empty file must fail.");
+  DS_PNG_decoder_set_resampling(decoder, &options);
+  // NOTE: Through the fast path and, interlaced, through libpng
+  for (int interlaced = 0; interlaced < 2; ++interlaced) {
+    encode_grey(pixels, 56, 56, PNG_ALL_FILTERS, interlaced, false, &encoded);
+    memset(decoded, 0, sizeof(decoded));
+    SEE_assert(DS_PNG_decode_grey_pixels_from_memory(
+                   decoder, encoded.data, encoded.size, decoded,
+                   sizeof(decoded)),
+               "Could not decode and resample.");
+    SEE_assert(memcmp(decoded, expected, sizeof(decoded)) == 0,
+               "Wrong resampled pixels, interlaced: %d.", interlaced);
+  }
+  SEE_assert(!DS_PNG_decode_grey_pixels_from_memory(
+                 decoder, encoded.data, encoded.size, decoded, 27 * 28),
+             "Resampling size must fit the length.");
+
+  // NOTE: Files of the network input size pass through unchanged
+  const DS_RESAMPLE_Options same = {.width = 28, .height = 28,
+                                    .crop_padding = -1};
+  DS_PNG_decoder_set_resampling(decoder, &same);
+  SEE_assert(DS_PNG_decode_grey_pixels(decoder, TEST_DATA_DIR "4.png",
+                                       decoded, PNG_4_SIZE),
+             "Could not decode test PNG.");
+  for (size_t i = 0; i < PNG_4_SIZE; ++i)
+    SEE_assert_eqlu((size_t)decoded[i],
+                    (size_t)lround(png_4_data[i] * MAX_GREY_VALUE),
+                    "Wrong pixel %lu.", i);
+  DS_PNG_decoder_set_resampling(decoder, NULL);
+  SEE_assert(!DS_PNG_decode_grey_pixels_from_memory(
+                 decoder, encoded.data, encoded.size, decoded,
+                 sizeof(decoded)),
+             "Without resampling the size must match.");
+  DS_PNG_decoder_free(decoder);
+}
+
+SEE_RUN_TESTS(test_fast_decoder_matches_libpng, test_fast_decoder_falls_back,
+              test_decoder_resamples,
+              test_decoder_into_inputs, test_load_png_gray, test_load_png_gray_pixels,
+              test_load_png_gray_pixels_from_memory,
+              test_file_list_to_data_set,
+              test_file_list_to_labelled_inputs_parallel)
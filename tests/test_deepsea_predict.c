@@ -0,0 +1,167 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "data/4_png.h"
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_png.c"
+#include "deepsea_predict.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define OUT_PATH TEST_OUT_DIR "predict.out"
+#define NUM_OUTPUTS 10
+#define MAX_LINE 256
+
+static uint8_t png_4_pixels[PNG_4_SIZE];
+
+/// Prediction of the network itself for the grey values of the test PNG.
+static size_t expected_prediction(DS_Network *const network,
+                                  DS_FLOAT *const probability) {
+  for (size_t i = 0; i < PNG_4_SIZE; ++i)
+    png_4_pixels[i] = (uint8_t)(png_4_data[i] * MAX_GREY_VALUE + 0.5);
+  return predict_row(network, png_4_pixels, DS_DTYPE_U8, PNG_4_SIZE,
+                     probability);
+}
+
+/// Reads the lines written to OUT_PATH, without their line breaks.
+static size_t read_lines(char lines[][MAX_LINE], const size_t max_lines) {
+  FILE *f = fopen(OUT_PATH, "r");
+  SEE_assert(f != NULL, "Could not open output.");
+  size_t count = 0;
+  while (f && count < max_lines && fgets(lines[count], MAX_LINE, f)) {
+    lines[count][strcspn(lines[count], "\n")] = '\0';
+    ++count;
+  }
+  if (f)
+    fclose(f);
+  return count;
+}
+
+void test_stream_files_csv(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Network *network = create_network(PNG_4_SIZE, 16, NUM_OUTPUTS);
+  DS_FLOAT probability = 0;
+  const size_t expected = expected_prediction(network, &probability);
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(2);
+  FILE *out = fopen(OUT_PATH, "w");
+  // NOTE: Batches of two, so the lines of several batches must keep order
+  DS_PREDICT_Stream *stream =
+      DS_PREDICT_stream_create(network, DS_PREDICT_CSV, 2, NULL, pool, out);
+  DS_PREDICT_add_file(stream, TEST_PNG_PATH);
+  DS_PREDICT_add_file(stream, TEST_OUT_DIR "missing,\"quoted\".png");
+  DS_PREDICT_add_file(stream, TEST_PNG_PATH);
+  DS_PREDICT_flush(stream);
+  const DS_PREDICT_Stats stats = DS_PREDICT_stream_stats(stream);
+  SEE_assert_eqlu(stats.samples, (size_t)3, "Wrong number of samples.");
+  SEE_assert_eqlu(stats.failed, (size_t)1, "Wrong number of failures.");
+  DS_PREDICT_stream_free(stream);
+  fclose(out);
+
+  char lines[8][MAX_LINE];
+  SEE_assert_eqlu(read_lines(lines, 8), (size_t)4, "Wrong number of lines.");
+  SEE_assert_eqstr(lines[0], "source,prediction,confidence,error",
+                   "Wrong header.");
+  char line[MAX_LINE];
+  snprintf(line, sizeof(line), "%s,%lu,%.6f,", TEST_PNG_PATH, expected,
+           probability);
+  SEE_assert_eqstr(lines[1], line, "Wrong first prediction.");
+  SEE_assert_eqstr(lines[2],
+                   "\"" TEST_OUT_DIR "missing,\"\"quoted\"\".png\",,,"
+                   "could not decode",
+                   "Failure must be quoted and reported.");
+  SEE_assert_eqstr(lines[3], line, "Wrong last prediction.");
+  DS_THREAD_pool_free(pool);
+  DS_network_free(network);
+}
+
+/// Writes `size` bytes into a new pipe and closes its write end. Returns
+/// the read end.
+static int pipe_with(const void *const data, const size_t size) {
+  int fds[2] = {-1, -1};
+  SEE_assert(pipe(fds) == 0, "Could not create pipe.");
+  SEE_assert(write(fds[1], data, size) == (ssize_t)size,
+             "Could not fill pipe.");
+  close(fds[1]);
+  return fds[0];
+}
+
+void test_read_paths_jsonl(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Network *network = create_network(PNG_4_SIZE, 16, NUM_OUTPUTS);
+  const size_t expected = expected_prediction(network, NULL);
+  FILE *out = fopen(OUT_PATH, "w");
+  DS_PREDICT_Stream *stream =
+      DS_PREDICT_stream_create(network, DS_PREDICT_JSONL, 8, NULL, NULL, out);
+  // NOTE: Line breaks of either kind, an empty line and no final break
+  const char paths[] = TEST_PNG_PATH "\r\n\n" TEST_OUT_DIR "missing.png";
+  const int fd = pipe_with(paths, sizeof(paths) - 1);
+  SEE_assert(DS_PREDICT_read_paths(stream, fd), "Could not read paths.");
+  close(fd);
+  SEE_assert_eqlu(DS_PREDICT_stream_stats(stream).samples, (size_t)2,
+                  "Wrong number of samples.");
+  DS_PREDICT_stream_free(stream);
+  fclose(out);
+
+  char lines[4][MAX_LINE];
+  SEE_assert_eqlu(read_lines(lines, 4), (size_t)2, "Wrong number of lines.");
+  char prefix[MAX_LINE];
+  snprintf(prefix, sizeof(prefix),
+           "{\"source\":\"%s\",\"prediction\":\"%lu\",\"confidence\":",
+           TEST_PNG_PATH, expected);
+  SEE_assert(strncmp(lines[0], prefix, strlen(prefix)) == 0,
+             "Wrong prediction line \"%s\".", lines[0]);
+  SEE_assert_eqstr(lines[1],
+                   "{\"source\":\"" TEST_OUT_DIR "missing.png\","
+                   "\"error\":\"could not decode\"}",
+                   "Wrong failure line.");
+  DS_network_free(network);
+}
+
+void test_read_frames(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  DS_Network *network = create_network(PNG_4_SIZE, 16, NUM_OUTPUTS);
+  const size_t expected = expected_prediction(network, NULL);
+  uint8_t frames[3][PNG_4_SIZE];
+  for (size_t f = 0; f < 3; ++f)
+    memcpy(frames[f], png_4_pixels, PNG_4_SIZE);
+  FILE *out = fopen(OUT_PATH, "w");
+  DS_PREDICT_Stream *stream =
+      DS_PREDICT_stream_create(network, DS_PREDICT_CSV, 2, NULL, NULL, out);
+  int fd = pipe_with(frames, sizeof(frames));
+  SEE_assert(DS_PREDICT_read_frames(stream, fd), "Could not read frames.");
+  close(fd);
+  // NOTE: A stream that ends within a frame fails after the full frames
+  fd = pipe_with(frames, PNG_4_SIZE + 10);
+  SEE_assert(!DS_PREDICT_read_frames(stream, fd),
+             "Partial frame must fail.");
+  close(fd);
+  const DS_PREDICT_Stats stats = DS_PREDICT_stream_stats(stream);
+  SEE_assert_eqlu(stats.samples, (size_t)4, "Wrong number of samples.");
+  SEE_assert_eqlu(stats.failed, (size_t)0, "Frames must not fail.");
+  DS_PREDICT_stream_free(stream);
+  fclose(out);
+
+  char lines[8][MAX_LINE];
+  SEE_assert_eqlu(read_lines(lines, 8), (size_t)5, "Wrong number of lines.");
+  for (size_t f = 0; f < 4; ++f) {
+    char prefix[MAX_LINE];
+    snprintf(prefix, sizeof(prefix), "%lu,%lu,", f, expected);
+    SEE_assert(strncmp(lines[f + 1], prefix, strlen(prefix)) == 0,
+               "Wrong line \"%s\" of frame %lu.", lines[f + 1], f);
+  }
+  DS_network_free(network);
+}
+
+SEE_RUN_TESTS(test_stream_files_csv, test_read_paths_jsonl, test_read_frames)
@@ -0,0 +1,122 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_resample.c"
+
+#include "common.h"
+
+#include <stdint.h>
+
+static void resample(const DS_RESAMPLE_Options *const options,
+                     const uint8_t *const image, const size_t width,
+                     const size_t height, uint8_t *const out) {
+  void *scratch = DS_MALLOC(DS_RESAMPLE_scratch_size(options, width, height));
+  SEE_assert(scratch != NULL, "Out of memory.");
+  DS_RESAMPLE_grey(options, image, width, height, out, scratch);
+  DS_FREE(scratch);
+}
+
+void test_resample_same_size_is_identity(void) {
+  uint8_t image[5 * 3];
+  uint8_t out[5 * 3];
+  for (size_t i = 0; i < sizeof(image); ++i)
+    image[i] = (uint8_t)(i * 17);
+  const DS_RESAMPLE_Options options = {.width = 5, .height = 3,
+                                       .crop_padding = -1};
+  resample(&options, image, 5, 3, out);
+  for (size_t i = 0; i < sizeof(image); ++i)
+    SEE_assert_eqlu((size_t)out[i], (size_t)image[i], "Wrong value at %lu.",
+                    i);
+}
+
+void test_resample_shrinking_averages_areas(void) {
+  // NOTE: 2x2 blocks of 0, 100, 200 and 255 shrunk by 2
+  const uint8_t image[4 * 4] = {0,   0,   100, 100, //
+                                0,   0,   100, 100, //
+                                200, 200, 255, 255, //
+                                200, 200, 255, 255};
+  const uint8_t expected[2 * 2] = {0, 100, 200, 255};
+  uint8_t out[2 * 2];
+  const DS_RESAMPLE_Options options = {.width = 2, .height = 2,
+                                       .crop_padding = -1};
+  resample(&options, image, 4, 4, out);
+  for (size_t i = 0; i < sizeof(out); ++i)
+    SEE_assert_eqlu((size_t)out[i], (size_t)expected[i],
+                    "Wrong average at %lu.", i);
+
+  // NOTE: Non-integer factors weigh partially covered pixels
+  const uint8_t row[3] = {0, 90, 180};
+  uint8_t halves[2];
+  const DS_RESAMPLE_Options half = {.width = 2, .height = 1,
+                                    .crop_padding = -1};
+  resample(&half, row, 3, 1, halves);
+  SEE_assert_eqlu((size_t)halves[0], (size_t)30, "Wrong first half.");
+  SEE_assert_eqlu((size_t)halves[1], (size_t)150, "Wrong second half.");
+}
+
+void test_resample_enlarging_interpolates(void) {
+  const uint8_t image[2] = {0, 200};
+  uint8_t out[4];
+  const DS_RESAMPLE_Options options = {.width = 4, .height = 1,
+                                       .crop_padding = -1};
+  resample(&options, image, 2, 1, out);
+  const uint8_t expected[4] = {0, 50, 150, 200};
+  for (size_t i = 0; i < sizeof(out); ++i)
+    SEE_assert_eqlu((size_t)out[i], (size_t)expected[i],
+                    "Wrong interpolation at %lu.", i);
+
+  uint8_t constant[3 * 3];
+  const uint8_t one = 77;
+  const DS_RESAMPLE_Options three = {.width = 3, .height = 3,
+                                     .crop_padding = -1};
+  resample(&three, &one, 1, 1, constant);
+  for (size_t i = 0; i < sizeof(constant); ++i)
+    SEE_assert_eqlu((size_t)constant[i], (size_t)one,
+                    "A single pixel must fill the image.");
+}
+
+void test_resample_crops_to_drawing(void) {
+  // NOTE: A 2x2 drawing in the corner of an 8x8 image fills the output
+  uint8_t image[8 * 8] = {0};
+  image[5 * 8 + 5] = 10;
+  image[5 * 8 + 6] = 20;
+  image[6 * 8 + 5] = 30;
+  image[6 * 8 + 6] = 40;
+  uint8_t out[2 * 2];
+  DS_RESAMPLE_Options options = {.width = 2, .height = 2, .crop_padding = 0};
+  resample(&options, image, 8, 8, out);
+  const uint8_t expected[2 * 2] = {10, 20, 30, 40};
+  for (size_t i = 0; i < sizeof(out); ++i)
+    SEE_assert_eqlu((size_t)out[i], (size_t)expected[i],
+                    "Wrong cropped value at %lu.", i);
+
+  // NOTE: Padding is clamped to the image: columns and rows 4..7 remain
+  options.width = 4;
+  options.height = 4;
+  options.crop_padding = 1;
+  uint8_t padded[4 * 4];
+  resample(&options, image, 8, 8, padded);
+  for (size_t y = 0; y < 4; ++y)
+    for (size_t x = 0; x < 4; ++x)
+      SEE_assert_eqlu((size_t)padded[y * 4 + x],
+                      (size_t)image[(y + 4) * 8 + x + 4],
+                      "Wrong padded value at %lu, %lu.", x, y);
+
+  // NOTE: An empty image is not cropped
+  uint8_t empty[4 * 4] = {0};
+  options.crop_padding = 0;
+  resample(&options, empty, 4, 4, padded);
+  for (size_t i = 0; i < sizeof(padded); ++i)
+    SEE_assert_eqlu((size_t)padded[i], (size_t)0,
+                    "Empty image must stay empty.");
+}
+
+SEE_RUN_TESTS(test_resample_same_size_is_identity,
+              test_resample_shrinking_averages_areas,
+              test_resample_enlarging_interpolates,
+              test_resample_crops_to_drawing)
@@ -0,0 +1,116 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_model.c"
+#include "deepsea_ring.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define RING_NAME "/ditect-test-ring"
+#define INPUT_LENGTH 70 // NOTE: Slots are padded to whole cache lines
+#define NUM_OUTPUTS 4
+#define NUM_SLOTS 6 // NOTE: Rounded up to 8
+#define NUM_FRAMES 100
+
+/// Prediction of the network itself, one frame at a time.
+static DS_RING_Result expected_result(DS_Inference *const inference,
+                                      const size_t index) {
+  uint8_t grey[INPUT_LENGTH];
+  fill_grey_row(index, grey, INPUT_LENGTH);
+  const DS_LabelledView view = row_view(grey, DS_DTYPE_U8, INPUT_LENGTH);
+  size_t prediction = 0;
+  DS_FLOAT probability = 0;
+  DS_inference_predict_view(inference, &view, &prediction, &probability);
+  return (DS_RING_Result){.prediction = (uint32_t)prediction,
+                          .confidence = (float)probability};
+}
+
+/// Submits frames in windows of `window` before taking their results and
+/// counts the results that differ from the network's.
+static size_t predict_frames(DS_RING_Client *const client,
+                             DS_Inference *const inference,
+                             const size_t window) {
+  size_t wrong = 0;
+  uint32_t tickets[NUM_SLOTS + 2];
+  for (size_t first = 0; first < NUM_FRAMES; first += window) {
+    const size_t count = DS_MIN(window, NUM_FRAMES - first);
+    for (size_t f = 0; f < count; ++f) {
+      uint8_t *const slot = DS_RING_client_slot(client);
+      SEE_assert_neqp(slot, NULL, "Ring has no free slot.");
+      fill_grey_row(first + f, slot, INPUT_LENGTH);
+      tickets[f] = DS_RING_client_submit(client);
+    }
+    for (size_t f = 0; f < count; ++f) {
+      DS_RING_Result result = {0};
+      SEE_assert(DS_RING_client_result(client, tickets[f], &result),
+                 "Frame %lu was not answered.", first + f);
+      const DS_RING_Result expected = expected_result(inference, first + f);
+      wrong += result.prediction != expected.prediction ||
+               result.confidence != expected.confidence;
+    }
+  }
+  return wrong;
+}
+
+void test_frames_predict_like_network(void) {
+  DS_Network *network = create_network(INPUT_LENGTH, 6, NUM_OUTPUTS);
+  DS_Inference *inference = DS_inference_create(network, DS_QUADRATIC, 1);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  DS_RING_Server *server = DS_RING_server_create(RING_NAME, model, NUM_SLOTS);
+  SEE_assert_neqp(server, NULL, "Could not create ring.");
+  DS_RING_Client *client = DS_RING_client_open(RING_NAME);
+  SEE_assert_neqp(client, NULL, "Could not open ring.");
+  SEE_assert_eqlu(DS_RING_client_frame_size(client), (size_t)INPUT_LENGTH,
+                  "Wrong frame size.");
+
+  // NOTE: One frame at a time, then windows that fill every slot and wrap
+  SEE_assert_eqlu(predict_frames(client, inference, 1), (size_t)0,
+                  "Single frames were predicted wrong.");
+  SEE_assert_eqlu(predict_frames(client, inference, 8), (size_t)0,
+                  "Windows of frames were predicted wrong.");
+  SEE_assert_eqlu(predict_frames(client, inference, 5), (size_t)0,
+                  "Wrapping windows of frames were predicted wrong.");
+  const DS_RING_Stats stats = DS_RING_server_stats(server);
+  SEE_assert_eqlu(stats.requests, (size_t)(3 * NUM_FRAMES),
+                  "Wrong number of requests.");
+  SEE_assert(stats.batches > 0 && stats.batches <= stats.requests,
+             "Wrong number of batches %lu.", stats.batches);
+
+  DS_RING_client_free(client);
+  DS_RING_server_free(server);
+  DS_inference_free(inference);
+  DS_MODEL_free(model);
+}
+
+void test_stopped_server_fails_client(void) {
+  DS_MODEL_Model *model =
+      DS_MODEL_create(create_network(INPUT_LENGTH, 6, NUM_OUTPUTS));
+  DS_RING_Server *server = DS_RING_server_create(RING_NAME, model, NUM_SLOTS);
+  DS_RING_Client *client = DS_RING_client_open(RING_NAME);
+  SEE_assert_neqp(client, NULL, "Could not open ring.");
+  uint8_t *const slot = DS_RING_client_slot(client);
+  SEE_assert_neqp(slot, NULL, "Ring has no free slot.");
+  fill_grey_row(0, slot, INPUT_LENGTH);
+  DS_RING_server_free(server);
+
+  // NOTE: The client keeps its mapping, but nothing answers any more
+  const uint32_t ticket = DS_RING_client_submit(client);
+  DS_RING_Result result = {0};
+  SEE_assert(!DS_RING_client_result(client, ticket, &result),
+             "Frame submitted after the stop must fail.");
+  SEE_assert(DS_RING_client_slot(client) == NULL,
+             "Stopped ring must have no slot.");
+  DS_RING_client_free(client);
+  SEE_assert(DS_RING_client_open(RING_NAME) == NULL,
+             "Stopped ring must be removed.");
+  DS_MODEL_free(model);
+}
+
+SEE_RUN_TESTS(test_frames_predict_like_network,
+              test_stopped_server_fails_client)
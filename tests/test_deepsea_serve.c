@@ -0,0 +1,189 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "data/4_png.h"
+#include "deepsea.c"
+#include "deepsea_batcher.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_model.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_serve.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define SOCKET_PATH TEST_OUT_DIR "serve.sock"
+#define NUM_OUTPUTS 10
+#define NUM_CLIENTS 4
+#define REQUESTS_PER_CLIENT 25
+
+static uint8_t png_file[TEST_PNG_MAX_FILE_SIZE];
+static size_t png_file_size;
+
+/// Prediction of the network itself for the test PNG.
+static size_t expected_prediction(DS_Network *const network,
+                                  DS_FLOAT *const probability) {
+  return predict_row(network, png_4_data, DS_DTYPE_FLOAT, PNG_4_SIZE,
+                     probability);
+}
+
+void test_serve_tensor_and_png(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  png_file_size = read_test_png(png_file);
+  DS_Network *network = create_network(PNG_4_SIZE, 16, NUM_OUTPUTS);
+  DS_FLOAT probability = 0;
+  const size_t expected = expected_prediction(network, &probability);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  DS_SERVE_Server *server =
+      DS_SERVE_server_create(SOCKET_PATH, model, 2, NULL, NULL);
+  SEE_assert_neqp(server, NULL, "Could not start server.");
+  if (!server) {
+    DS_MODEL_free(model);
+    return;
+  }
+  SEE_assert_eqlu(DS_SERVE_server_num_workers(server), (size_t)2,
+                  "Wrong number of workers.");
+
+  DS_SERVE_Client *client = DS_SERVE_client_connect(SOCKET_PATH);
+  SEE_assert_neqp(client, NULL, "Could not connect.");
+  float values[PNG_4_SIZE];
+  for (size_t i = 0; i < PNG_4_SIZE; ++i)
+    values[i] = (float)png_4_data[i];
+  DS_SERVE_Response response;
+  SEE_assert(DS_SERVE_client_predict_tensor(client, values, PNG_4_SIZE,
+                                            &response),
+             "Tensor request failed.");
+  SEE_assert_eqlu((size_t)response.status, (size_t)DS_SERVE_OK,
+                  "Wrong tensor status.");
+  SEE_assert_eqlu((size_t)response.prediction, expected,
+                  "Wrong tensor prediction.");
+  SEE_assert(fabs(response.confidence - probability) < 1e-5,
+             "Wrong tensor confidence.");
+  char label[8];
+  snprintf(label, sizeof(label), "%lu", expected);
+  SEE_assert_eqstr(response.label, label, "Wrong label.");
+
+  // NOTE: The same connection answers the PNG of the same digit
+  SEE_assert(DS_SERVE_client_predict_png(client, png_file, png_file_size,
+                                         &response),
+             "PNG request failed.");
+  SEE_assert_eqlu((size_t)response.status, (size_t)DS_SERVE_OK,
+                  "Wrong PNG status.");
+  SEE_assert_eqlu((size_t)response.prediction, expected,
+                  "Wrong PNG prediction.");
+
+  // NOTE: Bad requests are answered and the connection stays usable
+  SEE_assert(DS_SERVE_client_predict_tensor(client, values, 10, &response),
+             "Short tensor request failed.");
+  SEE_assert_eqlu((size_t)response.status, (size_t)DS_SERVE_BAD_REQUEST,
+                  "Short tensor must be rejected.");
+  SEE_assert(DS_SERVE_client_predict_png(client, png_file, 16, &response),
+             "Broken PNG request failed.");
+  SEE_assert_eqlu((size_t)response.status, (size_t)DS_SERVE_BAD_IMAGE,
+                  "Broken PNG must be rejected.");
+  SEE_assert(DS_SERVE_client_predict_tensor(client, values, PNG_4_SIZE,
+                                            &response) &&
+                 response.status == DS_SERVE_OK,
+             "Connection unusable after a bad request.");
+  DS_SERVE_client_free(client);
+
+  DS_SERVE_server_stop(server);
+  const DS_SERVE_Stats stats = DS_SERVE_server_stats(server);
+  SEE_assert_eqlu(stats.requests, (size_t)5, "Wrong number of requests.");
+  SEE_assert_eqlu(stats.errors, (size_t)2, "Wrong number of errors.");
+  SEE_assert(stats.p50_seconds > 0 && stats.p50_seconds <= stats.p99_seconds,
+             "Wrong latency percentiles.");
+  DS_SERVE_server_free(server);
+  SEE_assert(access(SOCKET_PATH, F_OK) != 0, "Socket must be removed.");
+  DS_MODEL_free(model);
+}
+
+typedef struct {
+  size_t expected;
+  size_t correct;
+} ClientArgs;
+
+static void *client_main(void *const arg) {
+  ClientArgs *const args = arg;
+  DS_SERVE_Client *client = DS_SERVE_client_connect(SOCKET_PATH);
+  if (!client)
+    return NULL;
+  DS_SERVE_Response response;
+  for (size_t r = 0; r < REQUESTS_PER_CLIENT; ++r)
+    if (DS_SERVE_client_predict_png(client, png_file, png_file_size,
+                                    &response) &&
+        response.status == DS_SERVE_OK &&
+        response.prediction == args->expected)
+      ++args->correct;
+  DS_SERVE_client_free(client);
+  return NULL;
+}
+
+void test_serve_concurrent_clients(void) {
+  mkdir(TEST_OUT_DIR, 0755);
+  png_file_size = read_test_png(png_file);
+  DS_Network *network = create_network(PNG_4_SIZE, 16, NUM_OUTPUTS);
+  const size_t expected = expected_prediction(network, NULL);
+  DS_MODEL_Model *model = DS_MODEL_create(network);
+  // NOTE: Fewer workers than clients, so the batches fill up
+  const DS_BATCHER_Options batching = {.max_batch_size = 2,
+                                       .deadline_seconds = 1e-3};
+  DS_SERVE_Server *server =
+      DS_SERVE_server_create(SOCKET_PATH, model, 3, NULL, &batching);
+  SEE_assert_neqp(server, NULL, "Could not start server.");
+  if (!server) {
+    DS_MODEL_free(model);
+    return;
+  }
+
+  pthread_t threads[NUM_CLIENTS];
+  ClientArgs args[NUM_CLIENTS];
+  for (size_t c = 0; c < NUM_CLIENTS; ++c) {
+    args[c] = (ClientArgs){.expected = expected};
+    pthread_create(&threads[c], NULL, &client_main, &args[c]);
+  }
+  for (size_t c = 0; c < NUM_CLIENTS; ++c) {
+    pthread_join(threads[c], NULL);
+    SEE_assert_eqlu(args[c].correct, (size_t)REQUESTS_PER_CLIENT,
+                    "Client %lu got wrong answers.", c);
+  }
+
+  // NOTE: An idle connection must not keep the server from stopping
+  DS_SERVE_Client *idle = DS_SERVE_client_connect(SOCKET_PATH);
+  SEE_assert_neqp(idle, NULL, "Could not connect.");
+  usleep(10000);
+  DS_SERVE_server_stop(server);
+  const DS_SERVE_Stats stats = DS_SERVE_server_stats(server);
+  SEE_assert_eqlu(stats.requests, (size_t)(NUM_CLIENTS * REQUESTS_PER_CLIENT),
+                  "Wrong number of requests.");
+  SEE_assert_eqlu(stats.batching.requests, stats.requests,
+                  "Every request must be batched.");
+  SEE_assert_eqlu(stats.batching.batch_sizes[0] +
+                      2 * stats.batching.batch_sizes[1],
+                  stats.requests, "Batches must not exceed two requests.");
+  if (idle)
+    DS_SERVE_client_free(idle);
+  DS_SERVE_server_free(server);
+  DS_MODEL_free(model);
+}
+
+void test_percentile(void) {
+  double seconds[5] = {5, 1, 4, 2, 3};
+  SEE_assert_eqf(DS_SERVE_percentile(seconds, 5, 0.5), 3., "Wrong median.");
+  SEE_assert_eqf(DS_SERVE_percentile(seconds, 5, 0.99), 5., "Wrong p99.");
+  SEE_assert_eqf(DS_SERVE_percentile(seconds, 5, 0), 1., "Wrong minimum.");
+  SEE_assert_eqf(DS_SERVE_percentile(seconds, 0, 0.5), 0., "Empty must be 0.");
+}
+
+SEE_RUN_TESTS(test_serve_tensor_and_png, test_serve_concurrent_clients,
+              test_percentile)
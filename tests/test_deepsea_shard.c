@@ -0,0 +1,209 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "data/4_png.h"
+#include "deepsea.c"
+#include "deepsea_data.c"
+#include "deepsea_file.c"
+#include "deepsea_io.c"
+#include "deepsea_manifest.c"
+#include "deepsea_png.c"
+#include "deepsea_resample.c"
+#include "deepsea_shard.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+#include "fixtures.h"
+
+#define SHARD_DIR TEST_OUT_DIR "shard"
+#define SHARD_PATTERN SHARD_DIR "-*" DS_SHARD_EXTENSION
+#define TAR_PATH TEST_OUT_DIR "shard.tar"
+
+static uint8_t png_file[TEST_PNG_MAX_FILE_SIZE];
+static size_t png_file_size;
+
+static void remove_shards(void) {
+  char path[256];
+  for (size_t i = 0; i < 2 * LABELLED_DIR_NUM_FILES; ++i) {
+    snprintf(path, sizeof(path), SHARD_DIR "-%05lu" DS_SHARD_EXTENSION, i);
+    unlink(path);
+  }
+}
+
+static void check_files(DS_SHARD_Set *const set, const size_t count) {
+  const DS_FILE_FileList *const file_list = DS_SHARD_set_file_list(set);
+  SEE_assert_eqlu(file_list->count, count, "Wrong number of files.");
+  SEE_assert_eqlu(DS_SHARD_set_max_file_size(set), png_file_size,
+                  "Wrong maximum file size.");
+  DS_IO_File files[LABELLED_DIR_NUM_FILES];
+  SEE_assert(DS_SHARD_set_read_files(set, 0, file_list->count, files),
+             "Could not read files.");
+  uint8_t buffer[4096];
+  for (size_t i = 0; i < file_list->count; ++i) {
+    SEE_assert_eqlu(files[i].size, png_file_size, "Wrong size of file %lu.",
+                    i);
+    SEE_assert(memcmp(files[i].data, png_file, png_file_size) == 0,
+               "Wrong contents of file %lu.", i);
+    size_t size = 0;
+    SEE_assert(DS_SHARD_set_read_file(set, i, buffer, &size),
+               "Could not read file %lu.", i);
+    SEE_assert(size == png_file_size &&
+                   memcmp(buffer, png_file, png_file_size) == 0,
+               "Wrong single file %lu.", i);
+  }
+  SEE_assert_eqlu((size_t)DS_SHARD_set_data_size(set), count * png_file_size,
+                  "Wrong data size.");
+  // NOTE: Dropped pages are read again when they are touched
+  DS_SHARD_set_advise(set, 0, count, true);
+  DS_SHARD_set_advise(set, 0, count, false);
+  for (size_t i = 0; i < count; ++i) {
+    size_t size = 0;
+    const uint8_t *const data = DS_SHARD_set_file_data(set, i, &size);
+    SEE_assert(size == png_file_size &&
+                   memcmp(data, png_file, png_file_size) == 0,
+               "Wrong mapped file %lu.", i);
+  }
+}
+
+void test_pack_and_open_shards(void) {
+  png_file_size = read_test_png(png_file);
+  create_labelled_dir(SHARD_DIR);
+  remove_shards();
+  SEE_assert(!DS_SHARD_is_shard_pattern(SHARD_PATTERN),
+             "Nothing is packed yet.");
+  SEE_assert(!DS_SHARD_is_shard_pattern(SHARD_DIR),
+             "A directory is not a shard.");
+  // NOTE: Two files fit into a shard
+  SEE_assert(DS_SHARD_write(SHARD_DIR "/", 16 + 2 * png_file_size, NULL),
+             "Could not pack the directory.");
+  SEE_assert(DS_SHARD_is_shard_pattern(SHARD_PATTERN), "Shards not found.");
+
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(2);
+  DS_FILE_FileList *scanned = DS_FILE_get_files(SHARD_DIR, pool);
+  DS_SHARD_Set *set = DS_SHARD_set_open(SHARD_PATTERN);
+  SEE_assert(set != NULL, "Could not open shards.");
+  if (set) {
+    SEE_assert_eqlu(set->num_shards, (size_t)2, "Wrong number of shards.");
+    check_files(set, LABELLED_DIR_NUM_FILES);
+    const DS_FILE_FileList *const file_list = DS_SHARD_set_file_list(set);
+    for (size_t i = 0; i < file_list->count && i < scanned->count; ++i) {
+      const char *const name = strchr(file_list->paths[i], ':') + 1;
+      SEE_assert_eqstr(name, scanned->paths[i] + strlen(TEST_OUT_DIR),
+                       "Wrong name of file %lu.", i);
+      SEE_assert_eqlu(DS_FILE_file_list_label(file_list, i),
+                      DS_FILE_file_list_label(scanned, i),
+                      "Wrong label of file %lu.", i);
+    }
+
+    size_t sizes[2] = {PNG_4_SIZE, 8};
+    DS_Network *network = DS_network_create_random(sizes, 2, NULL);
+    DS_DATA_Set *data_set =
+        DS_PNG_shard_set_to_data_set(set, network, NULL, pool);
+    SEE_assert(data_set != NULL, "Could not decode shards.");
+    if (data_set) {
+      for (size_t p = 0; p < data_set->count; ++p)
+        for (size_t i = 0; i < PNG_4_SIZE; ++i)
+          SEE_assert_eqf(data_set->pixels[p * PNG_4_SIZE + i] / 255.,
+                         png_4_data[i], "Wrong pixel %lu of file %lu.", i, p);
+      DS_DATA_set_free(data_set);
+    }
+    DS_network_free(network);
+    DS_SHARD_set_free(set);
+  }
+  DS_FILE_file_list_free(scanned);
+  DS_THREAD_pool_free(pool);
+}
+
+void test_corrupt_shard_fails(void) {
+  png_file_size = read_test_png(png_file);
+  create_labelled_dir(SHARD_DIR);
+  remove_shards();
+  SEE_assert(DS_SHARD_write(SHARD_DIR, SIZE_MAX, NULL),
+             "Could not pack the directory.");
+  SEE_assert(truncate(SHARD_DIR "-00000" DS_SHARD_EXTENSION,
+                      16 + png_file_size) == 0,
+             "Could not truncate shard.");
+  SEE_assert(DS_SHARD_is_shard_pattern(SHARD_PATTERN),
+             "Magic is still intact.");
+  SEE_assert_eqp(DS_SHARD_set_open(SHARD_PATTERN), NULL,
+                 "Truncated shard must fail.");
+  SEE_assert_eqp(DS_SHARD_set_open(TEST_OUT_DIR "missing-*.shard"), NULL,
+                 "Missing shards must fail.");
+}
+
+/// Writes a ustar header block for a member of `size` bytes.
+static void tar_header(FILE *const f, const char *const name,
+                       const char type, const size_t size) {
+  uint8_t block[TAR_BLOCK_SIZE] = {0};
+  memcpy(block, name, DS_MIN(strlen(name), 100));
+  memcpy(&block[100], "0000644", 7);
+  snprintf((char *)&block[124], 12, "%011lo", size);
+  block[156] = (uint8_t)type;
+  memcpy(&block[257], "ustar", 6);
+  memcpy(&block[263], "00", 2);
+  memset(&block[148], ' ', 8);
+  size_t sum = 0;
+  for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i)
+    sum += block[i];
+  snprintf((char *)&block[148], 8, "%06lo", sum);
+  fwrite(block, 1, TAR_BLOCK_SIZE, f);
+}
+
+static void tar_member(FILE *const f, const uint8_t *const data,
+                       const size_t size) {
+  static const uint8_t zeros[TAR_BLOCK_SIZE] = {0};
+  fwrite(data, 1, size, f);
+  fwrite(zeros, 1, (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE,
+         f);
+}
+
+void test_open_tar(void) {
+  png_file_size = read_test_png(png_file);
+  create_labelled_dir(SHARD_DIR);
+  char long_name[200];
+  memset(long_name, 'x', sizeof(long_name));
+  memcpy(long_name, "png/7/", 6);
+  strcpy(&long_name[sizeof(long_name) - 5], ".png");
+
+  FILE *f = fopen(TAR_PATH, "wb");
+  SEE_assert(f != NULL, "Could not create tar archive.");
+  if (!f)
+    return;
+  tar_header(f, "png/", '5', 0);
+  tar_header(f, "png/3/a.png", '0', png_file_size);
+  tar_member(f, png_file, png_file_size);
+  tar_header(f, "././@LongLink", 'L', strlen(long_name) + 1);
+  tar_member(f, (const uint8_t *)long_name, strlen(long_name) + 1);
+  tar_header(f, "png/7/ignored.png", '0', png_file_size);
+  tar_member(f, png_file, png_file_size);
+  const uint8_t end[2 * TAR_BLOCK_SIZE] = {0};
+  fwrite(end, 1, sizeof(end), f);
+  fclose(f);
+
+  SEE_assert(DS_SHARD_is_shard_pattern(TAR_PATH), "Tar not recognized.");
+  DS_SHARD_Set *set = DS_SHARD_set_open(TAR_PATH);
+  SEE_assert(set != NULL, "Could not open tar archive.");
+  if (set) {
+    check_files(set, 2);
+    const DS_FILE_FileList *const file_list = DS_SHARD_set_file_list(set);
+    SEE_assert_eqlu(DS_FILE_file_list_label(file_list, 0), (size_t)3,
+                    "Wrong label of the first member.");
+    SEE_assert_eqlu(DS_FILE_file_list_label(file_list, 1), (size_t)7,
+                    "Wrong label of the long member.");
+    SEE_assert_eqstr(strchr(file_list->paths[1], ':') + 1, long_name,
+                     "Long name is not used.");
+    DS_SHARD_set_free(set);
+  }
+
+  SEE_assert(truncate(TAR_PATH, 3 * TAR_BLOCK_SIZE) == 0,
+             "Could not truncate tar archive.");
+  SEE_assert_eqp(DS_SHARD_set_open(TAR_PATH), NULL,
+                 "Truncated tar archive must fail.");
+}
+
+SEE_RUN_TESTS(test_pack_and_open_shards, test_corrupt_shard_fails,
+              test_open_tar)
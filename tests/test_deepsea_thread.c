@@ -0,0 +1,68 @@
+#include "see.h"
+
+#define DS_MALLOC SEE_DEBUG_MALLOC
+#define DS_FREE SEE_DEBUG_FREE
+#define DS_CALLOC SEE_DEBUG_CALLOC
+#define DS_REALLOC SEE_DEBUG_REALLOC
+
+#include "deepsea.c"
+#include "deepsea_thread.c"
+
+#include "common.h"
+
+#define LOOP_COUNT 1000
+#define NUM_THREADS 4
+
+typedef struct {
+  size_t size;
+  size_t visits[LOOP_COUNT];
+  size_t workers[LOOP_COUNT];
+} LoopContext;
+
+static void count_task(void *const context, const size_t index,
+                       const size_t worker) {
+  LoopContext *const loop = context;
+  ++loop->visits[index]; // NOTE: Every index is visited by exactly one worker
+  loop->workers[index] = worker;
+}
+
+static void check_loop(DS_THREAD_Pool *const pool, const size_t count) {
+  static LoopContext loop;
+  memset(&loop, 0, sizeof(loop));
+  DS_THREAD_pool_for(pool, count, &count_task, &loop);
+  for (size_t i = 0; i < count; ++i) {
+    SEE_assert_eqlu(loop.visits[i], (size_t)1, "Index %lu visited wrongly.", i);
+    SEE_assert(loop.workers[i] < DS_THREAD_pool_size(pool),
+               "Worker of index %lu out of range.", i);
+  }
+  for (size_t i = count; i < LOOP_COUNT; ++i)
+    SEE_assert_eqlu(loop.visits[i], (size_t)0, "Index %lu must not be visited.",
+                    i);
+}
+
+void test_pool_size(void) {
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(NUM_THREADS);
+  SEE_assert_eqlu(DS_THREAD_pool_size(pool), (size_t)NUM_THREADS,
+                  "Wrong pool size.");
+  DS_THREAD_pool_free(pool);
+  SEE_assert_eqlu(DS_THREAD_pool_size(NULL), (size_t)1,
+                  "NULL pool must have one worker.");
+}
+
+void test_pool_for(void) {
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(NUM_THREADS);
+  check_loop(pool, LOOP_COUNT);
+  check_loop(pool, 3); // NOTE: Fewer indexes than workers
+  check_loop(pool, 0);
+  check_loop(pool, LOOP_COUNT - 1);
+  DS_THREAD_pool_free(pool);
+}
+
+void test_pool_for_serial(void) {
+  check_loop(NULL, LOOP_COUNT);
+  DS_THREAD_Pool *pool = DS_THREAD_pool_create(1);
+  check_loop(pool, LOOP_COUNT);
+  DS_THREAD_pool_free(pool);
+}
+
+SEE_RUN_TESTS(test_pool_size, test_pool_for, test_pool_for_serial)